@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "cost.h"
+
+/**
+ * glibc internal allocation functions, wrapped to count allocations
+ */
+extern void *__libc_malloc(size_t bytes);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/**
+ * Number of allocations, if counting
+ */
+static u_int allocs;
+static bool counting = FALSE;
+
+void *malloc(size_t bytes)
+{
+	allocs += counting;
+	return __libc_malloc(bytes);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs += counting;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs += counting;
+	return __libc_realloc(ptr, size);
+}
+
+/**
+ * See header
+ */
+void cost_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+	allocs = 0;
+	counting = TRUE;
+}
+
+/**
+ * See header
+ */
+void cost_end(struct timespec *start, cost_t *cost)
+{
+	struct timespec end;
+
+	counting = FALSE;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cost->allocs += allocs;
+	cost->ns += (end.tv_sec - start->tv_sec) * 1000000000ULL +
+				end.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * See header
+ */
+void cost_abort()
+{
+	counting = FALSE;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * Time and allocation counting shared by the burn scripts.
+ *
+ * Linking cost.c wraps malloc(), calloc() and realloc() of the program to
+ * count allocations while a phase is measured.
+ */
+
+#ifndef COST_H_
+#define COST_H_
+
+#include <time.h>
+
+#include <library.h>
+
+typedef struct cost_t cost_t;
+
+/**
+ * Time and allocations of a phase
+ */
+struct cost_t {
+	u_int allocs;
+	u_int64_t ns;
+};
+
+/**
+ * Start measuring a phase
+ *
+ * @param start		receives the start time of the phase
+ */
+void cost_start(struct timespec *start);
+
+/**
+ * Stop measuring a phase, add the cost
+ *
+ * @param start		start time of the phase, as set by cost_start()
+ * @param cost		cost to add time and allocations of the phase to
+ */
+void cost_end(struct timespec *start, cost_t *cost);
+
+/**
+ * Stop measuring a phase without adding its cost, e.g. if it failed
+ */
+void cost_abort();
+
+#endif /** COST_H_ */
@@ -0,0 +1,895 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <credentials/sets/mem_cred.h>
+#include <bus/listeners/file_logger.h>
+#include <encoding/payloads/cp_payload.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+
+/**
+ * Addresses of initiators and responder
+ */
+#define INITIATOR "192.168.0.1"
+#define RESPONDER "192.168.0.2"
+
+/**
+ * Address the DHCP stand-in listens on, and the first address it leases
+ */
+#define DHCP_SERVER "127.0.0.1"
+#define DHCP_FIRST_LEASE "10.3.0.1"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+/**
+ * DHCP message format, as used by the dhcp plugin
+ */
+typedef struct __attribute__((packed)) {
+	u_int8_t opcode;
+	u_int8_t hw_type;
+	u_int8_t hw_addr_len;
+	u_int8_t hop_count;
+	u_int32_t transaction_id;
+	u_int16_t number_of_seconds;
+	u_int16_t flags;
+	u_int32_t client_address;
+	u_int32_t your_address;
+	u_int32_t server_address;
+	u_int32_t gateway_address;
+	char client_hw_addr[6];
+	char client_hw_padding[10];
+	char server_hostname[64];
+	char boot_filename[128];
+	u_int32_t magic_cookie;
+	u_char options[252];
+} dhcp_t;
+
+/**
+ * DHCP options and message types we use
+ */
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_LEASE_TIME 51
+#define DHCP_OPT_MESSAGE_TYPE 53
+#define DHCP_OPT_SERVER_ID 54
+#define DHCP_OPT_END 255
+#define DHCP_DISCOVER 1
+#define DHCP_OFFER 2
+#define DHCP_REQUEST 3
+#define DHCP_ACK 5
+
+/**
+ * A DHCP reply the stand-in sends once its delay expired
+ */
+typedef struct {
+	timeval_t due;
+	dhcp_t dhcp;
+	int len;
+} reply_t;
+
+/**
+ * Delay of the DHCP stand-in for each reply, in ms
+ */
+static u_int delay = 300;
+
+/**
+ * Next address the DHCP stand-in offers, host order
+ */
+static u_int32_t next_lease;
+
+/**
+ * Find a DHCP option of a given type, with an expected length
+ */
+static u_char *find_option(dhcp_t *dhcp, int len, u_char type, u_char optlen)
+{
+	int pos = 0;
+
+	len -= offsetof(dhcp_t, options);
+	while (pos + 2 <= len && dhcp->options[pos] != DHCP_OPT_END)
+	{
+		if (dhcp->options[pos] == type && dhcp->options[pos + 1] == optlen &&
+			pos + 2 + optlen <= len)
+		{
+			return &dhcp->options[pos + 2];
+		}
+		pos += 2 + dhcp->options[pos + 1];
+	}
+	return NULL;
+}
+
+/**
+ * Build an OFFER/ACK for a DISCOVER/REQUEST, FALSE to ignore the message
+ */
+static bool build_reply(dhcp_t *in, int len, reply_t *reply)
+{
+	u_char *type, *requested, *opt;
+	u_int32_t address, lease = htonl(3600);
+
+	type = find_option(in, len, DHCP_OPT_MESSAGE_TYPE, 1);
+	if (!type || len < offsetof(dhcp_t, options) ||
+		in->magic_cookie != htonl(0x63825363))
+	{
+		return FALSE;
+	}
+	switch (*type)
+	{
+		case DHCP_DISCOVER:
+			address = htonl(next_lease++);
+			break;
+		case DHCP_REQUEST:
+			requested = find_option(in, len, DHCP_OPT_REQUESTED_IP, 4);
+			if (!requested)
+			{
+				return FALSE;
+			}
+			memcpy(&address, requested, sizeof(address));
+			break;
+		default:
+			return FALSE;
+	}
+
+	memset(&reply->dhcp, 0, sizeof(reply->dhcp));
+	memcpy(&reply->dhcp, in, offsetof(dhcp_t, options));
+	reply->dhcp.opcode = 2; /* BOOTREPLY */
+	reply->dhcp.your_address = address;
+	opt = reply->dhcp.options;
+	*opt++ = DHCP_OPT_MESSAGE_TYPE;
+	*opt++ = 1;
+	*opt++ = *type == DHCP_DISCOVER ? DHCP_OFFER : DHCP_ACK;
+	*opt++ = DHCP_OPT_SERVER_ID;
+	*opt++ = 4;
+	inet_pton(AF_INET, DHCP_SERVER, opt);
+	opt += 4;
+	*opt++ = DHCP_OPT_LEASE_TIME;
+	*opt++ = 4;
+	memcpy(opt, &lease, sizeof(lease));
+	opt += sizeof(lease);
+	*opt++ = DHCP_OPT_END;
+	reply->len = offsetof(dhcp_t, options) + (opt - reply->dhcp.options);
+
+	time_monotonic(&reply->due);
+	reply->due.tv_sec += delay / 1000;
+	reply->due.tv_usec += (delay % 1000) * 1000;
+	if (reply->due.tv_usec >= 1000000)
+	{
+		reply->due.tv_usec -= 1000000;
+		reply->due.tv_sec++;
+	}
+	return TRUE;
+}
+
+/**
+ * Cleanup function for replies not sent yet
+ */
+static void destroy_replies(linked_list_t *replies)
+{
+	replies->destroy_function(replies, free);
+}
+
+/**
+ * DHCP stand-in, answers each DISCOVER/REQUEST after a delay
+ */
+static void *serve(int *fd)
+{
+	struct sockaddr_in client = {
+		.sin_family = AF_INET,
+		.sin_port = htons(DHCP_CLIENT_PORT),
+	};
+	struct pollfd pfd = {
+		.fd = *fd,
+		.events = POLLIN,
+	};
+	linked_list_t *replies;
+	reply_t *reply;
+	timeval_t now;
+	dhcp_t dhcp;
+	int timeout, len;
+	bool old;
+
+	inet_pton(AF_INET, DHCP_SERVER, &client.sin_addr);
+	replies = linked_list_create();
+	thread_cleanup_push((void*)destroy_replies, replies);
+	while (TRUE)
+	{
+		timeout = -1;
+		if (replies->get_first(replies, (void**)&reply) == SUCCESS)
+		{
+			time_monotonic(&now);
+			timeout = 0;
+			if (timercmp(&reply->due, &now, >))
+			{
+				timersub(&reply->due, &now, &now);
+				timeout = now.tv_sec * 1000 + now.tv_usec / 1000 + 1;
+			}
+		}
+		old = thread_cancelability(TRUE);
+		len = poll(&pfd, 1, timeout);
+		thread_cancelability(old);
+
+		if (len > 0)
+		{
+			len = recv(*fd, &dhcp, sizeof(dhcp), MSG_DONTWAIT);
+			reply = malloc_thing(reply_t);
+			if (len > 0 && build_reply(&dhcp, len, reply))
+			{	/* constant delay keeps the list ordered by due time */
+				replies->insert_last(replies, reply);
+			}
+			else
+			{
+				free(reply);
+			}
+		}
+		time_monotonic(&now);
+		while (replies->get_first(replies, (void**)&reply) == SUCCESS &&
+			   !timercmp(&reply->due, &now, >))
+		{
+			replies->remove_first(replies, (void**)&reply);
+			sendto(*fd, &reply->dhcp, reply->len, 0,
+				   (struct sockaddr*)&client, sizeof(client));
+			free(reply);
+		}
+	}
+	thread_cleanup_pop(TRUE);
+	return NULL;
+}
+
+/**
+ * Open the socket of the DHCP stand-in
+ */
+static int open_server()
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(DHCP_SERVER_PORT),
+	};
+	int fd, on = 1;
+
+	inet_pton(AF_INET, DHCP_SERVER, &addr.sin_addr);
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+		bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Packets sent but not yet delivered, responses get sent from worker threads
+ */
+static linked_list_t *packets;
+static mutex_t *mutex;
+static condvar_t *condvar;
+
+/**
+ * Initiating IKE_SAs, indexed by initiator SPI - 1
+ */
+static ike_sa_t **initiators;
+
+/**
+ * Number of IKE_SAs set up, number of virtual IPs received
+ */
+static int established, vips;
+
+METHOD(sender_t, send_, void,
+	sender_t *this, packet_t *packet)
+{
+	mutex->lock(mutex);
+	packets->insert_last(packets, packet);
+	condvar->signal(condvar);
+	mutex->unlock(mutex);
+}
+
+/**
+ * SPI counter of the fake kernel interface
+ */
+static u_int32_t spis;
+
+METHOD(kernel_ipsec_t, get_spi, status_t,
+	kernel_ipsec_t *this, host_t *src, host_t *dst,
+	u_int8_t protocol, u_int32_t reqid, u_int32_t *spi)
+{
+	mutex->lock(mutex);
+	*spi = htonl(++spis);
+	mutex->unlock(mutex);
+	return SUCCESS;
+}
+
+/**
+ * Fake kernel operation that always succeeds
+ */
+static status_t return_success()
+{
+	return SUCCESS;
+}
+
+/**
+ * Create a kernel IPsec interface that installs nothing
+ */
+static kernel_ipsec_t *kernel_ipsec_create()
+{
+	kernel_ipsec_t *this;
+
+	INIT(this,
+		.get_spi = _get_spi,
+		.get_cpi = (void*)return_failed,
+		.add_sa = (void*)return_success,
+		.update_sa = (void*)return_success,
+		.query_sa = (void*)return_failed,
+		.del_sa = (void*)return_success,
+		.flush_sas = (void*)return_failed,
+		.add_policy = (void*)return_success,
+		.query_policy = (void*)return_failed,
+		.del_policy = (void*)return_success,
+		.flush_policies = (void*)return_failed,
+		.bypass_socket = (void*)return_true,
+		.enable_udp_decap = (void*)return_true,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+METHOD(diffie_hellman_t, null_get_shared_secret, status_t,
+	diffie_hellman_t *this, chunk_t *secret)
+{
+	*secret = chunk_empty;
+	return SUCCESS;
+}
+
+METHOD(diffie_hellman_t, null_get_my_public_value, void,
+	diffie_hellman_t *this, chunk_t *value)
+{
+	*value = chunk_empty;
+}
+
+METHOD(diffie_hellman_t, null_get_dh_group, diffie_hellman_group_t,
+	diffie_hellman_t *this)
+{
+	return MODP_NULL;
+}
+
+/**
+ * Create a MODP_NULL Diffie-Hellman, DH costs are not what we measure
+ */
+static diffie_hellman_t *null_dh_create(diffie_hellman_group_t group)
+{
+	diffie_hellman_t *this;
+
+	if (group != MODP_NULL)
+	{
+		return NULL;
+	}
+	INIT(this,
+		.get_shared_secret = _null_get_shared_secret,
+		.set_other_public_value = (void*)nop,
+		.get_my_public_value = _null_get_my_public_value,
+		.get_dh_group = _null_get_dh_group,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+METHOD(kernel_net_t, get_interface, bool,
+	kernel_net_t *this, host_t *host, char **name)
+{
+	*name = strdup("lo");
+	return TRUE;
+}
+
+/**
+ * Create a kernel networking interface accepting virtual IPs on "lo"
+ */
+static kernel_net_t *kernel_net_create()
+{
+	kernel_net_t *this;
+
+	INIT(this,
+		.get_source_addr = (void*)return_null,
+		.get_nexthop = (void*)return_null,
+		.get_interface = _get_interface,
+		.create_address_enumerator = (void*)enumerator_create_empty,
+		.add_ip = (void*)return_success,
+		.del_ip = (void*)return_success,
+		.add_route = (void*)return_failed,
+		.del_route = (void*)return_failed,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+/**
+ * Configurations of initiator and responder
+ */
+static linked_list_t *configs;
+
+METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
+	backend_t *this, identification_t *me, identification_t *other)
+{
+	return configs->create_enumerator(configs);
+}
+
+/**
+ * Enumerator filter, peer_cfg_t => ike_cfg_t
+ */
+static bool ike_cfg_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
+{
+	*out = (*in)->get_ike_cfg(*in);
+	return TRUE;
+}
+
+METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
+	backend_t *this, host_t *me, host_t *other)
+{
+	return enumerator_create_filter(configs->create_enumerator(configs),
+									(void*)ike_cfg_filter, NULL, NULL);
+}
+
+/**
+ * Add a PSK authentication round to a peer config
+ */
+static void add_auth(peer_cfg_t *peer_cfg, bool local, char *id)
+{
+	auth_cfg_t *auth;
+
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_AUTH_CLASS, AUTH_CLASS_PSK);
+	auth->add(auth, AUTH_RULE_IDENTITY, identification_create_from_string(id));
+	peer_cfg->add_auth_cfg(peer_cfg, auth, local);
+}
+
+/**
+ * Create the configuration of one peer
+ */
+static peer_cfg_t *create_config(char *name, char *me, char *other,
+								 char *my_id, char *other_id, char *ike)
+{
+	lifetime_cfg_t lifetime = {};
+	proposal_t *proposal;
+	child_cfg_t *child_cfg;
+	peer_cfg_t *peer_cfg;
+	ike_cfg_t *ike_cfg;
+
+	ike_cfg = ike_cfg_create(IKEV2, FALSE, FALSE, me, FALSE, IKEV2_UDP_PORT,
+							 other, FALSE, IKEV2_UDP_PORT);
+	proposal = proposal_create_from_string(PROTO_IKE, ike);
+	if (!proposal)
+	{
+		ike_cfg->destroy(ike_cfg);
+		return NULL;
+	}
+	ike_cfg->add_proposal(ike_cfg, proposal);
+	peer_cfg = peer_cfg_create(name, ike_cfg, CERT_NEVER_SEND, UNIQUE_NO,
+							   1, 0, 0, 0, 0, FALSE, FALSE, 0, 0,
+							   FALSE, NULL, NULL);
+	add_auth(peer_cfg, TRUE, my_id);
+	add_auth(peer_cfg, FALSE, other_id);
+
+	child_cfg = child_cfg_create(name, &lifetime, NULL, FALSE, MODE_TUNNEL,
+								 ACTION_NONE, ACTION_NONE, ACTION_NONE, FALSE,
+								 0, 0, NULL, NULL, 0);
+	child_cfg->add_proposal(child_cfg, proposal_create_default(PROTO_ESP));
+	/* the initiator tunnels its virtual IP to the responders subnet */
+	child_cfg->add_traffic_selector(child_cfg, !streq(name, "initiator"),
+			traffic_selector_create_from_cidr("10.2.0.0/16", 0, 0));
+	child_cfg->add_traffic_selector(child_cfg, streq(name, "initiator"),
+			traffic_selector_create_dynamic(0, 0, 65535));
+	peer_cfg->add_child_cfg(peer_cfg, child_cfg);
+	return peer_cfg;
+}
+
+/**
+ * Count the virtual IPs an initiator receives with the IKE_AUTH response
+ */
+METHOD(listener_t, message_hook, bool,
+	listener_t *this, ike_sa_t *ike_sa, message_t *message,
+	bool incoming, bool plain)
+{
+	enumerator_t *enumerator, *attributes;
+	configuration_attribute_t *attribute;
+	payload_t *payload;
+	cp_payload_t *cp;
+
+	if (!incoming || !plain || message->get_request(message) ||
+		message->get_exchange_type(message) != IKE_AUTH)
+	{
+		return TRUE;
+	}
+	enumerator = message->create_payload_enumerator(message);
+	while (enumerator->enumerate(enumerator, &payload))
+	{
+		if (payload->get_type(payload) != CONFIGURATION)
+		{
+			continue;
+		}
+		cp = (cp_payload_t*)payload;
+		attributes = cp->create_attribute_enumerator(cp);
+		while (attributes->enumerate(attributes, &attribute))
+		{
+			if (attribute->get_type(attribute) == INTERNAL_IP4_ADDRESS &&
+				attribute->get_chunk(attribute).len == 4)
+			{
+				vips++;
+			}
+		}
+		attributes->destroy(attributes);
+	}
+	enumerator->destroy(enumerator);
+	return TRUE;
+}
+
+/**
+ * Deliver a packet to the peer it is addressed to, as the receiver would do
+ */
+static void deliver(packet_t *packet, int count)
+{
+	message_t *message;
+	ike_sa_id_t *id, *ike_sa_id;
+	ike_sa_t *ike_sa;
+	u_int64_t spi;
+	host_t *host;
+	status_t status;
+
+	message = message_create_from_packet(packet);
+	if (message->parse_header(message) != SUCCESS)
+	{
+		message->destroy(message);
+		return;
+	}
+	host = host_create_from_string(INITIATOR, 0);
+	if (host->ip_equals(host, message->get_destination(message)))
+	{	/* initiators are not managed, as they share SPIs with the responder */
+		id = message->get_ike_sa_id(message);
+		spi = be64toh(id->get_initiator_spi(id));
+		if (spi >= 1 && spi <= count && initiators[spi - 1])
+		{
+			ike_sa = initiators[spi - 1];
+			ike_sa_id = ike_sa->get_id(ike_sa);
+			if (ike_sa_id->get_responder_spi(ike_sa_id) == 0)
+			{	/* as checkout_by_message() would do */
+				ike_sa_id->set_responder_spi(ike_sa_id,
+											 id->get_responder_spi(id));
+			}
+			charon->bus->set_sa(charon->bus, ike_sa);
+			status = ike_sa->process_message(ike_sa, message);
+			if (message->get_exchange_type(message) == IKE_AUTH &&
+				ike_sa->get_state(ike_sa) == IKE_ESTABLISHED)
+			{
+				established++;
+			}
+			charon->bus->set_sa(charon->bus, NULL);
+			if (status == DESTROY_ME)
+			{
+				ike_sa->destroy(ike_sa);
+				initiators[spi - 1] = NULL;
+			}
+		}
+	}
+	else
+	{
+		ike_sa = charon->ike_sa_manager->checkout_by_message(
+											charon->ike_sa_manager, message);
+		if (ike_sa)
+		{
+			if (ike_sa->process_message(ike_sa, message) == DESTROY_ME)
+			{
+				charon->ike_sa_manager->checkin_and_destroy(
+											charon->ike_sa_manager, ike_sa);
+			}
+			else
+			{
+				charon->ike_sa_manager->checkin(charon->ike_sa_manager,
+												ike_sa);
+			}
+		}
+	}
+	host->destroy(host);
+	message->destroy(message);
+}
+
+/**
+ * Start an IKE_SA with a given initiator SPI
+ */
+static bool initiate(peer_cfg_t *peer_cfg, int i)
+{
+	enumerator_t *enumerator;
+	child_cfg_t *child_cfg;
+	ike_sa_t *ike_sa;
+	status_t status;
+
+	ike_sa = ike_sa_create(ike_sa_id_create(IKEV2_MAJOR_VERSION,
+											htobe64(i + 1), 0, TRUE),
+						   TRUE, IKEV2);
+	charon->bus->set_sa(charon->bus, ike_sa);
+	ike_sa->set_peer_cfg(ike_sa, peer_cfg);
+	enumerator = peer_cfg->create_child_cfg_enumerator(peer_cfg);
+	enumerator->enumerate(enumerator, &child_cfg);
+	enumerator->destroy(enumerator);
+	status = ike_sa->initiate(ike_sa, child_cfg->get_ref(child_cfg), 0,
+							  NULL, NULL);
+	charon->bus->set_sa(charon->bus, NULL);
+	if (status != SUCCESS)
+	{
+		ike_sa->destroy(ike_sa);
+		return FALSE;
+	}
+	initiators[i] = ike_sa;
+	return TRUE;
+}
+
+/**
+ * Deliver packets until all IKE_SAs are up, or nothing happens for a while
+ */
+static void run(int count)
+{
+	packet_t *packet;
+	bool timeout = FALSE;
+
+	while (established < count && !timeout)
+	{
+		mutex->lock(mutex);
+		while (packets->remove_first(packets, (void**)&packet) != SUCCESS)
+		{
+			timeout = condvar->timed_wait(condvar, mutex,
+										  max(delay * 10, 10000));
+			if (timeout)
+			{
+				break;
+			}
+		}
+		mutex->unlock(mutex);
+		if (!timeout)
+		{
+			deliver(packet, count);
+		}
+	}
+}
+
+/**
+ * Print usage information
+ */
+static void usage(FILE *out, char *name)
+{
+	fprintf(out, "Set up IKE_SAs with virtual IPs from a local DHCP stand-in\n\n");
+	fprintf(out, "%s [OPTIONS]\n\n", name);
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -h, --help          print this help.\n");
+	fprintf(out, "  -n, --sas=COUNT     number of concurrent IKE_SAs.\n");
+	fprintf(out, "  -d, --delay=MS      delay of each DHCP reply.\n");
+	fprintf(out, "  -t, --threads=NUM   number of worker threads.\n");
+	fprintf(out, "  -p, --proposal=IKE  IKE proposal to use.\n");
+	fprintf(out, "  -v, --debug=LEVEL   log to stderr with LEVEL.\n");
+	fprintf(out, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	sender_t sender = {
+		.send = _send_,
+		.send_no_marker = _send_,
+		.flush = (void*)nop,
+		.destroy = (void*)nop,
+	};
+	backend_t backend = {
+		.create_peer_cfg_enumerator = _create_peer_cfg_enumerator,
+		.create_ike_cfg_enumerator = _create_ike_cfg_enumerator,
+		.get_peer_cfg_by_name = (void*)return_null,
+	};
+	listener_t listener = {
+		.message = _message_hook,
+	};
+	char *ike = "aes128-sha256-modpnull";
+	int count = 100, threads = 4, level = -1, fd, i;
+	file_logger_t *logger = NULL;
+	peer_cfg_t *peer_cfg, *peer;
+	struct timespec start, end;
+	struct in_addr lease;
+	thread_t *server;
+	mem_cred_t *creds;
+	bool ok = TRUE;
+
+	while (TRUE)
+	{
+		struct option long_opts[] = {
+			{"help",		no_argument,		NULL,	'h' },
+			{"sas",			required_argument,	NULL,	'n' },
+			{"delay",		required_argument,	NULL,	'd' },
+			{"threads",		required_argument,	NULL,	't' },
+			{"proposal",	required_argument,	NULL,	'p' },
+			{"debug",		required_argument,	NULL,	'v' },
+			{0,0,0,0 },
+		};
+		switch (getopt_long(argc, argv, "hn:d:t:p:v:", long_opts, NULL))
+		{
+			case EOF:
+				break;
+			case 'h':
+				usage(stdout, argv[0]);
+				return 0;
+			case 'n':
+				count = max(atoi(optarg), 1);
+				continue;
+			case 'd':
+				delay = atoi(optarg);
+				continue;
+			case 't':
+				threads = max(atoi(optarg), 3);
+				continue;
+			case 'p':
+				ike = optarg;
+				continue;
+			case 'v':
+				level = atoi(optarg);
+				continue;
+			default:
+				usage(stderr, argv[0]);
+				return 1;
+		}
+		break;
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("dhcp_loopback");
+	atexit(libhydra_deinit);
+	libcharon_init("dhcp_loopback");
+	atexit(libcharon_deinit);
+	if (level >= 0)
+	{
+		logger = file_logger_create("stderr");
+		logger->set_level(logger, DBG_ANY, level);
+		logger->open(logger, FALSE, FALSE);
+		charon->bus->add_logger(charon->bus, &logger->logger);
+	}
+
+	fd = open_server();
+	if (fd == -1)
+	{
+		fprintf(stderr, "binding DHCP stand-in to %s:%d failed: %s\n",
+				DHCP_SERVER, DHCP_SERVER_PORT, strerror(errno));
+		return 1;
+	}
+	inet_pton(AF_INET, DHCP_FIRST_LEASE, &lease);
+	next_lease = ntohl(lease.s_addr);
+
+	lib->settings->set_str(lib->settings, "%s.plugins.dhcp.server",
+						   DHCP_SERVER, charon->name);
+	/* don't let initiators retransmit while the responder waits for DHCP */
+	lib->settings->set_double(lib->settings, "%s.retransmit_timeout", 60,
+							  charon->name);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS " nonce dhcp");
+	if (!strstr(lib->plugins->loaded_plugins(lib->plugins), "dhcp"))
+	{
+		fprintf(stderr, "dhcp plugin not loaded, loaded: %s\n",
+				lib->plugins->loaded_plugins(lib->plugins));
+		close(fd);
+		return 1;
+	}
+	/* the strongSwan vendor ID allows us to use MODP_NULL from private space */
+	lib->settings->set_bool(lib->settings, "%s.send_vendor_id", TRUE,
+							charon->name);
+	lib->crypto->add_dh(lib->crypto, MODP_NULL, "dhcp_loopback",
+						(dh_constructor_t)null_dh_create);
+	hydra->kernel_interface->add_ipsec_interface(hydra->kernel_interface,
+												 kernel_ipsec_create);
+	hydra->kernel_interface->add_net_interface(hydra->kernel_interface,
+											   kernel_net_create);
+
+	creds = mem_cred_create();
+	creds->add_shared(creds, shared_key_create(SHARED_IKE,
+							chunk_clone(chunk_create("dhcp_loopback", 13))),
+					  identification_create_from_string("moon.strongswan.org"),
+					  identification_create_from_string("carol@strongswan.org"),
+					  NULL);
+	lib->credmgr->add_set(lib->credmgr, &creds->set);
+
+	configs = linked_list_create();
+	peer_cfg = create_config("initiator", INITIATOR, RESPONDER,
+							 "carol@strongswan.org", "moon.strongswan.org", ike);
+	peer = create_config("responder", RESPONDER, INITIATOR,
+						 "moon.strongswan.org", "carol@strongswan.org", ike);
+	if (!peer_cfg || !peer)
+	{
+		fprintf(stderr, "invalid proposal: %s\n", ike);
+		DESTROY_IF(peer_cfg);
+		DESTROY_IF(peer);
+		close(fd);
+		return 1;
+	}
+	peer_cfg->add_virtual_ip(peer_cfg, host_create_from_string("0.0.0.0", 0));
+	peer->add_pool(peer, "dhcp");
+	configs->insert_last(configs, peer_cfg);
+	configs->insert_last(configs, peer);
+	charon->backends->add_backend(charon->backends, &backend);
+	charon->bus->add_listener(charon->bus, &listener);
+
+	packets = linked_list_create();
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+	initiators = calloc(count, sizeof(ike_sa_t*));
+	charon->ike_sa_manager = ike_sa_manager_create();
+	charon->sender = &sender;
+	server = thread_create((thread_main_t)serve, &fd);
+	/* scheduler and DHCP receive job block a thread each, the others
+	 * resume deferred IKE_AUTH responses */
+	lib->processor->set_threads(lib->processor, threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; ok && i < count; i++)
+	{
+		ok = initiate(peer_cfg, i);
+	}
+	if (ok)
+	{
+		run(count);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%d IKE_SAs, DHCP delay %ums, %d threads\n", count, delay, threads);
+	printf("established %d, virtual IPs %d, in %.3fs\n", established, vips,
+		   (end.tv_sec - start.tv_sec) +
+		   (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+	ok = ok && established == count && vips == count;
+
+	lib->processor->cancel(lib->processor);
+	server->cancel(server);
+	server->join(server);
+	close(fd);
+	for (i = 0; i < count; i++)
+	{
+		DESTROY_IF(initiators[i]);
+	}
+	free(initiators);
+	charon->ike_sa_manager->flush(charon->ike_sa_manager);
+	charon->ike_sa_manager->destroy(charon->ike_sa_manager);
+	charon->ike_sa_manager = NULL;
+	charon->sender = NULL;
+	packets->destroy_offset(packets, offsetof(packet_t, destroy));
+	mutex->destroy(mutex);
+	condvar->destroy(condvar);
+	charon->bus->remove_listener(charon->bus, &listener);
+	charon->backends->remove_backend(charon->backends, &backend);
+	configs->destroy_offset(configs, offsetof(peer_cfg_t, destroy));
+	lib->credmgr->remove_set(lib->credmgr, &creds->set);
+	creds->destroy(creds);
+	hydra->kernel_interface->remove_ipsec_interface(hydra->kernel_interface,
+													kernel_ipsec_create);
+	hydra->kernel_interface->remove_net_interface(hydra->kernel_interface,
+												  kernel_net_create);
+	lib->crypto->remove_dh(lib->crypto, (dh_constructor_t)null_dh_create);
+	if (logger)
+	{
+		charon->bus->remove_logger(charon->bus, &logger->logger);
+		logger->destroy(logger);
+	}
+	return ok ? 0 : 1;
+}
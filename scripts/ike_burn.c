@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "cost.h"
+
+#include <stdio.h>
+
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <credentials/sets/mem_cred.h>
+
+/**
+ * Addresses of initiator and responder
+ */
+#define INITIATOR "192.168.0.1"
+#define RESPONDER "192.168.0.2"
+
+/**
+ * Proposals used with "null" crypto
+ */
+#define NULL_PROPOSAL "null-sha1-modpnull"
+
+/**
+ * Packets sent but not yet delivered
+ */
+static linked_list_t *packets;
+
+/**
+ * IKE_SA managers of initiator and responder, as both share the same SPIs
+ */
+static ike_sa_manager_t *initiator, *responder;
+
+/**
+ * Phases we measure, by exchange type of the processed message
+ */
+typedef enum {
+	PHASE_IKE_SA_INIT,
+	PHASE_IKE_AUTH,
+	PHASE_CREATE_CHILD_SA,
+	PHASE_INFORMATIONAL,
+	PHASE_MAX,
+} phase_t;
+
+/**
+ * Accumulated costs of all phases
+ */
+static cost_t costs[PHASE_MAX];
+
+/**
+ * Map an exchange type to the phase it belongs to
+ */
+static phase_t get_phase(exchange_type_t type)
+{
+	switch (type)
+	{
+		case IKE_SA_INIT:
+			return PHASE_IKE_SA_INIT;
+		case IKE_AUTH:
+			return PHASE_IKE_AUTH;
+		case CREATE_CHILD_SA:
+			return PHASE_CREATE_CHILD_SA;
+		default:
+			return PHASE_INFORMATIONAL;
+	}
+}
+
+METHOD(sender_t, send_, void,
+	sender_t *this, packet_t *packet)
+{
+	packets->insert_last(packets, packet);
+}
+
+/**
+ * SPI counter of the fake kernel interface
+ */
+static u_int32_t spis;
+
+METHOD(kernel_ipsec_t, get_spi, status_t,
+	kernel_ipsec_t *this, host_t *src, host_t *dst,
+	u_int8_t protocol, u_int32_t reqid, u_int32_t *spi)
+{
+	*spi = htonl(++spis);
+	return SUCCESS;
+}
+
+/**
+ * Fake kernel operation that always succeeds
+ */
+static status_t return_success()
+{
+	return SUCCESS;
+}
+
+/**
+ * Create a kernel IPsec interface that installs nothing
+ */
+static kernel_ipsec_t *kernel_ipsec_create()
+{
+	kernel_ipsec_t *this;
+
+	INIT(this,
+		.get_spi = _get_spi,
+		.get_cpi = (void*)return_failed,
+		.add_sa = (void*)return_success,
+		.update_sa = (void*)return_success,
+		.query_sa = (void*)return_failed,
+		.del_sa = (void*)return_success,
+		.flush_sas = (void*)return_failed,
+		.add_policy = (void*)return_success,
+		.query_policy = (void*)return_failed,
+		.del_policy = (void*)return_success,
+		.flush_policies = (void*)return_failed,
+		.bypass_socket = (void*)return_true,
+		.enable_udp_decap = (void*)return_true,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+METHOD(crypter_t, null_crypt, bool,
+	crypter_t *this, chunk_t data, chunk_t iv, chunk_t *out)
+{
+	if (out)
+	{
+		*out = chunk_clone(data);
+	}
+	return TRUE;
+}
+
+METHOD(crypter_t, null_get_block_size, size_t,
+	crypter_t *this)
+{
+	return 1;
+}
+
+METHOD(crypter_t, null_get_size, size_t,
+	crypter_t *this)
+{
+	return 0;
+}
+
+/**
+ * Create an ENCR_NULL crypter, used to protect IKE with "null" crypto
+ */
+static crypter_t *null_crypter_create(encryption_algorithm_t algo,
+									  size_t key_size)
+{
+	crypter_t *this;
+
+	if (algo != ENCR_NULL)
+	{
+		return NULL;
+	}
+	INIT(this,
+		.encrypt = _null_crypt,
+		.decrypt = _null_crypt,
+		.get_block_size = _null_get_block_size,
+		.get_iv_size = _null_get_size,
+		.get_key_size = _null_get_size,
+		.set_key = (void*)return_true,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+METHOD(diffie_hellman_t, null_get_shared_secret, status_t,
+	diffie_hellman_t *this, chunk_t *secret)
+{
+	*secret = chunk_empty;
+	return SUCCESS;
+}
+
+METHOD(diffie_hellman_t, null_get_my_public_value, void,
+	diffie_hellman_t *this, chunk_t *value)
+{
+	*value = chunk_empty;
+}
+
+METHOD(diffie_hellman_t, null_get_dh_group, diffie_hellman_group_t,
+	diffie_hellman_t *this)
+{
+	return MODP_NULL;
+}
+
+/**
+ * Create a MODP_NULL Diffie-Hellman, similar to the one of load-tester
+ */
+static diffie_hellman_t *null_dh_create(diffie_hellman_group_t group)
+{
+	diffie_hellman_t *this;
+
+	if (group != MODP_NULL)
+	{
+		return NULL;
+	}
+	INIT(this,
+		.get_shared_secret = _null_get_shared_secret,
+		.set_other_public_value = (void*)nop,
+		.get_my_public_value = _null_get_my_public_value,
+		.get_dh_group = _null_get_dh_group,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+/**
+ * Configurations of initiator and responder
+ */
+static linked_list_t *configs;
+
+METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
+	backend_t *this, identification_t *me, identification_t *other)
+{
+	return configs->create_enumerator(configs);
+}
+
+/**
+ * Enumerator filter, peer_cfg_t => ike_cfg_t
+ */
+static bool ike_cfg_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
+{
+	*out = (*in)->get_ike_cfg(*in);
+	return TRUE;
+}
+
+METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
+	backend_t *this, host_t *me, host_t *other)
+{
+	return enumerator_create_filter(configs->create_enumerator(configs),
+									(void*)ike_cfg_filter, NULL, NULL);
+}
+
+/**
+ * Add a PSK authentication round to a peer config
+ */
+static void add_auth(peer_cfg_t *peer_cfg, bool local, char *id)
+{
+	auth_cfg_t *auth;
+
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_AUTH_CLASS, AUTH_CLASS_PSK);
+	auth->add(auth, AUTH_RULE_IDENTITY, identification_create_from_string(id));
+	peer_cfg->add_auth_cfg(peer_cfg, auth, local);
+}
+
+/**
+ * Create the configuration of one peer
+ */
+static peer_cfg_t *create_config(char *name, char *me, char *other,
+								 char *my_id, char *other_id,
+								 char *ike, char *esp)
+{
+	lifetime_cfg_t lifetime = {};
+	proposal_t *proposal;
+	child_cfg_t *child_cfg;
+	peer_cfg_t *peer_cfg;
+	ike_cfg_t *ike_cfg;
+
+	ike_cfg = ike_cfg_create(IKEV2, FALSE, FALSE, me, FALSE, IKEV2_UDP_PORT,
+							 other, FALSE, IKEV2_UDP_PORT);
+	proposal = proposal_create_from_string(PROTO_IKE, ike);
+	if (!proposal)
+	{
+		ike_cfg->destroy(ike_cfg);
+		return NULL;
+	}
+	ike_cfg->add_proposal(ike_cfg, proposal);
+	peer_cfg = peer_cfg_create(name, ike_cfg, CERT_NEVER_SEND, UNIQUE_NO,
+							   1, 0, 0, 0, 0, FALSE, FALSE, 0, 0,
+							   FALSE, NULL, NULL);
+	add_auth(peer_cfg, TRUE, my_id);
+	add_auth(peer_cfg, FALSE, other_id);
+
+	child_cfg = child_cfg_create(name, &lifetime, NULL, FALSE, MODE_TUNNEL,
+								 ACTION_NONE, ACTION_NONE, ACTION_NONE, FALSE,
+								 0, 0, NULL, NULL, 0);
+	proposal = proposal_create_from_string(PROTO_ESP, esp);
+	if (!proposal)
+	{
+		child_cfg->destroy(child_cfg);
+		peer_cfg->destroy(peer_cfg);
+		return NULL;
+	}
+	child_cfg->add_proposal(child_cfg, proposal);
+	child_cfg->add_traffic_selector(child_cfg, TRUE,
+			traffic_selector_create_from_cidr(streq(name, "initiator") ?
+									"10.1.0.0/16" : "10.2.0.0/16", 0, 0));
+	child_cfg->add_traffic_selector(child_cfg, FALSE,
+			traffic_selector_create_from_cidr(streq(name, "initiator") ?
+									"10.2.0.0/16" : "10.1.0.0/16", 0, 0));
+	peer_cfg->add_child_cfg(peer_cfg, child_cfg);
+	return peer_cfg;
+}
+
+/**
+ * Make an IKE_SA manager the current one
+ */
+static void use_manager(ike_sa_manager_t *manager)
+{
+	charon->ike_sa_manager = manager;
+}
+
+/**
+ * Deliver a packet to the peer it is addressed to, as the receiver would do
+ */
+static bool deliver(packet_t *packet)
+{
+	struct timespec start;
+	host_t *host;
+	message_t *message;
+	ike_sa_t *ike_sa;
+	phase_t phase = PHASE_INFORMATIONAL;
+	bool ok = FALSE;
+
+	host = host_create_from_string(INITIATOR, 0);
+	if (host->ip_equals(host, packet->get_destination(packet)))
+	{
+		use_manager(initiator);
+	}
+	else
+	{
+		use_manager(responder);
+	}
+	host->destroy(host);
+
+	cost_start(&start);
+	message = message_create_from_packet(packet);
+	if (message->parse_header(message) == SUCCESS)
+	{
+		phase = get_phase(message->get_exchange_type(message));
+		ike_sa = charon->ike_sa_manager->checkout_by_message(
+											charon->ike_sa_manager, message);
+		if (ike_sa)
+		{
+			if (ike_sa->process_message(ike_sa, message) == DESTROY_ME)
+			{
+				charon->ike_sa_manager->checkin_and_destroy(
+											charon->ike_sa_manager, ike_sa);
+			}
+			else
+			{
+				charon->ike_sa_manager->checkin(charon->ike_sa_manager,
+												ike_sa);
+			}
+			ok = TRUE;
+		}
+	}
+	message->destroy(message);
+	cost_end(&start, &costs[phase]);
+	return ok;
+}
+
+/**
+ * Deliver packets until both peers are idle
+ */
+static bool run()
+{
+	packet_t *packet;
+
+	while (packets->remove_first(packets, (void**)&packet) == SUCCESS)
+	{
+		if (!deliver(packet))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Run an action on the initiating IKE_SA, create one if id is NULL
+ */
+static bool initiate(ike_sa_id_t **id, peer_cfg_t *peer_cfg, phase_t phase)
+{
+	struct timespec start;
+	child_cfg_t *child_cfg;
+	enumerator_t *enumerator;
+	ike_sa_t *ike_sa;
+	status_t status;
+
+	use_manager(initiator);
+	cost_start(&start);
+	if (*id)
+	{
+		ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager, *id);
+	}
+	else
+	{
+		ike_sa = charon->ike_sa_manager->checkout_new(charon->ike_sa_manager,
+													  IKEV2, TRUE);
+		if (ike_sa)
+		{	/* as checkout_by_config() would do */
+			charon->bus->set_sa(charon->bus, ike_sa);
+			ike_sa->set_peer_cfg(ike_sa, peer_cfg);
+			*id = ike_sa->get_id(ike_sa);
+			*id = (*id)->clone(*id);
+		}
+	}
+	if (!ike_sa)
+	{
+		cost_abort();
+		return FALSE;
+	}
+	if (phase == PHASE_INFORMATIONAL)
+	{
+		status = ike_sa->delete(ike_sa);
+	}
+	else
+	{
+		enumerator = peer_cfg->create_child_cfg_enumerator(peer_cfg);
+		enumerator->enumerate(enumerator, &child_cfg);
+		enumerator->destroy(enumerator);
+		status = ike_sa->initiate(ike_sa, child_cfg->get_ref(child_cfg),
+								  0, NULL, NULL);
+	}
+	if (status == DESTROY_ME)
+	{
+		charon->ike_sa_manager->checkin_and_destroy(charon->ike_sa_manager,
+													ike_sa);
+	}
+	else
+	{
+		charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+	}
+	cost_end(&start, &costs[phase]);
+	return status == SUCCESS && run();
+}
+
+/**
+ * Set up an IKE_SA with two CHILD_SAs, and delete it
+ */
+static bool setup(peer_cfg_t *peer_cfg)
+{
+	ike_sa_id_t *id = NULL;
+	bool ok;
+
+	ok = initiate(&id, peer_cfg, PHASE_IKE_SA_INIT) &&
+		 initiate(&id, peer_cfg, PHASE_CREATE_CHILD_SA) &&
+		 initiate(&id, peer_cfg, PHASE_INFORMATIONAL);
+	DESTROY_IF(id);
+	return ok && initiator->get_count(initiator) == 0 &&
+		   responder->get_count(responder) == 0;
+}
+
+/**
+ * Print the cost of a phase
+ */
+static void print_phase(char *name, cost_t *cost, int rounds)
+{
+	printf("%-16s %7u %9llu\n", name, cost->allocs / rounds,
+		   cost->ns / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	sender_t sender = {
+		.send = _send_,
+		.send_no_marker = _send_,
+		.flush = (void*)nop,
+		.destroy = (void*)nop,
+	};
+	backend_t backend = {
+		.create_peer_cfg_enumerator = _create_peer_cfg_enumerator,
+		.create_ike_cfg_enumerator = _create_ike_cfg_enumerator,
+		.get_peer_cfg_by_name = (void*)return_null,
+	};
+	char *ike = "aes128-sha256-modp2048", *esp = "aes128-sha256-modp2048";
+	peer_cfg_t *peer_cfg, *peer;
+	mem_cred_t *creds;
+	u_int64_t ns = 0;
+	int rounds = 1000, warmup, i;
+	bool ok = TRUE;
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("ike_burn");
+	atexit(libhydra_deinit);
+	libcharon_init("ike_burn");
+	atexit(libcharon_deinit);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+
+	if (argc > 1)
+	{
+		rounds = max(atoi(argv[1]), 1);
+	}
+	if (argc > 2)
+	{
+		ike = esp = argv[2];
+		if (streq(ike, "null"))
+		{
+			ike = esp = NULL_PROPOSAL;
+		}
+	}
+	if (argc > 3)
+	{
+		esp = argv[3];
+	}
+
+	/* the strongSwan vendor ID allows us to use MODP_NULL from private space */
+	lib->settings->set_bool(lib->settings, "%s.send_vendor_id", TRUE,
+							charon->name);
+	lib->crypto->add_crypter(lib->crypto, ENCR_NULL, "ike_burn",
+							 null_crypter_create);
+	lib->crypto->add_dh(lib->crypto, MODP_NULL, "ike_burn",
+						(dh_constructor_t)null_dh_create);
+	hydra->kernel_interface->add_ipsec_interface(hydra->kernel_interface,
+												 kernel_ipsec_create);
+
+	creds = mem_cred_create();
+	creds->add_shared(creds, shared_key_create(SHARED_IKE,
+							chunk_clone(chunk_create("ike_burn", 8))),
+					  identification_create_from_string("moon.strongswan.org"),
+					  identification_create_from_string("sun.strongswan.org"),
+					  NULL);
+	lib->credmgr->add_set(lib->credmgr, &creds->set);
+
+	configs = linked_list_create();
+	peer_cfg = create_config("initiator", INITIATOR, RESPONDER,
+							 "moon.strongswan.org", "sun.strongswan.org",
+							 ike, esp);
+	peer = create_config("responder", RESPONDER, INITIATOR,
+						 "sun.strongswan.org", "moon.strongswan.org",
+						 ike, esp);
+	if (!peer_cfg || !peer)
+	{
+		fprintf(stderr, "invalid proposal: %s/%s\n", ike, esp);
+		DESTROY_IF(peer_cfg);
+		DESTROY_IF(peer);
+		ok = FALSE;
+	}
+	else
+	{
+		configs->insert_last(configs, peer_cfg);
+		configs->insert_last(configs, peer);
+		charon->backends->add_backend(charon->backends, &backend);
+	}
+
+	packets = linked_list_create();
+	initiator = ike_sa_manager_create();
+	responder = ike_sa_manager_create();
+	charon->sender = &sender;
+
+	/* warm up caches and allocators, then measure */
+	warmup = max(rounds / 10, 1);
+	for (i = 0; ok && i < warmup; i++)
+	{
+		ok = setup(peer_cfg);
+	}
+	memset(costs, 0, sizeof(costs));
+	for (i = 0; ok && i < rounds; i++)
+	{
+		ok = setup(peer_cfg);
+	}
+	if (ok)
+	{
+		printf("%d setups, IKE %s, ESP %s\n", rounds, ike, esp);
+		printf("%-16s %7s %9s\n", "phase", "alloc", "ns");
+		print_phase("IKE_SA_INIT", &costs[PHASE_IKE_SA_INIT], rounds);
+		print_phase("IKE_AUTH", &costs[PHASE_IKE_AUTH], rounds);
+		print_phase("CREATE_CHILD_SA", &costs[PHASE_CREATE_CHILD_SA], rounds);
+		print_phase("INFORMATIONAL", &costs[PHASE_INFORMATIONAL], rounds);
+		for (i = PHASE_IKE_SA_INIT; i < PHASE_INFORMATIONAL; i++)
+		{
+			ns += costs[i].ns;
+		}
+		printf("%-16s %17.1f\n", "setups/s", rounds * 1000000000.0 / ns);
+	}
+	else
+	{
+		fprintf(stderr, "IKE setup failed, algorithms supported? loaded: %s\n",
+				lib->plugins->loaded_plugins(lib->plugins));
+	}
+
+	charon->sender = NULL;
+	initiator->flush(initiator);
+	responder->flush(responder);
+	initiator->destroy(initiator);
+	responder->destroy(responder);
+	charon->ike_sa_manager = NULL;
+	packets->destroy_offset(packets, offsetof(packet_t, destroy));
+	charon->backends->remove_backend(charon->backends, &backend);
+	configs->destroy_offset(configs, offsetof(peer_cfg_t, destroy));
+	lib->credmgr->remove_set(lib->credmgr, &creds->set);
+	creds->destroy(creds);
+	hydra->kernel_interface->remove_ipsec_interface(hydra->kernel_interface,
+													kernel_ipsec_create);
+	lib->crypto->remove_dh(lib->crypto, (dh_constructor_t)null_dh_create);
+	lib->crypto->remove_crypter(lib->crypto, null_crypter_create);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "cost.h"
+
+#include <stdio.h>
+
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <encoding/message.h>
+#include <encoding/payloads/sa_payload.h>
+#include <encoding/payloads/ke_payload.h>
+#include <encoding/payloads/nonce_payload.h>
+#include <encoding/payloads/id_payload.h>
+#include <encoding/payloads/auth_payload.h>
+#include <encoding/payloads/ts_payload.h>
+#include <encoding/payloads/delete_payload.h>
+
+/**
+ * AEAD used to protect IKE_AUTH
+ */
+static aead_t *aead;
+
+/**
+ * Fake public DH value
+ */
+static char dh_value[256];
+
+METHOD(diffie_hellman_t, dh_get_my_public_value, void,
+	diffie_hellman_t *this, chunk_t *value)
+{
+	*value = chunk_clone(chunk_from_thing(dh_value));
+}
+
+METHOD(diffie_hellman_t, dh_get_dh_group, diffie_hellman_group_t,
+	diffie_hellman_t *this)
+{
+	return MODP_2048_BIT;
+}
+
+METHOD(keymat_t, keymat_get_version, ike_version_t,
+	keymat_t *this)
+{
+	return IKEV2;
+}
+
+METHOD(keymat_t, keymat_get_aead, aead_t*,
+	keymat_t *this, bool in)
+{
+	return aead;
+}
+
+/**
+ * Create a message with common header fields
+ */
+static message_t *create_message(exchange_type_t type, u_int32_t id,
+								 u_int64_t spi_r, u_int16_t port)
+{
+	message_t *message;
+	ike_sa_id_t *ike_sa_id;
+
+	message = message_create(IKEV2_MAJOR_VERSION, IKEV2_MINOR_VERSION);
+	message->set_exchange_type(message, type);
+	message->set_message_id(message, id);
+	ike_sa_id = ike_sa_id_create(IKEV2_MAJOR_VERSION, 0x1234, spi_r, TRUE);
+	message->set_ike_sa_id(message, ike_sa_id);
+	ike_sa_id->destroy(ike_sa_id);
+	message->set_source(message, host_create_from_string("192.168.0.1", port));
+	message->set_destination(message,
+							 host_create_from_string("192.168.0.2", port));
+	return message;
+}
+
+/**
+ * Build an IKE_SA_INIT request
+ */
+static message_t *build_ike_sa_init()
+{
+	diffie_hellman_t dh = {
+		.get_my_public_value = _dh_get_my_public_value,
+		.get_dh_group = _dh_get_dh_group,
+	};
+	char nat[20] = {};
+	nonce_payload_t *nonce;
+	proposal_t *proposal;
+	message_t *message;
+
+	message = create_message(IKE_SA_INIT, 0, 0, 500);
+	proposal = proposal_create_from_string(PROTO_IKE,
+							"aes128-aes256-sha256-sha1-modp2048-modp3072");
+	message->add_payload(message,
+				(payload_t*)sa_payload_create_from_proposal_v2(proposal));
+	proposal->destroy(proposal);
+	message->add_payload(message, (payload_t*)
+				ke_payload_create_from_diffie_hellman(KEY_EXCHANGE, &dh));
+	nonce = nonce_payload_create(NONCE);
+	nonce->set_nonce(nonce, chunk_from_thing(dh_value));
+	message->add_payload(message, (payload_t*)nonce);
+	message->add_notify(message, FALSE, NAT_DETECTION_SOURCE_IP,
+						chunk_from_thing(nat));
+	message->add_notify(message, FALSE, NAT_DETECTION_DESTINATION_IP,
+						chunk_from_thing(nat));
+	return message;
+}
+
+/**
+ * Build an IKE_AUTH request
+ */
+static message_t *build_ike_auth()
+{
+	identification_t *id;
+	traffic_selector_t *ts;
+	linked_list_t *list;
+	proposal_t *proposal;
+	auth_payload_t *auth;
+	message_t *message;
+
+	message = create_message(IKE_AUTH, 1, 0x5678, 4500);
+	id = identification_create_from_string("moon.strongswan.org");
+	message->add_payload(message, (payload_t*)
+				id_payload_create_from_identification(ID_INITIATOR, id));
+	id->destroy(id);
+	id = identification_create_from_string("sun.strongswan.org");
+	message->add_payload(message, (payload_t*)
+				id_payload_create_from_identification(ID_RESPONDER, id));
+	id->destroy(id);
+	auth = auth_payload_create();
+	auth->set_auth_method(auth, AUTH_RSA);
+	auth->set_data(auth, chunk_from_thing(dh_value));
+	message->add_payload(message, (payload_t*)auth);
+	message->add_notify(message, FALSE, INITIAL_CONTACT, chunk_empty);
+	proposal = proposal_create_from_string(PROTO_ESP, "aes128-sha256-sha1");
+	message->add_payload(message,
+				(payload_t*)sa_payload_create_from_proposal_v2(proposal));
+	proposal->destroy(proposal);
+	ts = traffic_selector_create_from_cidr("10.1.0.0/16", 0, 0);
+	list = linked_list_create_with_items(ts, NULL);
+	message->add_payload(message, (payload_t*)
+				ts_payload_create_from_traffic_selectors(TRUE, list));
+	message->add_payload(message, (payload_t*)
+				ts_payload_create_from_traffic_selectors(FALSE, list));
+	list->destroy(list);
+	ts->destroy(ts);
+	return message;
+}
+
+/**
+ * Build a CREATE_CHILD_SA request
+ */
+static message_t *build_create_child_sa()
+{
+	diffie_hellman_t dh = {
+		.get_my_public_value = _dh_get_my_public_value,
+		.get_dh_group = _dh_get_dh_group,
+	};
+	traffic_selector_t *ts;
+	linked_list_t *list;
+	proposal_t *proposal;
+	nonce_payload_t *nonce;
+	message_t *message;
+
+	message = create_message(CREATE_CHILD_SA, 2, 0x5678, 4500);
+	proposal = proposal_create_from_string(PROTO_ESP,
+										   "aes128-sha256-sha1-modp2048");
+	message->add_payload(message,
+				(payload_t*)sa_payload_create_from_proposal_v2(proposal));
+	proposal->destroy(proposal);
+	nonce = nonce_payload_create(NONCE);
+	nonce->set_nonce(nonce, chunk_create(dh_value, 32));
+	message->add_payload(message, (payload_t*)nonce);
+	message->add_payload(message, (payload_t*)
+				ke_payload_create_from_diffie_hellman(KEY_EXCHANGE, &dh));
+	ts = traffic_selector_create_from_cidr("10.2.0.0/16", 0, 0);
+	list = linked_list_create_with_items(ts, NULL);
+	message->add_payload(message, (payload_t*)
+				ts_payload_create_from_traffic_selectors(TRUE, list));
+	message->add_payload(message, (payload_t*)
+				ts_payload_create_from_traffic_selectors(FALSE, list));
+	list->destroy(list);
+	ts->destroy(ts);
+	return message;
+}
+
+/**
+ * Build an INFORMATIONAL request deleting a CHILD_SA
+ */
+static message_t *build_informational()
+{
+	delete_payload_t *delete;
+	message_t *message;
+
+	message = create_message(INFORMATIONAL, 3, 0x5678, 4500);
+	delete = delete_payload_create(DELETE, PROTO_ESP);
+	delete->add_spi(delete, htonl(0xc0c0c0c0));
+	message->add_payload(message, (payload_t*)delete);
+	return message;
+}
+
+/**
+ * Parse a packet, optionally lazily and accessing all payloads afterwards
+ */
+static bool parse(packet_t *packet, keymat_t *keymat, bool lazy, bool access,
+				  cost_t *cost)
+{
+	struct timespec start;
+	enumerator_t *enumerator;
+	message_t *message;
+	payload_t *payload;
+	bool ok;
+
+	packet = packet->clone(packet);
+	cost_start(&start);
+	message = message_create_from_packet(packet);
+	message->set_lazy_parsing(message, lazy);
+	ok = message->parse_header(message) == SUCCESS &&
+		 message->parse_body(message, keymat) == SUCCESS;
+	if (ok && access)
+	{
+		enumerator = message->create_payload_enumerator(message);
+		while (enumerator->enumerate(enumerator, &payload))
+		{
+			/* parsed, nothing to do */
+		}
+		enumerator->destroy(enumerator);
+	}
+	message->destroy(message);
+	cost_end(&start, cost);
+	return ok;
+}
+
+/**
+ * Generate and parse a message, count allocations and time
+ */
+static bool burn(char *name, message_t *(*build)(), keymat_t *keymat,
+				 int rounds)
+{
+	cost_t gen = {}, eager = {}, lazy = {}, access = {};
+	struct timespec start;
+	message_t *message;
+	packet_t *packet;
+	u_int len = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++)
+	{
+		message = build();
+
+		cost_start(&start);
+		if (message->generate(message, keymat, &packet) != SUCCESS)
+		{
+			cost_abort();
+			fprintf(stderr, "generating %s failed\n", name);
+			message->destroy(message);
+			return FALSE;
+		}
+		message->destroy(message);
+		cost_end(&start, &gen);
+		len = packet->get_data(packet).len;
+
+		if (!parse(packet, keymat, FALSE, FALSE, &eager) ||
+			!parse(packet, keymat, TRUE, FALSE, &lazy) ||
+			!parse(packet, keymat, TRUE, TRUE, &access))
+		{
+			fprintf(stderr, "parsing %s failed\n", name);
+			packet->destroy(packet);
+			return FALSE;
+		}
+		packet->destroy(packet);
+	}
+	printf("%-16s %5u %5u %7llu %5u %7llu %5u %7llu %5u %7llu\n", name, len,
+		   gen.allocs / rounds, gen.ns / rounds,
+		   eager.allocs / rounds, eager.ns / rounds,
+		   lazy.allocs / rounds, lazy.ns / rounds,
+		   access.allocs / rounds, access.ns / rounds);
+	return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	keymat_t keymat = {
+		.get_version = _keymat_get_version,
+		.get_aead = _keymat_get_aead,
+	};
+	char key[32] = {};
+	crypter_t *crypter;
+	signer_t *signer;
+	int rounds = 10000;
+	bool ok;
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("message_burn");
+	atexit(libhydra_deinit);
+	libcharon_init("message_burn");
+	atexit(libcharon_deinit);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+
+	if (argc > 1)
+	{
+		rounds = max(atoi(argv[1]), 1);
+	}
+
+	crypter = lib->crypto->create_crypter(lib->crypto, ENCR_AES_CBC, 16);
+	signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_SHA2_256_128);
+	if (!crypter || !signer ||
+		!crypter->set_key(crypter, chunk_create(key, 16)) ||
+		!signer->set_key(signer, chunk_create(key, 32)))
+	{
+		fprintf(stderr, "AES-CBC/HMAC-SHA256 not supported, loaded: %s\n",
+				PLUGINS);
+		DESTROY_IF(crypter);
+		DESTROY_IF(signer);
+		return 1;
+	}
+	aead = aead_create(crypter, signer);
+
+	printf("%-16s %5s %13s %13s %13s %13s\n", "", "", "generate",
+		   "parse", "lazy parse", "lazy+access");
+	printf("%-16s %5s %5s %7s %5s %7s %5s %7s %5s %7s\n", "exchange", "bytes",
+		   "alloc", "ns", "alloc", "ns", "alloc", "ns", "alloc", "ns");
+	ok = burn("IKE_SA_INIT", build_ike_sa_init, &keymat, rounds) &&
+		 burn("IKE_AUTH", build_ike_auth, &keymat, rounds) &&
+		 burn("CREATE_CHILD_SA", build_create_child_sa, &keymat, rounds) &&
+		 burn("INFORMATIONAL", build_informational, &keymat, rounds);
+
+	aead->destroy(aead);
+	return ok ? 0 : 1;
+}
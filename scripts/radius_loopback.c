@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <library.h>
+#include <utils/debug.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <radius_socket.h>
+
+/**
+ * Shared secret of the loopback server
+ */
+static chunk_t secret = chunk_from_chars('l','o','o','p','b','a','c','k');
+
+/**
+ * Number of requests completed, and failed
+ */
+static u_int completed, failed;
+
+/**
+ * Crypto primitives of the loopback server
+ */
+static hasher_t *hasher;
+static signer_t *signer;
+
+/**
+ * Lock and condvar to wait for completion
+ */
+static mutex_t *mutex;
+static condvar_t *condvar;
+
+/**
+ * Print usage information
+ */
+static void usage(FILE *out, char *cmd)
+{
+	fprintf(out, "usage:\n");
+	fprintf(out, "  %s [--requests <n>] [--debug <level>]\n", cmd);
+	fprintf(out, "  %s --sync [--requests <n>] [--threads <n>] [--debug <level>]\n", cmd);
+}
+
+/**
+ * Loopback RADIUS server, answers all requests with an Accept/Response
+ */
+static void *serve(int *fd)
+{
+	radius_message_t *request, *response;
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	char buf[4096];
+	chunk_t data;
+	bool oldstate;
+	int len;
+
+	while (TRUE)
+	{
+		addrlen = sizeof(addr);
+		oldstate = thread_cancelability(TRUE);
+		len = recvfrom(*fd, buf, sizeof(buf), 0,
+					   (struct sockaddr*)&addr, &addrlen);
+		thread_cancelability(oldstate);
+		if (len <= 0)
+		{
+			break;
+		}
+		request = radius_message_parse(chunk_create(buf, len));
+		if (!request)
+		{
+			continue;
+		}
+		if (request->get_code(request) == RMC_ACCOUNTING_REQUEST)
+		{
+			response = radius_message_create(RMC_ACCOUNTING_RESPONSE);
+		}
+		else
+		{
+			response = radius_message_create(RMC_ACCESS_ACCEPT);
+		}
+		response->set_identifier(response, request->get_identifier(request));
+		if (response->sign(response, request->get_authenticator(request),
+						   secret, hasher, signer, NULL, TRUE))
+		{
+			data = response->get_encoding(response);
+			sendto(*fd, data.ptr, data.len, 0,
+				   (struct sockaddr*)&addr, addrlen);
+		}
+		response->destroy(response);
+		request->destroy(request);
+	}
+	return NULL;
+}
+
+/**
+ * Count a completed request
+ */
+static void count(bool success)
+{
+	mutex->lock(mutex);
+	completed++;
+	if (!success)
+	{
+		failed++;
+	}
+	condvar->signal(condvar);
+	mutex->unlock(mutex);
+}
+
+/**
+ * Callback for asynchronous requests
+ */
+static void response_cb(void *data, radius_message_t *request,
+						radius_message_t *response)
+{
+	count(response && response->get_code(response) == RMC_ACCESS_ACCEPT);
+}
+
+/**
+ * Arguments for synchronous request threads
+ */
+typedef struct {
+	radius_socket_t *socket;
+	u_int requests;
+} sync_t;
+
+/**
+ * Issue synchronous requests
+ */
+static void *request_sync(sync_t *sync)
+{
+	radius_message_t *request, *response;
+
+	while (sync->requests--)
+	{
+		request = radius_message_create(RMC_ACCESS_REQUEST);
+		response = sync->socket->request(sync->socket, request);
+		count(response && response->get_code(response) == RMC_ACCESS_ACCEPT);
+		DESTROY_IF(response);
+		request->destroy(request);
+	}
+	return NULL;
+}
+
+/**
+ * Bind a UDP socket to a random loopback port
+ */
+static int bind_loopback(u_int16_t *port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t addrlen = sizeof(addr);
+	int fd, size = 1024 * 1024;
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	/* bursts of outstanding requests overflow the default receive buffer */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (bind(fd, (struct sockaddr*)&addr, addrlen) == -1 ||
+		getsockname(fd, (struct sockaddr*)&addr, &addrlen) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	radius_socket_t *socket;
+	radius_message_t *request;
+	thread_t *server, **clients = NULL;
+	sync_t *sync = NULL;
+	u_int requests = 10000, threads = 4, i;
+	struct timespec start, end;
+	bool synchronous = FALSE;
+	u_int16_t port;
+	double secs;
+	int fd;
+
+	library_init(NULL);
+	atexit(library_deinit);
+
+	while (TRUE)
+	{
+		struct option long_opts[] = {
+			{"help",		no_argument,		NULL,	'h' },
+			{"requests",	required_argument,	NULL,	'r' },
+			{"threads",		required_argument,	NULL,	't' },
+			{"sync",		no_argument,		NULL,	's' },
+			{"debug",		required_argument,	NULL,	'd' },
+			{0,0,0,0 }
+		};
+		switch (getopt_long(argc, argv, "", long_opts, NULL))
+		{
+			case EOF:
+				break;
+			case 'h':
+				usage(stdout, argv[0]);
+				return 0;
+			case 'r':
+				requests = atoi(optarg);
+				continue;
+			case 't':
+				threads = max(1, atoi(optarg));
+				continue;
+			case 's':
+				synchronous = TRUE;
+				continue;
+			case 'd':
+				dbg_default_set_level(atoi(optarg));
+				continue;
+			default:
+				usage(stderr, argv[0]);
+				return 1;
+		}
+		break;
+	}
+
+	if (!lib->plugins->load(lib->plugins, NULL, PLUGINS))
+	{
+		return 1;
+	}
+	/* one thread for the scheduler, one receives responses/invokes callbacks */
+	lib->processor->set_threads(lib->processor, 2);
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_MD5);
+	signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_MD5_128);
+	if (!hasher || !signer || !signer->set_key(signer, secret))
+	{
+		fprintf(stderr, "HMAC/MD5 required\n");
+		return 1;
+	}
+	fd = bind_loopback(&port);
+	if (fd == -1)
+	{
+		fprintf(stderr, "binding loopback socket failed: %s\n", strerror(errno));
+		return 1;
+	}
+	socket = radius_socket_create("127.0.0.1", port, port, secret);
+	if (!socket)
+	{
+		close(fd);
+		return 1;
+	}
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+	server = thread_create((thread_main_t)serve, &fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (synchronous)
+	{
+		requests = requests / threads * threads;
+		sync = malloc(sizeof(sync_t) * threads);
+		clients = malloc(sizeof(thread_t*) * threads);
+		for (i = 0; i < threads; i++)
+		{
+			sync[i].socket = socket;
+			sync[i].requests = requests / threads;
+			clients[i] = thread_create((thread_main_t)request_sync, &sync[i]);
+		}
+	}
+	else
+	{
+		for (i = 0; i < requests; i++)
+		{
+			request = radius_message_create(RMC_ACCESS_REQUEST);
+			if (!socket->request_async(socket, request, response_cb, NULL))
+			{
+				count(FALSE);
+			}
+		}
+	}
+	mutex->lock(mutex);
+	while (completed < requests)
+	{
+		condvar->wait(condvar, mutex);
+	}
+	mutex->unlock(mutex);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (clients)
+	{
+		for (i = 0; i < threads; i++)
+		{
+			clients[i]->join(clients[i]);
+		}
+		free(clients);
+		free(sync);
+	}
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u %s requests in %.3fs, %u failed: %.0f requests/s\n",
+		   requests, synchronous ? "synchronous" : "asynchronous", secs,
+		   failed, requests / secs);
+
+	socket->destroy(socket);
+	server->cancel(server);
+	server->join(server);
+	close(fd);
+	hasher->destroy(hasher);
+	signer->destroy(signer);
+	mutex->destroy(mutex);
+	condvar->destroy(condvar);
+	lib->processor->cancel(lib->processor);
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include <library.h>
 #include <ipsec.h>
 #include <processing/jobs/callback_job.h>
+#include <threading/mutex.h>
 #include <threading/rwlock.h>
 #include <threading/thread.h>
 
@@ -53,6 +54,16 @@ struct private_android_service_t {
 	 */
 	ike_sa_t *ike_sa;
 
+	/**
+	 * CHILD_SA is up, initiation failures are not reported anymore
+	 */
+	bool established;
+
+	/**
+	 * lock for ike_sa and established, listener callbacks run concurrently
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * the type of VPN
 	 */
@@ -347,16 +358,55 @@ static void close_tun_device(private_android_service_t *this)
 	close(tunfd);
 }
 
+/**
+ * Check if an event is for the current IKE_SA, optionally only while it is
+ * being initiated
+ */
+static bool is_current(private_android_service_t *this, ike_sa_t *ike_sa,
+					   bool initiating)
+{
+	bool current;
+
+	this->mutex->lock(this->mutex);
+	current = this->ike_sa == ike_sa && (!initiating || !this->established);
+	this->mutex->unlock(this->mutex);
+	return current;
+}
+
+/**
+ * Replace the current IKE_SA, returns FALSE if old is not the current one
+ */
+static bool replace_current(private_android_service_t *this, ike_sa_t *old,
+							ike_sa_t *new, bool initiating)
+{
+	bool current;
+
+	this->mutex->lock(this->mutex);
+	current = this->ike_sa == old;
+	if (current)
+	{
+		this->ike_sa = new;
+		if (initiating)
+		{
+			this->established = FALSE;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+	return current;
+}
+
 METHOD(listener_t, child_updown, bool,
 	private_android_service_t *this, ike_sa_t *ike_sa, child_sa_t *child_sa,
 	bool up)
 {
-	if (this->ike_sa == ike_sa)
+	if (is_current(this, ike_sa, FALSE))
 	{
 		if (up)
 		{
 			/* disable the hooks registered to catch initiation failures */
-			this->public.listener.ike_updown = NULL;
+			this->mutex->lock(this->mutex);
+			this->established = TRUE;
+			this->mutex->unlock(this->mutex);
 			if (!setup_tun_device(this, ike_sa, child_sa))
 			{
 				DBG1(DBG_DMN, "failed to setup TUN device");
@@ -386,9 +436,9 @@ METHOD(listener_t, child_updown, bool,
 METHOD(listener_t, ike_updown, bool,
 	private_android_service_t *this, ike_sa_t *ike_sa, bool up)
 {
-	/* this callback is only registered during initiation, so if the IKE_SA
+	/* this callback is only active during initiation, so if the IKE_SA
 	 * goes down we assume an authentication error */
-	if (this->ike_sa == ike_sa && !up)
+	if (!up && is_current(this, ike_sa, TRUE))
 	{
 		charonservice->update_status(charonservice,
 									 CHARONSERVICE_AUTH_ERROR);
@@ -401,7 +451,7 @@ METHOD(listener_t, alert, bool,
 	private_android_service_t *this, ike_sa_t *ike_sa, alert_t alert,
 	va_list args)
 {
-	if (this->ike_sa == ike_sa)
+	if (is_current(this, ike_sa, FALSE))
 	{
 		switch (alert)
 		{
@@ -432,23 +482,16 @@ METHOD(listener_t, alert, bool,
 METHOD(listener_t, ike_rekey, bool,
 	private_android_service_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	if (this->ike_sa == old)
-	{
-		this->ike_sa = new;
-	}
+	replace_current(this, old, new, FALSE);
 	return TRUE;
 }
 
 METHOD(listener_t, ike_reestablish, bool,
 	private_android_service_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	if (this->ike_sa == old)
-	{
-		this->ike_sa = new;
-		/* re-register hook to detect initiation failures */
-		this->public.listener.ike_updown = _ike_updown;
-		/* the TUN device will be closed when the new CHILD_SA is established */
-	}
+	/* re-enable hook to detect initiation failures, the TUN device will be
+	 * closed when the new CHILD_SA is established */
+	replace_current(this, old, new, TRUE);
 	return TRUE;
 }
 
@@ -558,7 +601,9 @@ static job_requeue_t initiate(private_android_service_t *this)
 	peer_cfg->destroy(peer_cfg);
 
 	/* store the IKE_SA so we can track its progress */
+	this->mutex->lock(this->mutex);
 	this->ike_sa = ike_sa;
+	this->mutex->unlock(this->mutex);
 
 	/* get an additional reference because initiate consumes one */
 	child_cfg->get_ref(child_cfg);
@@ -580,6 +625,7 @@ METHOD(android_service_t, destroy, void,
 	/* make sure the tun device is actually closed */
 	close_tun_device(this);
 	this->lock->destroy(this->lock);
+	this->mutex->destroy(this->mutex);
 	free(this->type);
 	free(this->gateway);
 	free(this->username);
@@ -612,6 +658,7 @@ android_service_t *android_service_create(android_creds_t *creds, char *type,
 			.destroy = _destroy,
 		},
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.username = username,
 		.password = password,
 		.gateway = gateway,
@@ -7,8 +7,8 @@ bus/bus.c bus/bus.h \
 bus/listeners/listener.h \
 bus/listeners/logger.h \
 bus/listeners/file_logger.c bus/listeners/file_logger.h \
-bus/listeners/sys_logger.c bus/listeners/sys_logger.h \
-config/backend_manager.c config/backend_manager.h config/backend.h \
+bus/listeners/sys_logger.c bus/listeners/sys_logger.h bus/listeners/log_queue.c bus/listeners/log_queue.h \
+config/backend_manager.c config/backend_manager.h config/config_index.c config/config_index.h config/backend.h \
 config/child_cfg.c config/child_cfg.h \
 config/ike_cfg.c config/ike_cfg.h \
 config/peer_cfg.c config/peer_cfg.h \
@@ -18,12 +18,24 @@
 
 #include <stdint.h>
 
+#include <daemon.h>
 #include <threading/thread.h>
 #include <threading/thread_value.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
 #include <threading/rwlock.h>
+#include <threading/spinlock.h>
+#include <selectors/traffic_selector.h>
+
+ENUM(trace_selector_names, TRACE_IKE_SA, TRACE_ADDRESS,
+	"ike-sa",
+	"conn",
+	"id",
+	"addr",
+);
 
 typedef struct private_bus_t private_bus_t;
+typedef struct listeners_t listeners_t;
 
 /**
  * Private data of a bus_t object.
@@ -35,9 +47,9 @@ struct private_bus_t {
 	bus_t public;
 
 	/**
-	 * List of registered listeners as entry_t.
+	 * Current immutable set of registered listeners, copied on write
 	 */
-	linked_list_t *listeners;
+	listeners_t *listeners;
 
 	/**
 	 * List of registered loggers for each log group as log_entry_t.
@@ -53,10 +65,15 @@ struct private_bus_t {
 	level_t max_level[DBG_MAX + 1];
 
 	/**
-	 * Mutex for the list of listeners, recursively.
+	 * Mutex serializing modifications of the listeners.
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * Spinlock to atomically get a reference to the current listeners
+	 */
+	spinlock_t *listeners_lock;
+
 	/**
 	 * Read-write lock for the list of loggers.
 	 */
@@ -66,8 +83,68 @@ struct private_bus_t {
 	 * Thread local storage the threads IKE_SA
 	 */
 	thread_value_t *thread_sa;
+
+	/**
+	 * Traced selectors, as trace_t, protected by log_lock
+	 */
+	linked_list_t *traces;
+
+	/**
+	 * Number of traced selectors
+	 */
+	u_int tracing;
+
+	/**
+	 * Maximum level of any traced selector for each log group
+	 */
+	level_t traced[DBG_MAX];
+
+	/**
+	 * Incremented whenever the traced selectors change
+	 */
+	u_int generation;
+
+	/**
+	 * Thread local trace levels of the threads IKE_SA, as trace_cache_t
+	 */
+	thread_value_t *thread_trace;
+
+	/**
+	 * Thread local storage of the listeners the thread is calling, calling_t
+	 */
+	thread_value_t *calling;
+
+	/**
+	 * Threads waiting for calls to a removed listener, as waiting_t
+	 */
+	linked_list_t *waiting;
+
+	/**
+	 * Mutex to lock the waiting list, acquired after the mutex of entries
+	 */
+	mutex_t *waiting_lock;
 };
 
+/**
+ * Events listeners can subscribe to, by implementing the callback
+ */
+typedef enum {
+	EVENT_ALERT,
+	EVENT_IKE_STATE_CHANGE,
+	EVENT_CHILD_STATE_CHANGE,
+	EVENT_MESSAGE,
+	EVENT_IKE_KEYS,
+	EVENT_CHILD_KEYS,
+	EVENT_IKE_UPDOWN,
+	EVENT_IKE_REKEY,
+	EVENT_IKE_REESTABLISH,
+	EVENT_CHILD_UPDOWN,
+	EVENT_CHILD_REKEY,
+	EVENT_AUTHORIZE,
+	EVENT_NARROW,
+	EVENT_MAX,
+} event_t;
+
 typedef struct entry_t entry_t;
 
 /**
@@ -81,10 +158,101 @@ struct entry_t {
 	listener_t *listener;
 
 	/**
-	 * are we currently calling this listener
+	 * number of calls currently in progress, in all threads
+	 */
+	u_int calling;
+
+	/**
+	 * mutex to lock the call counter
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * signaled when a call to a removed listener returns
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * listener has been unregistered, don't call it anymore
+	 */
+	bool removed;
+
+	/**
+	 * listener asked to get unregistered by returning FALSE from a callback
+	 */
+	bool dropped;
+
+	/**
+	 * references held by listeners_t and removing threads
+	 */
+	refcount_t ref;
+};
+
+/**
+ * Immutable set of registered listeners, replaced on each modification
+ */
+struct listeners_t {
+
+	/**
+	 * all registered listeners, in registration order
+	 */
+	entry_t **all;
+
+	/**
+	 * number of registered listeners
+	 */
+	u_int count;
+
+	/**
+	 * listeners implementing each event callback, in registration order
+	 */
+	entry_t **events[EVENT_MAX];
+
+	/**
+	 * number of listeners implementing each event callback
+	 */
+	u_int counts[EVENT_MAX];
+
+	/**
+	 * references held by the bus and dispatching threads
+	 */
+	refcount_t ref;
+};
+
+typedef struct calling_t calling_t;
+
+/**
+ * A listener being called by a thread, as a stack on the threads stack
+ */
+struct calling_t {
+
+	/**
+	 * entry of the called listener
+	 */
+	entry_t *entry;
+
+	/**
+	 * listener called before, NULL for the outermost call
+	 */
+	calling_t *prev;
+};
+
+typedef struct waiting_t waiting_t;
+
+/**
+ * A thread waiting in remove_listener() for calls to a listener
+ */
+struct waiting_t {
+
+	/**
+	 * entry the thread waits for
 	 */
-	int calling;
+	entry_t *entry;
 
+	/**
+	 * listeners the waiting thread is calling itself
+	 */
+	calling_t *calling;
 };
 
 typedef struct log_entry_t log_entry_t;
@@ -106,6 +274,280 @@ struct log_entry_t {
 
 };
 
+/**
+ * Check if a listener implements the callback of an event
+ */
+static bool has_event(listener_t *listener, event_t event)
+{
+	switch (event)
+	{
+		case EVENT_ALERT:
+			return listener->alert != NULL;
+		case EVENT_IKE_STATE_CHANGE:
+			return listener->ike_state_change != NULL;
+		case EVENT_CHILD_STATE_CHANGE:
+			return listener->child_state_change != NULL;
+		case EVENT_MESSAGE:
+			return listener->message != NULL;
+		case EVENT_IKE_KEYS:
+			return listener->ike_keys != NULL;
+		case EVENT_CHILD_KEYS:
+			return listener->child_keys != NULL;
+		case EVENT_IKE_UPDOWN:
+			return listener->ike_updown != NULL;
+		case EVENT_IKE_REKEY:
+			return listener->ike_rekey != NULL;
+		case EVENT_IKE_REESTABLISH:
+			return listener->ike_reestablish != NULL;
+		case EVENT_CHILD_UPDOWN:
+			return listener->child_updown != NULL;
+		case EVENT_CHILD_REKEY:
+			return listener->child_rekey != NULL;
+		case EVENT_AUTHORIZE:
+			return listener->authorize != NULL;
+		case EVENT_NARROW:
+			return listener->narrow != NULL;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Release a reference to a listener entry
+ */
+static void entry_put(entry_t *entry)
+{
+	if (ref_put(&entry->ref))
+	{
+		entry->condvar->destroy(entry->condvar);
+		entry->mutex->destroy(entry->mutex);
+		free(entry);
+	}
+}
+
+/**
+ * Create a set of listeners from a list of entries, adds references
+ */
+static listeners_t *listeners_create(entry_t **entries, u_int count)
+{
+	listeners_t *listeners;
+	entry_t *entry;
+	event_t event;
+	u_int i;
+
+	INIT(listeners,
+		.all = calloc(max(count, 1), sizeof(entry_t*)),
+		.ref = 1,
+	);
+	for (event = 0; event < EVENT_MAX; event++)
+	{
+		listeners->events[event] = calloc(max(count, 1), sizeof(entry_t*));
+	}
+	for (i = 0; i < count; i++)
+	{
+		entry = entries[i];
+		ref_get(&entry->ref);
+		listeners->all[listeners->count++] = entry;
+		for (event = 0; event < EVENT_MAX; event++)
+		{
+			if (has_event(entry->listener, event))
+			{
+				listeners->events[event][listeners->counts[event]++] = entry;
+			}
+		}
+	}
+	return listeners;
+}
+
+/**
+ * Release a reference to a set of listeners
+ */
+static void listeners_put(listeners_t *listeners)
+{
+	event_t event;
+	u_int i;
+
+	if (ref_put(&listeners->ref))
+	{
+		for (i = 0; i < listeners->count; i++)
+		{
+			entry_put(listeners->all[i]);
+		}
+		for (event = 0; event < EVENT_MAX; event++)
+		{
+			free(listeners->events[event]);
+		}
+		free(listeners->all);
+		free(listeners);
+	}
+}
+
+/**
+ * Get a reference to the current set of listeners
+ */
+static listeners_t *listeners_get(private_bus_t *this)
+{
+	listeners_t *listeners;
+
+	this->listeners_lock->lock(this->listeners_lock);
+	listeners = this->listeners;
+	ref_get(&listeners->ref);
+	this->listeners_lock->unlock(this->listeners_lock);
+	return listeners;
+}
+
+/**
+ * Replace the current set of listeners, requires this->mutex
+ */
+static void listeners_replace(private_bus_t *this, listeners_t *listeners)
+{
+	listeners_t *old;
+
+	this->listeners_lock->lock(this->listeners_lock);
+	old = this->listeners;
+	this->listeners = listeners;
+	this->listeners_lock->unlock(this->listeners_lock);
+	listeners_put(old);
+}
+
+/**
+ * Count the calls to a listener in a stack of calling listeners
+ */
+static u_int count_calls(calling_t *calling, entry_t *entry)
+{
+	u_int count = 0;
+
+	for (; calling; calling = calling->prev)
+	{
+		if (calling->entry == entry)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * Check if waiting for calls to entry closes a cycle of threads waiting for
+ * each other, i.e. if a thread calling it waits (transitively) for one of the
+ * listeners we are calling. Requires this->waiting_lock.
+ */
+static bool waits_for(private_bus_t *this, entry_t *entry, calling_t *mine,
+					  u_int depth)
+{
+	enumerator_t *enumerator;
+	waiting_t *waiting;
+	bool found = FALSE;
+
+	if (depth > this->waiting->get_count(this->waiting))
+	{
+		return FALSE;
+	}
+	enumerator = this->waiting->create_enumerator(this->waiting);
+	while (!found && enumerator->enumerate(enumerator, &waiting))
+	{
+		if (waiting->calling != mine &&
+			count_calls(waiting->calling, entry))
+		{
+			found = count_calls(mine, waiting->entry) ||
+					waits_for(this, waiting->entry, mine, depth + 1);
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Wait until other threads returned from calls to a removed listener, returns
+ * FALSE without waiting if that would deadlock
+ */
+static bool wait_calls(private_bus_t *this, entry_t *entry)
+{
+	calling_t *mine;
+	waiting_t waiting;
+	u_int own;
+	bool deadlock = FALSE;
+
+	mine = this->calling->get(this->calling);
+	own = count_calls(mine, entry);
+	waiting = (waiting_t) {
+		.entry = entry,
+		.calling = mine,
+	};
+
+	entry->mutex->lock(entry->mutex);
+	while (entry->calling > own)
+	{
+		/* register and check atomically, so that only the last thread
+		 * closing a cycle sees and breaks it */
+		this->waiting_lock->lock(this->waiting_lock);
+		deadlock = mine && waits_for(this, entry, mine, 0);
+		if (!deadlock)
+		{
+			this->waiting->insert_last(this->waiting, &waiting);
+		}
+		this->waiting_lock->unlock(this->waiting_lock);
+		if (deadlock)
+		{
+			DBG1(DBG_DMN, "can't remove listener while a thread calling it "
+				 "waits for a listener we are calling");
+			break;
+		}
+		entry->condvar->wait(entry->condvar, entry->mutex);
+		this->waiting_lock->lock(this->waiting_lock);
+		this->waiting->remove(this->waiting, &waiting, NULL);
+		this->waiting_lock->unlock(this->waiting_lock);
+	}
+	entry->mutex->unlock(entry->mutex);
+	return !deadlock;
+}
+
+/**
+ * Add an entry to the registered listeners, requires this->mutex
+ */
+static void register_entry(private_bus_t *this, entry_t *entry)
+{
+	listeners_t *current;
+	entry_t **entries;
+
+	entry->mutex->lock(entry->mutex);
+	entry->removed = FALSE;
+	entry->mutex->unlock(entry->mutex);
+	current = this->listeners;
+	entries = malloc(sizeof(entry_t*) * (current->count + 1));
+	memcpy(entries, current->all, sizeof(entry_t*) * current->count);
+	entries[current->count] = entry;
+	listeners_replace(this, listeners_create(entries, current->count + 1));
+	free(entries);
+}
+
+/**
+ * Remove an entry from the registered listeners, requires this->mutex
+ */
+static void unregister_entry(private_bus_t *this, entry_t *entry)
+{
+	listeners_t *current;
+	entry_t **entries;
+	u_int i, count = 0;
+
+	if (entry->removed)
+	{
+		return;
+	}
+	entry->removed = TRUE;
+	current = this->listeners;
+	entries = calloc(max(current->count, 1), sizeof(entry_t*));
+	for (i = 0; i < current->count; i++)
+	{
+		if (current->all[i] != entry)
+		{
+			entries[count++] = current->all[i];
+		}
+	}
+	listeners_replace(this, listeners_create(entries, count));
+	free(entries);
+}
+
 METHOD(bus_t, add_listener, void,
 	private_bus_t *this, listener_t *listener)
 {
@@ -113,32 +555,104 @@ METHOD(bus_t, add_listener, void,
 
 	INIT(entry,
 		.listener = listener,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	this->mutex->lock(this->mutex);
-	this->listeners->insert_last(this->listeners, entry);
+	register_entry(this, entry);
 	this->mutex->unlock(this->mutex);
 }
 
-METHOD(bus_t, remove_listener, void,
+METHOD(bus_t, remove_listener, bool,
 	private_bus_t *this, listener_t *listener)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
+	listeners_t *current;
+	entry_t *entry = NULL;
+	bool removed = TRUE;
+	u_int i;
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	current = this->listeners;
+	for (i = 0; i < current->count; i++)
 	{
-		if (entry->listener == listener)
+		if (current->all[i]->listener == listener)
 		{
-			this->listeners->remove_at(this->listeners, enumerator);
-			free(entry);
+			entry = current->all[i];
+			ref_get(&entry->ref);
+			unregister_entry(this, entry);
 			break;
 		}
 	}
-	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
+
+	if (entry)
+	{	/* wait for other threads currently calling the listener */
+		removed = wait_calls(this, entry);
+		if (!removed)
+		{	/* the caller keeps the listener, register it again */
+			this->mutex->lock(this->mutex);
+			if (!entry->dropped)
+			{
+				register_entry(this, entry);
+			}
+			this->mutex->unlock(this->mutex);
+		}
+		entry_put(entry);
+	}
+	return removed;
+}
+
+/**
+ * Prepare calling a listener, returns FALSE if the listener must be skipped
+ */
+static bool call_begin(private_bus_t *this, entry_t *entry, calling_t *calling)
+{
+	calling_t *prev;
+
+	prev = this->calling->get(this->calling);
+	if (count_calls(prev, entry))
+	{	/* don't call a listener recursively */
+		return FALSE;
+	}
+	entry->mutex->lock(entry->mutex);
+	if (entry->removed)
+	{
+		entry->mutex->unlock(entry->mutex);
+		return FALSE;
+	}
+	entry->calling++;
+	entry->mutex->unlock(entry->mutex);
+
+	*calling = (calling_t) {
+		.entry = entry,
+		.prev = prev,
+	};
+	this->calling->set(this->calling, calling);
+	return TRUE;
+}
+
+/**
+ * Finish calling a listener, unregister it if requested
+ */
+static void call_end(private_bus_t *this, entry_t *entry, calling_t *calling,
+					 bool keep)
+{
+	this->calling->set(this->calling, calling->prev);
+	entry->mutex->lock(entry->mutex);
+	entry->calling--;
+	if (entry->removed)
+	{
+		entry->condvar->broadcast(entry->condvar);
+	}
+	entry->mutex->unlock(entry->mutex);
+	if (!keep)
+	{
+		this->mutex->lock(this->mutex);
+		entry->dropped = TRUE;
+		unregister_entry(this, entry);
+		this->mutex->unlock(this->mutex);
+	}
 }
 
 /**
@@ -244,10 +758,279 @@ METHOD(bus_t, remove_logger, void,
 	this->log_lock->unlock(this->log_lock);
 }
 
+/**
+ * A traced selector
+ */
+typedef struct {
+	/** type of selector */
+	trace_selector_t type;
+	/** selector as string */
+	char *value;
+	/** unique IKE_SA identifier, for TRACE_IKE_SA */
+	u_int32_t unique_id;
+	/** remote identity, for TRACE_IDENTITY */
+	identification_t *id;
+	/** remote subnet, for TRACE_ADDRESS */
+	traffic_selector_t *ts;
+	/** traced levels */
+	level_t levels[DBG_MAX];
+} trace_t;
+
+/**
+ * Trace levels of the IKE_SA a thread uses, cached per thread
+ */
+typedef struct {
+	/** IKE_SA levels have been matched for */
+	ike_sa_t *ike_sa;
+	/** generation of selectors levels have been matched against */
+	u_int generation;
+	/** traced levels of ike_sa */
+	level_t levels[DBG_MAX];
+} trace_cache_t;
+
+/**
+ * Destroy a trace_t
+ */
+static void trace_destroy(trace_t *trace)
+{
+	DESTROY_IF(trace->id);
+	DESTROY_IF(trace->ts);
+	free(trace->value);
+	free(trace);
+}
+
+/**
+ * Create a trace_t, NULL if value is invalid
+ */
+static trace_t *trace_create(trace_selector_t type, char *value)
+{
+	trace_t *trace;
+	host_t *net;
+	debug_t group;
+	char *end;
+	int bits;
+
+	INIT(trace,
+		.type = type,
+		.value = strdup(value),
+	);
+	for (group = 0; group < DBG_MAX; group++)
+	{
+		trace->levels[group] = LEVEL_SILENT;
+	}
+
+	switch (type)
+	{
+		case TRACE_IKE_SA:
+			trace->unique_id = strtoul(value, &end, 10);
+			if (!*value || *end)
+			{
+				trace_destroy(trace);
+				return NULL;
+			}
+			break;
+		case TRACE_PEER_CFG:
+			break;
+		case TRACE_IDENTITY:
+			trace->id = identification_create_from_string(value);
+			break;
+		case TRACE_ADDRESS:
+			net = host_create_from_subnet(value, &bits);
+			if (net)
+			{
+				trace->ts = traffic_selector_create_from_subnet(net, bits,
+																0, 0);
+				net->destroy(net);
+			}
+			if (!trace->ts)
+			{
+				trace_destroy(trace);
+				return NULL;
+			}
+			break;
+		default:
+			trace_destroy(trace);
+			return NULL;
+	}
+	return trace;
+}
+
+/**
+ * Check if an IKE_SA matches a traced selector
+ */
+static bool trace_matches(trace_t *trace, ike_sa_t *ike_sa)
+{
+	identification_t *id;
+	peer_cfg_t *peer_cfg;
+
+	switch (trace->type)
+	{
+		case TRACE_IKE_SA:
+			return ike_sa->get_unique_id(ike_sa) == trace->unique_id;
+		case TRACE_PEER_CFG:
+			peer_cfg = ike_sa->get_peer_cfg(ike_sa);
+			return peer_cfg && streq(peer_cfg->get_name(peer_cfg),
+									 trace->value);
+		case TRACE_IDENTITY:
+			id = ike_sa->get_other_id(ike_sa);
+			return id && id->matches(id, trace->id);
+		case TRACE_ADDRESS:
+			return trace->ts->includes(trace->ts,
+									   ike_sa->get_other_host(ike_sa));
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Get the traced level of the threads IKE_SA for a group, log_lock is held
+ */
+static level_t get_trace_level(private_bus_t *this, ike_sa_t *ike_sa,
+							   debug_t group)
+{
+	enumerator_t *enumerator;
+	trace_cache_t *cache;
+	trace_t *trace;
+	debug_t current;
+
+	if (!ike_sa)
+	{
+		return LEVEL_SILENT;
+	}
+	cache = this->thread_trace->get(this->thread_trace);
+	if (!cache)
+	{
+		INIT(cache);
+		this->thread_trace->set(this->thread_trace, cache);
+	}
+	if (cache->ike_sa != ike_sa || cache->generation != this->generation)
+	{
+		cache->ike_sa = ike_sa;
+		cache->generation = this->generation;
+		for (current = 0; current < DBG_MAX; current++)
+		{
+			cache->levels[current] = LEVEL_SILENT;
+		}
+		enumerator = this->traces->create_enumerator(this->traces);
+		while (enumerator->enumerate(enumerator, &trace))
+		{
+			if (trace_matches(trace, ike_sa))
+			{
+				for (current = 0; current < DBG_MAX; current++)
+				{
+					cache->levels[current] = max(cache->levels[current],
+												 trace->levels[current]);
+				}
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	return cache->levels[group];
+}
+
+METHOD(bus_t, set_trace, bool,
+	private_bus_t *this, trace_selector_t type, char *value, debug_t group,
+	level_t level)
+{
+	enumerator_t *enumerator;
+	trace_t *trace = NULL, *current;
+	debug_t i;
+	bool active = FALSE;
+
+	this->log_lock->write_lock(this->log_lock);
+	enumerator = this->traces->create_enumerator(this->traces);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->type == type && streq(current->value, value))
+		{
+			trace = current;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (!trace)
+	{
+		if (level <= LEVEL_SILENT)
+		{
+			this->log_lock->unlock(this->log_lock);
+			return TRUE;
+		}
+		trace = trace_create(type, value);
+		if (!trace)
+		{
+			this->log_lock->unlock(this->log_lock);
+			return FALSE;
+		}
+		this->traces->insert_last(this->traces, trace);
+	}
+	for (i = 0; i < DBG_MAX; i++)
+	{
+		if (group == DBG_ANY || group == i)
+		{
+			trace->levels[i] = max(level, LEVEL_SILENT);
+		}
+		active = active || trace->levels[i] > LEVEL_SILENT;
+	}
+	if (!active)
+	{
+		this->traces->remove(this->traces, trace, NULL);
+		trace_destroy(trace);
+	}
+	for (i = 0; i < DBG_MAX; i++)
+	{
+		this->traced[i] = LEVEL_SILENT;
+	}
+	enumerator = this->traces->create_enumerator(this->traces);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		for (i = 0; i < DBG_MAX; i++)
+		{
+			this->traced[i] = max(this->traced[i], current->levels[i]);
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->tracing = this->traces->get_count(this->traces);
+	this->generation++;
+	this->log_lock->unlock(this->log_lock);
+	return TRUE;
+}
+
+/**
+ * Filter traced selectors
+ */
+static bool trace_filter(void *null, trace_t **in, trace_selector_t *type,
+						 void *in2, char **value, void *in3, level_t **levels)
+{
+	*type = (*in)->type;
+	*value = (*in)->value;
+	*levels = (*in)->levels;
+	return TRUE;
+}
+
+METHOD(bus_t, create_trace_enumerator, enumerator_t*,
+	private_bus_t *this)
+{
+	this->log_lock->read_lock(this->log_lock);
+	return enumerator_create_filter(
+						this->traces->create_enumerator(this->traces),
+						(void*)trace_filter, this->log_lock,
+						(void*)this->log_lock->unlock);
+}
+
 METHOD(bus_t, set_sa, void,
 	private_bus_t *this, ike_sa_t *ike_sa)
 {
+	trace_cache_t *cache;
+
 	this->thread_sa->set(this->thread_sa, ike_sa);
+	if (this->tracing)
+	{	/* match selectors again, properties of the IKE_SA might change */
+		cache = this->thread_trace->get(this->thread_trace);
+		if (cache)
+		{
+			cache->ike_sa = NULL;
+		}
+	}
 }
 
 METHOD(bus_t, get_sa, ike_sa_t*,
@@ -260,6 +1043,8 @@ METHOD(bus_t, get_sa, ike_sa_t*,
  * data associated to a signal, passed to callback
  */
 typedef struct {
+	/** bus the message is logged on */
+	private_bus_t *bus;
 	/** associated IKE_SA */
 	ike_sa_t *ike_sa;
 	/** invoking thread */
@@ -268,6 +1053,10 @@ typedef struct {
 	debug_t group;
 	/** debug level */
 	level_t level;
+	/** traced level of the IKE_SA, if already looked up */
+	level_t traced;
+	/** has traced been looked up */
+	bool resolved;
 	/** message */
 	char *message;
 } log_data_t;
@@ -278,8 +1067,17 @@ typedef struct {
 static void log_cb(log_entry_t *entry, log_data_t *data)
 {
 	if (entry->levels[data->group] < data->level)
-	{
-		return;
+	{	/* matching traced selectors only for loggers that filter it */
+		if (!data->resolved)
+		{
+			data->traced = get_trace_level(data->bus, data->ike_sa,
+										   data->group);
+			data->resolved = TRUE;
+		}
+		if (data->traced < data->level)
+		{
+			return;
+		}
 	}
 	entry->logger->log(entry->logger, data->group, data->level,
 					   data->thread, data->ike_sa, data->message);
@@ -290,7 +1088,7 @@ METHOD(bus_t, vlog, void,
 	char* format, va_list args)
 {
 	this->log_lock->read_lock(this->log_lock);
-	if (this->max_level[group] >= level)
+	if (this->max_level[group] >= level || this->traced[group] >= level)
 	{
 		linked_list_t *loggers = this->loggers[group];
 		log_data_t data;
@@ -298,7 +1096,10 @@ METHOD(bus_t, vlog, void,
 		char buf[1024];
 		ssize_t len;
 
+		data.bus = this;
 		data.ike_sa = this->thread_sa->get(this->thread_sa);
+		data.traced = LEVEL_SILENT;
+		data.resolved = this->traced[group] < level;
 		data.thread = thread_current_id();
 		data.group = group;
 		data.level = level;
@@ -336,136 +1137,112 @@ METHOD(bus_t, log_, void,
 	va_end(args);
 }
 
-/**
- * unregister a listener
- */
-static inline void unregister_listener(private_bus_t *this, entry_t *entry,
-									   enumerator_t *enumerator)
-{
-	this->listeners->remove_at(this->listeners, enumerator);
-	free(entry);
-}
-
 METHOD(bus_t, alert, void,
 	private_bus_t *this, alert_t alert, ...)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	va_list args;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_ALERT]; i++)
 	{
-		if (entry->calling || !entry->listener->alert)
+		entry = listeners->events[EVENT_ALERT][i];
+		if (!entry->listener->alert || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		va_start(args, alert);
 		keep = entry->listener->alert(entry->listener, ike_sa, alert, args);
 		va_end(args);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_state_change, void,
 	private_bus_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_IKE_STATE_CHANGE]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_state_change)
+		entry = listeners->events[EVENT_IKE_STATE_CHANGE][i];
+		if (!entry->listener->ike_state_change ||
+			!call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_state_change(entry->listener, ike_sa, state);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_state_change, void,
 	private_bus_t *this, child_sa_t *child_sa, child_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_CHILD_STATE_CHANGE]; i++)
 	{
-		if (entry->calling || !entry->listener->child_state_change)
+		entry = listeners->events[EVENT_CHILD_STATE_CHANGE][i];
+		if (!entry->listener->child_state_change ||
+			!call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_state_change(entry->listener, ike_sa,
 												   child_sa, state);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, message, void,
 	private_bus_t *this, message_t *message, bool incoming, bool plain)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_MESSAGE]; i++)
 	{
-		if (entry->calling || !entry->listener->message)
+		entry = listeners->events[EVENT_MESSAGE][i];
+		if (!entry->listener->message || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->message(entry->listener, ike_sa,
 										message, incoming, plain);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_keys, void,
@@ -473,150 +1250,131 @@ METHOD(bus_t, ike_keys, void,
 	chunk_t dh_other, chunk_t nonce_i, chunk_t nonce_r,
 	ike_sa_t *rekey, shared_key_t *shared)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_IKE_KEYS]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_keys)
+		entry = listeners->events[EVENT_IKE_KEYS][i];
+		if (!entry->listener->ike_keys || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_keys(entry->listener, ike_sa, dh, dh_other,
 										 nonce_i, nonce_r, rekey, shared);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_keys, void,
 	private_bus_t *this, child_sa_t *child_sa, bool initiator,
 	diffie_hellman_t *dh, chunk_t nonce_i, chunk_t nonce_r)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_CHILD_KEYS]; i++)
 	{
-		if (entry->calling || !entry->listener->child_keys)
+		entry = listeners->events[EVENT_CHILD_KEYS][i];
+		if (!entry->listener->child_keys || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_keys(entry->listener, ike_sa,
 								child_sa, initiator, dh, nonce_i, nonce_r);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_updown, void,
 	private_bus_t *this, child_sa_t *child_sa, bool up)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_CHILD_UPDOWN]; i++)
 	{
-		if (entry->calling || !entry->listener->child_updown)
+		entry = listeners->events[EVENT_CHILD_UPDOWN][i];
+		if (!entry->listener->child_updown ||
+			!call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_updown(entry->listener,
 											 ike_sa, child_sa, up);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_rekey, void,
 	private_bus_t *this, child_sa_t *old, child_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_CHILD_REKEY]; i++)
 	{
-		if (entry->calling || !entry->listener->child_rekey)
+		entry = listeners->events[EVENT_CHILD_REKEY][i];
+		if (!entry->listener->child_rekey || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_rekey(entry->listener, ike_sa,
 											old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_updown, void,
 	private_bus_t *this, ike_sa_t *ike_sa, bool up)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_IKE_UPDOWN]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_updown)
+		entry = listeners->events[EVENT_IKE_UPDOWN][i];
+		if (!entry->listener->ike_updown || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_updown(entry->listener, ike_sa, up);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 
 	/* a down event for IKE_SA implicitly downs all CHILD_SAs */
 	if (!up)
@@ -636,90 +1394,79 @@ METHOD(bus_t, ike_updown, void,
 METHOD(bus_t, ike_rekey, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_IKE_REKEY]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_rekey)
+		entry = listeners->events[EVENT_IKE_REKEY][i];
+		if (!entry->listener->ike_rekey || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_rekey(entry->listener, old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_reestablish, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_IKE_REESTABLISH]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_reestablish)
+		entry = listeners->events[EVENT_IKE_REESTABLISH][i];
+		if (!entry->listener->ike_reestablish ||
+			!call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_reestablish(entry->listener, old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, authorize, bool,
 	private_bus_t *this, bool final)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep, success = TRUE;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_AUTHORIZE]; i++)
 	{
-		if (entry->calling || !entry->listener->authorize)
+		entry = listeners->events[EVENT_AUTHORIZE][i];
+		if (!entry->listener->authorize || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->authorize(entry->listener, ike_sa,
 										  final, &success);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 		if (!success)
 		{
 			break;
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 	return success;
 }
 
@@ -727,32 +1474,28 @@ METHOD(bus_t, narrow, void,
 	private_bus_t *this, child_sa_t *child_sa, narrow_hook_t type,
 	linked_list_t *local, linked_list_t *remote)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
+	calling_t calling;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	u_int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = listeners_get(this);
+	for (i = 0; i < listeners->counts[EVENT_NARROW]; i++)
 	{
-		if (entry->calling || !entry->listener->narrow)
+		entry = listeners->events[EVENT_NARROW][i];
+		if (!entry->listener->narrow || !call_begin(this, entry, &calling))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->narrow(entry->listener, ike_sa, child_sa,
 									   type, local, remote);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		call_end(this, entry, &calling, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, destroy, void,
@@ -765,8 +1508,14 @@ METHOD(bus_t, destroy, void,
 	}
 	this->loggers[DBG_MAX]->destroy_function(this->loggers[DBG_MAX],
 											 (void*)free);
-	this->listeners->destroy_function(this->listeners, (void*)free);
+	listeners_put(this->listeners);
+	this->listeners_lock->destroy(this->listeners_lock);
 	this->thread_sa->destroy(this->thread_sa);
+	this->thread_trace->destroy(this->thread_trace);
+	this->traces->destroy_function(this->traces, (void*)trace_destroy);
+	this->calling->destroy(this->calling);
+	this->waiting->destroy(this->waiting);
+	this->waiting_lock->destroy(this->waiting_lock);
 	this->log_lock->destroy(this->log_lock);
 	this->mutex->destroy(this->mutex);
 	free(this);
@@ -788,6 +1537,8 @@ bus_t *bus_create()
 			.remove_logger = _remove_logger,
 			.set_sa = _set_sa,
 			.get_sa = _get_sa,
+			.set_trace = _set_trace,
+			.create_trace_enumerator = _create_trace_enumerator,
 			.log = _log_,
 			.vlog = _vlog,
 			.alert = _alert,
@@ -805,10 +1556,16 @@ bus_t *bus_create()
 			.narrow = _narrow,
 			.destroy = _destroy,
 		},
-		.listeners = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.listeners = listeners_create(NULL, 0),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.listeners_lock = spinlock_create(),
 		.log_lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.thread_sa = thread_value_create(NULL),
+		.traces = linked_list_create(),
+		.thread_trace = thread_value_create(free),
+		.calling = thread_value_create(NULL),
+		.waiting = linked_list_create(),
+		.waiting_lock = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	for (group = 0; group <= DBG_MAX; group++)
@@ -816,6 +1573,10 @@ bus_t *bus_create()
 		this->loggers[group] = linked_list_create();
 		this->max_level[group] = LEVEL_SILENT;
 	}
+	for (group = 0; group < DBG_MAX; group++)
+	{
+		this->traced[group] = LEVEL_SILENT;
+	}
 
 	return &this->public;
 }
@@ -24,6 +24,7 @@
 
 typedef enum alert_t alert_t;
 typedef enum narrow_hook_t narrow_hook_t;
+typedef enum trace_selector_t trace_selector_t;
 typedef struct bus_t bus_t;
 
 #include <stdarg.h>
@@ -134,6 +135,25 @@ enum narrow_hook_t {
 	NARROW_INITIATOR_POST_AUTH,
 };
 
+/**
+ * Selector types to trace specific IKE_SAs with raised log levels.
+ */
+enum trace_selector_t {
+	/** IKE_SA with a unique identifier */
+	TRACE_IKE_SA,
+	/** IKE_SAs using a peer config with a name */
+	TRACE_PEER_CFG,
+	/** IKE_SAs with a remote identity, may contain wildcards */
+	TRACE_IDENTITY,
+	/** IKE_SAs with a remote address in a subnet, addr[/prefix] */
+	TRACE_ADDRESS,
+};
+
+/**
+ * enum names for trace_selector_t.
+ */
+extern enum_name_t *trace_selector_names;
+
 /**
  * The bus receives events and sends them to all registered listeners.
  *
@@ -148,6 +168,11 @@ struct bus_t {
 	 * The listener is passive; the thread which emitted the event
 	 * processes the listener routine.
 	 *
+	 * Events are dispatched without a global lock, different listeners may
+	 * get called by multiple threads concurrently, and so may a single
+	 * listener, which has to lock its own state. Only callbacks implemented
+	 * when registering the listener receive events.
+	 *
 	 * @param listener	listener to register.
 	 */
 	void (*add_listener) (bus_t *this, listener_t *listener);
@@ -155,9 +180,16 @@ struct bus_t {
 	/**
 	 * Unregister a listener from the bus.
 	 *
+	 * Waits until other threads currently calling the listener return, but
+	 * not for calls of the current thread. If that would deadlock, because
+	 * a thread calling the listener waits for one the current thread is
+	 * calling, the listener is not removed and must not be destroyed. This
+	 * may only happen if called from within a listener callback.
+	 *
 	 * @param listener	listener to unregister.
+	 * @return			FALSE if the listener is still registered or called
 	 */
-	void (*remove_listener) (bus_t *this, listener_t *listener);
+	bool (*remove_listener) (bus_t *this, listener_t *listener);
 
 	/**
 	 * Register a logger with the bus.
@@ -209,6 +241,34 @@ struct bus_t {
 	 */
 	ike_sa_t* (*get_sa)(bus_t *this);
 
+	/**
+	 * Raise the log levels for IKE_SAs matching a selector.
+	 *
+	 * Messages logged while a matching IKE_SA is set via set_sa() are passed
+	 * to all loggers registered for the log group, if the traced level is
+	 * equal or higher than the level of the message. Selectors get matched
+	 * once after set_sa() on the first message not logged due to the global
+	 * levels, so an IKE_SA not matching yet (e.g. its peer config or remote
+	 * identity is not known) is traced after its next check-out.
+	 *
+	 * @param type		type of selector
+	 * @param value		unique IKE_SA identifier, peer config name, remote
+	 *					identity or remote address/subnet
+	 * @param group		debug group to raise level for, DBG_ANY for all
+	 * @param level		level to log, LEVEL_SILENT to stop tracing
+	 * @return			FALSE if value is invalid for the selector type
+	 */
+	bool (*set_trace)(bus_t *this, trace_selector_t type, char *value,
+					  debug_t group, level_t level);
+
+	/**
+	 * Create an enumerator over the traced selectors.
+	 *
+	 * @return			enumerator over (trace_selector_t, char*, level_t*),
+	 *					levels is an array of DBG_MAX levels
+	 */
+	enumerator_t* (*create_trace_enumerator)(bus_t *this);
+
 	/**
 	 * Send a log message to the bus.
 	 *
@@ -19,14 +19,32 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/time.h>
 
 #include "file_logger.h"
+#include "log_queue.h"
 
 #include <daemon.h>
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
 
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/**
+ * Maximum length of a line prefix written asynchronously
+ */
+#define PREFIX_LEN 288
+
+/**
+ * Number of records formatted before writing them asynchronously
+ */
+#define BATCH_RECORDS 128
+
 typedef struct private_file_logger_t private_file_logger_t;
 
 /**
@@ -73,6 +91,36 @@ struct private_file_logger_t {
 	 * Lock to read/write options (FD, levels, time_format, etc.)
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * Queue writing messages asynchronously, if any
+	 */
+	log_queue_t *queue;
+
+	/**
+	 * Prefixes of the records in the current batch, used by the writer
+	 */
+	char (*prefixes)[PREFIX_LEN];
+
+	/**
+	 * I/O vectors of the current batch, used by the writer
+	 */
+	struct iovec *iov;
+
+	/**
+	 * Number of used I/O vectors in the current batch
+	 */
+	int iovcnt;
+
+	/**
+	 * Time of the cached time prefix of the writer
+	 */
+	time_t last;
+
+	/**
+	 * Cached time prefix of the writer
+	 */
+	char timestr[128];
 };
 
 METHOD(logger_t, log_, void,
@@ -90,7 +138,7 @@ METHOD(logger_t, log_, void,
 		this->lock->unlock(this->lock);
 		return;
 	}
-	if (this->time_format)
+	if (this->time_format && !this->queue)
 	{
 		t = time(NULL);
 		localtime_r(&t, &tm);
@@ -113,6 +161,13 @@ METHOD(logger_t, log_, void,
 	{
 		namestr[0] = '\0';
 	}
+	if (this->queue)
+	{	/* prefix formatting and I/O is done by the writer thread */
+		this->queue->enqueue(this->queue, group, level, thread, namestr,
+							 message);
+		this->lock->unlock(this->lock);
+		return;
+	}
 
 	/* prepend a prefix in front of every line */
 	this->mutex->lock(this->mutex);
@@ -141,6 +196,164 @@ METHOD(logger_t, log_, void,
 	this->lock->unlock(this->lock);
 }
 
+/**
+ * Write the I/O vectors of the current batch
+ */
+static void write_batch(private_file_logger_t *this)
+{
+	struct iovec *iov = this->iov;
+	int iovcnt = this->iovcnt, fd;
+	ssize_t len;
+
+	fd = fileno(this->out);
+	while (iovcnt)
+	{
+		len = writev(fd, iov, min(iovcnt, IOV_MAX));
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		while (iovcnt && len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt)
+		{	/* partially written */
+			iov->iov_base = (char*)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+	this->iovcnt = 0;
+}
+
+/**
+ * Add a line to the current batch
+ */
+static void add_line(private_file_logger_t *this, char *prefix, int plen,
+					 const char *line, int len)
+{
+	this->iov[this->iovcnt++] = (struct iovec){
+		.iov_base = prefix,
+		.iov_len = plen,
+	};
+	this->iov[this->iovcnt++] = (struct iovec){
+		.iov_base = (char*)line,
+		.iov_len = len,
+	};
+	this->iov[this->iovcnt++] = (struct iovec){
+		.iov_base = "\n",
+		.iov_len = 1,
+	};
+	if (this->iovcnt > IOV_MAX - 3)
+	{
+		write_batch(this);
+	}
+}
+
+/**
+ * Format the prefix of a record, returns its length
+ */
+static int format_prefix(private_file_logger_t *this, char *buf,
+						 log_record_t *record)
+{
+	struct tm tm;
+	int len;
+
+	if (this->time_format)
+	{
+		if (record->time.tv_sec != this->last)
+		{
+			this->last = record->time.tv_sec;
+			localtime_r(&this->last, &tm);
+			strftime(this->timestr, sizeof(this->timestr),
+					 this->time_format, &tm);
+		}
+		len = snprintf(buf, PREFIX_LEN, "%s %.2d[%s]%s ", this->timestr,
+					   record->thread, enum_to_name(debug_names, record->group),
+					   record->name);
+	}
+	else
+	{
+		len = snprintf(buf, PREFIX_LEN, "%.2d[%s]%s ", record->thread,
+					   enum_to_name(debug_names, record->group), record->name);
+	}
+	return min(len, PREFIX_LEN - 1);
+}
+
+/**
+ * Write a batch of queued records, invoked by the log_queue_t writer thread
+ */
+static void write_records(private_file_logger_t *this, log_record_t *records,
+						  int count, u_int dropped)
+{
+	char drop[PREFIX_LEN];
+	const char *current, *next;
+	log_record_t record = {
+		.group = DBG_DMN,
+		.name = "",
+	};
+	int i, prefixes = 0, plen;
+
+	this->lock->read_lock(this->lock);
+	if (!this->out)
+	{
+		this->lock->unlock(this->lock);
+		return;
+	}
+	/* don't interleave with messages written synchronously before */
+	this->mutex->lock(this->mutex);
+	fflush(this->out);
+	this->iovcnt = 0;
+	if (dropped)
+	{
+		gettimeofday(&record.time, NULL);
+		plen = format_prefix(this, drop, &record);
+		snprintf(drop + plen, sizeof(drop) - plen, "dropped %u log messages",
+				 dropped);
+		add_line(this, drop, strlen(drop), "", 0);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (prefixes == BATCH_RECORDS)
+		{	/* prefix buffers get reused, write pending lines */
+			write_batch(this);
+			prefixes = 0;
+		}
+		plen = format_prefix(this, this->prefixes[prefixes], &records[i]);
+		current = records[i].message;
+		while (TRUE)
+		{
+			next = strchr(current, '\n');
+			if (next == NULL)
+			{
+				add_line(this, this->prefixes[prefixes], plen,
+						 current, strlen(current));
+				break;
+			}
+			add_line(this, this->prefixes[prefixes], plen,
+					 current, next - current);
+			current = next + 1;
+		}
+		if (this->iovcnt == 0)
+		{	/* batch has been written, prefix buffers are free */
+			prefixes = 0;
+		}
+		else
+		{
+			prefixes++;
+		}
+	}
+	write_batch(this);
+	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
+}
+
 METHOD(logger_t, get_level, level_t,
 	private_file_logger_t *this, debug_t group)
 {
@@ -180,6 +393,28 @@ METHOD(file_logger_t, set_options, void,
 	this->lock->unlock(this->lock);
 }
 
+METHOD(file_logger_t, set_async, void,
+	private_file_logger_t *this, size_t size)
+{
+	log_queue_t *queue = NULL, *old;
+
+	if (size)
+	{
+		if (!this->prefixes)
+		{
+			this->prefixes = malloc(BATCH_RECORDS * PREFIX_LEN);
+			this->iov = malloc(sizeof(struct iovec) * IOV_MAX);
+		}
+		queue = log_queue_create(size, (void*)write_records, this);
+	}
+	this->lock->write_lock(this->lock);
+	old = this->queue;
+	this->queue = queue;
+	this->lock->unlock(this->lock);
+	/* writes messages still queued */
+	DESTROY_IF(old);
+}
+
 /**
  * Close the current file, if any
  */
@@ -228,6 +463,8 @@ METHOD(file_logger_t, open_, void,
 METHOD(file_logger_t, destroy, void,
 	private_file_logger_t *this)
 {
+	/* detach the queue first, log() might still enqueue */
+	set_async(this, 0);
 	this->lock->write_lock(this->lock);
 	close_file(this);
 	this->lock->unlock(this->lock);
@@ -235,6 +472,8 @@ METHOD(file_logger_t, destroy, void,
 	this->lock->destroy(this->lock);
 	free(this->time_format);
 	free(this->filename);
+	free(this->prefixes);
+	free(this->iov);
 	free(this);
 }
 
@@ -253,6 +492,7 @@ file_logger_t *file_logger_create(char *filename)
 			},
 			.set_level = _set_level,
 			.set_options = _set_options,
+			.set_async = _set_async,
 			.open = _open_,
 			.destroy = _destroy,
 		},
@@ -52,6 +52,18 @@ struct file_logger_t {
 	 */
 	void (*set_options) (file_logger_t *this, char *time_format, bool ike_name);
 
+	/**
+	 * Write log messages asynchronously from a dedicated thread.
+	 *
+	 * Messages are copied to a buffer of the logging thread, line prefixes
+	 * get formatted and written to the file with writev() in batches.
+	 * Messages are dropped if a buffer is full, which gets logged.
+	 *
+	 * @param size			size of the buffer of each thread, 0 to log
+	 *						synchronously
+	 */
+	void (*set_async) (file_logger_t *this, size_t size);
+
 	/**
 	 * Open (or reopen) the log file according to the given parameters
 	 *
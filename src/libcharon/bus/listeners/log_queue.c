@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "log_queue.h"
+
+#include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <collections/linked_list.h>
+
+/**
+ * Interval in ms the writer thread drains buffers at most
+ */
+#define DRAIN_INTERVAL 100
+
+typedef struct private_log_queue_t private_log_queue_t;
+
+/**
+ * Private data of a log_queue_t object.
+ */
+struct private_log_queue_t {
+
+	/**
+	 * Public log_queue_t interface.
+	 */
+	log_queue_t public;
+
+	/**
+	 * Size of each buffer
+	 */
+	size_t size;
+
+	/**
+	 * Writer callback
+	 */
+	log_queue_writer_t writer;
+
+	/**
+	 * User data to pass to writer
+	 */
+	void *data;
+
+	/**
+	 * Buffer of the calling thread, as ring_t
+	 */
+	thread_value_t *ring;
+
+	/**
+	 * All buffers, as ring_t
+	 */
+	linked_list_t *rings;
+
+	/**
+	 * Mutex protecting rings, pending and stopping
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Condvar to wake up the writer thread
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Writer thread
+	 */
+	thread_t *thread;
+
+	/**
+	 * TRUE if a buffer is half full
+	 */
+	bool pending;
+
+	/**
+	 * TRUE if the queue is getting destroyed
+	 */
+	bool stopping;
+
+	/**
+	 * Records passed to writer, used by the writer thread only
+	 */
+	log_record_t *records;
+
+	/**
+	 * Number of allocated records
+	 */
+	int max;
+};
+
+/**
+ * Buffers of a logging thread
+ */
+typedef struct {
+
+	/**
+	 * Mutex protecting buffers, only contended while swapping them
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Buffer the thread currently writes to
+	 */
+	char *buf;
+
+	/**
+	 * Buffer drained by the writer thread
+	 */
+	char *spare;
+
+	/**
+	 * Bytes used in buf
+	 */
+	size_t used;
+
+	/**
+	 * Bytes of spare to drain
+	 */
+	size_t drain;
+
+	/**
+	 * Number of messages dropped since buffers have been swapped
+	 */
+	u_int dropped;
+
+	/**
+	 * TRUE if writer thread has been woken up for this buffer
+	 */
+	bool signaled;
+
+	/**
+	 * TRUE if the logging thread terminated
+	 */
+	bool orphaned;
+
+} ring_t;
+
+/**
+ * Header of a record in a buffer, followed by name and message
+ */
+typedef struct {
+	/** length of the record, including header and padding */
+	size_t len;
+	/** time message has been logged */
+	timeval_t time;
+	/** thread number */
+	int thread;
+	/** debug group */
+	debug_t group;
+	/** debug level */
+	level_t level;
+	/** length of name, including the terminating null */
+	size_t namelen;
+} header_t;
+
+/**
+ * Destroy a ring
+ */
+static void ring_destroy(ring_t *ring)
+{
+	ring->mutex->destroy(ring->mutex);
+	free(ring->buf);
+	free(ring->spare);
+	free(ring);
+}
+
+/**
+ * Mark the ring of a terminating thread, released by the writer thread
+ */
+static void ring_orphan(ring_t *ring)
+{
+	ring->mutex->lock(ring->mutex);
+	ring->orphaned = TRUE;
+	ring->mutex->unlock(ring->mutex);
+}
+
+/**
+ * Get the ring of the calling thread, create one if necessary
+ */
+static ring_t *get_ring(private_log_queue_t *this)
+{
+	ring_t *ring;
+
+	ring = this->ring->get(this->ring);
+	if (!ring)
+	{
+		INIT(ring,
+			.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+			.buf = malloc(this->size),
+			.spare = malloc(this->size),
+		);
+		this->ring->set(this->ring, ring);
+		this->mutex->lock(this->mutex);
+		this->rings->insert_last(this->rings, ring);
+		this->mutex->unlock(this->mutex);
+	}
+	return ring;
+}
+
+METHOD(log_queue_t, enqueue, void,
+	private_log_queue_t *this, debug_t group, level_t level, int thread,
+	char *name, const char *message)
+{
+	ring_t *ring;
+	header_t *header;
+	size_t namelen, msglen, len, avail;
+	bool wakeup = FALSE;
+
+	/* space for name and message in a record filling a whole buffer */
+	avail = this->size / sizeof(header_t) * sizeof(header_t) -
+			sizeof(header_t) - 2;
+	namelen = strlen(name);
+	msglen = strlen(message);
+	if (namelen > avail / 2)
+	{
+		namelen = 0;
+	}
+	if (namelen + msglen > avail)
+	{	/* truncate messages that never fit into a buffer */
+		msglen = avail - namelen;
+	}
+	len = sizeof(header_t) + namelen + 1 + msglen + 1;
+	/* keep subsequent headers aligned */
+	len = (len + sizeof(header_t) - 1) / sizeof(header_t) * sizeof(header_t);
+
+	ring = get_ring(this);
+	ring->mutex->lock(ring->mutex);
+	if (ring->used + len > this->size)
+	{
+		ring->dropped++;
+	}
+	else
+	{
+		header = (header_t*)(ring->buf + ring->used);
+		*header = (header_t){
+			.len = len,
+			.thread = thread,
+			.group = group,
+			.level = level,
+			.namelen = namelen + 1,
+		};
+		gettimeofday(&header->time, NULL);
+		memcpy(header + 1, name, namelen);
+		((char*)(header + 1))[namelen] = '\0';
+		memcpy((char*)(header + 1) + namelen + 1, message, msglen);
+		((char*)(header + 1))[namelen + 1 + msglen] = '\0';
+		ring->used += len;
+		if (ring->used > this->size / 2 && !ring->signaled)
+		{
+			ring->signaled = wakeup = TRUE;
+		}
+	}
+	ring->mutex->unlock(ring->mutex);
+
+	if (wakeup)
+	{
+		this->mutex->lock(this->mutex);
+		this->pending = TRUE;
+		this->condvar->signal(this->condvar);
+		this->mutex->unlock(this->mutex);
+	}
+}
+
+/**
+ * Compare records by time, keeping the order of records of the same buffer
+ */
+static int record_cmp(const void *a, const void *b)
+{
+	const log_record_t *ra = a, *rb = b;
+
+	if (timercmp(&ra->time, &rb->time, <))
+	{
+		return -1;
+	}
+	if (timercmp(&ra->time, &rb->time, >))
+	{
+		return 1;
+	}
+	if (ra->message == rb->message)
+	{
+		return 0;
+	}
+	return ra->message < rb->message ? -1 : 1;
+}
+
+/**
+ * Add the records of a swapped buffer to the record array
+ */
+static int parse_records(private_log_queue_t *this, ring_t *ring, int count)
+{
+	header_t *header;
+	size_t pos;
+
+	for (pos = 0; pos < ring->drain; pos += header->len)
+	{
+		header = (header_t*)(ring->spare + pos);
+		if (count == this->max)
+		{
+			this->max = max(this->max * 2, 64);
+			this->records = realloc(this->records,
+									sizeof(log_record_t) * this->max);
+		}
+		this->records[count++] = (log_record_t){
+			.time = header->time,
+			.thread = header->thread,
+			.group = header->group,
+			.level = header->level,
+			.name = (char*)(header + 1),
+			.message = (char*)(header + 1) + header->namelen,
+		};
+	}
+	return count;
+}
+
+/**
+ * Swap all buffers and pass their records to the writer
+ */
+static void drain(private_log_queue_t *this)
+{
+	enumerator_t *enumerator;
+	linked_list_t *orphans;
+	ring_t *ring;
+	u_int dropped = 0;
+	int count = 0;
+
+	orphans = linked_list_create();
+	this->mutex->lock(this->mutex);
+	enumerator = this->rings->create_enumerator(this->rings);
+	while (enumerator->enumerate(enumerator, &ring))
+	{
+		ring->mutex->lock(ring->mutex);
+		ring->drain = ring->used;
+		if (ring->drain)
+		{
+			char *buf = ring->buf;
+
+			ring->buf = ring->spare;
+			ring->spare = buf;
+			ring->used = 0;
+		}
+		dropped += ring->dropped;
+		ring->dropped = 0;
+		ring->signaled = FALSE;
+		if (ring->orphaned)
+		{	/* thread won't log anymore, release after writing */
+			this->rings->remove_at(this->rings, enumerator);
+			orphans->insert_last(orphans, ring);
+		}
+		ring->mutex->unlock(ring->mutex);
+		count = parse_records(this, ring, count);
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+
+	if (count || dropped)
+	{
+		qsort(this->records, count, sizeof(log_record_t), record_cmp);
+		this->writer(this->data, this->records, count, dropped);
+	}
+	orphans->destroy_function(orphans, (void*)ring_destroy);
+}
+
+/**
+ * Writer thread, drains the buffers periodically or if one is half full
+ */
+static void *write_records(private_log_queue_t *this)
+{
+	bool stopping = FALSE;
+
+	while (!stopping)
+	{
+		this->mutex->lock(this->mutex);
+		if (!this->pending && !this->stopping)
+		{
+			this->condvar->timed_wait(this->condvar, this->mutex,
+									  DRAIN_INTERVAL);
+		}
+		this->pending = FALSE;
+		stopping = this->stopping;
+		this->mutex->unlock(this->mutex);
+
+		drain(this);
+	}
+	return NULL;
+}
+
+METHOD(log_queue_t, destroy, void,
+	private_log_queue_t *this)
+{
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	this->condvar->signal(this->condvar);
+	this->mutex->unlock(this->mutex);
+	if (this->thread)
+	{
+		this->thread->join(this->thread);
+	}
+	else
+	{
+		drain(this);
+	}
+	this->ring->destroy(this->ring);
+	this->rings->destroy_function(this->rings, (void*)ring_destroy);
+	this->condvar->destroy(this->condvar);
+	this->mutex->destroy(this->mutex);
+	free(this->records);
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+log_queue_t *log_queue_create(size_t size, log_queue_writer_t writer,
+							  void *data)
+{
+	private_log_queue_t *this;
+
+	INIT(this,
+		.public = {
+			.enqueue = _enqueue,
+			.destroy = _destroy,
+		},
+		.size = max(size, 1024),
+		.writer = writer,
+		.data = data,
+		.ring = thread_value_create((thread_cleanup_t)ring_orphan),
+		.rings = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+	);
+
+	this->thread = thread_create((thread_main_t)write_records, this);
+
+	return &this->public;
+}
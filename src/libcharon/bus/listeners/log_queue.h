@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup log_queue log_queue
+ * @{ @ingroup listeners
+ */
+
+#ifndef LOG_QUEUE_H_
+#define LOG_QUEUE_H_
+
+#include <bus/bus.h>
+
+typedef struct log_queue_t log_queue_t;
+typedef struct log_record_t log_record_t;
+
+/**
+ * A log message queued for asynchronous writing.
+ */
+struct log_record_t {
+
+	/** time the message has been logged */
+	timeval_t time;
+
+	/** thread number of the logging thread */
+	int thread;
+
+	/** debug group */
+	debug_t group;
+
+	/** debug level */
+	level_t level;
+
+	/** name of the associated IKE_SA, "" if none */
+	char *name;
+
+	/** formatted log message */
+	char *message;
+};
+
+/**
+ * Callback function writing a batch of log records.
+ *
+ * @param data			user data, as passed to log_queue_create()
+ * @param records		array of log records, ordered by time
+ * @param count			number of records in array
+ * @param dropped		number of messages dropped since last invocation
+ */
+typedef void (*log_queue_writer_t)(void *data, log_record_t *records,
+								   int count, u_int dropped);
+
+/**
+ * Queue for asynchronous logging.
+ *
+ * Logging threads copy formatted messages to a buffer of their own, which
+ * are swapped and drained in batches by a dedicated writer thread. The
+ * writer thread gets woken up if a buffer is half full, or every 100ms.
+ * Messages are dropped if a thread fills its buffer before the writer
+ * drains it, messages larger than a buffer get truncated.
+ */
+struct log_queue_t {
+
+	/**
+	 * Queue a log message.
+	 *
+	 * @param group		debug group
+	 * @param level		debug level
+	 * @param thread	thread number
+	 * @param name		name of the associated IKE_SA, "" if none
+	 * @param message	formatted log message
+	 */
+	void (*enqueue)(log_queue_t *this, debug_t group, level_t level,
+					int thread, char *name, const char *message);
+
+	/**
+	 * Destroy a log_queue_t, writes all queued messages.
+	 */
+	void (*destroy)(log_queue_t *this);
+};
+
+/**
+ * Create a log_queue instance.
+ *
+ * @param size			size of the buffer of each thread, in bytes
+ * @param writer		callback function invoked from the writer thread
+ * @param data			data to pass to writer
+ * @return				log_queue_t instance
+ */
+log_queue_t *log_queue_create(size_t size, log_queue_writer_t writer,
+							  void *data);
+
+#endif /** LOG_QUEUE_H_ @}*/
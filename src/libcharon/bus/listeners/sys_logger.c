@@ -19,6 +19,7 @@
 #include <syslog.h>
 
 #include "sys_logger.h"
+#include "log_queue.h"
 
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
@@ -59,14 +60,41 @@ struct private_sys_logger_t {
 	 * Lock to read/write options (levels, ike_name)
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * Queue passing messages to syslog asynchronously, if any
+	 */
+	log_queue_t *queue;
 };
 
+/**
+ * Do a syslog for every line of a message
+ */
+static void log_lines(private_sys_logger_t *this, int thread, char *groupstr,
+					  char *namestr, const char *message)
+{
+	const char *current = message, *next;
+
+	while (TRUE)
+	{
+		next = strchr(current, '\n');
+		if (next == NULL)
+		{
+			syslog(this->facility | LOG_INFO, "%.2d[%s]%s %s\n",
+				   thread, groupstr, namestr, current);
+			break;
+		}
+		syslog(this->facility | LOG_INFO, "%.2d[%s]%s %.*s\n",
+			   thread, groupstr, namestr, (int)(next - current), current);
+		current = next + 1;
+	}
+}
+
 METHOD(logger_t, log_, void,
 	private_sys_logger_t *this, debug_t group, level_t level, int thread,
 	ike_sa_t* ike_sa, const char *message)
 {
 	char groupstr[4], namestr[128] = "";
-	const char *current = message, *next;
 
 	/* cache group name and optional name string */
 	snprintf(groupstr, sizeof(groupstr), "%N", debug_names, group);
@@ -85,22 +113,40 @@ METHOD(logger_t, log_, void,
 				ike_sa->get_unique_id(ike_sa));
 		}
 	}
+	if (this->queue)
+	{	/* syslog() is called by the writer thread */
+		this->queue->enqueue(this->queue, group, level, thread, namestr,
+							 message);
+		this->lock->unlock(this->lock);
+		return;
+	}
 	this->lock->unlock(this->lock);
 
 	/* do a syslog for every line */
 	this->mutex->lock(this->mutex);
-	while (TRUE)
+	log_lines(this, thread, groupstr, namestr, message);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Write a batch of queued records, invoked by the log_queue_t writer thread
+ */
+static void write_records(private_sys_logger_t *this, log_record_t *records,
+						  int count, u_int dropped)
+{
+	int i;
+
+	this->mutex->lock(this->mutex);
+	if (dropped)
 	{
-		next = strchr(current, '\n');
-		if (next == NULL)
-		{
-			syslog(this->facility | LOG_INFO, "%.2d[%s]%s %s\n",
-				   thread, groupstr, namestr, current);
-			break;
-		}
-		syslog(this->facility | LOG_INFO, "%.2d[%s]%s %.*s\n",
-			   thread, groupstr, namestr, (int)(next - current), current);
-		current = next + 1;
+		syslog(this->facility | LOG_INFO, "00[DMN] dropped %u log messages\n",
+			   dropped);
+	}
+	for (i = 0; i < count; i++)
+	{
+		log_lines(this, records[i].thread,
+				  enum_to_name(debug_names, records[i].group),
+				  records[i].name, records[i].message);
 	}
 	this->mutex->unlock(this->mutex);
 }
@@ -142,9 +188,28 @@ METHOD(sys_logger_t, set_options, void,
 	this->lock->unlock(this->lock);
 }
 
+METHOD(sys_logger_t, set_async, void,
+	private_sys_logger_t *this, size_t size)
+{
+	log_queue_t *queue = NULL, *old;
+
+	if (size)
+	{
+		queue = log_queue_create(size, (void*)write_records, this);
+	}
+	this->lock->write_lock(this->lock);
+	old = this->queue;
+	this->queue = queue;
+	this->lock->unlock(this->lock);
+	/* passes messages still queued to syslog */
+	DESTROY_IF(old);
+}
+
 METHOD(sys_logger_t, destroy, void,
 	private_sys_logger_t *this)
 {
+	/* detach the queue first, log() might still enqueue */
+	set_async(this, 0);
 	this->lock->destroy(this->lock);
 	this->mutex->destroy(this->mutex);
 	free(this);
@@ -165,6 +230,7 @@ sys_logger_t *sys_logger_create(int facility)
 			},
 			.set_level = _set_level,
 			.set_options = _set_options,
+			.set_async = _set_async,
 			.destroy = _destroy,
 		},
 		.facility = facility,
@@ -51,6 +51,17 @@ struct sys_logger_t {
 	 */
 	void (*set_options) (sys_logger_t *this, bool ike_name);
 
+	/**
+	 * Pass log messages to syslog asynchronously from a dedicated thread.
+	 *
+	 * Messages are copied to a buffer of the logging thread, and are dropped
+	 * if it is full, which gets logged.
+	 *
+	 * @param size			size of the buffer of each thread, 0 to log
+	 *						synchronously
+	 */
+	void (*set_async) (sys_logger_t *this, size_t size);
+
 	/**
 	 * Destroys a sys_logger_t object.
 	 */
@@ -0,0 +1,675 @@
+/*
+ * Copyright (C) 2013 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "config_index.h"
+
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+
+typedef struct private_config_index_t private_config_index_t;
+
+/**
+ * Private data of an config_index_t object.
+ */
+struct private_config_index_t {
+
+	/**
+	 * Public config_index_t interface.
+	 */
+	config_index_t public;
+
+	/**
+	 * All entries, peer_cfg_t => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * All entries, ordered by sequence number
+	 */
+	linked_list_t *all;
+
+	/**
+	 * Buckets by remote address, host_t => bucket_t
+	 */
+	hashtable_t *addrs;
+
+	/**
+	 * Entries potentially matching any remote address
+	 */
+	linked_list_t *any_addr;
+
+	/**
+	 * Buckets by remote identity, identification_t => bucket_t
+	 */
+	hashtable_t *ids;
+
+	/**
+	 * Entries potentially matching any remote identity
+	 */
+	linked_list_t *any_id;
+
+	/**
+	 * Buckets by peer and child config names, char* => bucket_t
+	 */
+	hashtable_t *names;
+
+	/**
+	 * Sequence number of the next added entry
+	 */
+	u_int seq;
+};
+
+/**
+ * An indexed peer config
+ */
+typedef struct {
+	/** indexed config */
+	peer_cfg_t *cfg;
+	/** sequence number, preserves the order of added configs */
+	u_int seq;
+	/** remote address the entry is indexed with, NULL for wildcard */
+	host_t *addr;
+	/** remote identity the entry is indexed with, NULL for wildcard */
+	identification_t *id;
+	/** names the entry is indexed with, char* */
+	linked_list_t *names;
+} entry_t;
+
+/**
+ * Entries sharing the same key
+ */
+typedef struct {
+	/** key of the bucket, owned */
+	void *key;
+	/** entries, ordered by sequence number */
+	linked_list_t *entries;
+} bucket_t;
+
+/**
+ * Key type specific functions of a bucket table
+ */
+typedef struct {
+	/** clone a key */
+	void *(*clone)(void *key);
+	/** destroy a cloned key */
+	void (*destroy)(void *key);
+} key_ops_t;
+
+/**
+ * Clone a host_t key
+ */
+static void *addr_clone(host_t *key)
+{
+	return key->clone(key);
+}
+
+/**
+ * Destroy a host_t key
+ */
+static void addr_destroy(host_t *key)
+{
+	key->destroy(key);
+}
+
+/**
+ * Clone an identification_t key
+ */
+static void *id_clone(identification_t *key)
+{
+	return key->clone(key);
+}
+
+/**
+ * Destroy an identification_t key
+ */
+static void id_destroy(identification_t *key)
+{
+	key->destroy(key);
+}
+
+/**
+ * Operations on host_t keys
+ */
+static key_ops_t addr_ops = {
+	.clone = (void*)addr_clone,
+	.destroy = (void*)addr_destroy,
+};
+
+/**
+ * Operations on identification_t keys
+ */
+static key_ops_t id_ops = {
+	.clone = (void*)id_clone,
+	.destroy = (void*)id_destroy,
+};
+
+/**
+ * Operations on name keys
+ */
+static key_ops_t name_ops = {
+	.clone = (void*)strdup,
+	.destroy = free,
+};
+
+/**
+ * Hashtable hash function for peer_cfg_t
+ */
+static u_int cfg_hash(peer_cfg_t *key)
+{
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function for peer_cfg_t
+ */
+static bool cfg_equals(peer_cfg_t *a, peer_cfg_t *b)
+{
+	return a == b;
+}
+
+/**
+ * Hashtable hash function for host_t
+ */
+static u_int addr_hash(host_t *key)
+{
+	return chunk_hash(key->get_address(key));
+}
+
+/**
+ * Hashtable equals function for host_t
+ */
+static bool addr_equals(host_t *a, host_t *b)
+{
+	return a->ip_equals(a, b);
+}
+
+/**
+ * Hashtable hash function for identification_t
+ */
+static u_int id_hash(identification_t *key)
+{
+	return key->hash(key, 0);
+}
+
+/**
+ * Hashtable equals function for identification_t
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Hashtable hash function for names
+ */
+static u_int name_hash(char *key)
+{
+	return chunk_hash(chunk_create(key, strlen(key)));
+}
+
+/**
+ * Hashtable equals function for names
+ */
+static bool name_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Insert an entry into a list ordered by sequence number
+ */
+static void insert_ordered(linked_list_t *list, entry_t *entry)
+{
+	enumerator_t *enumerator;
+	entry_t *current;
+
+	/* entries usually get added in order, so check the tail first */
+	if (list->get_last(list, (void**)&current) != SUCCESS ||
+		current->seq < entry->seq)
+	{
+		list->insert_last(list, entry);
+		return;
+	}
+	enumerator = list->create_enumerator(list);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->seq > entry->seq)
+		{
+			list->insert_before(list, enumerator, entry);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Add an entry to the bucket for key, creating it if necessary
+ */
+static void bucket_add(hashtable_t *table, key_ops_t *ops, void *key,
+					   entry_t *entry)
+{
+	bucket_t *bucket;
+
+	bucket = table->get(table, key);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.key = ops->clone(key),
+			.entries = linked_list_create(),
+		);
+		table->put(table, bucket->key, bucket);
+	}
+	insert_ordered(bucket->entries, entry);
+}
+
+/**
+ * Remove an entry from the bucket for key, destroying the bucket if empty
+ */
+static void bucket_remove(hashtable_t *table, key_ops_t *ops, void *key,
+						  entry_t *entry)
+{
+	bucket_t *bucket;
+
+	bucket = table->get(table, key);
+	if (bucket)
+	{
+		bucket->entries->remove(bucket->entries, entry, NULL);
+		if (bucket->entries->get_count(bucket->entries) == 0)
+		{
+			table->remove(table, key);
+			bucket->entries->destroy(bucket->entries);
+			ops->destroy(bucket->key);
+			free(bucket);
+		}
+	}
+}
+
+/**
+ * Destroy all buckets in a table, and the table
+ */
+static void buckets_destroy(hashtable_t *table, key_ops_t *ops)
+{
+	enumerator_t *enumerator;
+	bucket_t *bucket;
+	void *key;
+
+	enumerator = table->create_enumerator(table);
+	while (enumerator->enumerate(enumerator, &key, &bucket))
+	{
+		bucket->entries->destroy(bucket->entries);
+		ops->destroy(bucket->key);
+		free(bucket);
+	}
+	enumerator->destroy(enumerator);
+	table->destroy(table);
+}
+
+/**
+ * Get the remote address to index an IKE config with, NULL for wildcard
+ */
+static host_t *get_addr_key(ike_cfg_t *ike_cfg)
+{
+	bool allow_any;
+	host_t *host;
+	char *addr;
+
+	addr = ike_cfg->get_other_addr(ike_cfg, &allow_any);
+	if (allow_any)
+	{
+		return NULL;
+	}
+	/* DNS names are not resolved, as the backend_manager_t does so only when
+	 * matching, and they might resolve differently then */
+	host = host_create_from_string(addr, 0);
+	if (host && host->is_anyaddr(host))
+	{
+		host->destroy(host);
+		return NULL;
+	}
+	return host;
+}
+
+/**
+ * Get the remote identity to index a peer config with, NULL for wildcard
+ */
+static identification_t *get_id_key(peer_cfg_t *cfg)
+{
+	enumerator_t *enumerator;
+	identification_t *id = NULL;
+	auth_cfg_t *auth;
+
+	/* as the backend_manager_t, consider the first auth round only */
+	enumerator = cfg->create_auth_cfg_enumerator(cfg, FALSE);
+	if (enumerator->enumerate(enumerator, &auth))
+	{
+		id = auth->get(auth, AUTH_RULE_IDENTITY);
+	}
+	enumerator->destroy(enumerator);
+	if (!id || id->contains_wildcards(id))
+	{
+		return NULL;
+	}
+	return id->clone(id);
+}
+
+/**
+ * Add the names of the peer and its child configs to the index
+ */
+static void add_names(private_config_index_t *this, entry_t *entry)
+{
+	enumerator_t *enumerator;
+	child_cfg_t *child;
+	char *name;
+
+	entry->names = linked_list_create();
+	entry->names->insert_last(entry->names,
+							  strdup(entry->cfg->get_name(entry->cfg)));
+	enumerator = entry->cfg->create_child_cfg_enumerator(entry->cfg);
+	while (enumerator->enumerate(enumerator, &child))
+	{
+		entry->names->insert_last(entry->names, strdup(child->get_name(child)));
+	}
+	enumerator->destroy(enumerator);
+
+	enumerator = entry->names->create_enumerator(entry->names);
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		bucket_add(this->names, &name_ops, name, entry);
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Remove the indexed names of an entry
+ */
+static void remove_names(private_config_index_t *this, entry_t *entry)
+{
+	char *name;
+
+	while (entry->names->remove_last(entry->names, (void**)&name) == SUCCESS)
+	{
+		bucket_remove(this->names, &name_ops, name, entry);
+		free(name);
+	}
+	entry->names->destroy(entry->names);
+}
+
+METHOD(config_index_t, add, void,
+	private_config_index_t *this, peer_cfg_t *cfg)
+{
+	entry_t *entry;
+
+	if (this->entries->get(this->entries, cfg))
+	{
+		return;
+	}
+	INIT(entry,
+		.cfg = cfg,
+		.seq = this->seq++,
+		.addr = get_addr_key(cfg->get_ike_cfg(cfg)),
+		.id = get_id_key(cfg),
+	);
+	this->entries->put(this->entries, cfg, entry);
+	this->all->insert_last(this->all, entry);
+	if (entry->addr)
+	{
+		bucket_add(this->addrs, &addr_ops, entry->addr, entry);
+	}
+	else
+	{
+		this->any_addr->insert_last(this->any_addr, entry);
+	}
+	if (entry->id)
+	{
+		bucket_add(this->ids, &id_ops, entry->id, entry);
+	}
+	else
+	{
+		this->any_id->insert_last(this->any_id, entry);
+	}
+	add_names(this, entry);
+}
+
+METHOD(config_index_t, remove_, void,
+	private_config_index_t *this, peer_cfg_t *cfg)
+{
+	entry_t *entry;
+
+	entry = this->entries->remove(this->entries, cfg);
+	if (!entry)
+	{
+		return;
+	}
+	this->all->remove(this->all, entry, NULL);
+	if (entry->addr)
+	{
+		bucket_remove(this->addrs, &addr_ops, entry->addr, entry);
+		entry->addr->destroy(entry->addr);
+	}
+	else
+	{
+		this->any_addr->remove(this->any_addr, entry, NULL);
+	}
+	if (entry->id)
+	{
+		bucket_remove(this->ids, &id_ops, entry->id, entry);
+		entry->id->destroy(entry->id);
+	}
+	else
+	{
+		this->any_id->remove(this->any_id, entry, NULL);
+	}
+	remove_names(this, entry);
+	free(entry);
+}
+
+METHOD(config_index_t, update, void,
+	private_config_index_t *this, peer_cfg_t *cfg)
+{
+	entry_t *entry;
+
+	entry = this->entries->get(this->entries, cfg);
+	if (entry)
+	{
+		remove_names(this, entry);
+		add_names(this, entry);
+	}
+}
+
+/**
+ * Enumerator merging a bucket with a wildcard list, by sequence number
+ */
+typedef struct {
+	/** implements enumerator_t */
+	enumerator_t public;
+	/** enumerator over bucket entries */
+	enumerator_t *bucket;
+	/** enumerator over wildcard entries */
+	enumerator_t *any;
+	/** next entry from bucket */
+	entry_t *next_bucket;
+	/** next entry from wildcard list */
+	entry_t *next_any;
+	/** return ike_cfg_t instead of peer_cfg_t */
+	bool ike;
+} merge_enumerator_t;
+
+METHOD(enumerator_t, merge_enumerate, bool,
+	merge_enumerator_t *this, void **out)
+{
+	entry_t *entry;
+
+	if (this->next_bucket &&
+		(!this->next_any || this->next_bucket->seq < this->next_any->seq))
+	{
+		entry = this->next_bucket;
+		if (!this->bucket->enumerate(this->bucket, &this->next_bucket))
+		{
+			this->next_bucket = NULL;
+		}
+	}
+	else if (this->next_any)
+	{
+		entry = this->next_any;
+		if (!this->any->enumerate(this->any, &this->next_any))
+		{
+			this->next_any = NULL;
+		}
+	}
+	else
+	{
+		return FALSE;
+	}
+	if (this->ike)
+	{
+		*out = entry->cfg->get_ike_cfg(entry->cfg);
+	}
+	else
+	{
+		*out = entry->cfg;
+	}
+	return TRUE;
+}
+
+METHOD(enumerator_t, merge_destroy, void,
+	merge_enumerator_t *this)
+{
+	this->bucket->destroy(this->bucket);
+	this->any->destroy(this->any);
+	free(this);
+}
+
+/**
+ * Create an enumerator over the entries of a bucket and a wildcard list
+ */
+static enumerator_t *create_merge_enumerator(bucket_t *bucket,
+											 linked_list_t *any, bool ike)
+{
+	merge_enumerator_t *this;
+
+	INIT(this,
+		.public = {
+			.enumerate = (void*)_merge_enumerate,
+			.destroy = _merge_destroy,
+		},
+		.any = any->create_enumerator(any),
+		.ike = ike,
+	);
+	if (bucket)
+	{
+		this->bucket = bucket->entries->create_enumerator(bucket->entries);
+	}
+	else
+	{
+		this->bucket = enumerator_create_empty();
+	}
+	if (!this->bucket->enumerate(this->bucket, &this->next_bucket))
+	{
+		this->next_bucket = NULL;
+	}
+	if (!this->any->enumerate(this->any, &this->next_any))
+	{
+		this->next_any = NULL;
+	}
+	return &this->public;
+}
+
+METHOD(config_index_t, create_ike_cfg_enumerator, enumerator_t*,
+	private_config_index_t *this, host_t *other)
+{
+	if (other)
+	{
+		return create_merge_enumerator(this->addrs->get(this->addrs, other),
+									   this->any_addr, TRUE);
+	}
+	return create_merge_enumerator(NULL, this->all, TRUE);
+}
+
+METHOD(config_index_t, create_peer_cfg_enumerator, enumerator_t*,
+	private_config_index_t *this, identification_t *other)
+{
+	if (other && !other->contains_wildcards(other))
+	{
+		return create_merge_enumerator(this->ids->get(this->ids, other),
+									   this->any_id, FALSE);
+	}
+	return create_merge_enumerator(NULL, this->all, FALSE);
+}
+
+METHOD(config_index_t, get_peer_cfg_by_name, peer_cfg_t*,
+	private_config_index_t *this, char *name)
+{
+	bucket_t *bucket;
+	entry_t *entry;
+
+	bucket = this->names->get(this->names, name);
+	if (bucket &&
+		bucket->entries->get_first(bucket->entries, (void**)&entry) == SUCCESS)
+	{
+		return entry->cfg;
+	}
+	return NULL;
+}
+
+METHOD(config_index_t, destroy, void,
+	private_config_index_t *this)
+{
+	entry_t *entry;
+
+	while (this->all->remove_last(this->all, (void**)&entry) == SUCCESS)
+	{
+		remove_(this, entry->cfg);
+	}
+	this->all->destroy(this->all);
+	this->any_addr->destroy(this->any_addr);
+	this->any_id->destroy(this->any_id);
+	buckets_destroy(this->addrs, &addr_ops);
+	buckets_destroy(this->ids, &id_ops);
+	buckets_destroy(this->names, &name_ops);
+	this->entries->destroy(this->entries);
+	free(this);
+}
+
+/**
+ * See header
+ */
+config_index_t *config_index_create()
+{
+	private_config_index_t *this;
+
+	INIT(this,
+		.public = {
+			.add = _add,
+			.remove = _remove_,
+			.update = _update,
+			.create_ike_cfg_enumerator = _create_ike_cfg_enumerator,
+			.create_peer_cfg_enumerator = _create_peer_cfg_enumerator,
+			.get_peer_cfg_by_name = _get_peer_cfg_by_name,
+			.destroy = _destroy,
+		},
+		.entries = hashtable_create((hashtable_hash_t)cfg_hash,
+									(hashtable_equals_t)cfg_equals, 32),
+		.all = linked_list_create(),
+		.addrs = hashtable_create((hashtable_hash_t)addr_hash,
+								  (hashtable_equals_t)addr_equals, 32),
+		.any_addr = linked_list_create(),
+		.ids = hashtable_create((hashtable_hash_t)id_hash,
+								(hashtable_equals_t)id_equals, 32),
+		.any_id = linked_list_create(),
+		.names = hashtable_create((hashtable_hash_t)name_hash,
+								  (hashtable_equals_t)name_equals, 32),
+	);
+
+	return &this->public;
+}
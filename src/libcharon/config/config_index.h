@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2013 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup config_index config_index
+ * @{ @ingroup config
+ */
+
+#ifndef CONFIG_INDEX_H_
+#define CONFIG_INDEX_H_
+
+typedef struct config_index_t config_index_t;
+
+#include <library.h>
+#include <config/peer_cfg.h>
+
+/**
+ * Index over peer configurations, usable by backends to speed up lookups.
+ *
+ * Backends keeping many configurations in memory may add them to an index
+ * to filter the configurations returned to the backend_manager_t. IKE
+ * configs are indexed by the remote address, peer configs by the remote
+ * identity of the first authentication round, and both by the names of the
+ * peer config and its child configs.
+ *
+ * Configurations potentially matching any address or identity (%any, DNS
+ * names, wildcard identities) are kept in a wildcard bucket which is included
+ * in every lookup. The enumerators return candidates in the order they have
+ * been added, so the backend_manager_t selects the same configuration as it
+ * would with an enumerator over all configurations.
+ *
+ * The index does not hold references to the added configurations, and is not
+ * thread safe. Backends have to synchronize access to it.
+ */
+struct config_index_t {
+
+	/**
+	 * Add a peer config to the index.
+	 *
+	 * @param cfg			config to add
+	 */
+	void (*add)(config_index_t *this, peer_cfg_t *cfg);
+
+	/**
+	 * Remove a peer config from the index.
+	 *
+	 * @param cfg			config to remove
+	 */
+	void (*remove)(config_index_t *this, peer_cfg_t *cfg);
+
+	/**
+	 * Reindex the child config names of a peer config after modifying them.
+	 *
+	 * @param cfg			config previously added
+	 */
+	void (*update)(config_index_t *this, peer_cfg_t *cfg);
+
+	/**
+	 * Create an enumerator over IKE configs potentially matching a host.
+	 *
+	 * @param other			remote address, NULL to enumerate all configs
+	 * @return				enumerator over ike_cfg_t
+	 */
+	enumerator_t* (*create_ike_cfg_enumerator)(config_index_t *this,
+											   host_t *other);
+
+	/**
+	 * Create an enumerator over peer configs potentially matching an identity.
+	 *
+	 * @param other			remote identity, NULL to enumerate all configs
+	 * @return				enumerator over peer_cfg_t
+	 */
+	enumerator_t* (*create_peer_cfg_enumerator)(config_index_t *this,
+												identification_t *other);
+
+	/**
+	 * Get the first peer config having the given name, or a child config
+	 * with that name.
+	 *
+	 * @param name			name of peer or child config
+	 * @return				peer config, no reference added, NULL if not found
+	 */
+	peer_cfg_t* (*get_peer_cfg_by_name)(config_index_t *this, char *name);
+
+	/**
+	 * Destroy a config_index_t.
+	 */
+	void (*destroy)(config_index_t *this);
+};
+
+/**
+ * Create a config_index instance.
+ */
+config_index_t *config_index_create();
+
+#endif /** CONFIG_INDEX_H_ @}*/
@@ -110,6 +110,27 @@ static void dbg_bus(debug_t group, level_t level, char *fmt, ...)
 	va_end(args);
 }
 
+/**
+ * Context of sampled allocations, the IKE_SA of the calling thread
+ */
+static u_int get_memusage_context()
+{
+	ike_sa_t *ike_sa;
+
+	ike_sa = charon->bus->get_sa(charon->bus);
+	return ike_sa ? ike_sa->get_unique_id(ike_sa) : 0;
+}
+
+/**
+ * Number of contexts of sampled allocations, the number of IKE_SAs
+ */
+static u_int count_memusage_contexts()
+{
+	ike_sa_manager_t *manager = charon->ike_sa_manager;
+
+	return manager ? manager->get_count(manager) : 0;
+}
+
 /**
  * Some metadata about configured loggers
  */
@@ -297,6 +318,9 @@ static void load_sys_logger(private_daemon_t *this, char *facility,
 	sys_logger->set_options(sys_logger,
 				lib->settings->get_bool(lib->settings, "%s.syslog.%s.ike_name",
 										FALSE, charon->name, facility));
+	sys_logger->set_async(sys_logger,
+				lib->settings->get_int(lib->settings, "%s.syslog.%s.async",
+									   0, charon->name, facility));
 
 	def = lib->settings->get_int(lib->settings, "%s.syslog.%s.default", 1,
 								 charon->name, facility);
@@ -333,6 +357,9 @@ static void load_file_logger(private_daemon_t *this, char *filename,
 	file_logger = add_file_logger(this, filename, current_loggers);
 	file_logger->set_options(file_logger, time_format, ike_name);
 	file_logger->open(file_logger, flush_line, append);
+	file_logger->set_async(file_logger,
+				lib->settings->get_int(lib->settings, "%s.filelog.%s.async",
+									   0, charon->name, filename));
 
 	def = lib->settings->get_int(lib->settings, "%s.filelog.%s.default", 1,
 								 charon->name, filename);
@@ -434,6 +461,11 @@ METHOD(daemon_t, set_level, void,
  */
 static void destroy(private_daemon_t *this)
 {
+	if (lib->leak_detective)
+	{
+		lib->leak_detective->set_context(lib->leak_detective, NULL, NULL,
+										 NULL);
+	}
 	/* terminate all idle threads */
 	lib->processor->set_threads(lib->processor, 0);
 	/* make sure nobody waits for a DNS query */
@@ -637,6 +669,12 @@ bool libcharon_init(const char *name)
 	dbg_old = dbg;
 	dbg = dbg_bus;
 
+	if (lib->leak_detective)
+	{	/* attribute sampled allocations to IKE_SAs */
+		lib->leak_detective->set_context(lib->leak_detective, "IKE_SA",
+							get_memusage_context, count_memusage_contexts);
+	}
+
 	lib->printf_hook->add_handler(lib->printf_hook, 'P',
 								  proposal_printf_hook,
 								  PRINTF_HOOK_ARGTYPE_POINTER,
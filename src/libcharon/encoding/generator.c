@@ -46,14 +46,10 @@
 
 /**
  * Generating is done in a data buffer.
- * This is the start size of this buffer in bytes.
+ * This is the default start size of this buffer in bytes, it gets doubled
+ * whenever it is too small.
  */
-#define GENERATOR_DATA_BUFFER_SIZE 500
-
-/**
- * Number of bytes to increase the buffer, if it is too small.
- */
-#define GENERATOR_DATA_BUFFER_INCREASE_VALUE 500
+#define GENERATOR_DATA_BUFFER_SIZE 512
 
 typedef struct private_generator_t private_generator_t;
 
@@ -153,24 +149,32 @@ static u_int32_t get_offset(private_generator_t *this)
  */
 static void make_space_available(private_generator_t *this, int bits)
 {
-	while ((get_space(this) * 8 - this->current_bit) < bits)
-	{
-		int old_buffer_size, new_buffer_size, out_position_offset;
+	int old_buffer_size, new_buffer_size, out_position_offset;
 
-		old_buffer_size = get_size(this);
-		new_buffer_size = old_buffer_size + GENERATOR_DATA_BUFFER_INCREASE_VALUE;
-		out_position_offset = this->out_position - this->buffer;
+	if ((get_space(this) * 8 - this->current_bit) >= bits)
+	{
+		return;
+	}
+	old_buffer_size = get_size(this);
+	out_position_offset = this->out_position - this->buffer;
 
-		if (this->debug)
-		{
-			DBG2(DBG_ENC, "increasing gen buffer from %d to %d byte",
-				 old_buffer_size, new_buffer_size);
-		}
+	/* grow exponentially to avoid reallocating for each payload */
+	new_buffer_size = old_buffer_size * 2;
+	while ((new_buffer_size - out_position_offset) * 8 <
+		   bits + this->current_bit)
+	{
+		new_buffer_size *= 2;
+	}
 
-		this->buffer = realloc(this->buffer,new_buffer_size);
-		this->out_position = (this->buffer + out_position_offset);
-		this->roof_position = (this->buffer + new_buffer_size);
+	if (this->debug)
+	{
+		DBG2(DBG_ENC, "increasing gen buffer from %d to %d byte",
+			 old_buffer_size, new_buffer_size);
 	}
+
+	this->buffer = realloc(this->buffer, new_buffer_size);
+	this->out_position = (this->buffer + out_position_offset);
+	this->roof_position = (this->buffer + new_buffer_size);
 }
 
 /**
@@ -581,21 +585,31 @@ METHOD(generator_t, destroy, void,
  * Described in header
  */
 generator_t *generator_create()
+{
+	return generator_create_sized(GENERATOR_DATA_BUFFER_SIZE);
+}
+
+/*
+ * Described in header
+ */
+generator_t *generator_create_sized(size_t size)
 {
 	private_generator_t *this;
 
+	size = max(size, 1);
+
 	INIT(this,
 		.public = {
 			.get_chunk = _get_chunk,
 			.generate_payload = _generate_payload,
 			.destroy = _destroy,
 		},
-		.buffer = malloc(GENERATOR_DATA_BUFFER_SIZE),
+		.buffer = malloc(size),
 		.debug = TRUE,
 	);
 
 	this->out_position = this->buffer;
-	this->roof_position = this->buffer + GENERATOR_DATA_BUFFER_SIZE;
+	this->roof_position = this->buffer + size;
 
 	return &this->public;
 }
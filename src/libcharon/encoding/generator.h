@@ -72,6 +72,14 @@ struct generator_t {
  */
 generator_t *generator_create(void);
 
+/**
+ * Constructor to create a generator with a preallocated buffer.
+ *
+ * @param size			expected number of bytes to generate
+ * @return				generator_t object.
+ */
+generator_t *generator_create_sized(size_t size);
+
 /**
  * Constructor to create a generator that does not log any debug messages > 1.
  *
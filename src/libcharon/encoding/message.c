@@ -34,6 +34,11 @@
 #include <encoding/payloads/unknown_payload.h>
 #include <encoding/payloads/cp_payload.h>
 
+/**
+ * Size of the arena blocks to allocate transient message data from
+ */
+#define MESSAGE_ARENA_SIZE 1024
+
 /**
  * Max number of notify payloads per IKEv2 message
  */
@@ -784,6 +789,38 @@ static message_rule_t message_rules[] = {
 
 
 typedef struct private_message_t private_message_t;
+typedef struct indexed_payload_t indexed_payload_t;
+
+/**
+ * A payload indexed in the packet data, parsed on demand
+ */
+struct indexed_payload_t {
+
+	/**
+	 * Type of the payload
+	 */
+	payload_type_t type;
+
+	/**
+	 * Type of the next payload
+	 */
+	payload_type_t next;
+
+	/**
+	 * Encoded payload, including the generic payload header
+	 */
+	chunk_t data;
+
+	/**
+	 * Parsed payload, NULL if not parsed yet
+	 */
+	payload_t *payload;
+
+	/**
+	 * TRUE if parsing or verifying the payload failed
+	 */
+	bool invalid;
+};
 
 /**
  * Private data of an message_t object.
@@ -860,6 +897,11 @@ struct private_message_t {
 	 */
 	linked_list_t *payloads;
 
+	/**
+	 * Arena holding this message, payload lists and their enumerators
+	 */
+	arena_t *arena;
+
 	 /**
 	  * Assigned parser to parse Header and Body of this message.
 	  */
@@ -869,6 +911,26 @@ struct private_message_t {
 	 * The message rule for this message instance
 	 */
 	message_rule_t *rule;
+
+	/**
+	 * Parse payloads lazily, on first access
+	 */
+	bool lazy;
+
+	/**
+	 * Payloads indexed but not yet moved to payloads, indexed_payload_t
+	 */
+	linked_list_t *index;
+
+	/**
+	 * Decrypted encryption payload, holds the data of indexed payloads
+	 */
+	encryption_payload_t *encryption;
+
+	/**
+	 * PARSE_ERROR or VERIFY_ERROR if a lazily parsed payload failed
+	 */
+	status_t lazy_status;
 };
 
 /**
@@ -907,6 +969,140 @@ static payload_rule_t* get_payload_rule(private_message_t *this,
 	return NULL;
 }
 
+/**
+ * Parse and verify an indexed payload, if not done yet
+ */
+static payload_t* parse_indexed(private_message_t *this,
+								indexed_payload_t *entry)
+{
+	parser_t *parser;
+	payload_t *payload;
+
+	if (entry->payload || entry->invalid)
+	{
+		return entry->payload;
+	}
+	DBG2(DBG_ENC, "parsing indexed %N payload", payload_type_names, entry->type);
+
+	parser = parser_create(entry->data);
+	if (parser->parse_payload(parser, entry->type, &payload) != SUCCESS)
+	{
+		DBG1(DBG_ENC, "payload type %N could not be parsed",
+			 payload_type_names, entry->type);
+		entry->invalid = TRUE;
+		if (this->lazy_status == SUCCESS)
+		{
+			this->lazy_status = PARSE_ERROR;
+		}
+	}
+	else if (payload->verify(payload) != SUCCESS)
+	{
+		DBG1(DBG_ENC, "%N payload verification failed",
+			 payload_type_names, entry->type);
+		payload->destroy(payload);
+		entry->invalid = TRUE;
+		if (this->lazy_status == SUCCESS)
+		{
+			this->lazy_status = VERIFY_ERROR;
+		}
+	}
+	else
+	{
+		payload->set_next_type(payload, entry->next);
+		entry->payload = payload;
+	}
+	parser->destroy(parser);
+	return entry->payload;
+}
+
+/**
+ * Parse all indexed payloads and move them to the list of payloads
+ */
+static void parse_index(private_message_t *this)
+{
+	indexed_payload_t *entry;
+
+	if (!this->index)
+	{
+		return;
+	}
+	while (this->index->remove_first(this->index, (void**)&entry) == SUCCESS)
+	{
+		if (parse_indexed(this, entry))
+		{
+			this->payloads->insert_last(this->payloads, entry->payload);
+		}
+	}
+	this->index->destroy(this->index);
+	this->index = NULL;
+}
+
+/**
+ * Get the notify type of an indexed notify payload without parsing it
+ */
+static notify_type_t peek_notify_type(indexed_payload_t *entry)
+{
+	/* protocol ID and SPI size precede the type, IKEv1 adds a DOI */
+	size_t offset = entry->type == NOTIFY_V1 ? 10 : 6;
+
+	if (entry->data.len < offset + 2)
+	{
+		return 0;
+	}
+	return untoh16(entry->data.ptr + offset);
+}
+
+/**
+ * Parse the first indexed payload of a type, and notify type if not 0
+ */
+static payload_t* get_indexed(private_message_t *this, payload_type_t type,
+							  notify_type_t notify)
+{
+	indexed_payload_t *entry;
+	enumerator_t *enumerator;
+	payload_t *found = NULL;
+
+	enumerator = this->index->create_enumerator(this->index);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (entry->type == type &&
+			(!notify || peek_notify_type(entry) == notify))
+		{
+			/* as in eager mode, an invalid payload does not reveal later ones */
+			found = parse_indexed(this, entry);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Enumerate indexed_payload_t if the message has an index, payload_t if not
+ */
+static enumerator_t* create_item_enumerator(private_message_t *this)
+{
+	if (this->index)
+	{
+		return this->index->create_enumerator(this->index);
+	}
+	return this->payloads->create_enumerator(this->payloads);
+}
+
+/**
+ * Get the payload type of an item enumerated by create_item_enumerator()
+ */
+static payload_type_t get_item_type(private_message_t *this, void *item)
+{
+	payload_t *payload = item;
+
+	if (this->index)
+	{
+		return ((indexed_payload_t*)item)->type;
+	}
+	return payload->get_type(payload);
+}
+
 METHOD(message_t, set_ike_sa_id, void,
 	private_message_t *this,ike_sa_id_t *ike_sa_id)
 {
@@ -1034,6 +1230,7 @@ METHOD(message_t, add_payload, void,
 {
 	payload_t *last_payload;
 
+	parse_index(this);
 	if (this->payloads->get_count(this->payloads) > 0)
 	{
 		this->payloads->get_last(this->payloads, (void **)&last_payload);
@@ -1058,6 +1255,7 @@ METHOD(message_t, add_notify, void,
 
 	if (flush)
 	{
+		parse_index(this);
 		while (this->payloads->remove_last(this->payloads,
 												(void**)&payload) == SUCCESS)
 		{
@@ -1104,9 +1302,51 @@ METHOD(message_t, get_destination, host_t*,
 METHOD(message_t, create_payload_enumerator, enumerator_t*,
 	private_message_t *this)
 {
+	parse_index(this);
 	return this->payloads->create_enumerator(this->payloads);
 }
 
+/**
+ * Filter unknown payloads
+ */
+static bool filter_unknown(void *null, payload_t **in, payload_t **out)
+{
+	if (payload_is_known((*in)->get_type(*in)))
+	{
+		return FALSE;
+	}
+	*out = *in;
+	return TRUE;
+}
+
+/**
+ * Filter and parse indexed unknown payloads
+ */
+static bool filter_indexed_unknown(private_message_t *this,
+								   indexed_payload_t **in, payload_t **out)
+{
+	if (payload_is_known((*in)->type))
+	{
+		return FALSE;
+	}
+	*out = parse_indexed(this, *in);
+	return *out != NULL;
+}
+
+METHOD(message_t, create_unknown_payload_enumerator, enumerator_t*,
+	private_message_t *this)
+{
+	if (this->index)
+	{
+		return enumerator_create_filter(
+							this->index->create_enumerator(this->index),
+							(void*)filter_indexed_unknown, this, NULL);
+	}
+	return enumerator_create_filter(
+							this->payloads->create_enumerator(this->payloads),
+							(void*)filter_unknown, NULL, NULL);
+}
+
 METHOD(message_t, remove_payload_at, void,
 	private_message_t *this, enumerator_t *enumerator)
 {
@@ -1119,6 +1359,10 @@ METHOD(message_t, get_payload, payload_t*,
 	payload_t *current, *found = NULL;
 	enumerator_t *enumerator;
 
+	if (this->index)
+	{
+		return get_indexed(this, type, 0);
+	}
 	enumerator = create_payload_enumerator(this);
 	while (enumerator->enumerate(enumerator, &current))
 	{
@@ -1139,6 +1383,12 @@ METHOD(message_t, get_notify, notify_payload_t*,
 	notify_payload_t *notify = NULL;
 	payload_t *payload;
 
+	if (this->index)
+	{
+		return (notify_payload_t*)get_indexed(this,
+							this->major_version == IKEV1_MAJOR_VERSION ?
+							NOTIFY_V1 : NOTIFY, type);
+	}
 	enumerator = create_payload_enumerator(this);
 	while (enumerator->enumerate(enumerator, &payload))
 	{
@@ -1164,6 +1414,8 @@ static char* get_string(private_message_t *this, char *buf, int len)
 {
 	enumerator_t *enumerator;
 	payload_t *payload;
+	payload_type_t payload_type;
+	void *item;
 	int written;
 	char *pos = buf;
 
@@ -1181,27 +1433,40 @@ static char* get_string(private_message_t *this, char *buf, int len)
 	pos += written;
 	len -= written;
 
-	enumerator = create_payload_enumerator(this);
-	while (enumerator->enumerate(enumerator, &payload))
+	/* indexed payloads get parsed only if we need more than their type */
+	enumerator = create_item_enumerator(this);
+	while (enumerator->enumerate(enumerator, &item))
 	{
+		payload_type = get_item_type(this, item);
+		payload = this->index ? NULL : item;
 		written = snprintf(pos, len, " %N", payload_type_short_names,
-						   payload->get_type(payload));
+						   payload_type);
 		if (written >= len || written < 0)
 		{
 			return buf;
 		}
 		pos += written;
 		len -= written;
-		if (payload->get_type(payload) == NOTIFY ||
-			payload->get_type(payload) == NOTIFY_V1)
+		if (payload_type == NOTIFY || payload_type == NOTIFY_V1)
 		{
 			notify_payload_t *notify;
 			notify_type_t type;
-			chunk_t data;
+			chunk_t data = chunk_empty;
 
 			notify = (notify_payload_t*)payload;
-			type = notify->get_notify_type(notify);
-			data = notify->get_notification_data(notify);
+			type = notify ? notify->get_notify_type(notify)
+						  : peek_notify_type(item);
+			if (type == MS_NOTIFY_STATUS)
+			{
+				if (!notify)
+				{
+					notify = (notify_payload_t*)parse_indexed(this, item);
+				}
+				if (notify)
+				{
+					data = notify->get_notification_data(notify);
+				}
+			}
 			if (type == MS_NOTIFY_STATUS && data.len == 4)
 			{
 				written = snprintf(pos, len, "(%N(%d))", notify_type_short_names,
@@ -1219,7 +1484,16 @@ static char* get_string(private_message_t *this, char *buf, int len)
 			pos += written;
 			len -= written;
 		}
-		if (payload->get_type(payload) == EXTENSIBLE_AUTHENTICATION)
+		if (!payload && (payload_type == EXTENSIBLE_AUTHENTICATION ||
+						 payload_type == CONFIGURATION))
+		{
+			payload = parse_indexed(this, item);
+			if (!payload)
+			{
+				continue;
+			}
+		}
+		if (payload_type == EXTENSIBLE_AUTHENTICATION)
 		{
 			eap_payload_t *eap = (eap_payload_t*)payload;
 			u_int32_t vendor;
@@ -1248,7 +1522,7 @@ static char* get_string(private_message_t *this, char *buf, int len)
 			pos += written;
 			len -= written;
 		}
-		if (payload->get_type(payload) == CONFIGURATION)
+		if (payload_type == CONFIGURATION)
 		{
 			cp_payload_t *cp = (cp_payload_t*)payload;
 			enumerator_t *attributes;
@@ -1299,7 +1573,7 @@ static void order_payloads(private_message_t *this)
 	int i;
 
 	/* move to temp list */
-	list = linked_list_create();
+	list = linked_list_create_arena(this->arena);
 	while (this->payloads->remove_last(this->payloads,
 									   (void**)&payload) == SUCCESS)
 	{
@@ -1360,7 +1634,7 @@ static encryption_payload_t* wrap_payloads(private_message_t *this)
 	payload_t *current;
 
 	/* copy all payloads in a temporary list */
-	payloads = linked_list_create();
+	payloads = linked_list_create_arena(this->arena);
 	while (this->payloads->remove_first(this->payloads,
 										(void**)&current) == SUCCESS)
 	{
@@ -1426,6 +1700,7 @@ METHOD(message_t, generate, status_t,
 	char str[BUF_LEN];
 	u_int32_t *lenpos;
 	bool encrypted = FALSE, *reserved;
+	size_t length;
 	int i;
 
 	if (this->exchange_type == EXCHANGE_TYPE_UNDEFINED)
@@ -1448,6 +1723,7 @@ METHOD(message_t, generate, status_t,
 		return NOT_SUPPORTED;
 	}
 
+	parse_index(this);
 	if (!this->sort_disabled)
 	{
 		order_payloads(this);
@@ -1538,7 +1814,20 @@ METHOD(message_t, generate, status_t,
 		}
 	}
 
-	generator = generator_create();
+	/* allocate a generator buffer large enough for the whole message */
+	length = IKE_HEADER_LENGTH;
+	enumerator = this->payloads->create_enumerator(this->payloads);
+	while (enumerator->enumerate(enumerator, &payload))
+	{
+		length += payload->get_length(payload);
+	}
+	enumerator->destroy(enumerator);
+	if (encryption)
+	{	/* set_transform() has to be called before get_length() */
+		encryption->set_transform(encryption, aead);
+		length += encryption->get_length(encryption);
+	}
+	generator = generator_create_sized(length);
 
 	/* generate all payloads with proper next type */
 	payload = (payload_t*)ike_header;
@@ -1564,8 +1853,7 @@ METHOD(message_t, generate, status_t,
 	ike_header->destroy(ike_header);
 
 	if (encryption)
-	{	/* set_transform() has to be called before get_length() */
-		encryption->set_transform(encryption, aead);
+	{
 		if (this->is_encrypted)
 		{	/* for IKEv1 instead of associated data we provide the IV */
 			if (!keymat_v1->get_iv(keymat_v1, this->message_id, &chunk))
@@ -1704,7 +1992,7 @@ METHOD(message_t, parse_header, status_t,
 static bool is_connectivity_check(private_message_t *this, payload_t *payload)
 {
 #ifdef ME
-	if (this->exchange_type == INFORMATIONAL &&
+	if (payload && this->exchange_type == INFORMATIONAL &&
 		payload->get_type(payload) == NOTIFY)
 	{
 		notify_payload_t *notify = (notify_payload_t*)payload;
@@ -1790,6 +2078,172 @@ static status_t parse_payloads(private_message_t *this)
 	return SUCCESS;
 }
 
+/**
+ * Index a chain of encoded payloads, up to and including an encryption payload
+ */
+static status_t index_chain(private_message_t *this, chunk_t data,
+							payload_type_t type)
+{
+	indexed_payload_t *entry;
+	u_int16_t length;
+
+	while (type != NO_PAYLOAD)
+	{
+		length = data.len >= 4 ? untoh16(data.ptr + 2) : 0;
+		if (length < 4 || length > data.len)
+		{
+			DBG1(DBG_ENC, "invalid %N payload length",
+				 payload_type_names, type);
+			return PARSE_ERROR;
+		}
+		entry = this->arena->alloc(this->arena, sizeof(*entry));
+		*entry = (indexed_payload_t){
+			.type = type,
+			.next = data.ptr[0],
+			.data = chunk_create(data.ptr, length),
+		};
+		this->index->insert_last(this->index, entry);
+
+		if (type == ENCRYPTED)
+		{	/* the encryption payload is the last one, decrypted later */
+			break;
+		}
+		type = entry->next;
+		data = chunk_skip(data, length);
+	}
+	return SUCCESS;
+}
+
+/**
+ * Index the unencrypted payloads in the packet data, but parse only the
+ * encryption payload, if any
+ */
+static status_t index_payloads(private_message_t *this)
+{
+	indexed_payload_t *entry;
+	chunk_t data;
+	status_t status;
+
+	this->index = linked_list_create_arena(this->arena);
+
+	if (this->is_encrypted)
+	{	/* wrap the whole encrypted IKEv1 message, as in parse_payloads() */
+		status = this->parser->parse_payload(this->parser, ENCRYPTED_V1,
+											 (payload_t**)&this->encryption);
+		if (status != SUCCESS)
+		{
+			DBG1(DBG_ENC, "failed to wrap encrypted IKEv1 message");
+			return PARSE_ERROR;
+		}
+		this->encryption->payload_interface.set_next_type(
+						(payload_t*)this->encryption, this->first_payload);
+		return SUCCESS;
+	}
+
+	data = chunk_skip(this->packet->get_data(this->packet), IKE_HEADER_LENGTH);
+	status = index_chain(this, data, this->first_payload);
+	if (status != SUCCESS)
+	{
+		return status;
+	}
+	if (this->index->get_last(this->index, (void**)&entry) == SUCCESS &&
+		entry->type == ENCRYPTED)
+	{
+		this->index->remove_last(this->index, (void**)&entry);
+		this->encryption = (encryption_payload_t*)parse_indexed(this, entry);
+		if (!this->encryption)
+		{
+			return PARSE_ERROR;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Decrypt an encryption payload, without parsing its payloads if plain is
+ * given
+ */
+static status_t decrypt(private_message_t *this,
+						encryption_payload_t *encryption, keymat_t *keymat,
+						chunk_t *plain)
+{
+	aead_t *aead;
+	chunk_t chunk;
+	size_t bs;
+	status_t status;
+
+	if (!keymat)
+	{
+		DBG1(DBG_ENC, "found encryption payload, but no keymat");
+		return INVALID_ARG;
+	}
+	aead = keymat->get_aead(keymat, TRUE);
+	if (!aead)
+	{
+		DBG1(DBG_ENC, "found encryption payload, but no transform set");
+		return INVALID_ARG;
+	}
+	bs = aead->get_block_size(aead);
+	encryption->set_transform(encryption, aead);
+	chunk = this->packet->get_data(this->packet);
+	if (chunk.len < encryption->get_length(encryption) ||
+		chunk.len < bs)
+	{
+		DBG1(DBG_ENC, "invalid payload length");
+		return VERIFY_ERROR;
+	}
+	if (keymat->get_version(keymat) == IKEV1)
+	{	/* instead of associated data we provide the IV, we also update
+		 * the IV with the last encrypted block */
+		keymat_v1_t *keymat_v1 = (keymat_v1_t*)keymat;
+		chunk_t iv;
+
+		if (!keymat_v1->get_iv(keymat_v1, this->message_id, &iv))
+		{
+			return FAILED;
+		}
+		if (plain)
+		{
+			status = encryption->decrypt_plain(encryption, iv, plain);
+		}
+		else
+		{
+			status = encryption->decrypt(encryption, iv);
+		}
+		if (status == SUCCESS &&
+			!keymat_v1->update_iv(keymat_v1, this->message_id,
+								  chunk_create(chunk.ptr + chunk.len - bs, bs)))
+		{
+			status = FAILED;
+		}
+		return status;
+	}
+	chunk.len -= encryption->get_length(encryption);
+	if (plain)
+	{
+		return encryption->decrypt_plain(encryption, chunk, plain);
+	}
+	return encryption->decrypt(encryption, chunk);
+}
+
+/**
+ * Check if a payload may be sent unencrypted
+ */
+static bool check_unencrypted(private_message_t *this, payload_type_t type)
+{
+	payload_rule_t *rule;
+
+	if (payload_is_known(type) && this->exchange_type != AGGRESSIVE)
+	{
+		rule = get_payload_rule(this, type);
+		if (!rule || rule->encrypted)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 /**
  * Decrypt payload from the encryption payload
  */
@@ -1798,9 +2252,7 @@ static status_t decrypt_payloads(private_message_t *this, keymat_t *keymat)
 	bool was_encrypted = FALSE;
 	payload_t *payload, *previous = NULL;
 	enumerator_t *enumerator;
-	payload_rule_t *rule;
 	payload_type_t type;
-	aead_t *aead;
 	status_t status = SUCCESS;
 
 	enumerator = this->payloads->create_enumerator(this->payloads);
@@ -1814,8 +2266,6 @@ static status_t decrypt_payloads(private_message_t *this, keymat_t *keymat)
 		{
 			encryption_payload_t *encryption;
 			payload_t *encrypted;
-			chunk_t chunk;
-			size_t bs;
 
 			encryption = (encryption_payload_t*)payload;
 
@@ -1827,57 +2277,7 @@ static status_t decrypt_payloads(private_message_t *this, keymat_t *keymat)
 				status = VERIFY_ERROR;
 				break;
 			}
-			if (!keymat)
-			{
-				DBG1(DBG_ENC, "found encryption payload, but no keymat");
-				status = INVALID_ARG;
-				break;
-			}
-			aead = keymat->get_aead(keymat, TRUE);
-			if (!aead)
-			{
-				DBG1(DBG_ENC, "found encryption payload, but no transform set");
-				status = INVALID_ARG;
-				break;
-			}
-			bs = aead->get_block_size(aead);
-			encryption->set_transform(encryption, aead);
-			chunk = this->packet->get_data(this->packet);
-			if (chunk.len < encryption->get_length(encryption) ||
-				chunk.len < bs)
-			{
-				DBG1(DBG_ENC, "invalid payload length");
-				status = VERIFY_ERROR;
-				break;
-			}
-			if (keymat->get_version(keymat) == IKEV1)
-			{	/* instead of associated data we provide the IV, we also update
-				 * the IV with the last encrypted block */
-				keymat_v1_t *keymat_v1 = (keymat_v1_t*)keymat;
-				chunk_t iv;
-
-				if (keymat_v1->get_iv(keymat_v1, this->message_id, &iv))
-				{
-					status = encryption->decrypt(encryption, iv);
-					if (status == SUCCESS)
-					{
-						if (!keymat_v1->update_iv(keymat_v1, this->message_id,
-								chunk_create(chunk.ptr + chunk.len - bs, bs)))
-						{
-							status = FAILED;
-						}
-					}
-				}
-				else
-				{
-					status = FAILED;
-				}
-			}
-			else
-			{
-				chunk.len -= encryption->get_length(encryption);
-				status = encryption->decrypt(encryption, chunk);
-			}
+			status = decrypt(this, encryption, keymat, NULL);
 			if (status != SUCCESS)
 			{
 				break;
@@ -1904,18 +2304,13 @@ static status_t decrypt_payloads(private_message_t *this, keymat_t *keymat)
 			}
 			encryption->destroy(encryption);
 		}
-		if (payload_is_known(type) && !was_encrypted &&
-			!is_connectivity_check(this, payload) &&
-			this->exchange_type != AGGRESSIVE)
+		if (!was_encrypted && !check_unencrypted(this, type) &&
+			!is_connectivity_check(this, payload))
 		{
-			rule = get_payload_rule(this, type);
-			if (!rule || rule->encrypted)
-			{
-				DBG1(DBG_ENC, "payload type %N was not encrypted",
-					 payload_type_names, type);
-				status = FAILED;
-				break;
-			}
+			DBG1(DBG_ENC, "payload type %N was not encrypted",
+				 payload_type_names, type);
+			status = FAILED;
+			break;
 		}
 		previous = payload;
 	}
@@ -1923,6 +2318,64 @@ static status_t decrypt_payloads(private_message_t *this, keymat_t *keymat)
 	return status;
 }
 
+/**
+ * Decrypt the encryption payload and index the decrypted payloads
+ */
+static status_t decrypt_index(private_message_t *this, keymat_t *keymat)
+{
+	indexed_payload_t *entry, *previous = NULL;
+	enumerator_t *enumerator;
+	payload_type_t type;
+	chunk_t plain;
+	status_t status;
+
+	enumerator = this->index->create_enumerator(this->index);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (!check_unencrypted(this, entry->type) &&
+			!is_connectivity_check(this, parse_indexed(this, entry)))
+		{
+			DBG1(DBG_ENC, "payload type %N was not encrypted",
+				 payload_type_names, entry->type);
+			enumerator->destroy(enumerator);
+			return FAILED;
+		}
+		previous = entry;
+	}
+	enumerator->destroy(enumerator);
+
+	if (!this->encryption)
+	{
+		return SUCCESS;
+	}
+	DBG2(DBG_ENC, "found an encryption payload");
+
+	status = decrypt(this, this->encryption, keymat, &plain);
+	if (status != SUCCESS)
+	{
+		return status;
+	}
+	type = this->encryption->payload_interface.get_next_type(
+										&this->encryption->payload_interface);
+	if (previous)
+	{
+		previous->next = type;
+	}
+	else
+	{
+		this->first_payload = type;
+	}
+	status = index_chain(this, plain, type);
+	if (status == SUCCESS &&
+		this->index->get_last(this->index, (void**)&entry) == SUCCESS &&
+		entry->type == ENCRYPTED)
+	{
+		DBG1(DBG_ENC, "found nested encryption payload");
+		status = VERIFY_ERROR;
+	}
+	return status;
+}
+
 /**
  * Verify a message and all payload according to message/payload rules
  */
@@ -1937,17 +2390,17 @@ static status_t verify(private_message_t *this)
 	for (i = 0; i < this->rule->rule_count; i++)
 	{
 		enumerator_t *enumerator;
-		payload_t *payload;
 		payload_rule_t *rule;
+		void *item;
 		int found = 0;
 
 		rule = &this->rule->rules[i];
-		enumerator = create_payload_enumerator(this);
-		while (enumerator->enumerate(enumerator, &payload))
+		enumerator = create_item_enumerator(this);
+		while (enumerator->enumerate(enumerator, &item))
 		{
 			payload_type_t type;
 
-			type = payload->get_type(payload);
+			type = get_item_type(this, item);
 			if (type == rule->type)
 			{
 				found++;
@@ -1997,13 +2450,27 @@ METHOD(message_t, parse_body, status_t,
 		return NOT_SUPPORTED;
 	}
 
-	status = parse_payloads(this);
+	if (this->lazy)
+	{
+		status = index_payloads(this);
+	}
+	else
+	{
+		status = parse_payloads(this);
+	}
 	if (status != SUCCESS)
 	{	/* error is already logged */
 		return status;
 	}
 
-	status = decrypt_payloads(this, keymat);
+	if (this->lazy)
+	{
+		status = decrypt_index(this, keymat);
+	}
+	else
+	{
+		status = decrypt_payloads(this, keymat);
+	}
 	if (status != SUCCESS)
 	{
 		DBG1(DBG_ENC, "could not decrypt payloads");
@@ -2043,6 +2510,11 @@ METHOD(message_t, parse_body, status_t,
 				return VERIFY_ERROR;
 			}
 			hash_payload = (hash_payload_t*)get_payload(this, HASH_V1);
+			if (!hash_payload)
+			{	/* lazily parsed HASH payload failed to parse */
+				chunk_free(&hash);
+				return VERIFY_ERROR;
+			}
 			other_hash = hash_payload->get_hash(hash_payload);
 			DBG3(DBG_ENC, "HASH received %B\nHASH expected %B",
 				 &other_hash, &hash);
@@ -2065,14 +2537,39 @@ METHOD(message_t, parse_body, status_t,
 	return SUCCESS;
 }
 
+METHOD(message_t, set_lazy_parsing, void,
+	private_message_t *this, bool lazy)
+{
+	this->lazy = lazy;
+}
+
+METHOD(message_t, parse_remaining, status_t,
+	private_message_t *this)
+{
+	parse_index(this);
+	return this->lazy_status;
+}
+
 METHOD(message_t, destroy, void,
 	private_message_t *this)
 {
+	indexed_payload_t *entry;
+
+	if (this->index)
+	{
+		while (this->index->remove_first(this->index,
+										 (void**)&entry) == SUCCESS)
+		{
+			DESTROY_IF(entry->payload);
+		}
+		this->index->destroy(this->index);
+	}
+	DESTROY_IF(this->encryption);
 	DESTROY_IF(this->ike_sa_id);
 	this->payloads->destroy_offset(this->payloads, offsetof(payload_t, destroy));
 	this->packet->destroy(this->packet);
 	this->parser->destroy(this->parser);
-	free(this);
+	this->arena->destroy(this->arena);
 }
 
 /*
@@ -2081,8 +2578,11 @@ METHOD(message_t, destroy, void,
 message_t *message_create_from_packet(packet_t *packet)
 {
 	private_message_t *this;
+	arena_t *arena;
 
-	INIT(this,
+	arena = arena_create(MESSAGE_ARENA_SIZE);
+	this = arena->alloc(arena, sizeof(*this));
+	*this = (private_message_t){
 		.public = {
 			.set_major_version = _set_major_version,
 			.get_major_version = _get_major_version,
@@ -2112,11 +2612,14 @@ message_t *message_create_from_packet(packet_t *packet)
 			.set_destination = _set_destination,
 			.get_destination = _get_destination,
 			.create_payload_enumerator = _create_payload_enumerator,
+			.create_unknown_payload_enumerator = _create_unknown_payload_enumerator,
 			.remove_payload_at = _remove_payload_at,
 			.get_payload = _get_payload,
 			.get_notify = _get_notify,
 			.parse_header = _parse_header,
 			.parse_body = _parse_body,
+			.set_lazy_parsing = _set_lazy_parsing,
+			.parse_remaining = _parse_remaining,
 			.get_packet = _get_packet,
 			.get_packet_data = _get_packet_data,
 			.destroy = _destroy,
@@ -2125,9 +2628,10 @@ message_t *message_create_from_packet(packet_t *packet)
 		.is_request = TRUE,
 		.first_payload = NO_PAYLOAD,
 		.packet = packet,
-		.payloads = linked_list_create(),
+		.arena = arena,
+		.payloads = linked_list_create_arena(arena),
 		.parser = parser_create(packet->get_data(packet)),
-	);
+	};
 
 	return &this->public;
 }
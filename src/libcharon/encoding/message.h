@@ -238,6 +238,34 @@ struct message_t {
 	 */
 	status_t (*parse_body) (message_t *this, keymat_t *keymat);
 
+	/**
+	 * Parse payloads lazily, when they are accessed for the first time.
+	 *
+	 * Instead of parsing all payloads, parse_body() just indexes them in the
+	 * packet data and verifies the message structure. Payloads get parsed
+	 * and verified by get_payload(), get_notify() or when first enumerated.
+	 * Payloads failing to parse or verify at that time are not returned,
+	 * parse_remaining() reports such failures.
+	 *
+	 * Must be called before parse_body().
+	 *
+	 * @param lazy		TRUE to parse payloads lazily
+	 */
+	void (*set_lazy_parsing)(message_t *this, bool lazy);
+
+	/**
+	 * Parse and verify all lazily parsed payloads not accessed yet.
+	 *
+	 * Must be called before a lazily parsed message gets processed, as
+	 * parse_body() does not report payloads that fail to parse or verify.
+	 *
+	 * @return
+	 *					- SUCCESS if all payloads are valid, or parsed eagerly
+	 *					- PARSE_ERROR if a payload could not be parsed
+	 *					- VERIFY_ERROR if a payload failed verification
+	 */
+	status_t (*parse_remaining)(message_t *this);
+
 	/**
 	 * Generates the UDP packet of specific message.
 	 *
@@ -311,6 +339,16 @@ struct message_t {
 	 */
 	enumerator_t * (*create_payload_enumerator) (message_t *this);
 
+	/**
+	 * Create an enumerator over payloads of unknown type.
+	 *
+	 * Unlike create_payload_enumerator(), this does not parse any lazily
+	 * parsed payloads of known types.
+	 *
+	 * @return			enumerator over unknown_payload_t
+	 */
+	enumerator_t * (*create_unknown_payload_enumerator) (message_t *this);
+
 	/**
 	 * Remove the payload at the current enumerator position.
 	 *
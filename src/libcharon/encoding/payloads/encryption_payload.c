@@ -184,12 +184,28 @@ METHOD(payload_t, set_next_type, void,
 }
 
 /**
- * Compute the length of the whole payload
+ * Get the length of the contained payloads, unencrypted
  */
-static void compute_length(private_encryption_payload_t *this)
+static size_t get_plain_length(private_encryption_payload_t *this)
 {
 	enumerator_t *enumerator;
 	payload_t *payload;
+	size_t length = 0;
+
+	enumerator = this->payloads->create_enumerator(this->payloads);
+	while (enumerator->enumerate(enumerator, &payload))
+	{
+		length += payload->get_length(payload);
+	}
+	enumerator->destroy(enumerator);
+	return length;
+}
+
+/**
+ * Compute the length of the whole payload
+ */
+static void compute_length(private_encryption_payload_t *this)
+{
 	size_t bs, length = 0;
 
 	if (this->encrypted.len)
@@ -198,12 +214,7 @@ static void compute_length(private_encryption_payload_t *this)
 	}
 	else
 	{
-		enumerator = this->payloads->create_enumerator(this->payloads);
-		while (enumerator->enumerate(enumerator, &payload))
-		{
-			length += payload->get_length(payload);
-		}
-		enumerator->destroy(enumerator);
+		length = get_plain_length(this);
 
 		if (this->aead)
 		{
@@ -331,7 +342,7 @@ METHOD(encryption_payload_t, encrypt, status_t,
 
 	assoc = append_header(this, assoc);
 
-	generator = generator_create();
+	generator = generator_create_sized(get_plain_length(this));
 	plain = generate(this, generator);
 	bs = this->aead->get_block_size(this->aead);
 	/* we need at least one byte padding to store the padding length */
@@ -400,7 +411,7 @@ METHOD(encryption_payload_t, encrypt_v1, status_t,
 		return INVALID_STATE;
 	}
 
-	generator = generator_create();
+	generator = generator_create_sized(get_plain_length(this));
 	plain = generate(this, generator);
 	bs = this->aead->get_block_size(this->aead);
 	padding.len = bs - (plain.len % bs);
@@ -471,10 +482,10 @@ static status_t parse(private_encryption_payload_t *this, chunk_t plain)
 	return SUCCESS;
 }
 
-METHOD(encryption_payload_t, decrypt, status_t,
-	private_encryption_payload_t *this, chunk_t assoc)
+METHOD(encryption_payload_t, decrypt_plain, status_t,
+	private_encryption_payload_t *this, chunk_t assoc, chunk_t *plain)
 {
-	chunk_t iv, plain, padding, icv, crypt;
+	chunk_t iv, padding, icv, crypt;
 	size_t bs;
 
 	if (this->aead == NULL)
@@ -522,25 +533,39 @@ METHOD(encryption_payload_t, decrypt, status_t,
 	}
 	free(assoc.ptr);
 
-	plain = chunk_create(crypt.ptr, crypt.len - icv.len);
-	padding.len = plain.ptr[plain.len - 1] + 1;
-	if (padding.len > plain.len)
+	*plain = chunk_create(crypt.ptr, crypt.len - icv.len);
+	padding.len = plain->ptr[plain->len - 1] + 1;
+	if (padding.len > plain->len)
 	{
 		DBG1(DBG_ENC, "decrypting encryption payload failed, "
 			 "padding invalid %B", &crypt);
 		return PARSE_ERROR;
 	}
-	plain.len -= padding.len;
-	padding.ptr = plain.ptr + plain.len;
+	plain->len -= padding.len;
+	padding.ptr = plain->ptr + plain->len;
 
-	DBG3(DBG_ENC, "plain %B", &plain);
+	DBG3(DBG_ENC, "plain %B", plain);
 	DBG3(DBG_ENC, "padding %B", &padding);
 
+	return SUCCESS;
+}
+
+METHOD(encryption_payload_t, decrypt, status_t,
+	private_encryption_payload_t *this, chunk_t assoc)
+{
+	chunk_t plain;
+	status_t status;
+
+	status = decrypt_plain(this, assoc, &plain);
+	if (status != SUCCESS)
+	{
+		return status;
+	}
 	return parse(this, plain);
 }
 
-METHOD(encryption_payload_t, decrypt_v1, status_t,
-	private_encryption_payload_t *this, chunk_t iv)
+METHOD(encryption_payload_t, decrypt_plain_v1, status_t,
+	private_encryption_payload_t *this, chunk_t iv, chunk_t *plain)
 {
 	if (this->aead == NULL)
 	{
@@ -566,7 +591,22 @@ METHOD(encryption_payload_t, decrypt_v1, status_t,
 
 	DBG3(DBG_ENC, "plain %B", &this->encrypted);
 
-	return parse(this, this->encrypted);
+	*plain = this->encrypted;
+	return SUCCESS;
+}
+
+METHOD(encryption_payload_t, decrypt_v1, status_t,
+	private_encryption_payload_t *this, chunk_t iv)
+{
+	chunk_t plain;
+	status_t status;
+
+	status = decrypt_plain_v1(this, iv, &plain);
+	if (status != SUCCESS)
+	{
+		return status;
+	}
+	return parse(this, plain);
 }
 
 METHOD(encryption_payload_t, set_transform, void,
@@ -608,6 +648,7 @@ encryption_payload_t *encryption_payload_create(payload_type_t type)
 			.set_transform = _set_transform,
 			.encrypt = _encrypt,
 			.decrypt = _decrypt,
+			.decrypt_plain = _decrypt_plain,
 			.destroy = _destroy,
 		},
 		.next_payload = NO_PAYLOAD,
@@ -620,6 +661,7 @@ encryption_payload_t *encryption_payload_create(payload_type_t type)
 	{
 		this->public.encrypt = _encrypt_v1;
 		this->public.decrypt = _decrypt_v1;
+		this->public.decrypt_plain = _decrypt_plain_v1;
 	}
 
 	return &this->public;
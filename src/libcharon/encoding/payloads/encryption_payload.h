@@ -92,6 +92,19 @@ struct encryption_payload_t {
 	 */
 	status_t (*decrypt) (encryption_payload_t *this, chunk_t assoc);
 
+	/**
+	 * Decrypt and verify contained payloads, but do not parse them.
+	 *
+	 * The returned data is owned by the encryption payload and contains the
+	 * encoded payloads, the type of the first one is get_next_type().
+	 *
+	 * @param assoc			associated data
+	 * @param plain			decrypted payload data
+	 * @return				see decrypt()
+	 */
+	status_t (*decrypt_plain) (encryption_payload_t *this, chunk_t assoc,
+							   chunk_t *plain);
+
 	/**
 	 * Destroys an encryption_payload_t object.
 	 */
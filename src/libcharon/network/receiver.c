@@ -122,12 +122,12 @@ struct private_receiver_t {
 	/**
 	 * Drop IKE_SA_INIT requests if processor job load exceeds this limit
 	 */
-	u_int init_limit_job_load;
+	settings_handle_t *init_limit_job_load;
 
 	/**
 	 * Drop IKE_SA_INIT requests if half open IKE_SA count exceeds this limit
 	 */
-	u_int init_limit_half_open;
+	settings_handle_t *init_limit_half_open;
 
 	/**
 	 * Delay for receiving incoming packets, to simulate larger RTT
@@ -148,6 +148,11 @@ struct private_receiver_t {
 	 * Delay response messages?
 	 */
 	bool receive_delay_response;
+
+	/**
+	 * Parse payloads of received messages lazily?
+	 */
+	bool lazy_parsing;
 };
 
 /**
@@ -320,7 +325,7 @@ static bool cookie_required(private_receiver_t *this,
  */
 static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 {
-	u_int half_open;
+	u_int half_open, limit;
 	u_int32_t now;
 
 	now = time_monotonic(NULL);
@@ -378,17 +383,18 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 	}
 
 	/* check if global half open IKE_SA limit reached */
-	if (this->init_limit_half_open &&
-		half_open >= this->init_limit_half_open)
+	limit = settings_handle_get_int(this->init_limit_half_open, 0);
+	if (limit && half_open >= limit)
 	{
 		DBG1(DBG_NET, "ignoring IKE_SA setup from %H, half open IKE_SA "
 			 "count of %d exceeds limit of %d", message->get_source(message),
-			 half_open, this->init_limit_half_open);
+			 half_open, limit);
 		return TRUE;
 	}
 
 	/* check if job load acceptable */
-	if (this->init_limit_job_load)
+	limit = settings_handle_get_int(this->init_limit_job_load, 0);
+	if (limit)
 	{
 		u_int jobs = 0, i;
 
@@ -396,11 +402,11 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 		{
 			jobs += lib->processor->get_job_load(lib->processor, i);
 		}
-		if (jobs > this->init_limit_job_load)
+		if (jobs > limit)
 		{
 			DBG1(DBG_NET, "ignoring IKE_SA setup from %H, job load of %d "
 				 "exceeds limit of %d", message->get_source(message),
-				 jobs, this->init_limit_job_load);
+				 jobs, limit);
 			return TRUE;
 		}
 	}
@@ -484,6 +490,7 @@ static job_requeue_t receive_packets(private_receiver_t *this)
 
 	/* parse message header */
 	message = message_create_from_packet(packet);
+	message->set_lazy_parsing(message, this->lazy_parsing);
 	if (message->parse_header(message) != SUCCESS)
 	{
 		DBG1(DBG_NET, "received invalid IKE header from %H - ignored",
@@ -638,10 +645,10 @@ receiver_t *receiver_create()
 		this->block_threshold = lib->settings->get_int(lib->settings,
 				"%s.block_threshold", BLOCK_THRESHOLD_DEFAULT, charon->name);
 	}
-	this->init_limit_job_load = lib->settings->get_int(lib->settings,
-				"%s.init_limit_job_load", 0, charon->name);
-	this->init_limit_half_open = lib->settings->get_int(lib->settings,
-				"%s.init_limit_half_open", 0, charon->name);
+	this->init_limit_job_load = lib->settings->get_handle(lib->settings,
+				"%s.init_limit_job_load", charon->name);
+	this->init_limit_half_open = lib->settings->get_handle(lib->settings,
+				"%s.init_limit_half_open", charon->name);
 	this->receive_delay = lib->settings->get_int(lib->settings,
 				"%s.receive_delay", 0, charon->name);
 	this->receive_delay_type = lib->settings->get_int(lib->settings,
@@ -650,6 +657,8 @@ receiver_t *receiver_create()
 				"%s.receive_delay_request", TRUE, charon->name),
 	this->receive_delay_response = lib->settings->get_bool(lib->settings,
 				"%s.receive_delay_response", TRUE, charon->name),
+	this->lazy_parsing = lib->settings->get_bool(lib->settings,
+				"%s.lazy_parsing", FALSE, charon->name);
 
 	this->hasher = lib->crypto->create_hasher(lib->crypto, HASH_PREFERRED);
 	if (!this->hasher)
@@ -22,6 +22,7 @@
 
 #include <daemon.h>
 #include <threading/thread.h>
+#include <threading/mutex.h>
 #include <processing/jobs/callback_job.h>
 
 typedef struct private_android_service_t private_android_service_t;
@@ -41,6 +42,16 @@ struct private_android_service_t {
 	 */
 	ike_sa_t *ike_sa;
 
+	/**
+	 * CHILD_SA is up, initiation failures are not reported anymore
+	 */
+	bool established;
+
+	/**
+	 * lock for ike_sa and established, listener callbacks run concurrently
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * android credentials
 	 */
@@ -67,6 +78,21 @@ typedef enum {
 	VPN_ERROR_CONNECTION_LOST = 103,
 } android_vpn_errors_t;
 
+/**
+ * Check if an event is for the current IKE_SA, optionally only while it is
+ * being initiated
+ */
+static bool is_current(private_android_service_t *this, ike_sa_t *ike_sa,
+					   bool initiating)
+{
+	bool current;
+
+	this->mutex->lock(this->mutex);
+	current = this->ike_sa == ike_sa && (!initiating || !this->established);
+	this->mutex->unlock(this->mutex);
+	return current;
+}
+
 /**
  * send a status code back to the Android app
  */
@@ -79,9 +105,9 @@ static void send_status(private_android_service_t *this, u_char code)
 METHOD(listener_t, ike_updown, bool,
 	   private_android_service_t *this, ike_sa_t *ike_sa, bool up)
 {
-	/* this callback is only registered during initiation, so if the IKE_SA
+	/* this callback is only active during initiation, so if the IKE_SA
 	 * goes down we assume an authentication error */
-	if (this->ike_sa == ike_sa && !up)
+	if (!up && is_current(this, ike_sa, TRUE))
 	{
 		send_status(this, VPN_ERROR_AUTH);
 		return FALSE;
@@ -93,9 +119,9 @@ METHOD(listener_t, child_state_change, bool,
 	   private_android_service_t *this, ike_sa_t *ike_sa, child_sa_t *child_sa,
 	   child_sa_state_t state)
 {
-	/* this callback is only registered during initiation, so we still have
+	/* this callback is only active during initiation, so we still have
 	 * the control socket open */
-	if (this->ike_sa == ike_sa && state == CHILD_DESTROYING)
+	if (state == CHILD_DESTROYING && is_current(this, ike_sa, TRUE))
 	{
 		send_status(this, VPN_ERROR_CONNECTION_FAILED);
 		return FALSE;
@@ -116,13 +142,14 @@ METHOD(listener_t, child_updown, bool,
 	   private_android_service_t *this, ike_sa_t *ike_sa, child_sa_t *child_sa,
 	   bool up)
 {
-	if (this->ike_sa == ike_sa)
+	if (is_current(this, ike_sa, FALSE))
 	{
 		if (up)
 		{
 			/* disable the hooks registered to catch initiation failures */
-			this->public.listener.ike_updown = NULL;
-			this->public.listener.child_state_change = NULL;
+			this->mutex->lock(this->mutex);
+			this->established = TRUE;
+			this->mutex->unlock(this->mutex);
 			property_set("vpn.status", "ok");
 		}
 		else
@@ -146,10 +173,12 @@ METHOD(listener_t, child_updown, bool,
 METHOD(listener_t, ike_rekey, bool,
 	   private_android_service_t *this, ike_sa_t *old, ike_sa_t *new)
 {
+	this->mutex->lock(this->mutex);
 	if (this->ike_sa == old)
 	{
 		this->ike_sa = new;
 	}
+	this->mutex->unlock(this->mutex);
 	return TRUE;
 }
 
@@ -315,7 +344,9 @@ static job_requeue_t initiate(private_android_service_t *this)
 	peer_cfg->destroy(peer_cfg);
 
 	/* store the IKE_SA so we can track its progress */
+	this->mutex->lock(this->mutex);
 	this->ike_sa = ike_sa;
+	this->mutex->unlock(this->mutex);
 
 	/* confirm that we received the request */
 	send_status(this, i);
@@ -339,6 +370,7 @@ METHOD(android_service_t, destroy, void,
 {
 	charon->bus->remove_listener(charon->bus, &this->public.listener);
 	close(this->control);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -360,12 +392,14 @@ android_service_t *android_service_create(android_creds_t *creds)
 			.destroy = _destroy,
 		},
 		.creds = creds,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	this->control = android_get_control_socket("charon");
 	if (this->control == -1)
 	{
 		DBG1(DBG_CFG, "failed to get Android control socket");
+		this->mutex->destroy(this->mutex);
 		free(this);
 		return NULL;
 	}
@@ -375,6 +409,7 @@ android_service_t *android_service_create(android_creds_t *creds)
 		DBG1(DBG_CFG, "failed to listen on Android control socket: %s",
 			 strerror(errno));
 		close(this->control);
+		this->mutex->destroy(this->mutex);
 		free(this);
 		return NULL;
 	}
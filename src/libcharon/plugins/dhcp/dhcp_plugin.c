@@ -56,7 +56,6 @@ METHOD(plugin_t, destroy, void,
 	hydra->attributes->remove_provider(hydra->attributes,
 									   &this->provider->provider);
 	this->provider->destroy(this->provider);
-	this->socket->destroy(this->socket);
 	free(this);
 }
 
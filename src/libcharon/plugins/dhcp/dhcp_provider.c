@@ -15,10 +15,31 @@
 
 #include "dhcp_provider.h"
 
+#include <daemon.h>
 #include <collections/hashtable.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <processing/jobs/callback_job.h>
 
 typedef struct private_dhcp_provider_t private_dhcp_provider_t;
+typedef struct pending_t pending_t;
+typedef struct provider_listener_t provider_listener_t;
+
+/**
+ * Listener starting enrollments early
+ */
+struct provider_listener_t {
+
+	/**
+	 * Implements listener interface
+	 */
+	listener_t listener;
+
+	/**
+	 * Points to provider
+	 */
+	private_dhcp_provider_t *provider;
+};
 
 /**
  * Private data of an dhcp_provider_t object.
@@ -36,14 +57,70 @@ struct private_dhcp_provider_t {
 	hashtable_t *transactions;
 
 	/**
-	 * Lock for transactions
+	 * Enrollments started early, pending_t indexed by IKE_SA unique ID
+	 */
+	hashtable_t *pending;
+
+	/**
+	 * Lock for transactions and pending enrollments
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * Condvar to wait for pending enrollments
+	 */
+	condvar_t *condvar;
+
 	/**
 	 * DHCP communication socket
 	 */
 	dhcp_socket_t *socket;
+
+	/**
+	 * Listener to start enrollments after authentication
+	 */
+	provider_listener_t listener;
+};
+
+/**
+ * Enrollment started for an IKE_SA before its IKE_AUTH response gets built
+ */
+struct pending_t {
+
+	/**
+	 * Provider the enrollment belongs to
+	 */
+	private_dhcp_provider_t *this;
+
+	/**
+	 * Unique ID of the IKE_SA
+	 */
+	u_int32_t unique;
+
+	/**
+	 * IKE_SA to resume on completion, NULL if response not deferred
+	 */
+	ike_sa_id_t *ike_sa_id;
+
+	/**
+	 * Identity the enrollment is for
+	 */
+	identification_t *id;
+
+	/**
+	 * Completed transaction, NULL on failure
+	 */
+	dhcp_transaction_t *transaction;
+
+	/**
+	 * Enrollment completed
+	 */
+	bool done;
+
+	/**
+	 * IKE_SA gone before completion, release the lease
+	 */
+	bool orphaned;
 };
 
 /**
@@ -80,6 +157,64 @@ static uintptr_t hash_transaction(dhcp_transaction_t *transaction)
 						transaction->get_address(transaction));
 }
 
+/**
+ * Destroy a pending enrollment, releasing an unused lease
+ */
+static void pending_destroy(pending_t *pending)
+{
+	if (pending->transaction)
+	{
+		pending->this->socket->release(pending->this->socket,
+									   pending->transaction);
+		pending->transaction->destroy(pending->transaction);
+	}
+	DESTROY_IF(pending->ike_sa_id);
+	pending->id->destroy(pending->id);
+	free(pending);
+}
+
+/**
+ * Take the enrollment started for the current IKE_SA, if any, waits for its
+ * completion. Returns FALSE if none found for this identity.
+ */
+static bool take_pending(private_dhcp_provider_t *this, identification_t *id,
+						 dhcp_transaction_t **transaction)
+{
+	pending_t *pending;
+	ike_sa_t *ike_sa;
+
+	ike_sa = charon->bus->get_sa(charon->bus);
+	if (!ike_sa)
+	{
+		return FALSE;
+	}
+	this->mutex->lock(this->mutex);
+	pending = this->pending->remove(this->pending,
+							(void*)(uintptr_t)ike_sa->get_unique_id(ike_sa));
+	if (pending)
+	{
+		while (!pending->done)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!pending)
+	{
+		return FALSE;
+	}
+	if (!id->equals(id, pending->id))
+	{	/* identity changed in a later authentication round */
+		pending_destroy(pending);
+		return FALSE;
+	}
+	*transaction = pending->transaction;
+	pending->transaction = NULL;
+	pending_destroy(pending);
+	return TRUE;
+}
+
 METHOD(attribute_provider_t, acquire_address, host_t*,
 	private_dhcp_provider_t *this, linked_list_t *pools,
 	identification_t *id, host_t *requested)
@@ -100,7 +235,10 @@ METHOD(attribute_provider_t, acquire_address, host_t*,
 		{
 			continue;
 		}
-		transaction = this->socket->enroll(this->socket, id);
+		if (!take_pending(this, id, &transaction))
+		{
+			transaction = this->socket->enroll(this->socket, id);
+		}
 		if (!transaction)
 		{
 			continue;
@@ -184,21 +322,214 @@ METHOD(attribute_provider_t, create_attribute_enumerator, enumerator_t*,
 						(void*)this->mutex->unlock, this->mutex);
 }
 
+/**
+ * Check if a peer config uses the DHCP pool
+ */
+static bool has_dhcp_pool(peer_cfg_t *peer_cfg)
+{
+	enumerator_t *enumerator;
+	bool found = FALSE;
+	char *pool;
+
+	if (peer_cfg)
+	{
+		enumerator = peer_cfg->create_pool_enumerator(peer_cfg);
+		while (enumerator->enumerate(enumerator, &pool))
+		{
+			if (streq(pool, "dhcp"))
+			{
+				found = TRUE;
+				break;
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	return found;
+}
+
+/**
+ * Get the identity acquire_address() gets called with for an IKE_SA
+ */
+static identification_t *get_identity(ike_sa_t *ike_sa)
+{
+	identification_t *id;
+	auth_cfg_t *auth;
+
+	/* the current round is not yet in the completed authentication rounds */
+	auth = ike_sa->get_auth_cfg(ike_sa, FALSE);
+	id = auth->get(auth, AUTH_RULE_EAP_IDENTITY);
+	if (id && id->get_type(id) != ID_ANY)
+	{
+		return id;
+	}
+	return ike_sa->get_other_eap_id(ike_sa);
+}
+
+/**
+ * Resume an IKE_SA waiting for an enrollment
+ */
+static job_requeue_t resume(ike_sa_id_t *ike_sa_id)
+{
+	ike_sa_t *ike_sa;
+
+	ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager,
+											  ike_sa_id);
+	if (ike_sa)
+	{
+		if (ike_sa->resume_response(ike_sa) == DESTROY_ME)
+		{
+			charon->ike_sa_manager->checkin_and_destroy(
+												charon->ike_sa_manager, ike_sa);
+		}
+		else
+		{
+			charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+		}
+	}
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Asynchronous enrollment completed
+ */
+static void enrolled(pending_t *pending, dhcp_transaction_t *transaction)
+{
+	private_dhcp_provider_t *this = pending->this;
+	ike_sa_id_t *ike_sa_id;
+	bool orphaned;
+
+	this->mutex->lock(this->mutex);
+	pending->transaction = transaction;
+	pending->done = TRUE;
+	ike_sa_id = pending->ike_sa_id;
+	pending->ike_sa_id = NULL;
+	orphaned = pending->orphaned;
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+
+	if (orphaned)
+	{
+		pending_destroy(pending);
+	}
+	if (ike_sa_id)
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)resume, ike_sa_id,
+					(callback_job_cleanup_t)ike_sa_id->destroy, NULL));
+	}
+}
+
+METHOD(listener_t, authorize, bool,
+	provider_listener_t *listener, ike_sa_t *ike_sa, bool final, bool *success)
+{
+	private_dhcp_provider_t *this = listener->provider;
+	identification_t *id;
+	pending_t *pending;
+	u_int32_t unique;
+	bool resume = FALSE;
+
+	if (final || ike_sa->has_condition(ike_sa, COND_ORIGINAL_INITIATOR) ||
+		!has_dhcp_pool(ike_sa->get_peer_cfg(ike_sa)))
+	{
+		return TRUE;
+	}
+	unique = ike_sa->get_unique_id(ike_sa);
+
+	this->mutex->lock(this->mutex);
+	if (this->pending->get(this->pending, (void*)(uintptr_t)unique))
+	{	/* started in an earlier authentication round */
+		this->mutex->unlock(this->mutex);
+		return TRUE;
+	}
+	id = get_identity(ike_sa);
+	INIT(pending,
+		.this = this,
+		.unique = unique,
+		.id = id->clone(id),
+	);
+	if (ike_sa->defer_response(ike_sa))
+	{
+		pending->ike_sa_id = ike_sa->get_id(ike_sa);
+		pending->ike_sa_id = pending->ike_sa_id->clone(pending->ike_sa_id);
+	}
+	this->pending->put(this->pending, (void*)(uintptr_t)unique, pending);
+	this->mutex->unlock(this->mutex);
+
+	if (!this->socket->enroll_async(this->socket, pending->id,
+									(dhcp_enroll_cb_t)enrolled, pending))
+	{
+		this->mutex->lock(this->mutex);
+		pending->done = TRUE;
+		if (pending->ike_sa_id)
+		{
+			pending->ike_sa_id->destroy(pending->ike_sa_id);
+			pending->ike_sa_id = NULL;
+			resume = TRUE;
+		}
+		this->mutex->unlock(this->mutex);
+		if (resume)
+		{	/* still processing the request, the response gets built as usual */
+			ike_sa->resume_response(ike_sa);
+		}
+	}
+	return TRUE;
+}
+
+METHOD(listener_t, ike_state_change, bool,
+	provider_listener_t *listener, ike_sa_t *ike_sa, ike_sa_state_t state)
+{
+	private_dhcp_provider_t *this = listener->provider;
+	pending_t *pending;
+
+	if (state == IKE_DESTROYING)
+	{
+		this->mutex->lock(this->mutex);
+		pending = this->pending->remove(this->pending,
+							(void*)(uintptr_t)ike_sa->get_unique_id(ike_sa));
+		if (pending && !pending->done)
+		{	/* released once completed */
+			pending->orphaned = TRUE;
+			pending = NULL;
+		}
+		this->mutex->unlock(this->mutex);
+		if (pending)
+		{
+			pending_destroy(pending);
+		}
+	}
+	return TRUE;
+}
+
 METHOD(dhcp_provider_t, destroy, void,
 	private_dhcp_provider_t *this)
 {
 	enumerator_t *enumerator;
 	dhcp_transaction_t *value;
+	pending_t *pending;
 	void *key;
 
+	charon->bus->remove_listener(charon->bus, &this->listener.listener);
+	/* completes pending enrollments */
+	this->socket->destroy(this->socket);
+
 	enumerator = this->transactions->create_enumerator(this->transactions);
 	while (enumerator->enumerate(enumerator, &key, &value))
 	{
 		value->destroy(value);
 	}
 	enumerator->destroy(enumerator);
+	enumerator = this->pending->create_enumerator(this->pending);
+	while (enumerator->enumerate(enumerator, &key, &pending))
+	{	/* socket is gone, can't release the lease */
+		DESTROY_IF(pending->transaction);
+		pending->transaction = NULL;
+		pending_destroy(pending);
+	}
+	enumerator->destroy(enumerator);
 	this->transactions->destroy(this->transactions);
+	this->pending->destroy(this->pending);
 	this->mutex->destroy(this->mutex);
+	this->condvar->destroy(this->condvar);
 	free(this);
 }
 
@@ -219,9 +550,19 @@ dhcp_provider_t *dhcp_provider_create(dhcp_socket_t *socket)
 			.destroy = _destroy,
 		},
 		.socket = socket,
+		.listener = {
+			.listener = {
+				.authorize = _authorize,
+				.ike_state_change = _ike_state_change,
+			},
+		},
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.transactions = hashtable_create(hash, equals, 8),
+		.pending = hashtable_create(hash, equals, 8),
 	);
+	this->listener.provider = this;
+	charon->bus->add_listener(charon->bus, &this->listener.listener);
 
 	return &this->public;
 }
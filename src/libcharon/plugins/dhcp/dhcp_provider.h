@@ -29,6 +29,11 @@ typedef struct dhcp_provider_t dhcp_provider_t;
 
 /**
  * DHCP based attribute provider.
+ *
+ * To avoid blocking a worker thread while waiting for the DHCP server,
+ * enrollment starts as soon as a responder has authenticated a peer using a
+ * "dhcp" pool. The IKE_AUTH response is deferred until the enrollment
+ * completes, acquire_address() then returns the address immediately.
  */
 struct dhcp_provider_t {
 
@@ -46,7 +51,7 @@ struct dhcp_provider_t {
 /**
  * Create a dhcp_provider instance.
  *
- * @param socket		socket to use for DHCP communication
+ * @param socket		socket to use for DHCP communication, gets owned
  * @return				provider instance
  */
 dhcp_provider_t *dhcp_provider_create(dhcp_socket_t *socket);
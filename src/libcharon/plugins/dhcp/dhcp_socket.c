@@ -18,6 +18,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -26,10 +28,10 @@
 #include <linux/filter.h>
 
 #include <collections/linked_list.h>
+#include <collections/hashtable.h>
 #include <utils/identification.h>
 #include <threading/mutex.h>
 #include <threading/condvar.h>
-#include <threading/thread.h>
 
 #include <hydra.h>
 #include <daemon.h>
@@ -40,6 +42,48 @@
 #define DHCP_TRIES 5
 
 typedef struct private_dhcp_socket_t private_dhcp_socket_t;
+typedef struct entry_t entry_t;
+
+/**
+ * An outstanding DHCP transaction
+ */
+struct entry_t {
+
+	/**
+	 * Transaction, in DISCOVER or REQUEST
+	 */
+	dhcp_transaction_t *transaction;
+
+	/**
+	 * TRUE if REQUEST has been sent, DISCOVER otherwise
+	 */
+	bool request;
+
+	/**
+	 * Number of times the current message has been sent
+	 */
+	int tries;
+
+	/**
+	 * Time to retransmit or give up
+	 */
+	timeval_t timeout;
+
+	/**
+	 * Callback of an asynchronous enrollment, NULL if synchronous
+	 */
+	dhcp_enroll_cb_t cb;
+
+	/**
+	 * Data to pass to callback
+	 */
+	void *data;
+
+	/**
+	 * Synchronous enrollment completed
+	 */
+	bool done;
+};
 
 /**
  * Private data of an dhcp_socket_t object.
@@ -57,34 +101,39 @@ struct private_dhcp_socket_t {
 	rng_t *rng;
 
 	/**
-	 * List of transactions in DISCOVER
+	 * Outstanding transactions, entry_t indexed by transaction ID
 	 */
-	linked_list_t *discover;
+	hashtable_t *transactions;
 
 	/**
-	 * List of transactions in REQUEST
+	 * Lock for transactions
 	 */
-	linked_list_t *request;
+	mutex_t *mutex;
 
 	/**
-	 * List of successfully completed transactions
+	 * Condvar to signal completed synchronous enrollments and stopped job
 	 */
-	linked_list_t *completed;
+	condvar_t *condvar;
 
 	/**
-	 * Lock for transactions
+	 * Earliest timeout of all outstanding transactions
 	 */
-	mutex_t *mutex;
+	timeval_t next_timeout;
 
 	/**
-	 * Condvar to wait for transaction completion
+	 * Pipe to wake up the receiving job
 	 */
-	condvar_t *condvar;
+	int notify[2];
+
+	/**
+	 * Is the receiving job queued or running?
+	 */
+	bool running;
 
 	/**
-	 * Threads waiting in condvar
+	 * Stop the receiving job
 	 */
-	int waiting;
+	bool stopping;
 
 	/**
 	 * DHCP send socket
@@ -364,63 +413,172 @@ static bool request(private_dhcp_socket_t *this,
 	return TRUE;
 }
 
-METHOD(dhcp_socket_t, enroll, dhcp_transaction_t*,
-	private_dhcp_socket_t *this, identification_t *identity)
+/**
+ * Hashtable hash function
+ */
+static u_int hash(void *key)
 {
-	dhcp_transaction_t *transaction;
-	u_int32_t id;
-	int try;
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Wake up the receiving job
+ */
+static void notify(private_dhcp_socket_t *this)
+{
+	char c = 0;
 
-	if (!this->rng->get_bytes(this->rng, sizeof(id), (u_int8_t*)&id))
+	ignore_result(write(this->notify[1], &c, 1));
+}
+
+/**
+ * Set the timeout of a transaction after sending a message, requires the lock.
+ * Returns TRUE if it is the earliest of all transactions.
+ */
+static bool set_timeout(private_dhcp_socket_t *this, entry_t *entry)
+{
+	time_monotonic(&entry->timeout);
+	entry->timeout.tv_sec += entry->tries;
+	if (!timerisset(&this->next_timeout) ||
+		timercmp(&entry->timeout, &this->next_timeout, <))
 	{
-		DBG1(DBG_CFG, "DHCP DISCOVER failed, no transaction ID");
-		return NULL;
+		this->next_timeout = entry->timeout;
+		return TRUE;
 	}
-	transaction = dhcp_transaction_create(id, identity);
+	return FALSE;
+}
 
-	this->mutex->lock(this->mutex);
-	this->discover->insert_last(this->discover, transaction);
-	try = 1;
-	while (try <= DHCP_TRIES && discover(this, transaction))
+/**
+ * Complete a transaction removed from the table, requires the lock.
+ * Asynchronous enrollments get added to a list to invoke the callback later,
+ * without holding the lock.
+ */
+static void complete(private_dhcp_socket_t *this, entry_t *entry,
+					 bool success, linked_list_t *completed)
+{
+	if (!success)
+	{
+		entry->transaction->destroy(entry->transaction);
+		entry->transaction = NULL;
+	}
+	if (entry->cb)
+	{
+		completed->insert_last(completed, entry);
+	}
+	else
+	{
+		entry->done = TRUE;
+		this->condvar->broadcast(this->condvar);
+	}
+}
+
+/**
+ * Invoke the callbacks of completed asynchronous enrollments
+ */
+static void invoke_completed(linked_list_t *completed)
+{
+	entry_t *entry;
+
+	while (completed->remove_first(completed, (void**)&entry) == SUCCESS)
 	{
-		if (!this->condvar->timed_wait(this->condvar, this->mutex, 1000 * try) &&
-			this->request->find_first(this->request, NULL,
-									  (void**)&transaction) == SUCCESS)
+		entry->cb(entry->data, entry->transaction);
+		free(entry);
+	}
+	completed->destroy(completed);
+}
+
+/**
+ * Create a transaction and send DHCP DISCOVER, requires the lock
+ */
+static bool submit(private_dhcp_socket_t *this, entry_t *entry,
+				   identification_t *identity)
+{
+	u_int32_t id;
+
+	if (this->stopping)
+	{
+		return FALSE;
+	}
+	do
+	{
+		if (!this->rng->get_bytes(this->rng, sizeof(id), (u_int8_t*)&id))
 		{
-			break;
+			DBG1(DBG_CFG, "DHCP DISCOVER failed, no transaction ID");
+			return FALSE;
 		}
-		try++;
 	}
-	if (this->discover->remove(this->discover, transaction, NULL))
-	{	/* no OFFER received */
-		this->mutex->unlock(this->mutex);
-		transaction->destroy(transaction);
-		DBG1(DBG_CFG, "DHCP DISCOVER timed out");
-		return NULL;
+	while (!id || this->transactions->get(this->transactions,
+										  (void*)(uintptr_t)id));
+
+	entry->transaction = dhcp_transaction_create(id, identity);
+	if (!discover(this, entry->transaction))
+	{
+		entry->transaction->destroy(entry->transaction);
+		entry->transaction = NULL;
+		return FALSE;
+	}
+	entry->tries = 1;
+	this->transactions->put(this->transactions, (void*)(uintptr_t)id, entry);
+	if (set_timeout(this, entry))
+	{
+		notify(this);
 	}
+	return TRUE;
+}
 
-	try = 1;
-	while (try <= DHCP_TRIES && request(this, transaction))
+METHOD(dhcp_socket_t, enroll, dhcp_transaction_t*,
+	private_dhcp_socket_t *this, identification_t *identity)
+{
+	dhcp_transaction_t *transaction = NULL;
+	entry_t *entry;
+
+	INIT(entry);
+
+	this->mutex->lock(this->mutex);
+	if (submit(this, entry, identity))
 	{
-		if (!this->condvar->timed_wait(this->condvar, this->mutex, 1000 * try) &&
-			this->completed->remove(this->completed, transaction, NULL))
+		while (!entry->done)
 		{
-			break;
+			this->condvar->wait(this->condvar, this->mutex);
 		}
-		try++;
-	}
-	if (this->request->remove(this->request, transaction, NULL))
-	{	/* no ACK received */
-		this->mutex->unlock(this->mutex);
-		transaction->destroy(transaction);
-		DBG1(DBG_CFG, "DHCP REQUEST timed out");
-		return NULL;
+		transaction = entry->transaction;
 	}
 	this->mutex->unlock(this->mutex);
+	free(entry);
 
 	return transaction;
 }
 
+METHOD(dhcp_socket_t, enroll_async, bool,
+	private_dhcp_socket_t *this, identification_t *identity,
+	dhcp_enroll_cb_t cb, void *data)
+{
+	entry_t *entry;
+	bool success;
+
+	INIT(entry,
+		.cb = cb,
+		.data = data,
+	);
+
+	this->mutex->lock(this->mutex);
+	success = submit(this, entry, identity);
+	this->mutex->unlock(this->mutex);
+	if (!success)
+	{
+		free(entry);
+	}
+	return success;
+}
+
 METHOD(dhcp_socket_t, release, void,
 	private_dhcp_socket_t *this, dhcp_transaction_t *transaction)
 {
@@ -462,33 +620,25 @@ METHOD(dhcp_socket_t, release, void,
 /**
  * Handle a DHCP OFFER
  */
-static void handle_offer(private_dhcp_socket_t *this, dhcp_t *dhcp, int optlen)
+static void handle_offer(private_dhcp_socket_t *this, dhcp_t *dhcp, int optlen,
+						 linked_list_t *completed)
 {
-	dhcp_transaction_t *transaction = NULL;
-	enumerator_t *enumerator;
+	dhcp_transaction_t *transaction;
+	entry_t *entry;
 	host_t *offer, *server = NULL;
 
 	offer = host_create_from_chunk(AF_INET,
 					chunk_from_thing(dhcp->your_address), 0);
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->discover->create_enumerator(this->discover);
-	while (enumerator->enumerate(enumerator, &transaction))
-	{
-		if (transaction->get_id(transaction) == dhcp->transaction_id)
-		{
-			this->discover->remove_at(this->discover, enumerator);
-			this->request->insert_last(this->request, transaction);
-			break;
-		}
-	}
-	enumerator->destroy(enumerator);
-
-	if (transaction)
+	entry = this->transactions->get(this->transactions,
+									(void*)(uintptr_t)dhcp->transaction_id);
+	if (entry && !entry->request)
 	{
 		int optsize, optpos = 0, pos;
 		dhcp_option_t *option;
 
+		transaction = entry->transaction;
 		while (optlen > sizeof(dhcp_option_t))
 		{
 			option = (dhcp_option_t*)&dhcp->options[optpos];
@@ -523,46 +673,55 @@ static void handle_offer(private_dhcp_socket_t *this, dhcp_t *dhcp, int optlen)
 		DBG1(DBG_CFG, "received DHCP OFFER %H from %H", offer, server);
 		transaction->set_address(transaction, offer->clone(offer));
 		transaction->set_server(transaction, server);
+
+		entry->request = TRUE;
+		entry->tries = 1;
+		if (request(this, transaction))
+		{
+			set_timeout(this, entry);
+		}
+		else
+		{
+			this->transactions->remove(this->transactions,
+									(void*)(uintptr_t)dhcp->transaction_id);
+			complete(this, entry, FALSE, completed);
+		}
 	}
 	this->mutex->unlock(this->mutex);
-	this->condvar->broadcast(this->condvar);
 	offer->destroy(offer);
 }
 
 /**
  * Handle a DHCP ACK
  */
-static void handle_ack(private_dhcp_socket_t *this, dhcp_t *dhcp, int optlen)
+static void handle_ack(private_dhcp_socket_t *this, dhcp_t *dhcp, int optlen,
+					   linked_list_t *completed)
 {
-	dhcp_transaction_t *transaction;
-	enumerator_t *enumerator;
+	entry_t *entry;
 	host_t *offer;
 
 	offer = host_create_from_chunk(AF_INET,
 						chunk_from_thing(dhcp->your_address), 0);
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->request->create_enumerator(this->request);
-	while (enumerator->enumerate(enumerator, &transaction))
+	entry = this->transactions->get(this->transactions,
+									(void*)(uintptr_t)dhcp->transaction_id);
+	if (entry && entry->request)
 	{
-		if (transaction->get_id(transaction) == dhcp->transaction_id)
-		{
-			DBG1(DBG_CFG, "received DHCP ACK for %H", offer);
-			this->request->remove_at(this->request, enumerator);
-			this->completed->insert_last(this->completed, transaction);
-			break;
-		}
+		DBG1(DBG_CFG, "received DHCP ACK for %H", offer);
+		this->transactions->remove(this->transactions,
+								   (void*)(uintptr_t)dhcp->transaction_id);
+		complete(this, entry, TRUE, completed);
 	}
-	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
-	this->condvar->broadcast(this->condvar);
 	offer->destroy(offer);
 }
 
 /**
- * Receive DHCP responses
+ * Receive a DHCP response, returns FALSE if none available
  */
-static job_requeue_t receive_dhcp(private_dhcp_socket_t *this)
+static bool receive_response(private_dhcp_socket_t *this,
+							 linked_list_t *completed)
 {
 	struct sockaddr_ll addr;
 	socklen_t addr_len = sizeof(addr);
@@ -571,15 +730,16 @@ static job_requeue_t receive_dhcp(private_dhcp_socket_t *this)
 		struct udphdr udp;
 		dhcp_t dhcp;
 	} packet;
-	int oldstate, optlen, origoptlen, optsize, optpos = 0;
+	int optlen, origoptlen, optsize, optpos = 0;
 	ssize_t len;
 	dhcp_option_t *option;
 
-	oldstate = thread_cancelability(TRUE);
-	len = recvfrom(this->receive, &packet, sizeof(packet), 0,
-					(struct sockaddr*)&addr, &addr_len);
-	thread_cancelability(oldstate);
-
+	len = recvfrom(this->receive, &packet, sizeof(packet), MSG_DONTWAIT,
+				   (struct sockaddr*)&addr, &addr_len);
+	if (len < 0)
+	{
+		return FALSE;
+	}
 	if (len >= sizeof(struct iphdr) + sizeof(struct udphdr) +
 		offsetof(dhcp_t, options))
 	{
@@ -598,10 +758,10 @@ static job_requeue_t receive_dhcp(private_dhcp_socket_t *this)
 				switch (option->data[0])
 				{
 					case DHCP_OFFER:
-						handle_offer(this, &packet.dhcp, origoptlen);
+						handle_offer(this, &packet.dhcp, origoptlen, completed);
 						break;
 					case DHCP_ACK:
-						handle_ack(this, &packet.dhcp, origoptlen);
+						handle_ack(this, &packet.dhcp, origoptlen, completed);
 					default:
 						break;
 				}
@@ -611,16 +771,183 @@ static job_requeue_t receive_dhcp(private_dhcp_socket_t *this)
 			optpos += optsize;
 		}
 	}
+	return TRUE;
+}
+
+/**
+ * Retransmit or fail timed out transactions, requires the lock
+ */
+static void check_timeouts(private_dhcp_socket_t *this, timeval_t *now,
+						   linked_list_t *completed)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+	bool sent;
+
+	enumerator = this->transactions->create_enumerator(this->transactions);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		if (timercmp(&entry->timeout, now, <=))
+		{
+			sent = FALSE;
+			if (entry->tries < DHCP_TRIES)
+			{
+				if (entry->request)
+				{
+					sent = request(this, entry->transaction);
+				}
+				else
+				{
+					sent = discover(this, entry->transaction);
+				}
+			}
+			if (!sent)
+			{
+				DBG1(DBG_CFG, "DHCP %s timed out",
+					 entry->request ? "REQUEST" : "DISCOVER");
+				this->transactions->remove_at(this->transactions, enumerator);
+				complete(this, entry, FALSE, completed);
+				continue;
+			}
+			entry->tries++;
+			entry->timeout = *now;
+			entry->timeout.tv_sec += entry->tries;
+		}
+		if (!timerisset(&this->next_timeout) ||
+			timercmp(&entry->timeout, &this->next_timeout, <))
+		{
+			this->next_timeout = entry->timeout;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Receive DHCP responses and handle timeouts of outstanding transactions
+ */
+static job_requeue_t receive_dhcp(private_dhcp_socket_t *this)
+{
+	struct pollfd pfd[] = {
+		{ .fd = this->notify[0], .events = POLLIN, },
+		{ .fd = this->receive, .events = POLLIN, },
+	};
+	linked_list_t *completed;
+	timeval_t now;
+	int timeout = -1;
+	char buf[64];
+
+	this->mutex->lock(this->mutex);
+	if (this->stopping)
+	{
+		this->mutex->unlock(this->mutex);
+		return JOB_REQUEUE_NONE;
+	}
+	if (timerisset(&this->next_timeout))
+	{
+		time_monotonic(&now);
+		if (timercmp(&this->next_timeout, &now, >))
+		{
+			timersub(&this->next_timeout, &now, &now);
+			timeout = now.tv_sec * 1000 + now.tv_usec / 1000 + 1;
+		}
+		else
+		{
+			timeout = 0;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (poll(pfd, countof(pfd), timeout) < 0)
+	{
+		if (errno != EINTR)
+		{
+			DBG1(DBG_CFG, "waiting for DHCP messages failed: %s",
+				 strerror(errno));
+			sleep(1);
+		}
+		return JOB_REQUEUE_DIRECT;
+	}
+	if (pfd[0].revents & POLLIN)
+	{
+		while (read(this->notify[0], buf, sizeof(buf)) == sizeof(buf))
+		{
+			/* drain the pipe */
+		}
+	}
+
+	completed = linked_list_create();
+	if (pfd[1].revents & POLLIN)
+	{
+		while (receive_response(this, completed))
+		{
+			/* replies to many transactions may arrive in a burst */
+		}
+	}
+	this->mutex->lock(this->mutex);
+	time_monotonic(&now);
+	if (timerisset(&this->next_timeout) &&
+		timercmp(&this->next_timeout, &now, <=))
+	{
+		timerclear(&this->next_timeout);
+		check_timeouts(this, &now, completed);
+	}
+	this->mutex->unlock(this->mutex);
+	invoke_completed(completed);
 	return JOB_REQUEUE_DIRECT;
 }
 
+/**
+ * Stop the receiving job
+ */
+static bool cancel_receiving(private_dhcp_socket_t *this)
+{
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	notify(this);
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
+/**
+ * Receiving job terminated or got destroyed without being executed
+ */
+static void receiving_stopped(private_dhcp_socket_t *this)
+{
+	linked_list_t *completed;
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	completed = linked_list_create();
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	enumerator = this->transactions->create_enumerator(this->transactions);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		this->transactions->remove_at(this->transactions, enumerator);
+		complete(this, entry, FALSE, completed);
+	}
+	enumerator->destroy(enumerator);
+	this->running = FALSE;
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+
+	invoke_completed(completed);
+}
+
 METHOD(dhcp_socket_t, destroy, void,
 	private_dhcp_socket_t *this)
 {
-	while (this->waiting)
+	this->mutex->lock(this->mutex);
+	if (this->running)
 	{
-		this->condvar->signal(this->condvar);
+		this->stopping = TRUE;
+		notify(this);
+		while (this->running)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
 	}
+	this->mutex->unlock(this->mutex);
 	if (this->send > 0)
 	{
 		close(this->send);
@@ -629,14 +956,14 @@ METHOD(dhcp_socket_t, destroy, void,
 	{
 		close(this->receive);
 	}
+	if (this->notify[0] != -1)
+	{
+		close(this->notify[0]);
+		close(this->notify[1]);
+	}
 	this->mutex->destroy(this->mutex);
 	this->condvar->destroy(this->condvar);
-	this->discover->destroy_offset(this->discover,
-								offsetof(dhcp_transaction_t, destroy));
-	this->request->destroy_offset(this->request,
-								offsetof(dhcp_transaction_t, destroy));
-	this->completed->destroy_offset(this->completed,
-								offsetof(dhcp_transaction_t, destroy));
+	this->transactions->destroy(this->transactions);
 	DESTROY_IF(this->rng);
 	DESTROY_IF(this->dst);
 	free(this);
@@ -692,15 +1019,15 @@ dhcp_socket_t *dhcp_socket_create()
 	INIT(this,
 		.public = {
 			.enroll = _enroll,
+			.enroll_async = _enroll_async,
 			.release = _release,
 			.destroy = _destroy,
 		},
 		.rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
-		.discover = linked_list_create(),
-		.request = linked_list_create(),
-		.completed = linked_list_create(),
+		.transactions = hashtable_create(hash, equals, 8),
+		.notify = { -1, -1 },
 	);
 
 	if (!this->rng)
@@ -767,9 +1094,22 @@ dhcp_socket_t *dhcp_socket_create()
 		return NULL;
 	}
 
+	if (pipe(this->notify) != 0)
+	{
+		DBG1(DBG_CFG, "creating DHCP notification pipe failed: %s",
+			 strerror(errno));
+		this->notify[0] = this->notify[1] = -1;
+		destroy(this);
+		return NULL;
+	}
+	fcntl(this->notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(this->notify[1], F_SETFL, O_NONBLOCK);
+
+	this->running = TRUE;
 	lib->processor->queue_job(lib->processor,
 		(job_t*)callback_job_create_with_prio((callback_job_cb_t)receive_dhcp,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+			this, (callback_job_cleanup_t)receiving_stopped,
+			(callback_job_cancel_t)cancel_receiving, JOB_PRIO_CRITICAL));
 
 	return &this->public;
 }
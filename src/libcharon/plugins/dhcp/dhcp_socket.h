@@ -26,7 +26,19 @@ typedef struct dhcp_socket_t dhcp_socket_t;
 #include "dhcp_transaction.h"
 
 /**
- * DHCP socket implementation
+ * Callback function invoked for a completed asynchronous enrollment.
+ *
+ * @param data			user data passed to dhcp_socket_t.enroll_async()
+ * @param transaction	completed transaction, gets owned; NULL on failure
+ */
+typedef void (*dhcp_enroll_cb_t)(void *data, dhcp_transaction_t *transaction);
+
+/**
+ * DHCP socket implementation.
+ *
+ * Any number of transactions may be outstanding, they are tracked by
+ * transaction ID. Replies are received and retransmits sent from a single
+ * job.
  */
 struct dhcp_socket_t {
 
@@ -39,6 +51,21 @@ struct dhcp_socket_t {
 	dhcp_transaction_t* (*enroll)(dhcp_socket_t *this,
 								  identification_t *identity);
 
+	/**
+	 * Enroll a client address using DHCP, invoke a callback on completion.
+	 *
+	 * Like enroll(), but does not block the calling thread. The callback
+	 * is invoked from a job once the ACK has been received, or the server
+	 * did not respond to any retransmit of DISCOVER or REQUEST.
+	 *
+	 * @param identity		peer identity to enroll an address for
+	 * @param cb			callback function to invoke on completion
+	 * @param data			data to pass to callback
+	 * @return				TRUE if DISCOVER sent
+	 */
+	bool (*enroll_async)(dhcp_socket_t *this, identification_t *identity,
+						 dhcp_enroll_cb_t cb, void *data);
+
 	/**
 	 * Release an enrolled DHCP address.
 	 *
@@ -164,13 +164,17 @@ static eap_peap_t *eap_peap_create(private_eap_peap_t * this,
 	frag_size = lib->settings->get_int(lib->settings,
 					"%s.plugins.eap-peap.fragment_size", MAX_FRAGMENT_LEN,
 					charon->name);
+	if (!frag_size)
+	{	/* use the largest fragments the path MTU to the peer allows */
+		frag_size = eap_method_get_max_size() ?: MAX_FRAGMENT_LEN;
+	}
 	max_msg_count = lib->settings->get_int(lib->settings,
 					"%s.plugins.eap-peap.max_message_count", MAX_MESSAGE_COUNT,
 					charon->name);
 	include_length = lib->settings->get_bool(lib->settings,
 					"%s.plugins.eap-peap.include_length", FALSE, charon->name);
 	tls = tls_create(is_server, server, peer, TLS_PURPOSE_EAP_PEAP,
-					 application, NULL);
+					 application, tls_eap_get_cache(EAP_PEAP));
 	this->tls_eap = tls_eap_create(EAP_PEAP, tls, frag_size, max_msg_count,
 												  include_length);
 	if (!this->tls_eap)
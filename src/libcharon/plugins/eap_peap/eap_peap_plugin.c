@@ -18,6 +18,7 @@
 #include "eap_peap.h"
 
 #include <daemon.h>
+#include <tls_eap.h>
 
 METHOD(plugin_t, get_name, char*,
 	eap_peap_plugin_t *this)
@@ -50,6 +51,7 @@ METHOD(plugin_t, get_features, int,
 METHOD(plugin_t, destroy, void,
 	eap_peap_plugin_t *this)
 {
+	tls_eap_destroy_cache(EAP_PEAP);
 	free(this);
 }
 
@@ -68,5 +70,7 @@ plugin_t *eap_peap_plugin_create()
 		},
 	);
 
+	tls_eap_create_cache(EAP_PEAP, "%s.plugins.eap-peap", charon->name);
+
 	return &this->plugin;
 }
@@ -21,8 +21,10 @@
 #include <radius_client.h>
 
 #include <daemon.h>
+#include <processing/jobs/callback_job.h>
 
 typedef struct private_eap_radius_t private_eap_radius_t;
+typedef struct pending_t pending_t;
 
 /**
  * Private data of an eap_radius_t object.
@@ -83,8 +85,142 @@ struct private_eap_radius_t {
 	 * Handle the Filter-Id attribute as IPsec CHILD_SA name?
 	 */
 	bool filter_id;
+
+	/**
+	 * Request sent asynchronously the IKE response got deferred for
+	 */
+	pending_t *pending;
+};
+
+/**
+ * Request sent asynchronously, shared with the job resuming the IKE_SA
+ */
+struct pending_t {
+
+	/**
+	 * IKE_SA to resume once the response has been received
+	 */
+	ike_sa_id_t *ike_sa_id;
+
+	/**
+	 * Copy of the received response, NULL if the server did not respond
+	 */
+	radius_message_t *response;
+
+	/**
+	 * Reference count, held by the method and the outstanding request
+	 */
+	refcount_t ref;
 };
 
+/**
+ * Release a reference to a pending request
+ */
+static void pending_destroy(pending_t *pending)
+{
+	if (ref_put(&pending->ref))
+	{
+		pending->ike_sa_id->destroy(pending->ike_sa_id);
+		DESTROY_IF(pending->response);
+		free(pending);
+	}
+}
+
+/**
+ * Resume the IKE_SA a response has been received for
+ */
+static job_requeue_t resume(pending_t *pending)
+{
+	ike_sa_t *ike_sa;
+
+	ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager,
+											  pending->ike_sa_id);
+	if (ike_sa)
+	{
+		if (ike_sa->resume_response(ike_sa) == DESTROY_ME)
+		{
+			charon->ike_sa_manager->checkin_and_destroy(
+												charon->ike_sa_manager, ike_sa);
+		}
+		else
+		{
+			charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+		}
+	}
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Response to an asynchronous request received, resume the IKE_SA in a job
+ */
+static void response_received(pending_t *pending, radius_message_t *req,
+							  radius_message_t *res)
+{
+	if (res)
+	{	/* the response gets destroyed after we return */
+		pending->response = radius_message_parse(res->get_encoding(res));
+	}
+	lib->processor->queue_job(lib->processor,
+		(job_t*)callback_job_create((callback_job_cb_t)resume, pending,
+				(callback_job_cleanup_t)pending_destroy, NULL));
+}
+
+/**
+ * Send a RADIUS request, gets owned.
+ *
+ * If the IKE_SA supports it, the IKE response gets deferred and the request
+ * is sent asynchronously instead of blocking the thread. In that case NULL is
+ * returned and deferred is set, the method gets invoked again once the
+ * response has been received.
+ */
+static radius_message_t *send_request(private_eap_radius_t *this,
+									  radius_message_t *request, bool *deferred)
+{
+	radius_message_t *response;
+	pending_t *pending;
+	ike_sa_t *ike_sa;
+
+	*deferred = FALSE;
+	ike_sa = charon->bus->get_sa(charon->bus);
+	if (ike_sa && ike_sa->defer_response(ike_sa))
+	{
+		INIT(pending,
+			.ike_sa_id = ike_sa->get_id(ike_sa),
+			.ref = 2,
+		);
+		pending->ike_sa_id = pending->ike_sa_id->clone(pending->ike_sa_id);
+		if (this->client->request_async(this->client, request,
+									(radius_callback_t)response_received, pending))
+		{
+			this->pending = pending;
+			*deferred = TRUE;
+			return NULL;
+		}
+		/* still processing the request, the response gets built as usual */
+		ike_sa->resume_response(ike_sa);
+		pending->ike_sa_id->destroy(pending->ike_sa_id);
+		free(pending);
+		return NULL;
+	}
+	response = this->client->request(this->client, request);
+	request->destroy(request);
+	return response;
+}
+
+/**
+ * Get the response to a request the IKE response got deferred for
+ */
+static radius_message_t *get_pending(private_eap_radius_t *this)
+{
+	radius_message_t *response;
+
+	response = this->pending->response;
+	this->pending->response = NULL;
+	pending_destroy(this->pending);
+	this->pending = NULL;
+	return response;
+}
+
 /**
  * Add EAP-Identity to RADIUS message
  */
@@ -161,23 +297,36 @@ METHOD(eap_method_t, initiate, status_t,
 	radius_message_t *request, *response;
 	status_t status = FAILED;
 	chunk_t username;
+	bool deferred;
 
-	request = radius_message_create(RMC_ACCESS_REQUEST);
-	username = chunk_create(this->id_prefix, strlen(this->id_prefix));
-	username = chunk_cata("cc", username, this->peer->get_encoding(this->peer));
-	request->add(request, RAT_USER_NAME, username);
-
-	if (this->eap_start)
+	if (this->pending)
 	{
-		request->add(request, RAT_EAP_MESSAGE, chunk_empty);
+		response = get_pending(this);
 	}
 	else
 	{
-		add_eap_identity(this, request);
-	}
-	eap_radius_forward_from_ike(request);
+		request = radius_message_create(RMC_ACCESS_REQUEST);
+		username = chunk_create(this->id_prefix, strlen(this->id_prefix));
+		username = chunk_cata("cc", username,
+							  this->peer->get_encoding(this->peer));
+		request->add(request, RAT_USER_NAME, username);
 
-	response = this->client->request(this->client, request);
+		if (this->eap_start)
+		{
+			request->add(request, RAT_EAP_MESSAGE, chunk_empty);
+		}
+		else
+		{
+			add_eap_identity(this, request);
+		}
+		eap_radius_forward_from_ike(request);
+
+		response = send_request(this, request, &deferred);
+		if (deferred)
+		{
+			return NEED_MORE;
+		}
+	}
 	if (response)
 	{
 		eap_radius_forward_to_ike(response);
@@ -205,7 +354,6 @@ METHOD(eap_method_t, initiate, status_t,
 	{
 		charon->bus->alert(charon->bus, ALERT_RADIUS_NOT_RESPONDING);
 	}
-	request->destroy(request);
 	return status;
 }
 
@@ -333,23 +481,36 @@ METHOD(eap_method_t, process, status_t,
 	radius_message_t *request, *response;
 	status_t status = FAILED;
 	chunk_t data;
+	bool deferred;
 
-	request = radius_message_create(RMC_ACCESS_REQUEST);
-	request->add(request, RAT_USER_NAME, this->peer->get_encoding(this->peer));
-	data = in->get_data(in);
-	DBG3(DBG_IKE, "%N payload %B", eap_type_names, this->type, &data);
-
-	/* fragment data suitable for RADIUS */
-	while (data.len > MAX_RADIUS_ATTRIBUTE_SIZE)
+	if (this->pending)
 	{
-		request->add(request, RAT_EAP_MESSAGE,
-					 chunk_create(data.ptr,MAX_RADIUS_ATTRIBUTE_SIZE));
-		data = chunk_skip(data, MAX_RADIUS_ATTRIBUTE_SIZE);
+		response = get_pending(this);
 	}
-	request->add(request, RAT_EAP_MESSAGE, data);
+	else
+	{
+		request = radius_message_create(RMC_ACCESS_REQUEST);
+		request->add(request, RAT_USER_NAME,
+					 this->peer->get_encoding(this->peer));
+		data = in->get_data(in);
+		DBG3(DBG_IKE, "%N payload %B", eap_type_names, this->type, &data);
+
+		/* fragment data suitable for RADIUS */
+		while (data.len > MAX_RADIUS_ATTRIBUTE_SIZE)
+		{
+			request->add(request, RAT_EAP_MESSAGE,
+						 chunk_create(data.ptr,MAX_RADIUS_ATTRIBUTE_SIZE));
+			data = chunk_skip(data, MAX_RADIUS_ATTRIBUTE_SIZE);
+		}
+		request->add(request, RAT_EAP_MESSAGE, data);
 
-	eap_radius_forward_from_ike(request);
-	response = this->client->request(this->client, request);
+		eap_radius_forward_from_ike(request);
+		response = send_request(this, request, &deferred);
+		if (deferred)
+		{
+			return NEED_MORE;
+		}
+	}
 	if (response)
 	{
 		eap_radius_forward_to_ike(response);
@@ -386,7 +547,6 @@ METHOD(eap_method_t, process, status_t,
 		}
 		response->destroy(response);
 	}
-	request->destroy(request);
 	return status;
 }
 
@@ -441,6 +601,10 @@ METHOD(eap_method_t, destroy, void,
 {
 	this->peer->destroy(this->peer);
 	this->server->destroy(this->server);
+	if (this->pending)
+	{
+		pending_destroy(this->pending);
+	}
 	this->client->destroy(this->client);
 	free(this);
 }
@@ -23,6 +23,7 @@
 #include <daemon.h>
 #include <collections/hashtable.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
 
 typedef struct private_eap_radius_accounting_t private_eap_radius_accounting_t;
 
@@ -42,10 +43,20 @@ struct private_eap_radius_accounting_t {
 	hashtable_t *sessions;
 
 	/**
-	 * Mutex to lock sessions
+	 * Mutex to lock sessions and outstanding requests
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * Condvar to signal completed requests
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Number of requests waiting for a response
+	 */
+	u_int outstanding;
+
 	/**
 	 * Session ID prefix
 	 */
@@ -117,31 +128,100 @@ static void update_usage(private_eap_radius_accounting_t *this,
 }
 
 /**
- * Send a RADIUS message, wait for response
+ * Context for an accounting request
+ */
+typedef struct {
+	/** accounting instance */
+	private_eap_radius_accounting_t *this;
+	/** IKE_SA unique id */
+	uintptr_t id;
+	/** entry added for an accounting start, NULL for other messages */
+	entry_t *entry;
+} request_t;
+
+/**
+ * Remove a session not acknowledged by the server, unless it has been
+ * replaced or stopped already
+ */
+static void remove_session(private_eap_radius_accounting_t *this,
+						   uintptr_t id, entry_t *started)
+{
+	entry_t *entry;
+
+	this->mutex->lock(this->mutex);
+	entry = this->sessions->get(this->sessions, (void*)id);
+	if (entry == started)
+	{
+		this->sessions->remove(this->sessions, (void*)id);
+		free(entry);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Handle the response to an accounting request
+ */
+static void response_received(request_t *request, radius_message_t *req,
+							  radius_message_t *res)
+{
+	private_eap_radius_accounting_t *this = request->this;
+
+	if (!res)
+	{
+		charon->bus->alert(charon->bus, ALERT_RADIUS_NOT_RESPONDING);
+	}
+	if ((!res || res->get_code(res) != RMC_ACCOUNTING_RESPONSE) &&
+		request->entry)
+	{
+		remove_session(this, request->id, request->entry);
+	}
+	free(request);
+
+	this->mutex->lock(this->mutex);
+	this->outstanding--;
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Send a RADIUS message, handle the response asynchronously
  */
-static bool send_message(private_eap_radius_accounting_t *this,
-						 radius_message_t *request)
+static void send_message(private_eap_radius_accounting_t *this,
+						 radius_message_t *message, uintptr_t id,
+						 entry_t *entry)
 {
-	radius_message_t *response;
 	radius_client_t *client;
-	bool ack = FALSE;
+	request_t *request;
 
 	client = eap_radius_create_client();
 	if (client)
 	{
-		response = client->request(client, request);
-		if (response)
+		INIT(request,
+			.this = this,
+			.id = id,
+			.entry = entry,
+		);
+		this->mutex->lock(this->mutex);
+		this->outstanding++;
+		this->mutex->unlock(this->mutex);
+		/* send all messages of a session over the same socket, so a Stop
+		 * can't overtake the Start */
+		client->pin_socket(client, id);
+		if (!client->request_async(client, message,
+								(radius_callback_t)response_received, request))
 		{
-			ack = response->get_code(response) == RMC_ACCOUNTING_RESPONSE;
-			response->destroy(response);
+			response_received(request, NULL, NULL);
 		}
-		else
+		client->destroy(client);
+	}
+	else
+	{
+		if (entry)
 		{
-			charon->bus->alert(charon->bus, ALERT_RADIUS_NOT_RESPONDING);
+			remove_session(this, id, entry);
 		}
-		client->destroy(client);
+		message->destroy(message);
 	}
-	return ack;
 }
 
 /**
@@ -187,7 +267,7 @@ static void add_ike_sa_parameters(radius_message_t *message, ike_sa_t *ike_sa)
 static void send_start(private_eap_radius_accounting_t *this, ike_sa_t *ike_sa)
 {
 	radius_message_t *message;
-	entry_t *entry;
+	entry_t *entry, *existing;
 	u_int32_t id, value;
 
 	id = ike_sa->get_unique_id(ike_sa);
@@ -202,14 +282,14 @@ static void send_start(private_eap_radius_accounting_t *this, ike_sa_t *ike_sa)
 	message->add(message, RAT_ACCT_SESSION_ID,
 				 chunk_create(entry->sid, strlen(entry->sid)));
 	add_ike_sa_parameters(message, ike_sa);
-	if (send_message(this, message))
-	{
-		this->mutex->lock(this->mutex);
-		entry = this->sessions->put(this->sessions, (void*)(uintptr_t)id, entry);
-		this->mutex->unlock(this->mutex);
-	}
-	message->destroy(message);
-	free(entry);
+
+	/* add the session now, it gets removed if the server does not ack it */
+	this->mutex->lock(this->mutex);
+	existing = this->sessions->put(this->sessions, (void*)(uintptr_t)id, entry);
+	this->mutex->unlock(this->mutex);
+	free(existing);
+
+	send_message(this, message, id, entry);
 }
 
 /**
@@ -252,8 +332,7 @@ static void send_stop(private_eap_radius_accounting_t *this, ike_sa_t *ike_sa)
 		value = htonl(time_monotonic(NULL) - entry->created);
 		message->add(message, RAT_ACCT_SESSION_TIME, chunk_from_thing(value));
 
-		send_message(this, message);
-		message->destroy(message);
+		send_message(this, message, id, NULL);
 		free(entry);
 	}
 }
@@ -324,6 +403,15 @@ METHOD(listener_t, child_updown, bool,
 METHOD(eap_radius_accounting_t, destroy, void,
 	private_eap_radius_accounting_t *this)
 {
+	/* callbacks of outstanding requests reference us, wait until they
+	 * complete or fail */
+	this->mutex->lock(this->mutex);
+	while (this->outstanding)
+	{
+		this->condvar->wait(this->condvar, this->mutex);
+	}
+	this->mutex->unlock(this->mutex);
+	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
 	this->sessions->destroy(this->sessions);
 	free(this);
@@ -351,6 +439,7 @@ eap_radius_accounting_t *eap_radius_accounting_create()
 		.sessions = hashtable_create((hashtable_hash_t)hash,
 									 (hashtable_equals_t)equals, 32),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	return &this->public;
@@ -146,12 +146,17 @@ static eap_tls_t *eap_tls_create(identification_t *server,
 	frag_size = lib->settings->get_int(lib->settings,
 					"%s.plugins.eap-tls.fragment_size", MAX_FRAGMENT_LEN,
 					charon->name);
+	if (!frag_size)
+	{	/* use the largest fragments the path MTU to the peer allows */
+		frag_size = eap_method_get_max_size() ?: MAX_FRAGMENT_LEN;
+	}
 	max_msg_count = lib->settings->get_int(lib->settings,
 					"%s.plugins.eap-tls.max_message_count", MAX_MESSAGE_COUNT,
 					charon->name);
 	include_length = lib->settings->get_bool(lib->settings,
 					"%s.plugins.eap-tls.include_length", TRUE, charon->name);
-	tls = tls_create(is_server, server, peer, TLS_PURPOSE_EAP_TLS, NULL, NULL);
+	tls = tls_create(is_server, server, peer, TLS_PURPOSE_EAP_TLS, NULL,
+					 tls_eap_get_cache(EAP_TLS));
 	this->tls_eap = tls_eap_create(EAP_TLS, tls, frag_size, max_msg_count,
 												 include_length);
 	if (!this->tls_eap)
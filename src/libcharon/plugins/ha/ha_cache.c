@@ -18,9 +18,33 @@
 #include <collections/hashtable.h>
 #include <collections/linked_list.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
 #include <processing/jobs/callback_job.h>
 
 typedef struct private_ha_cache_t private_ha_cache_t;
+typedef struct resync_t resync_t;
+
+/**
+ * State of a streaming resync of a single segment
+ */
+struct resync_t {
+	/* snapshot of cached messages to send, a linked_list_t per IKE_SA */
+	linked_list_t *snapshot;
+	/* IDs of IKE_SAs to rekey once all chunks are sent, ike_sa_id_t */
+	linked_list_t *rekey;
+	/* number of IKE_SAs in the snapshot or rekey list */
+	u_int total;
+	/* number of IKE_SAs sent to the other node */
+	u_int synced;
+	/* number of IKE_SAs rekeyed */
+	u_int rekeyed;
+	/* sequence number of the last chunk sent */
+	u_int32_t seq;
+	/* sequence number of the last chunk acknowledged */
+	u_int32_t acked;
+	/* time the last chunk has been sent */
+	time_t sent;
+};
 
 /**
  * Private data of an ha_cache_t object.
@@ -56,6 +80,51 @@ struct private_ha_cache_t {
 	 * Mutex to lock cache
 	 */
 	mutex_t *mutex;
+
+	/**
+	 * Signaled when a job referencing the cache gets destroyed
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Number of queued, scheduled or running jobs referencing this cache
+	 */
+	u_int jobs;
+
+	/**
+	 * TRUE if the cache is being destroyed, jobs must not reschedule
+	 */
+	bool stopping;
+
+	/**
+	 * TRUE if destroy() left freeing the cache to the last pending job
+	 */
+	bool orphaned;
+
+	/**
+	 * Active streaming resyncs, indexed by segment
+	 */
+	resync_t *resyncs[SEGMENTS_MAX + 1];
+
+	/**
+	 * Number of IKE_SAs to resync/rekey per chunk
+	 */
+	u_int chunk_size;
+
+	/**
+	 * Number of unacknowledged chunks to send before waiting for an ACK
+	 */
+	u_int window;
+
+	/**
+	 * Delay between chunks, in ms
+	 */
+	u_int interval;
+
+	/**
+	 * Time to wait for a chunk acknowledgement, in s
+	 */
+	u_int timeout;
 };
 
 /**
@@ -245,9 +314,9 @@ static status_t rekey_children(ike_sa_t *ike_sa)
 }
 
 /**
- * Trigger rekeying of CHILD_SA in segment
+ * Collect the IDs of all established IKE_SAs in a segment
  */
-static void rekey_segment(private_ha_cache_t *this, u_int segment)
+static linked_list_t *collect_segment(private_ha_cache_t *this, u_int segment)
 {
 	ike_sa_t *ike_sa;
 	enumerator_t *enumerator;
@@ -269,8 +338,18 @@ static void rekey_segment(private_ha_cache_t *this, u_int segment)
 		}
 	}
 	enumerator->destroy(enumerator);
+	return list;
+}
+
+/**
+ * Trigger rekeying of the CHILD_SAs of a list of IKE_SAs, destroys the list
+ */
+static void rekey_list(linked_list_t *list)
+{
+	ike_sa_t *ike_sa;
+	ike_sa_id_t *id;
 
-	while (list->remove_last(list, (void**)&id) == SUCCESS)
+	while (list->remove_first(list, (void**)&id) == SUCCESS)
 	{
 		ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager, id);
 		if (ike_sa)
@@ -291,47 +370,382 @@ static void rekey_segment(private_ha_cache_t *this, u_int segment)
 	list->destroy(list);
 }
 
-METHOD(ha_cache_t, resync, void,
-	private_ha_cache_t *this, u_int segment)
+/**
+ * Destroy a list of snapshotted messages of an IKE_SA
+ */
+static void messages_destroy(linked_list_t *messages)
+{
+	messages->destroy_offset(messages, offsetof(ha_message_t, destroy));
+}
+
+/**
+ * Destroy a resync state
+ */
+static void resync_destroy(resync_t *resync)
+{
+	resync->snapshot->destroy_function(resync->snapshot,
+									   (void*)messages_destroy);
+	if (resync->rekey)
+	{
+		resync->rekey->destroy_offset(resync->rekey,
+									  offsetof(ike_sa_id_t, destroy));
+	}
+	free(resync);
+}
+
+/**
+ * Add a copy of a cached message to a snapshot list
+ */
+static void snapshot_message(linked_list_t *messages, ha_message_t *message)
+{
+	message = ha_message_parse(message->get_encoding(message));
+	if (message)
+	{
+		messages->insert_last(messages, message);
+	}
+}
+
+/**
+ * Snapshot the cached messages of all IKE_SAs in a segment, mutex must be held
+ */
+static u_int snapshot_segment(private_ha_cache_t *this, u_int segment,
+							  linked_list_t *snapshot)
 {
 	enumerator_t *enumerator, *updates;
+	linked_list_t *messages;
+	ha_message_t *message;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
-	ha_message_t *message;
-
-	DBG1(DBG_CFG, "resyncing HA segment %d", segment);
+	u_int count = 0;
 
-	this->mutex->lock(this->mutex);
 	enumerator = this->cache->create_enumerator(this->cache);
 	while (enumerator->enumerate(enumerator, &ike_sa, &entry))
 	{
 		if (entry->segment == segment)
 		{
-			this->socket->push(this->socket, entry->add);
+			messages = linked_list_create();
+			snapshot_message(messages, entry->add);
 			updates = entry->updates->create_enumerator(entry->updates);
 			while (updates->enumerate(updates, &message))
 			{
-				this->socket->push(this->socket, message);
+				snapshot_message(messages, message);
 			}
 			updates->destroy(updates);
 			if (entry->midi)
 			{
-				this->socket->push(this->socket, entry->midi);
+				snapshot_message(messages, entry->midi);
 			}
 			if (entry->midr)
 			{
-				this->socket->push(this->socket, entry->midr);
+				snapshot_message(messages, entry->midr);
 			}
 			if (entry->iv)
 			{
-				this->socket->push(this->socket, entry->iv);
+				snapshot_message(messages, entry->iv);
 			}
+			snapshot->insert_last(snapshot, messages);
+			count++;
 		}
 	}
 	enumerator->destroy(enumerator);
+	return count;
+}
+
+/**
+ * Data passed to resync streaming jobs
+ */
+typedef struct {
+	/* cache to stream from */
+	private_ha_cache_t *this;
+	/* segment to stream */
+	u_int segment;
+} resync_job_t;
+
+static job_requeue_t stream_resync(resync_job_t *job);
+
+/**
+ * Release a job reference to the cache, invoked when a job gets destroyed,
+ * whether it has been executed or not
+ */
+static void job_destroy(private_ha_cache_t *this)
+{
+	this->mutex->lock(this->mutex);
+	if (--this->jobs == 0 && this->orphaned)
+	{
+		this->mutex->unlock(this->mutex);
+		this->condvar->destroy(this->condvar);
+		this->mutex->destroy(this->mutex);
+		free(this);
+		return;
+	}
+	this->condvar->signal(this->condvar);
 	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Cleanup function for resync streaming jobs
+ */
+static void resync_job_destroy(resync_job_t *job)
+{
+	job_destroy(job->this);
+	free(job);
+}
+
+/**
+ * Schedule the next step of a streaming resync, mutex must be held
+ */
+static void schedule_resync(private_ha_cache_t *this, u_int segment, u_int ms)
+{
+	resync_job_t *job;
 
-	rekey_segment(this, segment);
+	if (this->stopping)
+	{
+		return;
+	}
+	INIT(job,
+		.this = this,
+		.segment = segment,
+	);
+	this->jobs++;
+	lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
+			callback_job_create_with_prio((callback_job_cb_t)stream_resync,
+						job, (callback_job_cleanup_t)resync_job_destroy, NULL,
+						JOB_PRIO_HIGH), ms);
+}
+
+/**
+ * Start a job referencing the cache, locks the mutex unless the cache is
+ * being destroyed
+ */
+static bool job_start(private_ha_cache_t *this)
+{
+	this->mutex->lock(this->mutex);
+	if (this->stopping)
+	{
+		this->mutex->unlock(this->mutex);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Send the next chunk of a segment snapshot, mutex must be held
+ */
+static void send_chunk(private_ha_cache_t *this, u_int segment,
+					   resync_t *resync)
+{
+	linked_list_t *messages;
+	ha_message_t *message;
+	u_int i;
+
+	for (i = 0; i < this->chunk_size &&
+		 resync->snapshot->remove_first(resync->snapshot,
+										(void**)&messages) == SUCCESS; i++)
+	{
+		while (messages->remove_first(messages, (void**)&message) == SUCCESS)
+		{
+			this->socket->push(this->socket, message);
+			message->destroy(message);
+		}
+		messages->destroy(messages);
+		resync->synced++;
+	}
+
+	message = ha_message_create(HA_RESYNC_MARK);
+	message->add_attribute(message, HA_SEGMENT, segment);
+	message->add_attribute(message, HA_RESYNC_SEQ, ++resync->seq);
+	this->socket->push(this->socket, message);
+	message->destroy(message);
+	resync->sent = time_monotonic(NULL);
+
+	DBG2(DBG_CFG, "sent HA resync chunk %u of segment %d, %u/%u IKE_SAs",
+		 resync->seq, segment, resync->synced, resync->total);
+}
+
+/**
+ * Check if the resync has to wait for acknowledgements, mutex must be held
+ */
+static bool waiting_for_ack(private_ha_cache_t *this, u_int segment,
+							resync_t *resync, u_int32_t window)
+{
+	if (resync->seq - resync->acked < window)
+	{
+		return FALSE;
+	}
+	if (time_monotonic(NULL) - resync->sent < this->timeout)
+	{
+		return TRUE;
+	}
+	DBG1(DBG_CFG, "HA resync chunk %u of segment %d not acknowledged, "
+		 "continuing", resync->acked + 1, segment);
+	resync->acked = resync->seq;
+	return FALSE;
+}
+
+/**
+ * Job streaming a segment resync in chunks, rekeying it afterwards
+ */
+static job_requeue_t stream_resync(resync_job_t *job)
+{
+	private_ha_cache_t *this = job->this;
+	u_int segment = job->segment;
+	linked_list_t *list;
+	resync_t *resync;
+	ike_sa_id_t *id;
+	bool done;
+	u_int i;
+
+	if (!job_start(this))
+	{
+		return JOB_REQUEUE_NONE;
+	}
+	resync = this->resyncs[segment];
+	if (resync->snapshot->get_count(resync->snapshot))
+	{
+		if (!waiting_for_ack(this, segment, resync, this->window))
+		{
+			send_chunk(this, segment, resync);
+		}
+		schedule_resync(this, segment, this->interval);
+		this->mutex->unlock(this->mutex);
+		return JOB_REQUEUE_NONE;
+	}
+	if (waiting_for_ack(this, segment, resync, 1))
+	{	/* rekey only after the other node has processed all chunks */
+		schedule_resync(this, segment, this->interval);
+		this->mutex->unlock(this->mutex);
+		return JOB_REQUEUE_NONE;
+	}
+	if (!resync->rekey)
+	{
+		/* we can't hold the mutex while enumerating IKE_SAs, as it is acquired
+		 * by the bus hooks while IKE_SAs are checked out */
+		this->mutex->unlock(this->mutex);
+		list = collect_segment(this, segment);
+		this->mutex->lock(this->mutex);
+		resync = this->resyncs[segment];
+		if (this->stopping || resync->snapshot->get_count(resync->snapshot) ||
+			resync->rekey)
+		{	/* resync got restarted in the mean time */
+			list->destroy_offset(list, offsetof(ike_sa_id_t, destroy));
+			schedule_resync(this, segment, this->interval);
+			this->mutex->unlock(this->mutex);
+			return JOB_REQUEUE_NONE;
+		}
+		resync->rekey = list;
+		resync->total = list->get_count(list);
+	}
+
+	list = linked_list_create();
+	for (i = 0; i < this->chunk_size &&
+		 resync->rekey->remove_first(resync->rekey, (void**)&id) == SUCCESS; i++)
+	{
+		list->insert_last(list, id);
+		resync->rekeyed++;
+	}
+	done = resync->rekey->get_count(resync->rekey) == 0;
+	if (done)
+	{
+		DBG1(DBG_CFG, "HA resync of segment %d complete, %u IKE_SAs synced, "
+			 "%u rekeyed", segment, resync->synced, resync->rekeyed);
+		this->resyncs[segment] = NULL;
+		resync_destroy(resync);
+	}
+	this->mutex->unlock(this->mutex);
+
+	rekey_list(list);
+
+	this->mutex->lock(this->mutex);
+	if (!done)
+	{
+		schedule_resync(this, segment, this->interval);
+	}
+	this->mutex->unlock(this->mutex);
+	return JOB_REQUEUE_NONE;
+}
+
+METHOD(ha_cache_t, resync, void,
+	private_ha_cache_t *this, u_int segment)
+{
+	resync_t *resync;
+	bool start = FALSE;
+
+	if (segment < 1 || segment > this->count)
+	{
+		return;
+	}
+
+	DBG1(DBG_CFG, "resyncing HA segment %d", segment);
+
+	this->mutex->lock(this->mutex);
+	resync = this->resyncs[segment];
+	if (resync)
+	{	/* restart an active resync, keeping the chunk sequence numbers */
+		resync->snapshot->destroy_function(resync->snapshot,
+										   (void*)messages_destroy);
+		if (resync->rekey)
+		{
+			resync->rekey->destroy_offset(resync->rekey,
+										  offsetof(ike_sa_id_t, destroy));
+			resync->rekey = NULL;
+		}
+		resync->synced = resync->rekeyed = 0;
+	}
+	else
+	{
+		INIT(resync);
+		this->resyncs[segment] = resync;
+		start = TRUE;
+	}
+	resync->snapshot = linked_list_create();
+	resync->total = snapshot_segment(this, segment, resync->snapshot);
+	if (start)
+	{
+		schedule_resync(this, segment, 0);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(ha_cache_t, ack, void,
+	private_ha_cache_t *this, u_int segment, u_int32_t seq)
+{
+	resync_t *resync;
+
+	if (segment < 1 || segment > this->count)
+	{
+		return;
+	}
+	this->mutex->lock(this->mutex);
+	resync = this->resyncs[segment];
+	if (resync && seq > resync->acked && seq <= resync->seq)
+	{
+		resync->acked = seq;
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(ha_cache_t, get_progress, bool,
+	private_ha_cache_t *this, u_int segment, u_int *synced, u_int *rekeyed,
+	u_int *total)
+{
+	resync_t *resync;
+	bool active = FALSE;
+
+	if (segment < 1 || segment > this->count)
+	{
+		return FALSE;
+	}
+	this->mutex->lock(this->mutex);
+	resync = this->resyncs[segment];
+	if (resync)
+	{
+		*synced = resync->synced;
+		*rekeyed = resync->rekeyed;
+		*total = resync->total;
+		active = TRUE;
+	}
+	this->mutex->unlock(this->mutex);
+	return active;
 }
 
 /**
@@ -342,6 +756,12 @@ static job_requeue_t request_resync(private_ha_cache_t *this)
 	ha_message_t *message;
 	int i;
 
+	if (!job_start(this))
+	{
+		return JOB_REQUEUE_NONE;
+	}
+	this->mutex->unlock(this->mutex);
+
 	DBG1(DBG_CFG, "requesting HA resynchronization");
 
 	message = ha_message_create(HA_RESYNC);
@@ -357,7 +777,36 @@ static job_requeue_t request_resync(private_ha_cache_t *this)
 METHOD(ha_cache_t, destroy, void,
 	private_ha_cache_t *this)
 {
+	int i;
+
+	/* jobs check the flag before they access the cache, wait until the ones
+	 * scheduled or running got destroyed. Jobs never run once the processor
+	 * has been terminated, which is the case when plugins get unloaded during
+	 * shutdown. Such jobs get destroyed later, the last one frees the cache */
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	while (this->jobs &&
+		   lib->processor->get_total_threads(lib->processor))
+	{
+		this->condvar->wait(this->condvar, this->mutex);
+	}
+	for (i = 0; i <= SEGMENTS_MAX; i++)
+	{
+		if (this->resyncs[i])
+		{
+			resync_destroy(this->resyncs[i]);
+			this->resyncs[i] = NULL;
+		}
+	}
 	this->cache->destroy(this->cache);
+	if (this->jobs)
+	{
+		this->orphaned = TRUE;
+		this->mutex->unlock(this->mutex);
+		return;
+	}
+	this->mutex->unlock(this->mutex);
+	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -375,6 +824,8 @@ ha_cache_t *ha_cache_create(ha_kernel_t *kernel, ha_socket_t *socket,
 			.cache = _cache,
 			.delete = _delete_,
 			.resync = _resync,
+			.ack = _ack,
+			.get_progress = _get_progress,
 			.destroy = _destroy,
 		},
 		.count = count,
@@ -382,14 +833,29 @@ ha_cache_t *ha_cache_create(ha_kernel_t *kernel, ha_socket_t *socket,
 		.socket = socket,
 		.cache = hashtable_create(hash, equals, 8),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.chunk_size = max(1, lib->settings->get_int(lib->settings,
+								"%s.plugins.ha.resync_chunk_size", 100,
+								charon->name)),
+		.window = max(1, lib->settings->get_int(lib->settings,
+								"%s.plugins.ha.resync_window", 4,
+								charon->name)),
+		.interval = lib->settings->get_int(lib->settings,
+								"%s.plugins.ha.resync_interval", 20,
+								charon->name),
+		.timeout = lib->settings->get_int(lib->settings,
+								"%s.plugins.ha.resync_timeout", 5,
+								charon->name),
 	);
 
 	if (sync)
 	{
 		/* request a resync as soon as we are up */
+		this->jobs++;
 		lib->scheduler->schedule_job(lib->scheduler, (job_t*)
 			callback_job_create_with_prio((callback_job_cb_t)request_resync,
-									this, NULL, NULL, JOB_PRIO_CRITICAL), 1);
+						this, (callback_job_cleanup_t)job_destroy, NULL,
+						JOB_PRIO_CRITICAL), 1);
 	}
 	return &this->public;
 }
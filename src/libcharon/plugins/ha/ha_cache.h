@@ -54,10 +54,35 @@ struct ha_cache_t {
 	/**
 	 * Resync a segment to the node using the cached messages.
 	 *
+	 * The cached messages of the segment get snapshotted and are streamed
+	 * to the other node in rate limited chunks, each terminated by a
+	 * HA_RESYNC_MARK the other node acknowledges. Once all chunks have been
+	 * sent, the CHILD_SAs in the segment get rekeyed in chunks, too.
+	 *
 	 * @param segment		segment to resync
 	 */
 	void (*resync)(ha_cache_t *this, u_int segment);
 
+	/**
+	 * Handle the acknowledgement of a resync chunk by the other node.
+	 *
+	 * @param segment		segment the acknowledged chunk belongs to
+	 * @param seq			sequence number of the acknowledged chunk
+	 */
+	void (*ack)(ha_cache_t *this, u_int segment, u_int32_t seq);
+
+	/**
+	 * Get the progress of an active resync of a segment.
+	 *
+	 * @param segment		segment to query
+	 * @param synced		number of IKE_SAs sent to the other node
+	 * @param rekeyed		number of IKE_SAs rekeyed
+	 * @param total			number of IKE_SAs in the segment snapshot
+	 * @return				TRUE if a resync of segment is in progress
+	 */
+	bool (*get_progress)(ha_cache_t *this, u_int segment, u_int *synced,
+						 u_int *rekeyed, u_int *total);
+
 	/**
 	 * Destroy a ha_cache_t.
 	 */
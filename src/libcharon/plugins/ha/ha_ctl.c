@@ -50,6 +50,25 @@ struct private_ha_ctl_t {
 	ha_cache_t *cache;
 };
 
+/**
+ * Log the progress of a segment resync
+ */
+static void log_progress(private_ha_ctl_t *this, u_int segment)
+{
+	u_int synced, rekeyed, total;
+
+	if (this->cache->get_progress(this->cache, segment, &synced, &rekeyed,
+								  &total))
+	{
+		DBG1(DBG_CFG, "HA resync of segment %d: %u/%u IKE_SAs synced, "
+			 "%u rekeyed", segment, synced, total, rekeyed);
+	}
+	else
+	{
+		DBG1(DBG_CFG, "no HA resync of segment %d active", segment);
+	}
+}
+
 /**
  * FIFO dispatching function
  */
@@ -87,6 +106,9 @@ static job_requeue_t dispatch_fifo(private_ha_ctl_t *this)
 				case '*':
 					this->cache->resync(this->cache, segment);
 					break;
+				case '?':
+					log_progress(this, segment);
+					break;
 				default:
 					break;
 			}
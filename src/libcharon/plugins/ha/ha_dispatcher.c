@@ -980,6 +980,83 @@ static void process_resync(private_ha_dispatcher_t *this,
 	message->destroy(message);
 }
 
+/**
+ * Process messages of type RESYNC_MARK, acknowledge the processed chunk
+ */
+static void process_resync_mark(private_ha_dispatcher_t *this,
+								ha_message_t *message)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	u_int16_t segment = 0;
+	u_int32_t seq = 0;
+
+	enumerator = message->create_attribute_enumerator(message);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		switch (attribute)
+		{
+			case HA_SEGMENT:
+				segment = value.u16;
+				break;
+			case HA_RESYNC_SEQ:
+				seq = value.u32;
+				break;
+			default:
+				break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	message->destroy(message);
+
+	if (segment && seq)
+	{
+		/* messages are processed in order, so the whole chunk is done */
+		message = ha_message_create(HA_RESYNC_ACK);
+		message->add_attribute(message, HA_SEGMENT, segment);
+		message->add_attribute(message, HA_RESYNC_SEQ, seq);
+		this->socket->push(this->socket, message);
+		message->destroy(message);
+	}
+}
+
+/**
+ * Process messages of type RESYNC_ACK
+ */
+static void process_resync_ack(private_ha_dispatcher_t *this,
+							   ha_message_t *message)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	u_int16_t segment = 0;
+	u_int32_t seq = 0;
+
+	enumerator = message->create_attribute_enumerator(message);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		switch (attribute)
+		{
+			case HA_SEGMENT:
+				segment = value.u16;
+				break;
+			case HA_RESYNC_SEQ:
+				seq = value.u32;
+				break;
+			default:
+				break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	message->destroy(message);
+
+	if (segment && seq)
+	{
+		this->cache->ack(this->cache, segment, seq);
+	}
+}
+
 /**
  * Dispatcher job function
  */
@@ -1033,6 +1110,12 @@ static job_requeue_t dispatch(private_ha_dispatcher_t *this)
 		case HA_RESYNC:
 			process_resync(this, message);
 			break;
+		case HA_RESYNC_MARK:
+			process_resync_mark(this, message);
+			break;
+		case HA_RESYNC_ACK:
+			process_resync_ack(this, message);
+			break;
 		default:
 			DBG1(DBG_CFG, "received unknown HA message type %d", type);
 			message->destroy(message);
@@ -46,7 +46,7 @@ struct private_ha_message_t {
 	chunk_t buf;
 };
 
-ENUM(ha_message_type_names, HA_IKE_ADD, HA_IKE_IV,
+ENUM(ha_message_type_names, HA_IKE_ADD, HA_RESYNC_ACK,
 	"IKE_ADD",
 	"IKE_UPDATE",
 	"IKE_MID_INITIATOR",
@@ -59,6 +59,8 @@ ENUM(ha_message_type_names, HA_IKE_ADD, HA_IKE_IV,
 	"STATUS",
 	"RESYNC",
 	"IKE_IV",
+	"RESYNC_MARK",
+	"RESYNC_ACK",
 );
 
 typedef struct ike_sa_id_encoding_t ike_sa_id_encoding_t;
@@ -254,6 +256,7 @@ METHOD(ha_message_t, add_attribute, void,
 		case HA_INBOUND_SPI:
 		case HA_OUTBOUND_SPI:
 		case HA_MID:
+		case HA_RESYNC_SEQ:
 		{
 			u_int32_t val;
 
@@ -475,6 +478,7 @@ METHOD(enumerator_t, attribute_enumerate, bool,
 		case HA_INBOUND_SPI:
 		case HA_OUTBOUND_SPI:
 		case HA_MID:
+		case HA_RESYNC_SEQ:
 		{
 			if (this->buf.len < sizeof(u_int32_t))
 			{
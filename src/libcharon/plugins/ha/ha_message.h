@@ -65,6 +65,10 @@ enum ha_message_type_t {
 	HA_RESYNC,
 	/** IV synchronization for IKEv1 Main/Aggressive mode */
 	HA_IKE_IV,
+	/** marks the end of a chunk of resync messages for a segment */
+	HA_RESYNC_MARK,
+	/** acknowledges a processed chunk of resync messages */
+	HA_RESYNC_ACK,
 };
 
 /**
@@ -154,6 +158,8 @@ enum ha_message_attribute_t {
 	HA_PSK,
 	/** chunk_t, IV for next IKEv1 message */
 	HA_IV,
+	/** u_int32_t, sequence number of a resync chunk */
+	HA_RESYNC_SEQ,
 };
 
 /**
@@ -16,9 +16,76 @@
 #include "load_tester_listener.h"
 
 #include <signal.h>
+#include <stdio.h>
+#include <errno.h>
 
 #include <daemon.h>
+#include <collections/hashtable.h>
+#include <threading/mutex.h>
 #include <processing/jobs/delete_ike_sa_job.h>
+#include <processing/jobs/rekey_ike_sa_job.h>
+
+/**
+ * Number of histogram buckets, bucket n counts latencies below 2^(n+1) us
+ */
+#define BUCKETS 32
+
+/**
+ * Phases we measure latencies for
+ */
+typedef enum {
+	/** IKE_SA_INIT round trip time */
+	PHASE_IKE_SA_INIT,
+	/** first IKE_AUTH request until IKE_SA is established */
+	PHASE_IKE_AUTH,
+	/** response received until CHILD_SA is installed */
+	PHASE_CHILD_SA,
+	/** first IKE_SA_INIT request until IKE_SA is established */
+	PHASE_SETUP,
+	PHASE_MAX,
+} phase_t;
+
+/**
+ * Names of phases, as used in the report
+ */
+static char *phase_names[] = {
+	"IKE_SA_INIT",
+	"IKE_AUTH",
+	"CHILD_SA",
+	"setup",
+};
+
+/**
+ * Latency histogram of a phase
+ */
+typedef struct {
+	/** number of samples */
+	u_int count;
+	/** sum of all samples, in us */
+	u_int64_t sum;
+	/** largest sample, in us */
+	u_int max;
+	/** samples per logarithmic bucket */
+	u_int buckets[BUCKETS];
+} histogram_t;
+
+/**
+ * Timestamps of an IKE_SA we initiated
+ */
+typedef struct {
+	/** unique IKE_SA identifier */
+	u_int32_t id;
+	/** first IKE_SA_INIT request sent */
+	timeval_t init;
+	/** last IKE_SA_INIT request sent */
+	timeval_t request;
+	/** first IKE_AUTH request sent */
+	timeval_t auth;
+	/** response setting up a CHILD_SA received */
+	timeval_t child;
+	/** setup has been completed, successfully or not */
+	bool done;
+} entry_t;
 
 typedef struct private_load_tester_listener_t private_load_tester_listener_t;
 
@@ -55,16 +122,369 @@ struct private_load_tester_listener_t {
 	 * Configuration backend
 	 */
 	load_tester_config_t *config;
+
+	/**
+	 * Seconds until an established IKE_SA gets rekeyed or deleted
+	 */
+	u_int lifetime;
+
+	/**
+	 * Percentage of IKE_SAs to rekey after lifetime
+	 */
+	u_int rekey_ratio;
+
+	/**
+	 * Percentage of IKE_SAs to delete after lifetime
+	 */
+	u_int delete_ratio;
+
+	/**
+	 * File to write the CSV latency report to, if any
+	 */
+	char *report;
+
+	/**
+	 * Timestamps of initiated IKE_SAs, u_int32_t => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * Latency histograms, by phase_t
+	 */
+	histogram_t histograms[PHASE_MAX];
+
+	/**
+	 * First IKE_SA_INIT request sent
+	 */
+	timeval_t first;
+
+	/**
+	 * Last IKE_SA established
+	 */
+	timeval_t last;
+
+	/**
+	 * Number of initiated IKE_SAs neither established nor destroyed yet
+	 */
+	u_int pending;
+
+	/**
+	 * All initiators completed their iterations
+	 */
+	bool completed;
+
+	/**
+	 * Report has been written
+	 */
+	bool reported;
+
+	/**
+	 * Lock for counters, entries, histograms and timestamps
+	 */
+	mutex_t *mutex;
 };
 
+/**
+ * Hashtable hash function
+ */
+static u_int hash(u_int32_t *key)
+{
+	return chunk_hash(chunk_from_thing(*key));
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals(u_int32_t *a, u_int32_t *b)
+{
+	return *a == *b;
+}
+
+/**
+ * Upper bound of a histogram bucket, in us
+ */
+static u_int64_t bucket_limit(u_int bucket)
+{
+	return 2ULL << bucket;
+}
+
+/**
+ * Add the latency from start to now to the histogram of a phase
+ */
+static void add_sample(private_load_tester_listener_t *this, phase_t phase,
+					   timeval_t *start, timeval_t *now)
+{
+	histogram_t *histogram = &this->histograms[phase];
+	u_int64_t us;
+	u_int bucket = 0;
+
+	if (!timerisset(start))
+	{
+		return;
+	}
+	us = (now->tv_sec - start->tv_sec) * 1000000LL +
+		 now->tv_usec - start->tv_usec;
+	while (bucket < BUCKETS - 1 && us >= bucket_limit(bucket))
+	{
+		bucket++;
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += us;
+	histogram->max = max(histogram->max, min(us, UINT_MAX));
+}
+
+/**
+ * Get the upper bound of the bucket containing a percentile
+ */
+static u_int64_t percentile(histogram_t *histogram, u_int percent)
+{
+	u_int64_t count = 0;
+	u_int bucket;
+
+	for (bucket = 0; bucket < BUCKETS - 1; bucket++)
+	{
+		count += histogram->buckets[bucket];
+		if (count * 100 >= (u_int64_t)histogram->count * percent)
+		{
+			break;
+		}
+	}
+	return bucket_limit(bucket);
+}
+
+/**
+ * Rekey or delete an established IKE_SA after its lifetime, as configured
+ */
+static void schedule_action(private_load_tester_listener_t *this,
+							ike_sa_id_t *id)
+{
+	job_t *job = NULL;
+	u_int roll;
+
+	if (!this->rekey_ratio && !this->delete_ratio)
+	{
+		return;
+	}
+	roll = random() % 100;
+	if (roll < this->rekey_ratio)
+	{
+		job = (job_t*)rekey_ike_sa_job_create(id, FALSE);
+	}
+	else if (roll < this->rekey_ratio + this->delete_ratio)
+	{
+		job = (job_t*)delete_ike_sa_job_create(id, TRUE);
+	}
+	if (job)
+	{
+		if (this->lifetime)
+		{
+			lib->scheduler->schedule_job(lib->scheduler, job, this->lifetime);
+		}
+		else
+		{
+			lib->processor->queue_job(lib->processor, job);
+		}
+	}
+}
+
+/**
+ * Log a latency summary and write the CSV report
+ */
+static void write_report(private_load_tester_listener_t *this)
+{
+	histogram_t *histogram;
+	u_int64_t ms;
+	FILE *out = NULL;
+	int phase, bucket, last;
+
+	if (this->report)
+	{
+		out = fopen(this->report, "w");
+		if (!out)
+		{
+			DBG1(DBG_CFG, "opening load-test report '%s' failed: %s",
+				 this->report, strerror(errno));
+		}
+		else
+		{
+			fprintf(out, "phase,upper_us,count\n");
+		}
+	}
+
+	this->mutex->lock(this->mutex);
+	histogram = &this->histograms[PHASE_SETUP];
+	if (histogram->count && timercmp(&this->last, &this->first, >))
+	{
+		ms = (this->last.tv_sec - this->first.tv_sec) * 1000LL +
+			 (this->last.tv_usec - this->first.tv_usec) / 1000;
+		DBG1(DBG_CFG, "load-test established %u IKE_SAs in %llu ms, %llu/s",
+			 histogram->count, ms, histogram->count * 1000ULL / max(ms, 1));
+	}
+	for (phase = 0; phase < PHASE_MAX; phase++)
+	{
+		histogram = &this->histograms[phase];
+		if (!histogram->count)
+		{
+			continue;
+		}
+		DBG1(DBG_CFG, "load-test %s latency: %u samples, avg %llu us, "
+			 "max %u us, p50 < %llu us, p90 < %llu us, p99 < %llu us",
+			 phase_names[phase], histogram->count,
+			 histogram->sum / histogram->count, histogram->max,
+			 percentile(histogram, 50), percentile(histogram, 90),
+			 percentile(histogram, 99));
+		if (out)
+		{
+			for (last = BUCKETS - 1; !histogram->buckets[last]; last--)
+			{
+				/* skip empty buckets at the end */
+			}
+			for (bucket = 0; bucket <= last; bucket++)
+			{
+				fprintf(out, "%s,%llu,%u\n", phase_names[phase],
+						bucket_limit(bucket), histogram->buckets[bucket]);
+			}
+		}
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (out)
+	{
+		fclose(out);
+	}
+}
+
+/**
+ * Check if a completed test has no setups pending, marks it reported if so.
+ * Must be called with the mutex held.
+ */
+static bool check_report(private_load_tester_listener_t *this)
+{
+	if (this->completed && !this->pending && !this->reported)
+	{
+		this->reported = TRUE;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Count an initiated IKE_SA as no longer pending, returns TRUE if the test
+ * is complete and should be reported.
+ * Must be called with the mutex held.
+ */
+static bool setup_done(private_load_tester_listener_t *this, entry_t *entry)
+{
+	if (entry && !entry->done)
+	{
+		entry->done = TRUE;
+		this->pending--;
+		return check_report(this);
+	}
+	return FALSE;
+}
+
+METHOD(listener_t, message_hook, bool,
+	private_load_tester_listener_t *this, ike_sa_t *ike_sa, message_t *message,
+	bool incoming, bool plain)
+{
+	ike_sa_id_t *id = ike_sa->get_id(ike_sa);
+	u_int32_t unique;
+	entry_t *entry;
+	timeval_t now;
+	bool request;
+
+	if (!plain || !id->is_initiator(id))
+	{
+		return TRUE;
+	}
+	time_monotonic(&now);
+	unique = ike_sa->get_unique_id(ike_sa);
+	request = message->get_request(message);
+
+	this->mutex->lock(this->mutex);
+	entry = this->entries->get(this->entries, &unique);
+	switch (message->get_exchange_type(message))
+	{
+		case IKE_SA_INIT:
+			if (!incoming && request)
+			{
+				if (!entry)
+				{
+					INIT(entry,
+						.id = unique,
+						.init = now,
+					);
+					this->entries->put(this->entries, &entry->id, entry);
+					this->pending++;
+					if (!timerisset(&this->first))
+					{
+						this->first = now;
+					}
+				}
+				entry->request = now;
+			}
+			else if (incoming && !request && entry)
+			{
+				add_sample(this, PHASE_IKE_SA_INIT, &entry->request, &now);
+			}
+			break;
+		case IKE_AUTH:
+			if (!incoming && request && entry && !timerisset(&entry->auth))
+			{
+				entry->auth = now;
+			}
+			/* FALL */
+		case CREATE_CHILD_SA:
+			if (incoming && !request && entry)
+			{
+				entry->child = now;
+			}
+			break;
+		default:
+			break;
+	}
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
 METHOD(listener_t, ike_updown, bool,
 	private_load_tester_listener_t *this, ike_sa_t *ike_sa, bool up)
 {
 	if (up)
 	{
 		ike_sa_id_t *id = ike_sa->get_id(ike_sa);
+		u_int32_t unique;
+		entry_t *entry;
+		timeval_t now;
+		u_int established;
+		bool done;
+
+		this->mutex->lock(this->mutex);
+		established = ++this->established;
+		this->mutex->unlock(this->mutex);
 
-		this->established++;
+		if (id->is_initiator(id))
+		{
+			time_monotonic(&now);
+			unique = ike_sa->get_unique_id(ike_sa);
+			this->mutex->lock(this->mutex);
+			entry = this->entries->get(this->entries, &unique);
+			if (entry)
+			{
+				add_sample(this, PHASE_IKE_AUTH, &entry->auth, &now);
+				add_sample(this, PHASE_SETUP, &entry->init, &now);
+				this->last = now;
+			}
+			done = setup_done(this, entry);
+			this->mutex->unlock(this->mutex);
+			if (done)
+			{
+				write_report(this);
+			}
+			schedule_action(this, id);
+		}
 
 		if (this->delete_after_established)
 		{
@@ -74,7 +494,7 @@ METHOD(listener_t, ike_updown, bool,
 
 		if (id->is_initiator(id))
 		{
-			if (this->shutdown_on == this->established)
+			if (this->shutdown_on == established)
 			{
 				DBG1(DBG_CFG, "load-test complete, raising SIGTERM");
 				kill(0, SIGTERM);
@@ -83,7 +503,33 @@ METHOD(listener_t, ike_updown, bool,
 	}
 	else
 	{
+		this->mutex->lock(this->mutex);
 		this->terminated++;
+		this->mutex->unlock(this->mutex);
+	}
+	return TRUE;
+}
+
+METHOD(listener_t, child_updown, bool,
+	private_load_tester_listener_t *this, ike_sa_t *ike_sa,
+	child_sa_t *child_sa, bool up)
+{
+	u_int32_t unique;
+	entry_t *entry;
+	timeval_t now;
+
+	if (up)
+	{
+		time_monotonic(&now);
+		unique = ike_sa->get_unique_id(ike_sa);
+		this->mutex->lock(this->mutex);
+		entry = this->entries->get(this->entries, &unique);
+		if (entry)
+		{
+			add_sample(this, PHASE_CHILD_SA, &entry->child, &now);
+			timerclear(&entry->child);
+		}
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -91,9 +537,25 @@ METHOD(listener_t, ike_updown, bool,
 METHOD(listener_t, ike_state_change, bool,
 	private_load_tester_listener_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
 {
+	u_int32_t unique;
+	entry_t *entry;
+	bool done;
+
 	if (state == IKE_DESTROYING)
 	{
 		this->config->delete_ip(this->config, ike_sa->get_my_host(ike_sa));
+
+		unique = ike_sa->get_unique_id(ike_sa);
+		this->mutex->lock(this->mutex);
+		entry = this->entries->remove(this->entries, &unique);
+		/* failed setups count as done, too */
+		done = setup_done(this, entry);
+		this->mutex->unlock(this->mutex);
+		free(entry);
+		if (done)
+		{
+			write_report(this);
+		}
 	}
 	return TRUE;
 }
@@ -101,12 +563,59 @@ METHOD(listener_t, ike_state_change, bool,
 METHOD(load_tester_listener_t, get_established, u_int,
 	private_load_tester_listener_t *this)
 {
-	return this->established - this->terminated;
+	u_int count;
+
+	this->mutex->lock(this->mutex);
+	count = this->established - this->terminated;
+	this->mutex->unlock(this->mutex);
+	return count;
+}
+
+METHOD(load_tester_listener_t, complete, void,
+	private_load_tester_listener_t *this)
+{
+	bool done;
+
+	this->mutex->lock(this->mutex);
+	this->completed = TRUE;
+	done = check_report(this);
+	this->mutex->unlock(this->mutex);
+	if (done)
+	{
+		write_report(this);
+	}
+}
+
+METHOD(load_tester_listener_t, report, void,
+	private_load_tester_listener_t *this)
+{
+	bool done;
+
+	this->mutex->lock(this->mutex);
+	done = !this->reported;
+	this->reported = TRUE;
+	this->mutex->unlock(this->mutex);
+	if (done)
+	{
+		write_report(this);
+	}
 }
 
 METHOD(load_tester_listener_t, destroy, void,
 	private_load_tester_listener_t *this)
 {
+	enumerator_t *enumerator;
+	entry_t *entry;
+	u_int32_t *key;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, &key, &entry))
+	{
+		free(entry);
+	}
+	enumerator->destroy(enumerator);
+	this->entries->destroy(this->entries);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -118,19 +627,42 @@ load_tester_listener_t *load_tester_listener_create(u_int shutdown_on,
 	INIT(this,
 		.public = {
 			.listener = {
+				.message = _message_hook,
 				.ike_updown = _ike_updown,
+				.child_updown = _child_updown,
 				.ike_state_change = _ike_state_change,
 			},
 			.get_established = _get_established,
+			.complete = _complete,
+			.report = _report,
 			.destroy = _destroy,
 		},
 		.delete_after_established = lib->settings->get_bool(lib->settings,
 					"%s.plugins.load-tester.delete_after_established", FALSE,
 					charon->name),
+		.lifetime = lib->settings->get_int(lib->settings,
+					"%s.plugins.load-tester.lifetime", 0, charon->name),
+		.rekey_ratio = lib->settings->get_int(lib->settings,
+					"%s.plugins.load-tester.rekey_ratio", 0, charon->name),
+		.delete_ratio = lib->settings->get_int(lib->settings,
+					"%s.plugins.load-tester.delete_ratio", 0, charon->name),
+		.report = lib->settings->get_str(lib->settings,
+					"%s.plugins.load-tester.report", NULL, charon->name),
+		.entries = hashtable_create((hashtable_hash_t)hash,
+									(hashtable_equals_t)equals, 1024),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.shutdown_on = shutdown_on,
 		.config = config,
 	);
 
+	if (this->rekey_ratio > 100 || this->delete_ratio > 100 ||
+		this->rekey_ratio + this->delete_ratio > 100)
+	{
+		DBG1(DBG_CFG, "load-tester rekey_ratio %d%% and delete_ratio %d%% "
+			 "exceed 100%%, not rekeying or deleting IKE_SAs",
+			 this->rekey_ratio, this->delete_ratio);
+		this->rekey_ratio = this->delete_ratio = 0;
+	}
 	return &this->public;
 }
 
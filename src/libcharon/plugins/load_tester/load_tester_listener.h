@@ -44,6 +44,20 @@ struct load_tester_listener_t {
 	 */
 	u_int (*get_established)(load_tester_listener_t *this);
 
+	/**
+	 * Signal that all initiators completed their iterations.
+	 *
+	 * The latency report gets written as soon as all initiated IKE_SAs
+	 * have been established or failed.
+	 */
+	void (*complete)(load_tester_listener_t *this);
+
+	/**
+	 * Log a latency summary and write histograms to the configured CSV report,
+	 * if that has not been done when the test completed.
+	 */
+	void (*report)(load_tester_listener_t *this);
+
 	/**
 	 * Destroy the backend.
 	 */
@@ -22,6 +22,7 @@
 #include "load_tester_diffie_hellman.h"
 
 #include <unistd.h>
+#include <math.h>
 
 #include <hydra.h>
 #include <daemon.h>
@@ -29,6 +30,11 @@
 #include <threading/condvar.h>
 #include <threading/mutex.h>
 
+/**
+ * Maximum open-loop arrival rate, in setups per second
+ */
+#define MAX_RATE 1000000
+
 typedef struct private_load_tester_plugin_t private_load_tester_plugin_t;
 
 /**
@@ -86,6 +92,21 @@ struct private_load_tester_plugin_t {
 	 */
 	int init_limit;
 
+	/**
+	 * Open-loop arrival rate of all initiators, in setups per second
+	 */
+	u_int rate;
+
+	/**
+	 * Use exponentially distributed inter-arrival times, constant otherwise
+	 */
+	bool poisson;
+
+	/**
+	 * Number of initiators that completed all iterations
+	 */
+	int completed;
+
 	/**
 	 * mutex to lock running field
 	 */
@@ -97,12 +118,48 @@ struct private_load_tester_plugin_t {
 	condvar_t *condvar;
 };
 
+/**
+ * Wait for the next arrival of an open-loop traffic profile
+ */
+static void wait_arrival(private_load_tester_plugin_t *this, timeval_t *next)
+{
+	timeval_t now, delta;
+	double rate;
+	u_int64_t us;
+
+	rate = (double)this->rate / max(this->initiators, 1);
+	if (this->poisson)
+	{	/* Poisson process, inter-arrival times are exponentially distributed */
+		us = -log((random() + 1.0) / (RAND_MAX + 1.0)) * 1000000 / rate;
+	}
+	else
+	{
+		us = 1000000 / rate;
+	}
+	delta.tv_sec = us / 1000000;
+	delta.tv_usec = us % 1000000;
+	timeradd(next, &delta, next);
+
+	/* arrivals don't depend on completions, catch up if we are late */
+	time_monotonic(&now);
+	if (timercmp(&now, next, <))
+	{
+		timersub(next, &now, &delta);
+		if (delta.tv_sec)
+		{
+			sleep(delta.tv_sec);
+		}
+		usleep(delta.tv_usec);
+	}
+}
+
 /**
  * Begin the load test
  */
 static job_requeue_t do_load_test(private_load_tester_plugin_t *this)
 {
 	int i, s = 0, ms = 0;
+	timeval_t next;
 
 	this->mutex->lock(this->mutex);
 	this->running++;
@@ -112,6 +169,7 @@ static job_requeue_t do_load_test(private_load_tester_plugin_t *this)
 		s = this->delay / 1000;
 		ms = this->delay % 1000;
 	}
+	time_monotonic(&next);
 
 	for (i = 0; this->iterations == 0 || i < this->iterations; i++)
 	{
@@ -119,6 +177,10 @@ static job_requeue_t do_load_test(private_load_tester_plugin_t *this)
 		child_cfg_t *child_cfg = NULL;
 		enumerator_t *enumerator;
 
+		if (this->rate)
+		{
+			wait_arrival(this, &next);
+		}
 		if (this->init_limit)
 		{
 			while ((charon->ike_sa_manager->get_count(charon->ike_sa_manager) -
@@ -153,6 +215,10 @@ static job_requeue_t do_load_test(private_load_tester_plugin_t *this)
 		charon->controller->initiate(charon->controller,
 					peer_cfg, child_cfg->get_ref(child_cfg),
 					NULL, NULL, 0);
+		if (this->rate)
+		{	/* open-loop arrivals are paced by wait_arrival() */
+			continue;
+		}
 		if (s)
 		{
 			sleep(s);
@@ -163,6 +229,11 @@ static job_requeue_t do_load_test(private_load_tester_plugin_t *this)
 		}
 	}
 	this->mutex->lock(this->mutex);
+	if (this->iterations > 0 && i >= this->iterations &&
+		++this->completed == this->initiators)
+	{	/* the report follows once all initiated IKE_SAs are set up */
+		this->listener->complete(this->listener);
+	}
 	this->running--;
 	this->condvar->signal(this->condvar);
 	this->mutex->unlock(this->mutex);
@@ -216,6 +287,7 @@ static bool register_load_tester(private_load_tester_plugin_t *this,
 			this->condvar->wait(this->condvar, this->mutex);
 		}
 		this->mutex->unlock(this->mutex);
+		this->listener->report(this->listener);
 		charon->backends->remove_backend(charon->backends, &this->config->backend);
 		lib->credmgr->remove_set(lib->credmgr, &this->creds->credential_set);
 		charon->bus->remove_listener(charon->bus, &this->listener->listener);
@@ -261,6 +333,8 @@ METHOD(plugin_t, destroy, void,
 plugin_t *load_tester_plugin_create()
 {
 	private_load_tester_plugin_t *this;
+	char *arrival;
+	int rate;
 
 	if (!lib->settings->get_bool(lib->settings,
 						"%s.plugins.load-tester.enable", FALSE, charon->name))
@@ -290,6 +364,25 @@ plugin_t *load_tester_plugin_create()
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
+	rate = lib->settings->get_int(lib->settings,
+						"%s.plugins.load-tester.rate", 0, charon->name);
+	if (rate < 0 || rate > MAX_RATE)
+	{
+		DBG1(DBG_CFG, "load-tester rate %d invalid, initiating closed-loop",
+			 rate);
+		rate = 0;
+	}
+	this->rate = rate;
+	arrival = lib->settings->get_str(lib->settings,
+						"%s.plugins.load-tester.arrival", "constant",
+						charon->name);
+	this->poisson = streq(arrival, "poisson");
+	if (!this->poisson && !streq(arrival, "constant"))
+	{
+		DBG1(DBG_CFG, "load-tester arrival '%s' unknown, using constant",
+			 arrival);
+	}
+
 	if (lib->settings->get_bool(lib->settings,
 			"%s.plugins.load-tester.fake_kernel", FALSE, charon->name))
 	{
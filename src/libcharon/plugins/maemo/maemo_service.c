@@ -21,6 +21,7 @@
 
 #include <daemon.h>
 #include <credentials/sets/mem_cred.h>
+#include <threading/mutex.h>
 #include <processing/jobs/callback_job.h>
 
 #define OSSO_STATUS_NAME	"status"
@@ -78,6 +79,16 @@ struct private_maemo_service_t {
 	 */
 	ike_sa_t *ike_sa;
 
+	/**
+	 * CHILD_SA is up, initiation failures are not reported anymore
+	 */
+	bool established;
+
+	/**
+	 * Lock for ike_sa and established, listener callbacks run concurrently
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * Status of the current connection
 	 */
@@ -102,12 +113,27 @@ static gint change_status(private_maemo_service_t *this, int status)
 	return res;
 }
 
+/**
+ * Check if an event is for the current IKE_SA, optionally only while it is
+ * being initiated
+ */
+static bool is_current(private_maemo_service_t *this, ike_sa_t *ike_sa,
+					   bool initiating)
+{
+	bool current;
+
+	this->mutex->lock(this->mutex);
+	current = this->ike_sa == ike_sa && (!initiating || !this->established);
+	this->mutex->unlock(this->mutex);
+	return current;
+}
+
 METHOD(listener_t, ike_updown, bool,
 	   private_maemo_service_t *this, ike_sa_t *ike_sa, bool up)
 {
-	/* this callback is only registered during initiation, so if the IKE_SA
+	/* this callback is only active during initiation, so if the IKE_SA
 	 * goes down we assume an authentication error */
-	if (this->ike_sa == ike_sa && !up)
+	if (!up && is_current(this, ike_sa, TRUE))
 	{
 		change_status(this, VPN_STATUS_AUTH_FAILED);
 		return FALSE;
@@ -118,8 +144,8 @@ METHOD(listener_t, ike_updown, bool,
 METHOD(listener_t, ike_state_change, bool,
 	   private_maemo_service_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
 {
-	/* this call back is only registered during initiation */
-	if (this->ike_sa == ike_sa && state == IKE_DESTROYING)
+	/* this call back is only active during initiation */
+	if (state == IKE_DESTROYING && is_current(this, ike_sa, TRUE))
 	{
 		change_status(this, VPN_STATUS_CONNECTION_FAILED);
 		return FALSE;
@@ -131,13 +157,14 @@ METHOD(listener_t, child_updown, bool,
 	   private_maemo_service_t *this, ike_sa_t *ike_sa, child_sa_t *child_sa,
 	   bool up)
 {
-	if (this->ike_sa == ike_sa)
+	if (is_current(this, ike_sa, FALSE))
 	{
 		if (up)
 		{
 			/* disable hooks registered to catch initiation failures */
-			this->public.listener.ike_updown = NULL;
-			this->public.listener.ike_state_change = NULL;
+			this->mutex->lock(this->mutex);
+			this->established = TRUE;
+			this->mutex->unlock(this->mutex);
 			change_status(this, VPN_STATUS_CONNECTED);
 		}
 		else
@@ -152,10 +179,12 @@ METHOD(listener_t, child_updown, bool,
 METHOD(listener_t, ike_rekey, bool,
 	   private_maemo_service_t *this, ike_sa_t *old, ike_sa_t *new)
 {
+	this->mutex->lock(this->mutex);
 	if (this->ike_sa == old)
 	{
 		this->ike_sa = new;
 	}
+	this->mutex->unlock(this->mutex);
 	return TRUE;
 }
 
@@ -374,10 +403,11 @@ static gboolean initiate_connection(private_maemo_service_t *this,
 	peer_cfg->destroy(peer_cfg);
 
 	/* store the IKE_SA, so we can track its progress */
+	this->mutex->lock(this->mutex);
 	this->ike_sa = ike_sa;
+	this->established = FALSE;
+	this->mutex->unlock(this->mutex);
 	this->status = VPN_STATUS_CONNECTING;
-	this->public.listener.ike_updown = _ike_updown;
-	this->public.listener.ike_state_change = _ike_state_change;
 	charon->bus->add_listener(charon->bus, &this->public.listener);
 
 	/* get an additional reference because initiate consumes one */
@@ -465,6 +495,7 @@ METHOD(maemo_service_t, destroy, void,
 	lib->credmgr->remove_set(lib->credmgr, &this->creds->set);
 	this->creds->destroy(this->creds);
 	this->current = (g_free(this->current), NULL);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -487,6 +518,7 @@ maemo_service_t *maemo_service_create()
 			.destroy = _destroy,
 		},
 		.creds = mem_cred_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	lib->credmgr->add_set(lib->credmgr, &this->creds->set);
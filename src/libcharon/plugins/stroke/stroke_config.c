@@ -18,6 +18,7 @@
 
 #include <hydra.h>
 #include <daemon.h>
+#include <config/config_index.h>
 #include <threading/mutex.h>
 #include <utils/lexparser.h>
 
@@ -38,6 +39,11 @@ struct private_stroke_config_t {
 	 */
 	linked_list_t *list;
 
+	/**
+	 * index over the configs in list, for lookups
+	 */
+	config_index_t *index;
+
 	/**
 	 * mutex to lock config list
 	 */
@@ -63,64 +69,31 @@ METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, identification_t *me, identification_t *other)
 {
 	this->mutex->lock(this->mutex);
-	return enumerator_create_cleaner(this->list->create_enumerator(this->list),
-									 (void*)this->mutex->unlock, this->mutex);
-}
-
-/**
- * filter function for ike configs
- */
-static bool ike_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
-{
-	*out = (*in)->get_ike_cfg(*in);
-	return TRUE;
+	return enumerator_create_cleaner(
+						this->index->create_peer_cfg_enumerator(this->index, other),
+						(void*)this->mutex->unlock, this->mutex);
 }
 
 METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, host_t *me, host_t *other)
 {
 	this->mutex->lock(this->mutex);
-	return enumerator_create_filter(this->list->create_enumerator(this->list),
-									(void*)ike_filter, this->mutex,
-									(void*)this->mutex->unlock);
+	return enumerator_create_cleaner(
+						this->index->create_ike_cfg_enumerator(this->index, other),
+						(void*)this->mutex->unlock, this->mutex);
 }
 
 METHOD(backend_t, get_peer_cfg_by_name, peer_cfg_t*,
 	private_stroke_config_t *this, char *name)
 {
-	enumerator_t *e1, *e2;
-	peer_cfg_t *current, *found = NULL;
-	child_cfg_t *child;
+	peer_cfg_t *found;
 
 	this->mutex->lock(this->mutex);
-	e1 = this->list->create_enumerator(this->list);
-	while (e1->enumerate(e1, &current))
+	found = this->index->get_peer_cfg_by_name(this->index, name);
+	if (found)
 	{
-		/* compare peer_cfgs name first */
-		if (streq(current->get_name(current), name))
-		{
-			found = current;
-			found->get_ref(found);
-			break;
-		}
-		/* compare all child_cfg names otherwise */
-		e2 = current->create_child_cfg_enumerator(current);
-		while (e2->enumerate(e2, &child))
-		{
-			if (streq(child->get_name(child), name))
-			{
-				found = current;
-				found->get_ref(found);
-				break;
-			}
-		}
-		e2->destroy(e2);
-		if (found)
-		{
-			break;
-		}
+		found->get_ref(found);
 	}
-	e1->destroy(e1);
 	this->mutex->unlock(this->mutex);
 	return found;
 }
@@ -1032,6 +1005,9 @@ METHOD(stroke_config_t, add, void,
 
 	if (use_existing)
 	{
+		this->mutex->lock(this->mutex);
+		this->index->update(this->index, peer_cfg);
+		this->mutex->unlock(this->mutex);
 		peer_cfg->destroy(peer_cfg);
 	}
 	else
@@ -1040,6 +1016,7 @@ METHOD(stroke_config_t, add, void,
 		DBG1(DBG_CFG, "added configuration '%s'", msg->add_conn.name);
 		this->mutex->lock(this->mutex);
 		this->list->insert_last(this->list, peer_cfg);
+		this->index->add(this->index, peer_cfg);
 		this->mutex->unlock(this->mutex);
 	}
 }
@@ -1056,7 +1033,7 @@ METHOD(stroke_config_t, del, void,
 	enumerator = this->list->create_enumerator(this->list);
 	while (enumerator->enumerate(enumerator, (void**)&peer))
 	{
-		bool keep = FALSE;
+		bool keep = FALSE, removed = FALSE;
 
 		/* remove any child with such a name */
 		children = peer->create_child_cfg_enumerator(peer);
@@ -1066,7 +1043,7 @@ METHOD(stroke_config_t, del, void,
 			{
 				peer->remove_child_cfg(peer, children);
 				child->destroy(child);
-				deleted = TRUE;
+				deleted = removed = TRUE;
 			}
 			else
 			{
@@ -1079,9 +1056,14 @@ METHOD(stroke_config_t, del, void,
 		if (!keep || streq(peer->get_name(peer), msg->del_conn.name))
 		{
 			this->list->remove_at(this->list, enumerator);
+			this->index->remove(this->index, peer);
 			peer->destroy(peer);
 			deleted = TRUE;
 		}
+		else if (removed)
+		{
+			this->index->update(this->index, peer);
+		}
 	}
 	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
@@ -1277,6 +1259,7 @@ METHOD(stroke_config_t, set_user_credentials, void,
 METHOD(stroke_config_t, destroy, void,
 	private_stroke_config_t *this)
 {
+	this->index->destroy(this->index);
 	this->list->destroy_offset(this->list, offsetof(peer_cfg_t, destroy));
 	this->mutex->destroy(this->mutex);
 	free(this);
@@ -1303,6 +1286,7 @@ stroke_config_t *stroke_config_create(stroke_ca_t *ca, stroke_cred_t *cred,
 			.destroy = _destroy,
 		},
 		.list = linked_list_create(),
+		.index = config_index_create(),
 		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
 		.ca = ca,
 		.cred = cred,
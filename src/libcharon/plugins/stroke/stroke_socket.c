@@ -29,6 +29,7 @@
 #include <threading/mutex.h>
 #include <threading/thread.h>
 #include <threading/condvar.h>
+#include <threading/lock_stats.h>
 #include <collections/linked_list.h>
 #include <processing/jobs/callback_job.h>
 
@@ -525,6 +526,102 @@ static void stroke_loglevel(private_stroke_socket_t *this,
 	charon->set_level(charon, group, msg->loglevel.level);
 }
 
+/**
+ * raise the verbosity of debug output for specific IKE_SAs, or list them
+ */
+static void stroke_trace(private_stroke_socket_t *this,
+						 stroke_msg_t *msg, FILE *out)
+{
+	enumerator_t *enumerator;
+	trace_selector_t selector;
+	debug_t group = DBG_ANY;
+	level_t *levels;
+	char *value;
+
+	pop_string(msg, &msg->trace.selector);
+	pop_string(msg, &msg->trace.value);
+	pop_string(msg, &msg->trace.type);
+
+	if (!msg->trace.selector)
+	{
+		enumerator = charon->bus->create_trace_enumerator(charon->bus);
+		while (enumerator->enumerate(enumerator, &selector, &value, &levels))
+		{
+			fprintf(out, "%N %s:", trace_selector_names, selector, value);
+			for (group = 0; group < DBG_MAX; group++)
+			{
+				if (levels[group] > LEVEL_SILENT)
+				{
+					fprintf(out, " %N %d", debug_lower_names, group,
+							levels[group]);
+				}
+			}
+			fprintf(out, "\n");
+		}
+		enumerator->destroy(enumerator);
+		return;
+	}
+	DBG1(DBG_CFG, "received stroke: trace %d for %s %s", msg->trace.level,
+		 msg->trace.selector, msg->trace.value);
+
+	selector = enum_from_name(trace_selector_names, msg->trace.selector);
+	if ((int)selector < 0 || !msg->trace.value)
+	{
+		fprintf(out, "invalid selector (%s)!\n", msg->trace.selector);
+		return;
+	}
+	if (msg->trace.type && !strcaseeq(msg->trace.type, "any"))
+	{
+		group = enum_from_name(debug_names, msg->trace.type);
+		if ((int)group < 0)
+		{
+			fprintf(out, "invalid type (%s)!\n", msg->trace.type);
+			return;
+		}
+	}
+	if (!charon->bus->set_trace(charon->bus, selector, msg->trace.value,
+								group, msg->trace.level))
+	{
+		fprintf(out, "invalid %s (%s)!\n", msg->trace.selector,
+				msg->trace.value);
+	}
+}
+
+/**
+ * Show or control lock statistics
+ */
+static void stroke_lockstats(private_stroke_socket_t *this,
+							 stroke_msg_t *msg, FILE *out)
+{
+	pop_string(msg, &msg->lockstats.action);
+
+	if (!msg->lockstats.action)
+	{
+		lock_stats_print(out, FALSE);
+	}
+	else if (streq(msg->lockstats.action, "csv"))
+	{
+		lock_stats_print(out, TRUE);
+	}
+	else if (streq(msg->lockstats.action, "on") ||
+			 streq(msg->lockstats.action, "off"))
+	{
+		DBG1(DBG_CFG, "received stroke: lockstats %s",
+			 msg->lockstats.action);
+		lock_stats_set_state(streq(msg->lockstats.action, "on"));
+	}
+	else if (streq(msg->lockstats.action, "reset"))
+	{
+		DBG1(DBG_CFG, "received stroke: lockstats reset");
+		lock_stats_reset();
+	}
+	else
+	{
+		fprintf(out, "invalid lockstats action (%s)!\n",
+				msg->lockstats.action);
+	}
+}
+
 /**
  * set various config options
  */
@@ -665,6 +762,12 @@ static job_requeue_t process(stroke_job_context_t *ctx)
 		case STR_USER_CREDS:
 			stroke_user_creds(this, msg, out);
 			break;
+		case STR_TRACE:
+			stroke_trace(this, msg, out);
+			break;
+		case STR_LOCKSTATS:
+			stroke_lockstats(this, msg, out);
+			break;
 		default:
 			DBG1(DBG_CFG, "received unknown stroke");
 			break;
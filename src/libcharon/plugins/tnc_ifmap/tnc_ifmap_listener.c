@@ -19,6 +19,7 @@
 #include <daemon.h>
 #include <hydra.h>
 #include <utils/debug.h>
+#include <threading/mutex.h>
 
 typedef struct private_tnc_ifmap_listener_t private_tnc_ifmap_listener_t;
 
@@ -37,6 +38,11 @@ struct private_tnc_ifmap_listener_t {
 	 */
 	tnc_ifmap_soap_t *ifmap;
 
+	/**
+	 * Mutex to serialize requests over the SOAP interface
+	 */
+	mutex_t *mutex;
+
 };
 
 /**
@@ -96,7 +102,9 @@ METHOD(listener_t, ike_updown, bool,
 {
 	if (ike_sa->get_state(ike_sa) != IKE_CONNECTING)
 	{
+		this->mutex->lock(this->mutex);
 		this->ifmap->publish_ike_sa(this->ifmap, ike_sa, up);
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -107,9 +115,11 @@ METHOD(listener_t, alert, bool,
 {
 	if (alert == ALERT_PEER_AUTH_FAILED)
 	{
+		this->mutex->lock(this->mutex);
 		this->ifmap->publish_enforcement_report(this->ifmap,
 							ike_sa->get_other_host(ike_sa),
 							"block", "authentication failed");
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -118,6 +128,7 @@ METHOD(tnc_ifmap_listener_t, destroy, void,
 	private_tnc_ifmap_listener_t *this)
 {
 	DESTROY_IF(this->ifmap);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -137,6 +148,7 @@ tnc_ifmap_listener_t *tnc_ifmap_listener_create(bool reload)
 			.destroy = _destroy,
 		},
 		.ifmap = tnc_ifmap_soap_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	if (!this->ifmap)
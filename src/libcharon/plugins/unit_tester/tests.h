@@ -19,6 +19,7 @@
  */
 
 DEFINE_TEST("linked_list_t->remove()", test_list_remove, FALSE)
+DEFINE_TEST("linked_list_t in an arena", test_list_arena, FALSE)
 DEFINE_TEST("hashtable_t->remove_at()", test_hashtable_remove_at, FALSE)
 DEFINE_TEST("simple enumerator", test_enumerate, FALSE)
 DEFINE_TEST("nested enumerator", test_enumerate_nested, FALSE)
@@ -28,17 +29,31 @@ DEFINE_TEST("auth cfg", test_auth_cfg, FALSE)
 DEFINE_TEST("CURL get", test_curl_get, FALSE)
 DEFINE_TEST("MySQL operations", test_mysql, FALSE)
 DEFINE_TEST("SQLite operations", test_sqlite, FALSE)
+DEFINE_TEST("SQLite statement cache eviction", test_sqlite_stmt_cache, FALSE)
+DEFINE_TEST("SQLite attr-sql lease benchmark", test_sqlite_leases, FALSE)
 DEFINE_TEST("mutex primitive", test_mutex, FALSE)
+DEFINE_TEST("lock contention statistics", test_lock_stats, FALSE)
+DEFINE_TEST("bus listener dispatching", test_bus_listeners, FALSE)
+DEFINE_TEST("bus listener removal", test_bus_remove, FALSE)
+DEFINE_TEST("bus IKE_SA tracing", test_bus_trace, FALSE)
+DEFINE_TEST("asynchronous log queue", test_log_queue, FALSE)
+DEFINE_TEST("lazy message parsing", test_message_lazy, FALSE)
 DEFINE_TEST("RSA key generation", test_rsa_gen, FALSE)
 DEFINE_TEST("RSA subjectPublicKeyInfo loading", test_rsa_load_any, FALSE)
 DEFINE_TEST("X509 certificate", test_cert_x509, FALSE)
 DEFINE_TEST("Mediation database key fetch", test_med_db, FALSE)
 DEFINE_TEST("Base64 converter", test_chunk_base64, FALSE)
 DEFINE_TEST("IP pool", test_pool, FALSE)
+DEFINE_TEST("in-memory IP pool", test_mem_pool, FALSE)
+DEFINE_TEST("HA cache streaming resync", test_ha_cache, FALSE)
+DEFINE_TEST("updown script executor", test_updown_executor, FALSE)
+DEFINE_TEST("attr-sql in-memory leases", test_sql_leases, FALSE)
 DEFINE_TEST("SSH agent", test_agent, FALSE)
 DEFINE_TEST("ID parts", test_id_parts, FALSE)
 DEFINE_TEST("ID wildcards", test_id_wildcards, FALSE)
 DEFINE_TEST("ID equals", test_id_equals, FALSE)
+DEFINE_TEST("ID hash", test_id_hash, FALSE)
 DEFINE_TEST("ID matches", test_id_matches, FALSE)
+DEFINE_TEST("peer config index", test_config_index, FALSE)
 
 /** @}*/
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <bus/bus.h>
+
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+ * Test listener, counting events
+ */
+typedef struct {
+	listener_t listener;
+	bus_t *bus;
+	refcount_t updown;
+	int rekey;
+	bool keep;
+} test_listener_t;
+
+static bool ike_updown(test_listener_t *this, ike_sa_t *ike_sa, bool up)
+{
+	ref_get(&this->updown);
+	sched_yield();
+	return this->keep;
+}
+
+static bool ike_rekey(test_listener_t *this, ike_sa_t *old, ike_sa_t *new)
+{
+	this->rekey++;
+	/* recursive events must not be delivered to ourself */
+	this->bus->ike_rekey(this->bus, old, new);
+	return TRUE;
+}
+
+#define THREADS 8
+#define EVENTS 10000
+
+static pthread_barrier_t barrier;
+
+static void* run(bus_t *bus)
+{
+	int i;
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < EVENTS; i++)
+	{
+		bus->ike_updown(bus, NULL, TRUE);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ * bus listener dispatching test
+ ******************************************************************************/
+bool test_bus_listeners()
+{
+	test_listener_t a = {
+		.listener = {
+			.ike_updown = (void*)ike_updown,
+			.ike_rekey = (void*)ike_rekey,
+		},
+		.keep = TRUE,
+	}, b = {
+		.listener = {
+			.ike_updown = (void*)ike_updown,
+		},
+		.keep = FALSE,
+	};
+	pthread_t threads[THREADS];
+	bus_t *bus;
+	int i;
+
+	bus = bus_create();
+	a.bus = b.bus = bus;
+	bus->add_listener(bus, &a.listener);
+	bus->add_listener(bus, &b.listener);
+
+	/* b unregisters after the first event */
+	bus->ike_updown(bus, NULL, TRUE);
+	bus->ike_updown(bus, NULL, TRUE);
+	if (a.updown != 2 || b.updown != 1)
+	{
+		bus->destroy(bus);
+		return FALSE;
+	}
+
+	bus->ike_rekey(bus, NULL, NULL);
+	if (a.rekey != 1)
+	{
+		bus->destroy(bus);
+		return FALSE;
+	}
+
+	/* the same listener gets called by multiple threads concurrently */
+	pthread_barrier_init(&barrier, NULL, THREADS);
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_create(&threads[i], NULL, (void*)run, bus);
+	}
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	bus->remove_listener(bus, &a.listener);
+	bus->ike_updown(bus, NULL, TRUE);
+	bus->destroy(bus);
+
+	return a.updown == 2 + THREADS * EVENTS && b.updown == 1;
+}
+
+/**
+ * Listener removing another listener from within a callback
+ */
+typedef struct {
+	listener_t listener;
+	bus_t *bus;
+	/* listener to remove, if any */
+	listener_t *remove;
+	/* raise a nested ike_updown event */
+	bool nested;
+	/* callback entered and left */
+	bool entered;
+	bool left;
+	/* result of removing the other listener */
+	bool removed;
+} remove_listener_t;
+
+static pthread_barrier_t remove_barrier;
+
+static bool remove_ike_rekey(remove_listener_t *this, ike_sa_t *old,
+							 ike_sa_t *new)
+{
+	if (this->nested)
+	{
+		this->bus->ike_updown(this->bus, NULL, TRUE);
+	}
+	return TRUE;
+}
+
+static bool remove_ike_updown(remove_listener_t *this, ike_sa_t *ike_sa,
+							  bool up)
+{
+	this->entered = TRUE;
+	usleep(100000);
+	this->left = TRUE;
+	return TRUE;
+}
+
+static bool remove_child_cb(remove_listener_t *this)
+{
+	this->entered = TRUE;
+	if (this->remove)
+	{
+		pthread_barrier_wait(&remove_barrier);
+		this->removed = this->bus->remove_listener(this->bus, this->remove);
+	}
+	return TRUE;
+}
+
+static void* raise_ike_rekey(bus_t *bus)
+{
+	bus->ike_rekey(bus, NULL, NULL);
+	return NULL;
+}
+
+static void* raise_child_updown(bus_t *bus)
+{
+	bus->child_updown(bus, NULL, TRUE);
+	return NULL;
+}
+
+static void* raise_child_rekey(bus_t *bus)
+{
+	bus->child_rekey(bus, NULL, NULL);
+	return NULL;
+}
+
+/*******************************************************************************
+ * bus listener removal test
+ ******************************************************************************/
+bool test_bus_remove()
+{
+	remove_listener_t a = {
+		.listener = {
+			.ike_rekey = (void*)remove_ike_rekey,
+		},
+		.nested = TRUE,
+	}, b = {
+		.listener = {
+			.ike_updown = (void*)remove_ike_updown,
+		},
+	}, c = {
+		.listener = {
+			.child_updown = (void*)remove_child_cb,
+		},
+	}, d = {
+		.listener = {
+			.child_rekey = (void*)remove_child_cb,
+		},
+	};
+	pthread_t threads[2];
+	bus_t *bus;
+	bool ok;
+
+	bus = bus_create();
+	a.bus = b.bus = c.bus = d.bus = bus;
+	bus->add_listener(bus, &a.listener);
+	bus->add_listener(bus, &b.listener);
+
+	/* removing waits for calls nested in another listener callback */
+	pthread_create(&threads[0], NULL, (void*)raise_ike_rekey, bus);
+	while (!b.entered)
+	{
+		sched_yield();
+	}
+	bus->remove_listener(bus, &b.listener);
+	ok = b.left;
+	pthread_join(threads[0], NULL);
+
+	/* threads removing each others listener from within callbacks must not
+	 * deadlock, one of them fails and keeps the other listener registered */
+	c.remove = &d.listener;
+	d.remove = &c.listener;
+	bus->add_listener(bus, &c.listener);
+	bus->add_listener(bus, &d.listener);
+	pthread_barrier_init(&remove_barrier, NULL, 2);
+	pthread_create(&threads[0], NULL, (void*)raise_child_updown, bus);
+	pthread_create(&threads[1], NULL, (void*)raise_child_rekey, bus);
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	pthread_barrier_destroy(&remove_barrier);
+
+	ok = ok && c.removed != d.removed;
+
+	c.entered = d.entered = FALSE;
+	c.remove = d.remove = NULL;
+	bus->child_updown(bus, NULL, TRUE);
+	bus->child_rekey(bus, NULL, NULL);
+	ok = ok && c.entered == c.removed && d.entered == d.removed;
+	ok = ok && bus->remove_listener(bus, c.removed ? &c.listener
+												   : &d.listener);
+
+	bus->remove_listener(bus, &a.listener);
+	bus->destroy(bus);
+	return ok;
+}
+
+/**
+ * Test logger, counting messages
+ */
+typedef struct {
+	logger_t logger;
+	int count;
+} test_logger_t;
+
+static void test_log(test_logger_t *this, debug_t group, level_t level,
+					 int thread, ike_sa_t *ike_sa, const char *message)
+{
+	this->count++;
+}
+
+static level_t test_get_level(test_logger_t *this, debug_t group)
+{
+	return group == DBG_IKE ? LEVEL_CTRL : LEVEL_SILENT;
+}
+
+static u_int32_t get_unique_id(ike_sa_t *this)
+{
+	return 42;
+}
+
+/*******************************************************************************
+ * bus IKE_SA tracing test
+ ******************************************************************************/
+bool test_bus_trace()
+{
+	test_logger_t logger = {
+		.logger = {
+			.log = (void*)test_log,
+			.get_level = (void*)test_get_level,
+		},
+	};
+	ike_sa_t ike_sa = {
+		.get_unique_id = get_unique_id,
+	};
+	bus_t *bus;
+	bool ok;
+
+	bus = bus_create();
+	bus->add_logger(bus, &logger.logger);
+	bus->set_sa(bus, &ike_sa);
+
+	bus->log(bus, DBG_IKE, LEVEL_DIAG, "not traced");
+	ok = logger.count == 0;
+
+	ok = ok && bus->set_trace(bus, TRACE_IKE_SA, "42", DBG_IKE, LEVEL_DIAG);
+	ok = ok && !bus->set_trace(bus, TRACE_IKE_SA, "a", DBG_IKE, LEVEL_DIAG);
+	bus->log(bus, DBG_IKE, LEVEL_DIAG, "traced");
+	bus->log(bus, DBG_IKE, LEVEL_RAW, "above traced level");
+	bus->log(bus, DBG_CFG, LEVEL_DIAG, "other group");
+	ok = ok && logger.count == 1;
+
+	bus->set_sa(bus, NULL);
+	bus->log(bus, DBG_IKE, LEVEL_DIAG, "no IKE_SA");
+	ok = ok && logger.count == 1;
+
+	bus->set_sa(bus, &ike_sa);
+	bus->set_trace(bus, TRACE_IKE_SA, "42", DBG_ANY, LEVEL_SILENT);
+	bus->log(bus, DBG_IKE, LEVEL_DIAG, "trace removed");
+	ok = ok && logger.count == 1;
+
+	bus->set_sa(bus, NULL);
+	bus->destroy(bus);
+	return ok;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <daemon.h>
+#include <config/config_index.h>
+
+/**
+ * A backend looking up configs in a list, or in an index over that list
+ */
+typedef struct {
+	/** implements backend_t */
+	backend_t backend;
+	/** all configs, peer_cfg_t */
+	linked_list_t *list;
+	/** index over list, NULL to scan list linearly */
+	config_index_t *index;
+} test_backend_t;
+
+/**
+ * Convert a peer config to its IKE config
+ */
+static bool ike_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
+{
+	*out = (*in)->get_ike_cfg(*in);
+	return TRUE;
+}
+
+METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
+	test_backend_t *this, identification_t *me, identification_t *other)
+{
+	if (this->index)
+	{
+		return this->index->create_peer_cfg_enumerator(this->index, other);
+	}
+	return this->list->create_enumerator(this->list);
+}
+
+METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
+	test_backend_t *this, host_t *me, host_t *other)
+{
+	if (this->index)
+	{
+		return this->index->create_ike_cfg_enumerator(this->index, other);
+	}
+	return enumerator_create_filter(this->list->create_enumerator(this->list),
+									(void*)ike_filter, NULL, NULL);
+}
+
+METHOD(backend_t, get_peer_cfg_by_name, peer_cfg_t*,
+	test_backend_t *this, char *name)
+{
+	enumerator_t *e1, *e2;
+	peer_cfg_t *current, *found = NULL;
+	child_cfg_t *child;
+
+	if (this->index)
+	{
+		found = this->index->get_peer_cfg_by_name(this->index, name);
+		return found ? found->get_ref(found) : NULL;
+	}
+	e1 = this->list->create_enumerator(this->list);
+	while (!found && e1->enumerate(e1, &current))
+	{
+		if (streq(current->get_name(current), name))
+		{
+			found = current;
+			break;
+		}
+		e2 = current->create_child_cfg_enumerator(current);
+		while (e2->enumerate(e2, &child))
+		{
+			if (streq(child->get_name(child), name))
+			{
+				found = current;
+				break;
+			}
+		}
+		e2->destroy(e2);
+	}
+	e1->destroy(e1);
+	return found ? found->get_ref(found) : NULL;
+}
+
+/**
+ * Peer configs to look up, ordered as added to the backend
+ */
+static struct {
+	/** name of the peer config */
+	char *name;
+	/** name of its child config */
+	char *child;
+	/** IKE version of the IKE config */
+	ike_version_t version;
+	/** remote address of the IKE config */
+	char *addr;
+	/** allow any remote address */
+	bool allow_any;
+	/** remote identity, NULL for none */
+	char *id;
+} configs[] = {
+	{ "any",		"any-net",	IKE_ANY,	"%any",			FALSE,	NULL	},
+	{ "dn-wild",	"dn-net",	IKEV2,		"192.168.0.1",	FALSE,
+	  "C=CH, O=strongSwan, CN=*"											},
+	{ "carol",		"carol-net",IKEV2,		"192.168.0.1",	FALSE,
+	  "carol@strongswan.org"												},
+	{ "carol-dup",	"carol-net",IKEV2,		"192.168.0.1",	FALSE,
+	  "carol@strongswan.org"												},
+	{ "dave",		"dave-net",	IKEV2,		"192.168.0.2",	FALSE,
+	  "C=CH, O=strongSwan, CN=dave"											},
+	{ "any-id",		"any-net",	IKEV2,		"192.168.0.2",	FALSE,	"%any"	},
+	{ "roaming",	"road-net",	IKE_ANY,	"10.1.0.1",		TRUE,
+	  "carol@strongswan.org"												},
+	{ "wild-net",	"wild-net",	IKEV2,		"0.0.0.0",		FALSE,
+	  "*@strongswan.org"													},
+	{ "carol-b",	"carol-b",	IKEV2,		"192.168.0.2",	FALSE,
+	  "CAROL@strongswan.org"												},
+};
+
+/**
+ * Remote addresses to look up
+ */
+static char *addrs[] = {
+	"192.168.0.1", "192.168.0.2", "10.1.0.1", "10.9.9.9",
+};
+
+/**
+ * Remote identities to look up, NULL for none
+ */
+static char *ids[] = {
+	"carol@strongswan.org", "C=CH, O=strongSwan, CN=dave",
+	"C=CH, O=strongSwan, CN=carol", "dave@strongswan.org", "%any", NULL,
+};
+
+/**
+ * Names to look up
+ */
+static char *names[] = {
+	"any", "carol", "carol-dup", "carol-net", "dave-net", "any-net",
+	"carol-b", "unknown",
+};
+
+/**
+ * Create a peer config with a child config from the configs table
+ */
+static peer_cfg_t *create_config(int i)
+{
+	ike_cfg_t *ike_cfg;
+	peer_cfg_t *peer_cfg;
+	child_cfg_t *child_cfg;
+	auth_cfg_t *auth;
+	lifetime_cfg_t lifetime = {};
+
+	ike_cfg = ike_cfg_create(configs[i].version, FALSE, FALSE,
+							 "0.0.0.0", FALSE, IKEV2_UDP_PORT,
+							 configs[i].addr, configs[i].allow_any,
+							 IKEV2_UDP_PORT);
+	peer_cfg = peer_cfg_create(configs[i].name, ike_cfg,
+							   CERT_SEND_IF_ASKED, UNIQUE_NO, 1, 0, 0, 0, 0,
+							   FALSE, FALSE, 0, 0, FALSE, NULL, NULL);
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_AUTH_CLASS, AUTH_CLASS_PSK);
+	peer_cfg->add_auth_cfg(peer_cfg, auth, TRUE);
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_AUTH_CLASS, AUTH_CLASS_PSK);
+	if (configs[i].id)
+	{
+		auth->add(auth, AUTH_RULE_IDENTITY,
+				  identification_create_from_string(configs[i].id));
+	}
+	peer_cfg->add_auth_cfg(peer_cfg, auth, FALSE);
+	child_cfg = child_cfg_create(configs[i].child, &lifetime, NULL, FALSE,
+								 MODE_TUNNEL, ACTION_NONE, ACTION_NONE,
+								 ACTION_NONE, FALSE, 0, 0, NULL, NULL, 0);
+	peer_cfg->add_child_cfg(peer_cfg, child_cfg);
+	return peer_cfg;
+}
+
+/**
+ * Collect the configs of our backend the backend_manager_t returns for a
+ * lookup, in order of priority
+ */
+static linked_list_t *lookup(test_backend_t *backend, host_t *me,
+							 host_t *other, identification_t *id)
+{
+	enumerator_t *enumerator;
+	linked_list_t *found;
+	peer_cfg_t *cfg;
+
+	found = linked_list_create();
+	charon->backends->add_backend(charon->backends, &backend->backend);
+	enumerator = charon->backends->create_peer_cfg_enumerator(
+							charon->backends, me, other, NULL, id, IKEV2);
+	while (enumerator->enumerate(enumerator, &cfg))
+	{	/* ignore configs of other backends */
+		if (backend->list->find_first(backend->list, NULL,
+									  (void**)&cfg) == SUCCESS)
+		{
+			found->insert_last(found, cfg);
+		}
+	}
+	enumerator->destroy(enumerator);
+	charon->backends->remove_backend(charon->backends, &backend->backend);
+	return found;
+}
+
+/**
+ * Compare the configs found by two lookups, in order
+ */
+static bool equal_configs(linked_list_t *a, linked_list_t *b)
+{
+	enumerator_t *ea, *eb;
+	peer_cfg_t *ca, *cb;
+	bool equal;
+
+	equal = a->get_count(a) == b->get_count(b);
+	ea = a->create_enumerator(a);
+	eb = b->create_enumerator(b);
+	while (equal && ea->enumerate(ea, &ca) && eb->enumerate(eb, &cb))
+	{
+		equal = ca == cb;
+	}
+	ea->destroy(ea);
+	eb->destroy(eb);
+	return equal;
+}
+
+/**
+ * Check the name of the config at a position in the result of a lookup
+ */
+static bool config_at(linked_list_t *found, int pos, char *name)
+{
+	enumerator_t *enumerator;
+	peer_cfg_t *cfg;
+	bool match = FALSE;
+
+	enumerator = found->create_enumerator(found);
+	while (enumerator->enumerate(enumerator, &cfg))
+	{
+		if (pos-- == 0)
+		{
+			match = streq(cfg->get_name(cfg), name);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return match;
+}
+
+/**
+ * Look up IKE configs for an address, compare index and linear scan
+ */
+static bool compare_ike_cfg(test_backend_t *linear, test_backend_t *indexed,
+							host_t *me, host_t *other)
+{
+	ike_cfg_t *a, *b;
+
+	charon->backends->add_backend(charon->backends, &linear->backend);
+	a = charon->backends->get_ike_cfg(charon->backends, me, other, IKEV2);
+	charon->backends->remove_backend(charon->backends, &linear->backend);
+	charon->backends->add_backend(charon->backends, &indexed->backend);
+	b = charon->backends->get_ike_cfg(charon->backends, me, other, IKEV2);
+	charon->backends->remove_backend(charon->backends, &indexed->backend);
+	DESTROY_IF(a);
+	DESTROY_IF(b);
+	return a == b;
+}
+
+/**
+ * Look up a config by name, compare index and linear scan
+ */
+static bool compare_name(test_backend_t *linear, test_backend_t *indexed,
+						 char *name)
+{
+	peer_cfg_t *a, *b;
+
+	a = linear->backend.get_peer_cfg_by_name(&linear->backend, name);
+	b = indexed->backend.get_peer_cfg_by_name(&indexed->backend, name);
+	DESTROY_IF(a);
+	DESTROY_IF(b);
+	return a == b;
+}
+
+/*******************************************************************************
+ * peer config index test, compares lookups to a linear scan
+ ******************************************************************************/
+bool test_config_index()
+{
+	test_backend_t linear = {
+		.backend = {
+			.create_peer_cfg_enumerator = _create_peer_cfg_enumerator,
+			.create_ike_cfg_enumerator = _create_ike_cfg_enumerator,
+			.get_peer_cfg_by_name = _get_peer_cfg_by_name,
+		},
+		.list = linked_list_create(),
+	}, indexed;
+	linked_list_t *a, *b;
+	identification_t *id;
+	host_t *me, *other;
+	peer_cfg_t *cfg;
+	bool good = TRUE;
+	int i, j;
+
+	indexed = linear;
+	indexed.index = config_index_create();
+	for (i = 0; i < countof(configs); i++)
+	{
+		cfg = create_config(i);
+		linear.list->insert_last(linear.list, cfg);
+		indexed.index->add(indexed.index, cfg);
+	}
+
+	me = host_create_from_string("192.168.0.254", IKEV2_UDP_PORT);
+	for (i = 0; good && i < countof(addrs); i++)
+	{
+		other = host_create_from_string(addrs[i], IKEV2_UDP_PORT);
+		good = compare_ike_cfg(&linear, &indexed, me, other);
+		for (j = 0; good && j < countof(ids); j++)
+		{
+			id = ids[j] ? identification_create_from_string(ids[j]) : NULL;
+			a = lookup(&linear, me, other, id);
+			b = lookup(&indexed, me, other, id);
+			good = equal_configs(a, b);
+			if (good && streq(addrs[i], "192.168.0.1") && j == 0)
+			{	/* exact matches first, in the order added */
+				good = a->get_count(a) == 5 && config_at(a, 0, "carol") &&
+					   config_at(a, 1, "carol-dup");
+			}
+			if (good && streq(addrs[i], "192.168.0.2") && j == 0)
+			{	/* identities match case insensitively */
+				good = config_at(a, 0, "carol-b");
+			}
+			if (good && streq(addrs[i], "10.9.9.9") && j == 3)
+			{	/* wildcard addresses and identities only */
+				good = a->get_count(a) == 2 && config_at(a, 0, "wild-net");
+			}
+			a->destroy(a);
+			b->destroy(b);
+			DESTROY_IF(id);
+		}
+		other->destroy(other);
+	}
+	me->destroy(me);
+
+	for (i = 0; good && i < countof(names); i++)
+	{
+		good = compare_name(&linear, &indexed, names[i]);
+	}
+
+	/* removed configs are not found anymore */
+	if (good && linear.list->remove_first(linear.list, (void**)&cfg) == SUCCESS)
+	{
+		indexed.index->remove(indexed.index, cfg);
+		cfg->destroy(cfg);
+		good = compare_name(&linear, &indexed, "any") &&
+			   compare_name(&linear, &indexed, "any-net");
+	}
+
+	indexed.index->destroy(indexed.index);
+	linear.list->destroy_offset(linear.list, offsetof(peer_cfg_t, destroy));
+	return good;
+}
@@ -58,6 +58,83 @@ bool test_list_remove()
 	return TRUE;
 }
 
+/*******************************************************************************
+ * linked list allocated from an arena test
+ ******************************************************************************/
+bool test_list_arena()
+{
+	enumerator_t *enumerator, *recycled;
+	linked_list_t *list;
+	arena_t *arena;
+	uintptr_t i, x;
+	chunk_t chunk;
+	char *large;
+
+	arena = arena_create(64);
+	list = linked_list_create_arena(arena);
+	for (i = 1; i <= 100; i++)
+	{
+		list->insert_last(list, (void*)i);
+	}
+	i = 1;
+	enumerator = list->create_enumerator(list);
+	while (enumerator->enumerate(enumerator, &x))
+	{
+		if (x != i++)
+		{
+			return FALSE;
+		}
+		if (x % 2)
+		{
+			list->remove_at(list, enumerator);
+		}
+	}
+	enumerator->destroy(enumerator);
+	recycled = list->create_enumerator(list);
+	if (recycled != enumerator || list->get_count(list) != 50)
+	{
+		return FALSE;
+	}
+	i = 2;
+	while (recycled->enumerate(recycled, &x))
+	{
+		if (x != i)
+		{
+			return FALSE;
+		}
+		i += 2;
+	}
+	recycled->destroy(recycled);
+
+	large = arena->alloc(arena, 1024);
+	memset(large, 0xff, 1024);
+	chunk = arena->clone(arena, chunk_from_chars(0x01, 0x02, 0x03));
+	if (chunk.len != 3 || chunk.ptr[2] != 0x03)
+	{
+		return FALSE;
+	}
+	list->destroy(list);
+	if (arena->get_size(arena) < 1024)
+	{
+		return FALSE;
+	}
+	arena->reset(arena);
+	if (arena->get_size(arena) != 0)
+	{
+		return FALSE;
+	}
+	large = arena->alloc(arena, 32);
+	for (i = 0; i < 32; i++)
+	{
+		if (large[i])
+		{
+			return FALSE;
+		}
+	}
+	arena->destroy(arena);
+	return TRUE;
+}
+
 /*******************************************************************************
  * Simple insert first/last and enumerate test
  ******************************************************************************/
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <daemon.h>
+
+#ifdef TEST_HA
+
+#include <ha/ha_cache.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+
+#include <unistd.h>
+
+/**
+ * Number of IKE_SAs cached on the active node
+ */
+#define IKE_SAS 250
+
+/**
+ * Loopback addresses of the two nodes
+ */
+#define ACTIVE_ADDR "127.0.0.1"
+#define PASSIVE_ADDR "127.0.0.2"
+
+/**
+ * Node of the loopback harness
+ */
+typedef struct {
+	/* socket of this node */
+	ha_socket_t *socket;
+	/* cache to report acknowledgements to, active node only */
+	ha_cache_t *cache;
+	/* acknowledge received chunks? passive node only */
+	bool ack;
+	/* number of IKE_SA ADD messages received */
+	int added;
+	/* number of chunks received or acknowledged */
+	int chunks;
+	/* mutex to lock counters */
+	mutex_t *mutex;
+} node_t;
+
+/**
+ * Receive messages on a node, pulls until canceled
+ */
+static void* receive(node_t *node)
+{
+	ha_message_t *message, *ack;
+	enumerator_t *enumerator;
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	u_int segment = 0, seq = 0;
+
+	while (TRUE)
+	{
+		message = node->socket->pull(node->socket);
+
+		enumerator = message->create_attribute_enumerator(message);
+		while (enumerator->enumerate(enumerator, &attribute, &value))
+		{
+			switch (attribute)
+			{
+				case HA_SEGMENT:
+					segment = value.u16;
+					break;
+				case HA_RESYNC_SEQ:
+					seq = value.u32;
+					break;
+				default:
+					break;
+			}
+		}
+		enumerator->destroy(enumerator);
+
+		node->mutex->lock(node->mutex);
+		switch (message->get_type(message))
+		{
+			case HA_IKE_ADD:
+				node->added++;
+				break;
+			case HA_RESYNC_MARK:
+				node->chunks++;
+				if (node->ack)
+				{
+					ack = ha_message_create(HA_RESYNC_ACK);
+					ack->add_attribute(ack, HA_SEGMENT, segment);
+					ack->add_attribute(ack, HA_RESYNC_SEQ, seq);
+					node->socket->push(node->socket, ack);
+					ack->destroy(ack);
+				}
+				break;
+			case HA_RESYNC_ACK:
+				if (node->cache)
+				{
+					node->chunks++;
+					node->cache->ack(node->cache, segment, seq);
+				}
+				break;
+			default:
+				break;
+		}
+		node->mutex->unlock(node->mutex);
+		message->destroy(message);
+	}
+	return NULL;
+}
+
+/**
+ * Cache an ADD and an UPDATE message for each IKE_SA
+ */
+static void fill_cache(ha_cache_t *cache, ike_sa_t **ike_sas)
+{
+	ha_message_t *message;
+	char buf[16];
+	int i;
+
+	for (i = 0; i < IKE_SAS; i++)
+	{
+		snprintf(buf, sizeof(buf), "10.1.%d.%d", i / 250, i % 250 + 1);
+		ike_sas[i] = ike_sa_create(ike_sa_id_create(IKEV2_MAJOR_VERSION,
+									i + 1, i + 1, FALSE), FALSE, IKEV2);
+		ike_sas[i]->set_other_host(ike_sas[i],
+								   host_create_from_string(buf, 500));
+
+		message = ha_message_create(HA_IKE_ADD);
+		message->add_attribute(message, HA_IKE_ID,
+							   ike_sas[i]->get_id(ike_sas[i]));
+		cache->cache(cache, ike_sas[i], message);
+		message = ha_message_create(HA_IKE_UPDATE);
+		message->add_attribute(message, HA_IKE_ID,
+							   ike_sas[i]->get_id(ike_sas[i]));
+		cache->cache(cache, ike_sas[i], message);
+	}
+}
+
+/**
+ * Remove the cache entries and destroy the IKE_SAs
+ */
+static void flush_cache(ha_cache_t *cache, ike_sa_t **ike_sas)
+{
+	int i;
+
+	for (i = 0; i < IKE_SAS; i++)
+	{
+		cache->delete(cache, ike_sas[i]);
+		ike_sas[i]->destroy(ike_sas[i]);
+	}
+}
+
+/**
+ * Wait until a resync of segment completes, at most for timeout in s
+ */
+static bool wait_resync(ha_cache_t *cache, u_int segment, int timeout)
+{
+	u_int synced, rekeyed, total;
+	int i;
+
+	for (i = 0; i < timeout * 100; i++)
+	{
+		if (!cache->get_progress(cache, segment, &synced, &rekeyed, &total))
+		{
+			return TRUE;
+		}
+		usleep(10000);
+	}
+	return FALSE;
+}
+
+/*******************************************************************************
+ * HA cache streaming resync over a loopback harness
+ ******************************************************************************/
+bool test_ha_cache()
+{
+	node_t active, passive;
+	thread_t *threads[2];
+	ha_kernel_t *kernel;
+	ha_cache_t *cache;
+	ike_sa_t *ike_sas[IKE_SAS];
+	u_int synced, rekeyed, total;
+	bool good = FALSE;
+
+	lib->settings->set_int(lib->settings, "%s.plugins.ha.resync_chunk_size",
+						   10, charon->name);
+	lib->settings->set_int(lib->settings, "%s.plugins.ha.resync_window",
+						   2, charon->name);
+	lib->settings->set_int(lib->settings, "%s.plugins.ha.resync_interval",
+						   1, charon->name);
+
+	active = (node_t){
+		.socket = ha_socket_create(ACTIVE_ADDR, PASSIVE_ADDR),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	};
+	passive = (node_t){
+		.socket = ha_socket_create(PASSIVE_ADDR, ACTIVE_ADDR),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.ack = TRUE,
+	};
+	if (!active.socket || !passive.socket)
+	{
+		DESTROY_IF(active.socket);
+		DESTROY_IF(passive.socket);
+		active.mutex->destroy(active.mutex);
+		passive.mutex->destroy(passive.mutex);
+		return FALSE;
+	}
+	kernel = ha_kernel_create(1);
+	cache = ha_cache_create(kernel, active.socket, FALSE, 1);
+	active.cache = cache;
+	fill_cache(cache, ike_sas);
+
+	threads[0] = thread_create((void*)receive, &active);
+	threads[1] = thread_create((void*)receive, &passive);
+
+	/* the segment gets streamed in acknowledged chunks */
+	cache->resync(cache, 1);
+	if (!wait_resync(cache, 1, 10))
+	{
+		DBG1(DBG_CFG, "HA resync did not complete");
+		goto out;
+	}
+	passive.mutex->lock(passive.mutex);
+	if (passive.added != IKE_SAS || passive.chunks != IKE_SAS / 10)
+	{
+		DBG1(DBG_CFG, "received %d IKE_SAs in %d chunks", passive.added,
+			 passive.chunks);
+		passive.mutex->unlock(passive.mutex);
+		goto out;
+	}
+	passive.added = passive.chunks = 0;
+	passive.ack = FALSE;
+	passive.mutex->unlock(passive.mutex);
+	active.mutex->lock(active.mutex);
+	if (active.chunks != IKE_SAS / 10)
+	{
+		active.mutex->unlock(active.mutex);
+		goto out;
+	}
+	active.mutex->unlock(active.mutex);
+
+	/* without acknowledgements the resync stalls after a window of chunks */
+	cache->resync(cache, 1);
+	usleep(200000);
+	if (!cache->get_progress(cache, 1, &synced, &rekeyed, &total) ||
+		synced != 20 || total != IKE_SAS)
+	{
+		DBG1(DBG_CFG, "stalled HA resync synced %u/%u IKE_SAs",
+			 synced, total);
+		goto out;
+	}
+	good = TRUE;
+
+out:
+	/* destroying the cache with an active resync waits for its jobs, none
+	 * must access the cache afterwards */
+	active.mutex->lock(active.mutex);
+	active.cache = NULL;
+	active.mutex->unlock(active.mutex);
+	flush_cache(cache, ike_sas);
+	cache->destroy(cache);
+	usleep(100000);
+
+	threads[0]->cancel(threads[0]);
+	threads[0]->join(threads[0]);
+	threads[1]->cancel(threads[1]);
+	threads[1]->join(threads[1]);
+	kernel->destroy(kernel);
+	active.socket->destroy(active.socket);
+	passive.socket->destroy(passive.socket);
+	active.mutex->destroy(active.mutex);
+	passive.mutex->destroy(passive.mutex);
+	return good;
+}
+
+#else /* TEST_HA */
+
+bool test_ha_cache()
+{
+	DBG1(DBG_CFG, "HA cache test requires the ha plugin, not supported in "
+		 "monolithic builds");
+	return TRUE;
+}
+
+#endif /* TEST_HA */
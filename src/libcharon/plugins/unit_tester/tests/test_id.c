@@ -193,6 +193,49 @@ bool test_id_equals()
 	return TRUE;
 }
 
+/*******************************************************************************
+ * identification hash test
+ ******************************************************************************/
+
+static bool test_id_hash_one(char *a_str, char *b_str)
+{
+	identification_t *a, *b;
+	bool equal;
+
+	a = identification_create_from_string(a_str);
+	b = identification_create_from_string(b_str);
+	equal = a->equals(a, b) && a->hash(a, 0) == b->hash(b, 0);
+	a->destroy(a);
+	b->destroy(b);
+	return equal;
+}
+
+bool test_id_hash()
+{
+	if (!test_id_hash_one("C=CH, E=martin@strongswan.org, CN=martin",
+						  "C=ch, E=martin@STRONGSWAN.ORG, CN=Martin"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("moon.strongswan.org", "MOON.strongSwan.org"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("carol@strongswan.org", "Carol@strongswan.org"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("192.168.0.1", "192.168.0.1"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("%any", "0.0.0.0"))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /*******************************************************************************
  * identification matches test
  ******************************************************************************/
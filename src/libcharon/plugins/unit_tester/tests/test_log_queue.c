@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <bus/listeners/log_queue.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define MESSAGES 2000
+
+/**
+ * Records received by the writer
+ */
+typedef struct {
+	/* next expected message of each thread */
+	int next[THREADS];
+	/* number of messages received */
+	int received;
+	/* number of messages reported as dropped */
+	u_int dropped;
+	/* length of the longest message received */
+	size_t longest;
+	/* records got out of order */
+	bool disorder;
+} received_t;
+
+static void write_records(received_t *this, log_record_t *records, int count,
+						  u_int dropped)
+{
+	int i, thread, seq;
+
+	this->dropped += dropped;
+	for (i = 0; i < count; i++)
+	{
+		this->received++;
+		this->longest = max(this->longest, strlen(records[i].message));
+		if (sscanf(records[i].message, "%d %d", &thread, &seq) == 2 &&
+			thread >= 0 && thread < THREADS)
+		{
+			if (seq < this->next[thread] || !streq(records[i].name, " <1>"))
+			{
+				this->disorder = TRUE;
+			}
+			this->next[thread] = seq + 1;
+		}
+	}
+}
+
+static log_queue_t *queue;
+
+static void* run(uintptr_t thread)
+{
+	char buf[64];
+	int i;
+
+	for (i = 0; i < MESSAGES; i++)
+	{
+		snprintf(buf, sizeof(buf), "%d %d", (int)thread, i);
+		queue->enqueue(queue, DBG_DMN, LEVEL_CTRL, thread, " <1>", buf);
+		if (i % 16 == 0)
+		{
+			usleep(1000);
+		}
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ * asynchronous log queue test
+ ******************************************************************************/
+bool test_log_queue()
+{
+	received_t received = {};
+	pthread_t threads[THREADS];
+	char big[4096];
+	uintptr_t i;
+
+	queue = log_queue_create(8192, (void*)write_records, &received);
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_create(&threads[i], NULL, (void*)run, (void*)i);
+	}
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	queue->destroy(queue);
+
+	if (received.disorder ||
+		received.received + received.dropped != THREADS * MESSAGES)
+	{
+		return FALSE;
+	}
+
+	/* messages larger than a buffer get truncated, not dropped */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	received = (received_t){};
+	queue = log_queue_create(1024, (void*)write_records, &received);
+	queue->enqueue(queue, DBG_DMN, LEVEL_CTRL, 1, " <1>", big);
+	queue->destroy(queue);
+
+	return received.received == 1 && received.dropped == 0 &&
+		   received.longest > 900 && received.longest < 1024;
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <daemon.h>
+#include <encoding/message.h>
+#include <encoding/payloads/sa_payload.h>
+#include <encoding/payloads/ke_payload.h>
+#include <encoding/payloads/nonce_payload.h>
+#include <encoding/payloads/id_payload.h>
+
+/**
+ * Get a chunk pointing to a string, without the terminating null
+ */
+static chunk_t chunk_str(char *str)
+{
+	return chunk_create(str, strlen(str));
+}
+
+/**
+ * AEAD returned by the keymat
+ */
+static aead_t *aead;
+
+METHOD(diffie_hellman_t, dh_get_my_public_value, void,
+	diffie_hellman_t *this, chunk_t *value)
+{
+	*value = chunk_clone(chunk_str("public-dh-value"));
+}
+
+METHOD(diffie_hellman_t, dh_get_dh_group, diffie_hellman_group_t,
+	diffie_hellman_t *this)
+{
+	return MODP_2048_BIT;
+}
+
+METHOD(keymat_t, keymat_get_version, ike_version_t,
+	keymat_t *this)
+{
+	return IKEV2;
+}
+
+METHOD(keymat_t, keymat_get_aead, aead_t*,
+	keymat_t *this, bool in)
+{
+	return aead;
+}
+
+/**
+ * Create an IKE_SA_INIT or IKE_AUTH request with some payloads
+ */
+static message_t *build_message(exchange_type_t type)
+{
+	diffie_hellman_t dh = {
+		.get_my_public_value = _dh_get_my_public_value,
+		.get_dh_group = _dh_get_dh_group,
+	};
+	identification_t *id;
+	proposal_t *proposal;
+	nonce_payload_t *nonce;
+	message_t *message;
+	ike_sa_id_t *ike_sa_id;
+
+	message = message_create(IKEV2_MAJOR_VERSION, IKEV2_MINOR_VERSION);
+	message->set_exchange_type(message, type);
+	message->set_message_id(message, type == IKE_SA_INIT ? 0 : 1);
+	ike_sa_id = ike_sa_id_create(IKEV2_MAJOR_VERSION, 1, 2, TRUE);
+	message->set_ike_sa_id(message, ike_sa_id);
+	ike_sa_id->destroy(ike_sa_id);
+	message->set_source(message, host_create_from_string("192.168.0.1", 500));
+	message->set_destination(message,
+							 host_create_from_string("192.168.0.2", 500));
+	if (type == IKE_SA_INIT)
+	{
+		proposal = proposal_create_from_string(PROTO_IKE,
+											   "aes128-sha256-modp2048");
+		message->add_payload(message,
+					(payload_t*)sa_payload_create_from_proposal_v2(proposal));
+		proposal->destroy(proposal);
+		message->add_payload(message, (payload_t*)
+					ke_payload_create_from_diffie_hellman(KEY_EXCHANGE, &dh));
+		nonce = nonce_payload_create(NONCE);
+		nonce->set_nonce(nonce, chunk_str("nonce-nonce-nonce"));
+		message->add_payload(message, (payload_t*)nonce);
+		message->add_notify(message, FALSE, NAT_DETECTION_SOURCE_IP,
+							chunk_str("source-hash-source-h"));
+		message->add_notify(message, FALSE, NAT_DETECTION_DESTINATION_IP,
+							chunk_str("dest-hash-dest-hash-"));
+	}
+	else
+	{
+		id = identification_create_from_string("moon.strongswan.org");
+		message->add_payload(message, (payload_t*)
+					id_payload_create_from_identification(ID_INITIATOR, id));
+		id->destroy(id);
+		message->add_notify(message, FALSE, INITIAL_CONTACT, chunk_empty);
+		message->add_notify(message, FALSE, MOBIKE_SUPPORTED, chunk_empty);
+	}
+	return message;
+}
+
+/**
+ * Parse a packet, lazily or not
+ */
+static message_t *parse_packet(packet_t *packet, keymat_t *keymat, bool lazy,
+							   status_t *status)
+{
+	message_t *message;
+
+	message = message_create_from_packet(packet->clone(packet));
+	message->set_lazy_parsing(message, lazy);
+	*status = message->parse_header(message);
+	if (*status == SUCCESS)
+	{
+		*status = message->parse_body(message, keymat);
+	}
+	return message;
+}
+
+/**
+ * Compare the payload types of two messages
+ */
+static bool equal_payloads(message_t *a, message_t *b)
+{
+	enumerator_t *ea, *eb;
+	payload_t *pa, *pb;
+	bool equal = TRUE;
+
+	ea = a->create_payload_enumerator(a);
+	eb = b->create_payload_enumerator(b);
+	while (ea->enumerate(ea, &pa))
+	{
+		if (!eb->enumerate(eb, &pb) ||
+			pa->get_type(pa) != pb->get_type(pb) ||
+			pa->get_next_type(pa) != pb->get_next_type(pb))
+		{
+			equal = FALSE;
+			break;
+		}
+	}
+	if (equal && eb->enumerate(eb, &pb))
+	{
+		equal = FALSE;
+	}
+	ea->destroy(ea);
+	eb->destroy(eb);
+	return equal;
+}
+
+/**
+ * Generate a message, parse it lazily and compare it to an eager parse
+ */
+static bool test_exchange(exchange_type_t type, keymat_t *keymat)
+{
+	message_t *message, *eager, *lazy;
+	notify_payload_t *notify;
+	nonce_payload_t *nonce;
+	enumerator_t *enumerator;
+	payload_t *payload;
+	packet_t *packet;
+	status_t status;
+	chunk_t chunk;
+	bool ok = FALSE, equal;
+
+	message = build_message(type);
+	if (message->generate(message, keymat, &packet) != SUCCESS)
+	{
+		message->destroy(message);
+		return FALSE;
+	}
+	message->destroy(message);
+
+	eager = parse_packet(packet, keymat, FALSE, &status);
+	if (status != SUCCESS)
+	{
+		eager->destroy(eager);
+		packet->destroy(packet);
+		return FALSE;
+	}
+	lazy = parse_packet(packet, keymat, TRUE, &status);
+	if (status != SUCCESS)
+	{
+		goto out;
+	}
+	/* access single payloads before enumerating them */
+	if (type == IKE_SA_INIT)
+	{
+		notify = lazy->get_notify(lazy, NAT_DETECTION_DESTINATION_IP);
+		if (!notify || !chunk_equals(notify->get_notification_data(notify),
+									 chunk_str("dest-hash-dest-hash-")))
+		{
+			goto out;
+		}
+		nonce = (nonce_payload_t*)lazy->get_payload(lazy, NONCE);
+		if (!nonce)
+		{
+			goto out;
+		}
+		chunk = nonce->get_nonce(nonce);
+		equal = chunk_equals(chunk, chunk_str("nonce-nonce-nonce"));
+		chunk_free(&chunk);
+		if (!equal)
+		{
+			goto out;
+		}
+	}
+	else
+	{
+		if (!lazy->get_notify(lazy, MOBIKE_SUPPORTED) ||
+			lazy->get_notify(lazy, NAT_DETECTION_SOURCE_IP) ||
+			lazy->get_payload(lazy, NONCE))
+		{
+			goto out;
+		}
+	}
+	enumerator = lazy->create_unknown_payload_enumerator(lazy);
+	if (enumerator->enumerate(enumerator, &payload))
+	{
+		enumerator->destroy(enumerator);
+		goto out;
+	}
+	enumerator->destroy(enumerator);
+	ok = lazy->get_first_payload_type(lazy) ==
+							eager->get_first_payload_type(eager) &&
+		 equal_payloads(eager, lazy) &&
+		 lazy->parse_remaining(lazy) == SUCCESS &&
+		 eager->parse_remaining(eager) == SUCCESS;
+
+out:
+	lazy->destroy(lazy);
+	eager->destroy(eager);
+	packet->destroy(packet);
+	return ok;
+}
+
+/**
+ * Check that payloads failing to parse fail lazily parsed messages on access
+ */
+static bool test_corrupt()
+{
+	message_t *message;
+	packet_t *packet;
+	status_t status;
+	chunk_t data;
+	u_int8_t type;
+	size_t pos = IKE_HEADER_LENGTH;
+	bool ok;
+
+	message = build_message(IKE_SA_INIT);
+	if (message->generate(message, NULL, &packet) != SUCCESS)
+	{
+		message->destroy(message);
+		return FALSE;
+	}
+	message->destroy(message);
+
+	/* break the protocol ID of the first notify, NAT_DETECTION_SOURCE_IP */
+	data = chunk_clone(packet->get_data(packet));
+	packet->set_data(packet, data);
+	type = data.ptr[16];
+	while (type != NOTIFY)
+	{
+		if (type == NO_PAYLOAD || pos + 4 > data.len)
+		{
+			packet->destroy(packet);
+			return FALSE;
+		}
+		type = data.ptr[pos];
+		pos += untoh16(data.ptr + pos + 2);
+	}
+	data.ptr[pos + 4] = 0xff;
+
+	message = parse_packet(packet, NULL, FALSE, &status);
+	message->destroy(message);
+	ok = status == VERIFY_ERROR;
+	message = parse_packet(packet, NULL, TRUE, &status);
+	ok = ok && status == SUCCESS &&
+		 !message->get_notify(message, NAT_DETECTION_SOURCE_IP) &&
+		 message->get_notify(message, NAT_DETECTION_DESTINATION_IP) &&
+		 message->get_payload(message, NONCE) &&
+		 message->parse_remaining(message) == VERIFY_ERROR;
+	message->destroy(message);
+	/* a later valid notify is not returned instead of the invalid one */
+	message = parse_packet(packet, NULL, TRUE, &status);
+	ok = ok && status == SUCCESS &&
+		 !message->get_payload(message, NOTIFY) &&
+		 message->parse_remaining(message) == VERIFY_ERROR;
+	message->destroy(message);
+	/* failures are reported even if the payload was never accessed */
+	message = parse_packet(packet, NULL, TRUE, &status);
+	ok = ok && status == SUCCESS &&
+		 message->parse_remaining(message) == VERIFY_ERROR;
+	message->destroy(message);
+
+	/* an invalid payload length breaks the chain, in both modes */
+	data.ptr[pos + 3] = 2;
+	message = parse_packet(packet, NULL, FALSE, &status);
+	message->destroy(message);
+	ok = ok && status == PARSE_ERROR;
+	message = parse_packet(packet, NULL, TRUE, &status);
+	message->destroy(message);
+	ok = ok && status == PARSE_ERROR;
+
+	packet->destroy(packet);
+	return ok;
+}
+
+/*******************************************************************************
+ * lazy message parsing test
+ ******************************************************************************/
+bool test_message_lazy()
+{
+	keymat_t keymat = {
+		.get_version = _keymat_get_version,
+		.get_aead = _keymat_get_aead,
+	};
+	char key[32] = {};
+	crypter_t *crypter;
+	signer_t *signer;
+	bool ok;
+
+	if (!test_exchange(IKE_SA_INIT, NULL) || !test_corrupt())
+	{
+		return FALSE;
+	}
+
+	crypter = lib->crypto->create_crypter(lib->crypto, ENCR_AES_CBC, 16);
+	signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_SHA2_256_128);
+	if (!crypter || !signer)
+	{	/* encrypted payloads not testable without AES-CBC/HMAC-SHA256 */
+		DESTROY_IF(crypter);
+		DESTROY_IF(signer);
+		return TRUE;
+	}
+	if (!crypter->set_key(crypter, chunk_create(key, 16)) ||
+		!signer->set_key(signer, chunk_create(key, 32)))
+	{
+		crypter->destroy(crypter);
+		signer->destroy(signer);
+		return FALSE;
+	}
+	aead = aead_create(crypter, signer);
+	ok = test_exchange(IKE_AUTH, &keymat);
+	aead->destroy(aead);
+	aead = NULL;
+	return ok;
+}
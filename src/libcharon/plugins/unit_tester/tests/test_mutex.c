@@ -15,6 +15,7 @@
 
 #include <library.h>
 #include <threading/mutex.h>
+#include <threading/lock_stats.h>
 
 #include <unistd.h>
 #include <sched.h>
@@ -98,3 +99,53 @@ bool test_mutex()
 	return !failed;
 }
 
+
+/*******************************************************************************
+ * lock statistics test
+ ******************************************************************************/
+bool test_lock_stats()
+{
+	unsigned long long count, contended;
+	pthread_t threads[THREADS];
+	char line[512];
+	bool found = FALSE, old;
+	FILE *out;
+	int i;
+
+	old = lock_stats_set_state(TRUE);
+	lock_stats_reset();
+	mutex = mutex_create(MUTEX_TYPE_RECURSIVE);
+
+	pthread_barrier_init(&barrier, NULL, THREADS);
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_create(&threads[i], NULL, run, NULL);
+	}
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	mutex->destroy(mutex);
+	lock_stats_set_state(old);
+
+	out = tmpfile();
+	if (!out)
+	{
+		return FALSE;
+	}
+	lock_stats_print(out, TRUE);
+	rewind(out);
+	while (fgets(line, sizeof(line), out))
+	{
+		/* recursive locks count once, all sites but ours are busy otherwise */
+		if (sscanf(line, "mutex,%*[^,],%llu,%llu,", &count, &contended) == 2 &&
+			count == THREADS * 100 && contended <= count)
+		{
+			found = TRUE;
+		}
+	}
+	fclose(out);
+	return !failed && found;
+}
@@ -18,6 +18,7 @@
 #include <library.h>
 #include <threading/thread.h>
 #include <hydra.h>
+#include <attributes/mem_pool.h>
 
 #define ALLOCS 1000
 #define THREADS 20
@@ -98,3 +99,142 @@ bool test_pool()
 	return TRUE;
 }
 
+
+/**
+ * Acquire an address from an in-memory pool, trying all operations
+ */
+static host_t *mem_acquire(mem_pool_t *pool, identification_t *id,
+						   host_t *requested)
+{
+	host_t *addr;
+
+	addr = pool->acquire_address(pool, id, requested, MEM_POOL_EXISTING);
+	if (!addr)
+	{
+		addr = pool->acquire_address(pool, id, requested, MEM_POOL_NEW);
+	}
+	if (!addr)
+	{
+		addr = pool->acquire_address(pool, id, requested, MEM_POOL_REASSIGN);
+	}
+	return addr;
+}
+
+/**
+ * Create the identity for lease i
+ */
+static identification_t *mem_id(int i)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%d@strongswan.org", i);
+	return identification_create_from_string(buf);
+}
+
+/**
+ * Check if the address acquired for id equals the given string
+ */
+static bool mem_check(mem_pool_t *pool, identification_t *id, host_t *any,
+					  char *expected)
+{
+	host_t *addr, *cmp;
+	bool equal;
+
+	addr = mem_acquire(pool, id, any);
+	if (!addr || !expected)
+	{
+		DESTROY_IF(addr);
+		return !addr && !expected;
+	}
+	cmp = host_create_from_string(expected, 0);
+	equal = addr->ip_equals(addr, cmp);
+	cmp->destroy(cmp);
+	addr->destroy(addr);
+	return equal;
+}
+
+/*******************************************************************************
+ * in-memory pool test
+ ******************************************************************************/
+bool test_mem_pool()
+{
+	identification_t *id[14], *lease_id;
+	host_t *base, *any, *addr;
+	enumerator_t *enumerator;
+	mem_pool_t *pool;
+	bool online, ok = TRUE;
+	char buf[32];
+	int i, count = 0;
+
+	base = host_create_from_string("10.0.0.0", 0);
+	any = host_create_from_string("0.0.0.0", 0);
+	/* a /28 provides 13 addresses */
+	pool = mem_pool_create("test", base, 28);
+	for (i = 0; i < countof(id); i++)
+	{
+		id[i] = mem_id(i);
+	}
+
+	/* a fresh pool has no leases to release or enumerate */
+	addr = host_create_from_string("10.0.0.1", 0);
+	ok = !pool->release_address(pool, addr, id[0]);
+	addr->destroy(addr);
+	enumerator = pool->create_lease_enumerator(pool);
+	while (enumerator->enumerate(enumerator, &lease_id, &addr, &online))
+	{
+		ok = FALSE;
+	}
+	enumerator->destroy(enumerator);
+
+	for (i = 0; i < 13 && ok; i++)
+	{
+		snprintf(buf, sizeof(buf), "10.0.0.%d", i + 1);
+		ok = mem_check(pool, id[i], any, buf);
+	}
+	/* pool is full, no offline leases to reassign */
+	ok = ok && mem_check(pool, id[13], any, NULL);
+	ok = ok && pool->get_online(pool) == 13 && pool->get_offline(pool) == 0;
+
+	/* online leases are reassigned if requested */
+	addr = host_create_from_string("10.0.0.3", 0);
+	ok = ok && mem_check(pool, id[2], addr, "10.0.0.3");
+	ok = ok && mem_check(pool, id[3], addr, NULL);
+
+	/* offline leases stay with their identity... */
+	ok = ok && pool->release_address(pool, addr, id[2]);
+	ok = ok && !pool->release_address(pool, addr, id[2]);
+	ok = ok && pool->get_online(pool) == 12 && pool->get_offline(pool) == 1;
+	ok = ok && mem_check(pool, id[2], any, "10.0.0.3");
+	addr->destroy(addr);
+
+	/* ...until they get reassigned, least recently released first */
+	for (i = 5; i >= 4; i--)
+	{
+		snprintf(buf, sizeof(buf), "10.0.0.%d", i + 1);
+		addr = host_create_from_string(buf, 0);
+		ok = ok && pool->release_address(pool, addr, id[i]);
+		addr->destroy(addr);
+	}
+	ok = ok && mem_check(pool, id[13], any, "10.0.0.6");
+	ok = ok && mem_check(pool, id[4], any, "10.0.0.5");
+	ok = ok && mem_check(pool, id[5], any, NULL);
+	ok = ok && pool->get_online(pool) == 13 && pool->get_offline(pool) == 0;
+
+	enumerator = pool->create_lease_enumerator(pool);
+	while (enumerator->enumerate(enumerator, &lease_id, &addr, &online))
+	{
+		count++;
+		ok = ok && online;
+	}
+	enumerator->destroy(enumerator);
+	ok = ok && count == 13;
+
+	pool->destroy(pool);
+	for (i = 0; i < countof(id); i++)
+	{
+		id[i]->destroy(id[i]);
+	}
+	base->destroy(base);
+	any->destroy(any);
+	return ok;
+}
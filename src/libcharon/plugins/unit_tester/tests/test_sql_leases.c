@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <daemon.h>
+
+#ifdef TEST_ATTR_SQL
+
+#include <plugins/attr_sql/sql_leases.h>
+
+#include <unistd.h>
+
+#define DBFILE "/tmp/strongswan-leases.db"
+
+/**
+ * Number of addresses in the pool
+ */
+#define ADDRESSES 4
+
+/**
+ * Create the attr-sql tables and a pool of ADDRESSES addresses
+ */
+static bool create_pool(database_t *db)
+{
+	u_int32_t addr;
+	int i;
+
+	if (db->execute(db, NULL, "CREATE TABLE identities ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"type INTEGER NOT NULL, data BLOB NOT NULL, "
+			"UNIQUE (type, data))") < 0 ||
+		db->execute(db, NULL, "CREATE TABLE pools ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"name TEXT NOT NULL, start BLOB NOT NULL, end BLOB NOT NULL, "
+			"timeout INTEGER NOT NULL)") < 0 ||
+		db->execute(db, NULL, "CREATE TABLE addresses ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"pool INTEGER NOT NULL, address BLOB NOT NULL, "
+			"identity INTEGER NOT NULL DEFAULT 0, "
+			"acquired INTEGER NOT NULL DEFAULT 0, "
+			"released INTEGER NOT NULL DEFAULT 1)") < 0 ||
+		db->execute(db, NULL, "CREATE TABLE leases ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"address INTEGER NOT NULL, identity INTEGER NOT NULL, "
+			"acquired INTEGER NOT NULL, released INTEGER NOT NULL)") < 0)
+	{
+		return FALSE;
+	}
+	if (db->execute(db, NULL, "INSERT INTO pools (name, start, end, timeout) "
+					"VALUES ('test', ?, ?, 3600)",
+					DB_BLOB, chunk_from_chars(10,3,0,1),
+					DB_BLOB, chunk_from_chars(10,3,0,ADDRESSES)) != 1)
+	{
+		return FALSE;
+	}
+	for (i = 0; i < ADDRESSES; i++)
+	{
+		addr = htonl(0x0a030001 + i);
+		if (db->execute(db, NULL, "INSERT INTO addresses (pool, address) "
+						"VALUES (1, ?)", DB_BLOB,
+						chunk_create((u_char*)&addr, sizeof(addr))) != 1)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Count the rows matching a query
+ */
+static int count_rows(database_t *db, char *sql)
+{
+	enumerator_t *e;
+	u_int count;
+
+	e = db->query(db, sql, DB_UINT);
+	if (!e || !e->enumerate(e, &count))
+	{
+		DESTROY_IF(e);
+		return -1;
+	}
+	e->destroy(e);
+	return count;
+}
+
+/**
+ * Acquire an address for each identity, the pool must then be exhausted
+ */
+static bool acquire_all(sql_leases_t *leases, linked_list_t *pools,
+						identification_t **ids, host_t **hosts)
+{
+	identification_t *id;
+	host_t *host;
+	int i, j;
+
+	for (i = 0; i < ADDRESSES; i++)
+	{
+		hosts[i] = leases->acquire(leases, pools, ids[i]);
+		if (!hosts[i])
+		{
+			return FALSE;
+		}
+		for (j = 0; j < i; j++)
+		{
+			if (hosts[i]->ip_equals(hosts[i], hosts[j]))
+			{
+				return FALSE;
+			}
+		}
+	}
+	id = identification_create_from_string("exhausted@strongswan.org");
+	host = leases->acquire(leases, pools, id);
+	id->destroy(id);
+	if (host)
+	{
+		host->destroy(host);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*******************************************************************************
+ * attr-sql in-memory lease allocation
+ ******************************************************************************/
+bool test_sql_leases()
+{
+	identification_t *ids[ADDRESSES];
+	host_t *hosts[ADDRESSES] = {}, *host = NULL;
+	linked_list_t *pools;
+	sql_leases_t *leases = NULL;
+	database_t *db;
+	char buf[64];
+	bool good = FALSE;
+	int i;
+
+	unlink(DBFILE);
+	db = lib->db->create(lib->db, "sqlite://" DBFILE);
+	if (!db)
+	{
+		return FALSE;
+	}
+	pools = linked_list_create();
+	pools->insert_last(pools, "test");
+	for (i = 0; i < ADDRESSES; i++)
+	{
+		snprintf(buf, sizeof(buf), "peer-%d@strongswan.org", i);
+		ids[i] = identification_create_from_string(buf);
+	}
+	if (!create_pool(db))
+	{
+		goto out;
+	}
+
+	/* a zero batch size writes single changes */
+	leases = sql_leases_create(db, TRUE, 0);
+	if (!leases || !acquire_all(leases, pools, ids, hosts))
+	{
+		goto out;
+	}
+	/* an offline lease stays with its identity */
+	if (!leases->release(leases, pools, hosts[0]))
+	{
+		goto out;
+	}
+	host = leases->acquire(leases, pools, ids[0]);
+	if (!host || !host->ip_equals(host, hosts[0]) ||
+		!leases->release(leases, pools, host))
+	{
+		goto out;
+	}
+	DESTROY_IF(host);
+	host = NULL;
+	leases->flush(leases);
+	if (count_rows(db, "SELECT COUNT(*) FROM addresses "
+				   "WHERE identity != 0") != ADDRESSES ||
+		count_rows(db, "SELECT COUNT(*) FROM addresses "
+				   "WHERE released != 0") != 1 ||
+		count_rows(db, "SELECT COUNT(*) FROM leases") != 2)
+	{
+		goto out;
+	}
+	leases->destroy(leases);
+
+	/* an excessive batch size gets capped, the leases are reloaded */
+	leases = sql_leases_create(db, TRUE, ~0);
+	if (!leases)
+	{
+		goto out;
+	}
+	host = leases->acquire(leases, pools, ids[0]);
+	if (!host || !host->ip_equals(host, hosts[0]))
+	{
+		goto out;
+	}
+	for (i = 1; i < ADDRESSES; i++)
+	{
+		if (!leases->release(leases, pools, hosts[i]))
+		{
+			goto out;
+		}
+	}
+	leases->flush(leases);
+	good = count_rows(db, "SELECT COUNT(*) FROM addresses "
+					  "WHERE released != 0") == ADDRESSES - 1 &&
+		   count_rows(db, "SELECT COUNT(*) FROM leases") == ADDRESSES + 1;
+
+out:
+	DESTROY_IF(leases);
+	DESTROY_IF(host);
+	for (i = 0; i < ADDRESSES; i++)
+	{
+		DESTROY_IF(hosts[i]);
+		ids[i]->destroy(ids[i]);
+	}
+	pools->destroy(pools);
+	db->destroy(db);
+	unlink(DBFILE);
+	return good;
+}
+
+#else /* TEST_ATTR_SQL */
+
+bool test_sql_leases()
+{
+	DBG1(DBG_CFG, "attr-sql leases test requires the attr-sql plugin, not "
+		 "supported in monolithic builds");
+	return TRUE;
+}
+
+#endif /* TEST_ATTR_SQL */
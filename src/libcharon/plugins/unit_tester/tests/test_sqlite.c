@@ -18,6 +18,7 @@
 #include <collections/enumerator.h>
 
 #include <unistd.h>
+#include <time.h>
 
 
 #define DBFILE "/tmp/strongswan-test.db"
@@ -91,3 +92,244 @@ bool test_sqlite()
 	return TRUE;
 }
 
+/*******************************************************************************
+ * sqlite statement cache eviction test
+ ******************************************************************************/
+bool test_sqlite_stmt_cache()
+{
+	database_t *db;
+	enumerator_t *outer, *inner;
+	char sql[64];
+	int i, j, value, sum;
+	bool good = FALSE;
+
+	/* cache fewer statements than we use, forcing evictions */
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.statement_cache", 2);
+	db = lib->db->create(lib->db, "sqlite://" DBFILE);
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.statement_cache", 32);
+	if (!db)
+	{
+		return FALSE;
+	}
+	if (db->execute(db, NULL, "CREATE TABLE test (value INTEGER)") < 0)
+	{
+		goto out;
+	}
+	for (i = 0; i < 8; i++)
+	{
+		if (db->execute(db, NULL, "INSERT INTO test (value) VALUES (?)",
+						DB_INT, i) != 1)
+		{
+			goto out;
+		}
+	}
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			/* distinct statements, the outer one stays in use */
+			outer = db->query(db, "SELECT value FROM test WHERE value = ?",
+							  DB_INT, j, DB_INT);
+			if (!outer || !outer->enumerate(outer, &value) || value != j)
+			{
+				DESTROY_IF(outer);
+				goto out;
+			}
+			snprintf(sql, sizeof(sql),
+					 "SELECT SUM(value) FROM test WHERE value < %d", j);
+			inner = db->query(db, sql, DB_INT);
+			if (!inner || !inner->enumerate(inner, &sum) ||
+				sum != j * (j - 1) / 2)
+			{
+				DESTROY_IF(inner);
+				outer->destroy(outer);
+				goto out;
+			}
+			inner->destroy(inner);
+			outer->destroy(outer);
+		}
+	}
+	good = db->execute(db, NULL, "DROP TABLE test") >= 0;
+
+out:
+	db->destroy(db);
+	unlink(DBFILE);
+	return good;
+}
+
+
+/*******************************************************************************
+ * attr-sql lease allocation benchmark
+ ******************************************************************************/
+
+#define LEASE_POOL "bench"
+#define LEASE_IDENTITIES 100000
+
+/**
+ * Get the identity ID, as sql_attribute.c does
+ */
+static u_int lease_identity(database_t *db, chunk_t data)
+{
+	enumerator_t *e;
+	u_int row = 0;
+	int id;
+
+	e = db->query(db, "SELECT id FROM identities WHERE type = ? AND data = ?",
+				  DB_INT, ID_FQDN, DB_BLOB, data, DB_UINT);
+	if (e)
+	{
+		if (!e->enumerate(e, &row))
+		{
+			row = 0;
+		}
+		e->destroy(e);
+	}
+	if (!row && db->execute(db, &id,
+					"INSERT INTO identities (type, data) VALUES (?, ?)",
+					DB_INT, ID_FQDN, DB_BLOB, data) == 1)
+	{
+		row = id;
+	}
+	return row;
+}
+
+/**
+ * Acquire a lease for an identity, as sql_attribute.c does
+ */
+static bool lease_acquire(database_t *db, u_int identity)
+{
+	enumerator_t *e;
+	u_int pool = 0, timeout, id = 0;
+	chunk_t address;
+
+	e = db->query(db, "SELECT id, timeout FROM pools WHERE name = ?",
+				  DB_TEXT, LEASE_POOL, DB_UINT, DB_UINT);
+	if (!e || !e->enumerate(e, &pool, &timeout))
+	{
+		DESTROY_IF(e);
+		return FALSE;
+	}
+	e->destroy(e);
+
+	e = db->query(db, "SELECT id, address FROM addresses "
+				  "WHERE pool = ? AND identity = ? AND released != 0 LIMIT 1",
+				  DB_UINT, pool, DB_UINT, identity, DB_UINT, DB_BLOB);
+	if (e)
+	{
+		if (e->enumerate(e, &id, &address))
+		{	/* no existing leases expected */
+			e->destroy(e);
+			return FALSE;
+		}
+		e->destroy(e);
+	}
+	e = db->query(db, "SELECT id, address FROM addresses "
+				  "WHERE pool = ? AND identity = 0 LIMIT 1",
+				  DB_UINT, pool, DB_UINT, DB_BLOB);
+	if (!e || !e->enumerate(e, &id, &address))
+	{
+		DESTROY_IF(e);
+		return FALSE;
+	}
+	e->destroy(e);
+	return db->execute(db, NULL, "UPDATE addresses SET "
+					   "acquired = ?, released = 0, identity = ? "
+					   "WHERE id = ? AND identity = 0",
+					   DB_UINT, time(NULL), DB_UINT, identity, DB_UINT, id) == 1;
+}
+
+/**
+ * Replays the attr-sql statements to lease an address to each of
+ * LEASE_IDENTITIES identities, reports the achieved rate.
+ */
+bool test_sqlite_leases()
+{
+	database_t *db;
+	enumerator_t *e;
+	timeval_t start, end;
+	char name[32];
+	u_int32_t addr;
+	u_int identity, leased = 0;
+	int i, usec;
+	bool good = FALSE;
+
+	unlink(DBFILE);
+	db = lib->db->create(lib->db, "sqlite://" DBFILE);
+	if (!db)
+	{
+		return FALSE;
+	}
+	if (db->execute(db, NULL, "CREATE TABLE identities ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"type INTEGER NOT NULL, data BLOB NOT NULL, "
+			"UNIQUE (type, data))") < 0 ||
+		db->execute(db, NULL, "CREATE TABLE pools ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"name TEXT NOT NULL, start BLOB NOT NULL, end BLOB NOT NULL, "
+			"timeout INTEGER NOT NULL)") < 0 ||
+		db->execute(db, NULL, "CREATE INDEX pools_name ON pools (name)") < 0 ||
+		db->execute(db, NULL, "CREATE TABLE addresses ("
+			"id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"pool INTEGER NOT NULL, address BLOB NOT NULL, "
+			"identity INTEGER NOT NULL DEFAULT 0, "
+			"acquired INTEGER NOT NULL DEFAULT 0, "
+			"released INTEGER NOT NULL DEFAULT 1)") < 0 ||
+		db->execute(db, NULL,
+			"CREATE INDEX addresses_pool ON addresses (pool)") < 0 ||
+		db->execute(db, NULL,
+			"CREATE INDEX addresses_identity ON addresses (identity)") < 0)
+	{
+		goto out;
+	}
+	if (db->execute(db, NULL, "INSERT INTO pools (name, start, end, timeout) "
+					"VALUES (?, ?, ?, 0)", DB_TEXT, LEASE_POOL,
+					DB_BLOB, chunk_from_chars(10,0,0,0),
+					DB_BLOB, chunk_from_chars(10,255,255,255)) != 1)
+	{
+		goto out;
+	}
+	db->execute(db, NULL, "BEGIN EXCLUSIVE TRANSACTION");
+	for (i = 0; i < LEASE_IDENTITIES; i++)
+	{
+		addr = htonl(0x0a000001 + i);
+		if (db->execute(db, NULL, "INSERT INTO addresses (pool, address) "
+						"VALUES (1, ?)", DB_BLOB,
+						chunk_create((u_char*)&addr, sizeof(addr))) != 1)
+		{
+			db->execute(db, NULL, "END TRANSACTION");
+			goto out;
+		}
+	}
+	db->execute(db, NULL, "END TRANSACTION");
+
+	time_monotonic(&start);
+	for (i = 0; i < LEASE_IDENTITIES; i++)
+	{
+		snprintf(name, sizeof(name), "peer-%d.strongswan.org", i);
+		identity = lease_identity(db, chunk_create(name, strlen(name)));
+		if (!identity || !lease_acquire(db, identity))
+		{
+			goto out;
+		}
+	}
+	time_monotonic(&end);
+	timersub(&end, &start, &end);
+	usec = end.tv_sec * 1000000 + end.tv_usec;
+	DBG1(DBG_CFG, "leased %d addresses in %d ms, %d leases/s",
+		 LEASE_IDENTITIES, usec / 1000,
+		 (int)((u_int64_t)LEASE_IDENTITIES * 1000000 / max(usec, 1)));
+
+	e = db->query(db, "SELECT count(*) FROM addresses WHERE identity != 0",
+				  DB_UINT);
+	if (e)
+	{
+		good = e->enumerate(e, &leased) && leased == LEASE_IDENTITIES;
+		e->destroy(e);
+	}
+out:
+	db->destroy(db);
+	unlink(DBFILE);
+	return good;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include <library.h>
+#include <daemon.h>
+
+#ifdef TEST_UPDOWN
+
+#include <updown/updown_executor.h>
+
+#include <unistd.h>
+
+/**
+ * Number of CHILD_SAs to queue events for
+ */
+#define REQIDS 8
+
+/**
+ * Number of events queued per CHILD_SA
+ */
+#define EVENTS 6
+
+/**
+ * Build the environment of an event
+ */
+static char **make_env(u_int32_t reqid, int seq)
+{
+	char **env;
+
+	env = calloc(3, sizeof(char*));
+	if (asprintf(&env[0], "PLUTO_REQID=%u", reqid) < 0 ||
+		asprintf(&env[1], "PLUTO_SEQ=%d", seq) < 0)
+	{
+		env[0] = env[1] = NULL;
+	}
+	return env;
+}
+
+/**
+ * Queue events of all CHILD_SAs, interleaved, and execute them
+ */
+static void run(u_int threads, u_int batch, char *batch_scripts, char *script)
+{
+	updown_executor_t *executor;
+	int i, j;
+
+	executor = updown_executor_create(threads, batch, batch_scripts);
+	for (i = 0; i < EVENTS; i++)
+	{
+		for (j = 1; j <= REQIDS; j++)
+		{
+			executor->execute(executor, j, script, make_env(j, i));
+		}
+	}
+	executor->destroy(executor);
+}
+
+/**
+ * Verify that all events have been executed once, in order per CHILD_SA,
+ * and count the script invocations
+ */
+static bool verify(char *path, int *invocations)
+{
+	int next[REQIDS + 1] = {}, reqid, seq, batch, events = 0;
+	char line[128];
+	bool ok = TRUE;
+	FILE *file;
+
+	*invocations = 0;
+	file = fopen(path, "r");
+	if (!file)
+	{
+		return FALSE;
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "batch %d", &batch) == 1)
+		{
+			(*invocations)++;
+		}
+		else if (sscanf(line, "PLUTO_REQID=%d", &reqid) == 1)
+		{	/* batched variables precede the sequence number */
+			continue;
+		}
+		else if (sscanf(line, "PLUTO_SEQ=%d", &seq) == 1 ||
+				 sscanf(line, "%d %d", &reqid, &seq) == 2)
+		{
+			if (reqid < 1 || reqid > REQIDS || seq != next[reqid]++)
+			{
+				ok = FALSE;
+			}
+			events++;
+		}
+	}
+	fclose(file);
+	unlink(path);
+	return ok && events == REQIDS * EVENTS;
+}
+
+/*******************************************************************************
+ * updown script executor test
+ ******************************************************************************/
+bool test_updown_executor()
+{
+	char path[] = "/tmp/strongswan-updown-XXXXXX";
+	char single[256], batched[256];
+	int fd, invocations;
+
+	fd = mkstemp(path);
+	if (fd == -1)
+	{
+		return FALSE;
+	}
+	close(fd);
+	snprintf(single, sizeof(single), "echo \"batch ${PLUTO_BATCH:-0}\" >>%s; "
+			 "echo \"$PLUTO_REQID $PLUTO_SEQ\" >>%s", path, path);
+	snprintf(batched, sizeof(batched), "{ echo \"batch $PLUTO_BATCH\"; "
+			 "grep PLUTO_; } >>%s", path);
+
+	/* synchronous execution, variables in the environment */
+	run(0, 0, NULL, single);
+	if (!verify(path, &invocations) || invocations != REQIDS * EVENTS)
+	{
+		DBG1(DBG_CHD, "synchronous updown: %d invocations", invocations);
+		return FALSE;
+	}
+
+	/* asynchronous execution keeps the order per CHILD_SA */
+	run(4, 0, NULL, single);
+	if (!verify(path, &invocations) || invocations != REQIDS * EVENTS)
+	{
+		DBG1(DBG_CHD, "asynchronous updown: %d invocations", invocations);
+		return FALSE;
+	}
+
+	/* scripts not opting in don't get batched events */
+	run(2, 4, batched, single);
+	if (!verify(path, &invocations) || invocations != REQIDS * EVENTS)
+	{
+		DBG1(DBG_CHD, "unbatched updown: %d invocations", invocations);
+		return FALSE;
+	}
+
+	/* batched events are passed on stdin */
+	run(2, 4, batched, batched);
+	if (!verify(path, &invocations) || invocations >= REQIDS * EVENTS)
+	{
+		DBG1(DBG_CHD, "batched updown: %d invocations", invocations);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+#else /* TEST_UPDOWN */
+
+bool test_updown_executor()
+{
+	DBG1(DBG_CHD, "updown executor test requires the updown plugin, not "
+		 "supported in monolithic builds");
+	return TRUE;
+}
+
+#endif /* TEST_UPDOWN */
@@ -0,0 +1,685 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "updown_executor.h"
+
+#include <daemon.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <collections/linked_list.h>
+
+extern char **environ;
+
+/**
+ * Maximum length of a line of script output we log
+ */
+#define MAX_LINE 512
+
+typedef struct private_updown_executor_t private_updown_executor_t;
+
+/**
+ * Private data of an updown_executor_t object.
+ */
+struct private_updown_executor_t {
+
+	/**
+	 * Public updown_executor_t interface.
+	 */
+	updown_executor_t public;
+
+	/**
+	 * Maximum number of events per script invocation, 0 to disable batching
+	 */
+	u_int batch;
+
+	/**
+	 * Scripts accepting batched events, as char*
+	 */
+	linked_list_t *batch_scripts;
+
+	/**
+	 * Queued events, as event_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * reqids of events currently executed, as uintptr_t
+	 */
+	linked_list_t *busy;
+
+	/**
+	 * Executing threads, as thread_t
+	 */
+	linked_list_t *threads;
+
+	/**
+	 * Mutex protecting queue, busy and statistics
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Condvar to signal queued or completed events
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * TRUE if threads terminate once the queue is empty
+	 */
+	bool stopping;
+
+	/**
+	 * Number of executed events
+	 */
+	u_int64_t events;
+
+	/**
+	 * Number of script invocations
+	 */
+	u_int64_t invocations;
+
+	/**
+	 * Sum of the latency of all events, in ms
+	 */
+	u_int64_t latency_sum;
+
+	/**
+	 * Maximum latency of an event, in ms
+	 */
+	u_int latency_max;
+
+	/**
+	 * Maximum number of queued events
+	 */
+	u_int depth_max;
+};
+
+/**
+ * A queued updown event
+ */
+typedef struct {
+	/** reqid of the CHILD_SA */
+	u_int32_t reqid;
+	/** script to invoke */
+	char *script;
+	/** NULL terminated NAME=value variables */
+	char **env;
+	/** time the event has been queued */
+	timeval_t queued;
+} event_t;
+
+/**
+ * Destroy an event
+ */
+static void event_destroy(event_t *event)
+{
+	int i;
+
+	for (i = 0; event->env[i]; i++)
+	{
+		free(event->env[i]);
+	}
+	free(event->env);
+	free(event->script);
+	free(event);
+}
+
+/**
+ * Build the environment of a script, inheriting our own
+ */
+static char **build_envp(char **env)
+{
+	char **envp;
+	int i, count = 0, inherited = 0;
+
+	while (environ[inherited])
+	{
+		inherited++;
+	}
+	while (env[count])
+	{
+		count++;
+	}
+	envp = malloc(sizeof(char*) * (inherited + count + 1));
+	memcpy(envp, env, sizeof(char*) * count);
+	for (i = 0; i < inherited; i++)
+	{
+		envp[count + i] = environ[i];
+	}
+	envp[count + inherited] = NULL;
+	return envp;
+}
+
+/**
+ * Log complete lines of script output, returns the bytes left in buf
+ */
+static size_t log_lines(char *buf, size_t len, bool flush)
+{
+	char *pos, *line = buf;
+
+	while ((pos = memchr(line, '\n', len - (line - buf))))
+	{
+		*pos = '\0';
+		DBG1(DBG_CHD, "updown: %s", line);
+		line = pos + 1;
+	}
+	len -= line - buf;
+	memmove(buf, line, len);
+	if (len && (flush || len == MAX_LINE - 1))
+	{
+		buf[len] = '\0';
+		DBG1(DBG_CHD, "updown: %s", buf);
+		len = 0;
+	}
+	return len;
+}
+
+/**
+ * Log the output of the script, while writing input to it
+ */
+static void handle_io(int out, int in, chunk_t input)
+{
+	struct pollfd pfd[2];
+	char buf[MAX_LINE];
+	size_t pos = 0;
+	ssize_t len;
+	int count;
+
+	while (TRUE)
+	{
+		count = 0;
+		pfd[count++] = (struct pollfd){
+			.fd = out,
+			.events = POLLIN,
+		};
+		if (in != -1)
+		{
+			pfd[count++] = (struct pollfd){
+				.fd = in,
+				.events = POLLOUT,
+			};
+		}
+		if (poll(pfd, count, -1) == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			DBG1(DBG_CHD, "error polling updown script: %s", strerror(errno));
+			break;
+		}
+		if (in != -1 && pfd[1].revents)
+		{
+			len = write(in, input.ptr, input.len);
+			if (len > 0)
+			{
+				input = chunk_skip(input, len);
+			}
+			if (!input.len || (len == -1 && errno != EINTR && errno != EAGAIN))
+			{
+				close(in);
+				in = -1;
+			}
+		}
+		if (pfd[0].revents)
+		{
+			len = read(out, buf + pos, sizeof(buf) - 1 - pos);
+			if (len == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (len <= 0)
+			{
+				if (len == -1)
+				{
+					DBG1(DBG_CHD, "error reading output from updown script");
+				}
+				break;
+			}
+			pos = log_lines(buf, pos + len, FALSE);
+		}
+	}
+	log_lines(buf, pos, TRUE);
+	if (in != -1)
+	{
+		close(in);
+	}
+	close(out);
+}
+
+/**
+ * Create a pipe, not inherited by scripts spawned concurrently
+ */
+static int pipe_cloexec(int fds[2])
+{
+#ifdef O_CLOEXEC
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) == -1)
+	{
+		return -1;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#endif
+}
+
+/**
+ * Spawn a script with the given environment and input, and wait for it
+ */
+static void run_script(char *script, char **envp, chunk_t input)
+{
+	posix_spawn_file_actions_t actions;
+	char *argv[] = { "/bin/sh", "-c", script, NULL };
+	int out[2], in[2] = { -1, -1 }, status, err;
+	pid_t pid;
+
+	if (pipe_cloexec(out) == -1)
+	{
+		DBG1(DBG_CHD, "could not execute updown script '%s': %s",
+			 script, strerror(errno));
+		return;
+	}
+	if (input.len)
+	{
+		if (pipe_cloexec(in) == -1)
+		{
+			DBG1(DBG_CHD, "could not execute updown script '%s': %s",
+				 script, strerror(errno));
+			close(out[0]);
+			close(out[1]);
+			return;
+		}
+		/* don't block on writing, script may not read before writing */
+		fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+	posix_spawn_file_actions_adddup2(&actions, out[1], 2);
+	posix_spawn_file_actions_addclose(&actions, out[0]);
+	posix_spawn_file_actions_addclose(&actions, out[1]);
+	if (input.len)
+	{
+		posix_spawn_file_actions_adddup2(&actions, in[0], 0);
+		posix_spawn_file_actions_addclose(&actions, in[0]);
+		posix_spawn_file_actions_addclose(&actions, in[1]);
+	}
+	err = posix_spawn(&pid, argv[0], &actions, NULL, argv, envp);
+	posix_spawn_file_actions_destroy(&actions);
+
+	close(out[1]);
+	if (input.len)
+	{
+		close(in[0]);
+	}
+	if (err)
+	{
+		DBG1(DBG_CHD, "could not execute updown script '%s': %s",
+			 script, strerror(err));
+		close(out[0]);
+		if (input.len)
+		{
+			close(in[1]);
+		}
+		return;
+	}
+	handle_io(out[0], in[1], input);
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+	{
+		/* retry */
+	}
+}
+
+/**
+ * Check if a script accepts batched events
+ */
+static bool is_batch_script(private_updown_executor_t *this, char *script)
+{
+	enumerator_t *enumerator;
+	char *current;
+	bool found = FALSE;
+
+	if (!this->batch)
+	{
+		return FALSE;
+	}
+	enumerator = this->batch_scripts->create_enumerator(this->batch_scripts);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (streq(current, script))
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Execute a number of events for the same script, update statistics
+ */
+static void run_events(private_updown_executor_t *this, event_t **events,
+					   int count)
+{
+	char **envp, *batch[] = { NULL, NULL }, *pos;
+	chunk_t input = chunk_empty;
+	timeval_t now;
+	u_int latency, sum = 0, max = 0;
+	size_t len;
+	int i, j;
+
+	if (is_batch_script(this, events[0]->script))
+	{
+		if (asprintf(&batch[0], "PLUTO_BATCH=%d", count) < 0)
+		{
+			batch[0] = NULL;
+		}
+		for (i = 0; i < count; i++)
+		{
+			for (j = 0; events[i]->env[j]; j++)
+			{
+				input.len += strlen(events[i]->env[j]) + 1;
+			}
+			input.len++;
+		}
+		input = chunk_alloc(input.len);
+		pos = (char*)input.ptr;
+		for (i = 0; i < count; i++)
+		{
+			for (j = 0; events[i]->env[j]; j++)
+			{
+				len = strlen(events[i]->env[j]);
+				memcpy(pos, events[i]->env[j], len);
+				pos += len;
+				*pos++ = '\n';
+			}
+			*pos++ = '\n';
+		}
+		envp = build_envp(batch);
+	}
+	else
+	{
+		envp = build_envp(events[0]->env);
+	}
+	DBG3(DBG_CHD, "running updown script '%s' for %d event%s",
+		 events[0]->script, count, count == 1 ? "" : "s");
+	run_script(events[0]->script, envp, input);
+	free(envp);
+	free(batch[0]);
+	chunk_free(&input);
+
+	gettimeofday(&now, NULL);
+	for (i = 0; i < count; i++)
+	{
+		latency = (now.tv_sec - events[i]->queued.tv_sec) * 1000 +
+				  (now.tv_usec - events[i]->queued.tv_usec) / 1000;
+		sum += latency;
+		max = max(max, latency);
+	}
+	DBG2(DBG_CHD, "updown script executed %d event%s, latency %ums max",
+		 count, count == 1 ? "" : "s", max);
+
+	this->mutex->lock(this->mutex);
+	this->invocations++;
+	this->events += count;
+	this->latency_sum += sum;
+	this->latency_max = max(this->latency_max, max);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Check if a list contains a reqid
+ */
+static bool has_reqid(linked_list_t *list, u_int32_t reqid)
+{
+	enumerator_t *enumerator;
+	uintptr_t current;
+	bool found = FALSE;
+
+	enumerator = list->create_enumerator(list);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current == reqid)
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Dequeue events to execute, returns the number of events, mutex is held
+ */
+static int dequeue(private_updown_executor_t *this, event_t **events)
+{
+	enumerator_t *enumerator;
+	linked_list_t *skipped;
+	event_t *event;
+	int count = 0, limit = 1, i;
+
+	skipped = linked_list_create();
+	enumerator = this->queue->create_enumerator(this->queue);
+	while (count < limit && enumerator->enumerate(enumerator, &event))
+	{
+		if (has_reqid(this->busy, event->reqid) ||
+			has_reqid(skipped, event->reqid))
+		{	/* an earlier event for this CHILD_SA is pending */
+			continue;
+		}
+		if (count && !streq(events[0]->script, event->script))
+		{	/* can't batch events for different scripts */
+			skipped->insert_last(skipped, (void*)(uintptr_t)event->reqid);
+			continue;
+		}
+		for (i = 0; i < count; i++)
+		{
+			if (events[i]->reqid == event->reqid)
+			{
+				break;
+			}
+		}
+		if (i < count)
+		{	/* events for a CHILD_SA are not batched together */
+			continue;
+		}
+		if (!count && is_batch_script(this, event->script))
+		{
+			limit = this->batch;
+		}
+		this->queue->remove_at(this->queue, enumerator);
+		events[count++] = event;
+	}
+	enumerator->destroy(enumerator);
+	skipped->destroy(skipped);
+
+	for (i = 0; i < count; i++)
+	{
+		this->busy->insert_last(this->busy, (void*)(uintptr_t)events[i]->reqid);
+	}
+	return count;
+}
+
+/**
+ * Executing thread
+ */
+static void *execute_events(private_updown_executor_t *this)
+{
+	event_t **events;
+	int count, i;
+
+	events = malloc(sizeof(event_t*) * max(this->batch, 1));
+	while (TRUE)
+	{
+		this->mutex->lock(this->mutex);
+		while (!(count = dequeue(this, events)))
+		{
+			if (this->stopping && !this->queue->get_count(this->queue))
+			{
+				this->mutex->unlock(this->mutex);
+				free(events);
+				return NULL;
+			}
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+		this->mutex->unlock(this->mutex);
+
+		run_events(this, events, count);
+
+		this->mutex->lock(this->mutex);
+		for (i = 0; i < count; i++)
+		{
+			this->busy->remove(this->busy,
+							   (void*)(uintptr_t)events[i]->reqid, NULL);
+		}
+		/* events for these CHILD_SAs might be executable now */
+		this->condvar->broadcast(this->condvar);
+		this->mutex->unlock(this->mutex);
+
+		for (i = 0; i < count; i++)
+		{
+			event_destroy(events[i]);
+		}
+	}
+}
+
+METHOD(updown_executor_t, execute, void,
+	private_updown_executor_t *this, u_int32_t reqid, char *script,
+	char **env)
+{
+	event_t *event;
+	u_int depth;
+
+	INIT(event,
+		.reqid = reqid,
+		.script = strdup(script),
+		.env = env,
+	);
+	gettimeofday(&event->queued, NULL);
+
+	if (!this->threads->get_count(this->threads))
+	{
+		run_events(this, &event, 1);
+		event_destroy(event);
+		return;
+	}
+
+	this->mutex->lock(this->mutex);
+	this->queue->insert_last(this->queue, event);
+	depth = this->queue->get_count(this->queue);
+	if (depth > this->depth_max)
+	{
+		this->depth_max = depth;
+		if (depth >= 16 && (depth & (depth - 1)) == 0)
+		{
+			DBG1(DBG_CHD, "%u updown events queued", depth);
+		}
+	}
+	this->condvar->signal(this->condvar);
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(updown_executor_t, destroy, void,
+	private_updown_executor_t *this)
+{
+	thread_t *thread;
+
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+	while (this->threads->remove_first(this->threads,
+									   (void**)&thread) == SUCCESS)
+	{
+		thread->join(thread);
+	}
+	if (this->events)
+	{
+		DBG1(DBG_CHD, "updown executed %llu events in %llu invocations, "
+			 "latency %llums avg/%ums max, %u events queued max",
+			 this->events, this->invocations,
+			 this->latency_sum / this->events, this->latency_max,
+			 this->depth_max);
+	}
+	this->threads->destroy(this->threads);
+	this->batch_scripts->destroy_function(this->batch_scripts, free);
+	this->queue->destroy(this->queue);
+	this->busy->destroy(this->busy);
+	this->condvar->destroy(this->condvar);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * See header
+ */
+updown_executor_t *updown_executor_create(u_int threads, u_int batch,
+										  char *batch_scripts)
+{
+	private_updown_executor_t *this;
+	enumerator_t *enumerator;
+	thread_t *thread;
+	char *script;
+	u_int i;
+
+	INIT(this,
+		.public = {
+			.execute = _execute,
+			.destroy = _destroy,
+		},
+		.batch = threads ? batch : 0,
+		.batch_scripts = linked_list_create(),
+		.queue = linked_list_create(),
+		.busy = linked_list_create(),
+		.threads = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+	);
+
+	if (batch_scripts)
+	{
+		enumerator = enumerator_create_token(batch_scripts, ",", " ");
+		while (enumerator->enumerate(enumerator, &script))
+		{
+			this->batch_scripts->insert_last(this->batch_scripts,
+											 strdup(script));
+		}
+		enumerator->destroy(enumerator);
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		thread = thread_create((thread_main_t)execute_events, this);
+		if (thread)
+		{
+			this->threads->insert_last(this->threads, thread);
+		}
+	}
+	return &this->public;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup updown_executor updown_executor
+ * @{ @ingroup updown
+ */
+
+#ifndef UPDOWN_EXECUTOR_H_
+#define UPDOWN_EXECUTOR_H_
+
+#include <library.h>
+
+typedef struct updown_executor_t updown_executor_t;
+
+/**
+ * Executes updown scripts, optionally asynchronously by a pool of threads.
+ *
+ * Scripts get spawned with posix_spawn() using /bin/sh, events are passed
+ * in environment variables. Asynchronously executed events for the same
+ * CHILD_SA (reqid) are executed in the order they have been queued.
+ *
+ * In batch mode, multiple queued events for a script that opted in are
+ * passed to a single script invocation. Such scripts get invoked with
+ * PLUTO_BATCH set to the number of events, which are written to stdin as
+ * NAME=value lines, each event terminated by an empty line. Other scripts
+ * get invoked for each event, as in synchronous mode.
+ */
+struct updown_executor_t {
+
+	/**
+	 * Execute or queue an updown event.
+	 *
+	 * @param reqid			reqid of the CHILD_SA, for ordering
+	 * @param script		script to invoke, cloned
+	 * @param env			NULL terminated NAME=value variables, adopted
+	 */
+	void (*execute)(updown_executor_t *this, u_int32_t reqid, char *script,
+					char **env);
+
+	/**
+	 * Destroy a updown_executor_t, executes all queued events.
+	 */
+	void (*destroy)(updown_executor_t *this);
+};
+
+/**
+ * Create a updown_executor instance.
+ *
+ * @param threads		number of threads executing scripts, 0 to execute
+ *						synchronously when calling execute()
+ * @param batch			maximum number of events per script invocation,
+ *						0 to pass events in the environment only
+ * @param batch_scripts	comma separated scripts accepting batched events
+ * @return				executor
+ */
+updown_executor_t *updown_executor_create(u_int threads, u_int batch,
+										  char *batch_scripts);
+
+#endif /** UPDOWN_EXECUTOR_H_ @}*/
@@ -21,6 +21,7 @@
 #include <hydra.h>
 #include <daemon.h>
 #include <config/child_cfg.h>
+#include <threading/mutex.h>
 
 typedef struct private_updown_listener_t private_updown_listener_t;
 
@@ -39,10 +40,20 @@ struct private_updown_listener_t {
 	 */
 	linked_list_t *iface_cache;
 
+	/**
+	 * Mutex to lock the interface name cache
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * DNS attribute handler
 	 */
 	updown_handler_t *handler;
+
+	/**
+	 * Executes the scripts
+	 */
+	updown_executor_t *executor;
 };
 
 typedef struct cache_entry_t cache_entry_t;
@@ -68,7 +79,9 @@ static void cache_iface(private_updown_listener_t *this, u_int32_t reqid,
 	entry->reqid = reqid;
 	entry->iface = strdup(iface);
 
+	this->mutex->lock(this->mutex);
 	this->iface_cache->insert_first(this->iface_cache, entry);
+	this->mutex->unlock(this->mutex);
 }
 
 /**
@@ -80,6 +93,7 @@ static char* uncache_iface(private_updown_listener_t *this, u_int32_t reqid)
 	cache_entry_t *entry;
 	char *iface = NULL;
 
+	this->mutex->lock(this->mutex);
 	enumerator = this->iface_cache->create_enumerator(this->iface_cache);
 	while (enumerator->enumerate(enumerator, &entry))
 	{
@@ -92,22 +106,48 @@ static char* uncache_iface(private_updown_listener_t *this, u_int32_t reqid)
 		}
 	}
 	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
 	return iface;
 }
 
 /**
- * Create variables for handled DNS attributes
+ * Add a variable to the NULL terminated environment passed to the script
  */
-static char *make_dns_vars(private_updown_listener_t *this, ike_sa_t *ike_sa)
+static void push_env(char **envp[], char *fmt, ...)
+{
+	va_list args;
+	char *var;
+	int i = 0;
+
+	va_start(args, fmt);
+	if (vasprintf(&var, fmt, args) < 0)
+	{
+		va_end(args);
+		return;
+	}
+	va_end(args);
+	while ((*envp)[i])
+	{
+		i++;
+	}
+	*envp = realloc(*envp, sizeof(char*) * (i + 2));
+	(*envp)[i] = var;
+	(*envp)[i + 1] = NULL;
+}
+
+/**
+ * Add variables for handled DNS attributes
+ */
+static void push_dns_env(private_updown_listener_t *this, ike_sa_t *ike_sa,
+						 char **envp[])
 {
 	enumerator_t *enumerator;
 	host_t *host;
 	int v4 = 0, v6 = 0;
-	char total[512] = "", current[64];
 
 	if (!this->handler)
 	{
-		return strdup("");
+		return;
 	}
 
 	enumerator = this->handler->create_dns_enumerator(this->handler,
@@ -117,32 +157,27 @@ static char *make_dns_vars(private_updown_listener_t *this, ike_sa_t *ike_sa)
 		switch (host->get_family(host))
 		{
 			case AF_INET:
-				snprintf(current, sizeof(current),
-						 "PLUTO_DNS4_%d='%H' ", ++v4, host);
+				push_env(envp, "PLUTO_DNS4_%d=%H", ++v4, host);
 				break;
 			case AF_INET6:
-				snprintf(current, sizeof(current),
-						 "PLUTO_DNS6_%d='%H' ", ++v6, host);
+				push_env(envp, "PLUTO_DNS6_%d=%H", ++v6, host);
 				break;
 			default:
 				continue;
 		}
-		strncat(total, current, sizeof(total) - strlen(total) - 1);
 	}
 	enumerator->destroy(enumerator);
-
-	return strdup(total);
 }
 
 /**
- * Create variables for local virtual IPs
+ * Add variables for local virtual IPs
  */
-static char *make_vip_vars(private_updown_listener_t *this, ike_sa_t *ike_sa)
+static void push_vip_env(private_updown_listener_t *this, ike_sa_t *ike_sa,
+						 char **envp[])
 {
 	enumerator_t *enumerator;
 	host_t *host;
 	int v4 = 0, v6 = 0;
-	char total[512] = "", current[64];
 	bool first = TRUE;
 
 	enumerator = ike_sa->create_virtual_ip_enumerator(ike_sa, TRUE);
@@ -150,28 +185,22 @@ static char *make_vip_vars(private_updown_listener_t *this, ike_sa_t *ike_sa)
 	{
 		if (first)
 		{	/* legacy variable for first VIP */
-			snprintf(current, sizeof(current),
-						 "PLUTO_MY_SOURCEIP='%H' ", host);
-			strncat(total, current, sizeof(total) - strlen(total) - 1);
+			first = FALSE;
+			push_env(envp, "PLUTO_MY_SOURCEIP=%H", host);
 		}
 		switch (host->get_family(host))
 		{
 			case AF_INET:
-				snprintf(current, sizeof(current),
-						 "PLUTO_MY_SOURCEIP4_%d='%H' ", ++v4, host);
+				push_env(envp, "PLUTO_MY_SOURCEIP4_%d=%H", ++v4, host);
 				break;
 			case AF_INET6:
-				snprintf(current, sizeof(current),
-						 "PLUTO_MY_SOURCEIP6_%d='%H' ", ++v6, host);
+				push_env(envp, "PLUTO_MY_SOURCEIP6_%d=%H", ++v6, host);
 				break;
 			default:
 				continue;
 		}
-		strncat(total, current, sizeof(total) - strlen(total) - 1);
 	}
 	enumerator->destroy(enumerator);
-
-	return strdup(total);
 }
 
 METHOD(listener_t, child_updown, bool,
@@ -197,91 +226,15 @@ METHOD(listener_t, child_updown, bool,
 	enumerator = child_sa->create_policy_enumerator(child_sa);
 	while (enumerator->enumerate(enumerator, &my_ts, &other_ts))
 	{
-		char command[1024];
 		host_t *my_client, *other_client;
 		u_int8_t my_client_mask, other_client_mask;
-		char *virtual_ip, *iface, *mark_in, *mark_out, *udp_enc, *dns, *xauth;
+		char **envp, *iface;
 		mark_t mark;
 		bool is_host, is_ipv6;
-		FILE *shell;
 
 		my_ts->to_subnet(my_ts, &my_client, &my_client_mask);
 		other_ts->to_subnet(other_ts, &other_client, &other_client_mask);
 
-		virtual_ip = make_vip_vars(this, ike_sa);
-
-		/* check for the presence of an inbound mark */
-		mark = config->get_mark(config, TRUE);
-		if (mark.value)
-		{
-			if (asprintf(&mark_in, "PLUTO_MARK_IN='%u/0x%08x' ",
-						 mark.value, mark.mask ) < 0)
-			{
-				mark_in = NULL;
-			}
-		}
-		else
-		{
-			if (asprintf(&mark_in, "") < 0)
-			{
-				mark_in = NULL;
-			}
-		}
-
-		/* check for the presence of an outbound mark */
-		mark = config->get_mark(config, FALSE);
-		if (mark.value)
-		{
-			if (asprintf(&mark_out, "PLUTO_MARK_OUT='%u/0x%08x' ",
-						 mark.value, mark.mask ) < 0)
-			{
-				mark_out = NULL;
-			}
-		}
-		else
-		{
-			if (asprintf(&mark_out, "") < 0)
-			{
-				mark_out = NULL;
-			}
-		}
-
-		/* check for a NAT condition causing ESP_IN_UDP encapsulation */
-		if (ike_sa->has_condition(ike_sa, COND_NAT_ANY))
-		{
-			if (asprintf(&udp_enc, "PLUTO_UDP_ENC='%u' ",
-						 other->get_port(other)) < 0)
-			{
-				udp_enc = NULL;
-			}
-
-		}
-		else
-		{
-			if (asprintf(&udp_enc, "") < 0)
-			{
-				udp_enc = NULL;
-			}
-
-		}
-
-		if (ike_sa->has_condition(ike_sa, COND_EAP_AUTHENTICATED) ||
-			ike_sa->has_condition(ike_sa, COND_XAUTH_AUTHENTICATED))
-		{
-			if (asprintf(&xauth, "PLUTO_XAUTH_ID='%Y' ",
-						 ike_sa->get_other_eap_id(ike_sa)) < 0)
-			{
-				xauth = NULL;
-			}
-		}
-		else
-		{
-			if (asprintf(&xauth, "") < 0)
-			{
-				xauth = NULL;
-			}
-		}
-
 		if (up)
 		{
 			if (hydra->kernel_interface->get_interface(hydra->kernel_interface,
@@ -295,105 +248,69 @@ METHOD(listener_t, child_updown, bool,
 			iface = uncache_iface(this, child_sa->get_reqid(child_sa));
 		}
 
-		dns = make_dns_vars(this, ike_sa);
-
 		/* determine IPv4/IPv6 and client/host situation */
 		is_host = my_ts->is_host(my_ts, me);
 		is_ipv6 = is_host ? (me->get_family(me) == AF_INET6) :
 							(my_ts->get_type(my_ts) == TS_IPV6_ADDR_RANGE);
 
-		/* build the command with all env variables.
+		/* pass all variables in the environment.
 		 * TODO: PLUTO_PEER_CA and PLUTO_NEXT_HOP are currently missing
 		 */
-		snprintf(command, sizeof(command),
-				 "2>&1 "
-				"PLUTO_VERSION='1.1' "
-				"PLUTO_VERB='%s%s%s' "
-				"PLUTO_CONNECTION='%s' "
-				"PLUTO_INTERFACE='%s' "
-				"PLUTO_REQID='%u' "
-				"PLUTO_ME='%H' "
-				"PLUTO_MY_ID='%Y' "
-				"PLUTO_MY_CLIENT='%H/%u' "
-				"PLUTO_MY_PORT='%u' "
-				"PLUTO_MY_PROTOCOL='%u' "
-				"PLUTO_PEER='%H' "
-				"PLUTO_PEER_ID='%Y' "
-				"PLUTO_PEER_CLIENT='%H/%u' "
-				"PLUTO_PEER_PORT='%u' "
-				"PLUTO_PEER_PROTOCOL='%u' "
-				"%s"
-				"%s"
-				"%s"
-				"%s"
-				"%s"
-				"%s"
-				"%s"
-				"%s",
-				 up ? "up" : "down",
-				 is_host ? "-host" : "-client",
-				 is_ipv6 ? "-v6" : "",
-				 config->get_name(config),
-				 iface ? iface : "unknown",
-				 child_sa->get_reqid(child_sa),
-				 me, ike_sa->get_my_id(ike_sa),
-				 my_client, my_client_mask,
-				 my_ts->get_from_port(my_ts),
-				 my_ts->get_protocol(my_ts),
-				 other, ike_sa->get_other_id(ike_sa),
-				 other_client, other_client_mask,
-				 other_ts->get_from_port(other_ts),
-				 other_ts->get_protocol(other_ts),
-				 xauth,
-				 virtual_ip,
-				 mark_in,
-				 mark_out,
-				 udp_enc,
-				 config->get_hostaccess(config) ? "PLUTO_HOST_ACCESS='1' " : "",
-				 dns,
-				 script);
-		my_client->destroy(my_client);
-		other_client->destroy(other_client);
-		free(virtual_ip);
-		free(mark_in);
-		free(mark_out);
-		free(udp_enc);
-		free(dns);
-		free(iface);
-		free(xauth);
-
-		DBG3(DBG_CHD, "running updown script: %s", command);
-		shell = popen(command, "r");
-
-		if (shell == NULL)
+		envp = calloc(1, sizeof(char*));
+		push_env(&envp, "PLUTO_VERSION=1.1");
+		push_env(&envp, "PLUTO_VERB=%s%s%s", up ? "up" : "down",
+				 is_host ? "-host" : "-client", is_ipv6 ? "-v6" : "");
+		push_env(&envp, "PLUTO_CONNECTION=%s", config->get_name(config));
+		push_env(&envp, "PLUTO_INTERFACE=%s", iface ? iface : "unknown");
+		push_env(&envp, "PLUTO_REQID=%u", child_sa->get_reqid(child_sa));
+		push_env(&envp, "PLUTO_ME=%H", me);
+		push_env(&envp, "PLUTO_MY_ID=%Y", ike_sa->get_my_id(ike_sa));
+		push_env(&envp, "PLUTO_MY_CLIENT=%H/%u", my_client, my_client_mask);
+		push_env(&envp, "PLUTO_MY_PORT=%u", my_ts->get_from_port(my_ts));
+		push_env(&envp, "PLUTO_MY_PROTOCOL=%u", my_ts->get_protocol(my_ts));
+		push_env(&envp, "PLUTO_PEER=%H", other);
+		push_env(&envp, "PLUTO_PEER_ID=%Y", ike_sa->get_other_id(ike_sa));
+		push_env(&envp, "PLUTO_PEER_CLIENT=%H/%u",
+				 other_client, other_client_mask);
+		push_env(&envp, "PLUTO_PEER_PORT=%u", other_ts->get_from_port(other_ts));
+		push_env(&envp, "PLUTO_PEER_PROTOCOL=%u",
+				 other_ts->get_protocol(other_ts));
+		if (ike_sa->has_condition(ike_sa, COND_EAP_AUTHENTICATED) ||
+			ike_sa->has_condition(ike_sa, COND_XAUTH_AUTHENTICATED))
 		{
-			DBG1(DBG_CHD, "could not execute updown script '%s'", script);
-			return TRUE;
+			push_env(&envp, "PLUTO_XAUTH_ID=%Y",
+					 ike_sa->get_other_eap_id(ike_sa));
 		}
-
-		while (TRUE)
+		push_vip_env(this, ike_sa, &envp);
+		/* check for the presence of an inbound mark */
+		mark = config->get_mark(config, TRUE);
+		if (mark.value)
 		{
-			char resp[128];
-
-			if (fgets(resp, sizeof(resp), shell) == NULL)
-			{
-				if (ferror(shell))
-				{
-					DBG1(DBG_CHD, "error reading output from updown script");
-				}
-				break;
-			}
-			else
-			{
-				char *e = resp + strlen(resp);
-				if (e > resp && e[-1] == '\n')
-				{	/* trim trailing '\n' */
-					e[-1] = '\0';
-				}
-				DBG1(DBG_CHD, "updown: %s", resp);
-			}
+			push_env(&envp, "PLUTO_MARK_IN=%u/0x%08x", mark.value, mark.mask);
+		}
+		/* check for the presence of an outbound mark */
+		mark = config->get_mark(config, FALSE);
+		if (mark.value)
+		{
+			push_env(&envp, "PLUTO_MARK_OUT=%u/0x%08x", mark.value, mark.mask);
 		}
-		pclose(shell);
+		/* check for a NAT condition causing ESP_IN_UDP encapsulation */
+		if (ike_sa->has_condition(ike_sa, COND_NAT_ANY))
+		{
+			push_env(&envp, "PLUTO_UDP_ENC=%u", other->get_port(other));
+		}
+		if (config->get_hostaccess(config))
+		{
+			push_env(&envp, "PLUTO_HOST_ACCESS=1");
+		}
+		push_dns_env(this, ike_sa, &envp);
+
+		my_client->destroy(my_client);
+		other_client->destroy(other_client);
+		free(iface);
+
+		this->executor->execute(this->executor, child_sa->get_reqid(child_sa),
+								script, envp);
 	}
 	enumerator->destroy(enumerator);
 	return TRUE;
@@ -402,14 +319,17 @@ METHOD(listener_t, child_updown, bool,
 METHOD(updown_listener_t, destroy, void,
 	private_updown_listener_t *this)
 {
+	this->executor->destroy(this->executor);
 	this->iface_cache->destroy(this->iface_cache);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
 /**
  * See header
  */
-updown_listener_t *updown_listener_create(updown_handler_t *handler)
+updown_listener_t *updown_listener_create(updown_handler_t *handler,
+										  updown_executor_t *executor)
 {
 	private_updown_listener_t *this;
 
@@ -421,7 +341,9 @@ updown_listener_t *updown_listener_create(updown_handler_t *handler)
 			.destroy = _destroy,
 		},
 		.iface_cache = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.handler = handler,
+		.executor = executor,
 	);
 
 	return &this->public;
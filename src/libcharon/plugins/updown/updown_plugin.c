@@ -20,6 +20,16 @@
 #include <daemon.h>
 #include <hydra.h>
 
+/**
+ * Maximum number of threads executing scripts
+ */
+#define MAX_THREADS 64
+
+/**
+ * Maximum number of events per script invocation
+ */
+#define MAX_BATCH 1024
+
 typedef struct private_updown_plugin_t private_updown_plugin_t;
 
 /**
@@ -69,6 +79,7 @@ METHOD(plugin_t, destroy, void,
 plugin_t *updown_plugin_create()
 {
 	private_updown_plugin_t *this;
+	int threads, batch;
 
 	INIT(this,
 		.public = {
@@ -87,7 +98,26 @@ plugin_t *updown_plugin_create()
 		hydra->attributes->add_handler(hydra->attributes,
 									   &this->handler->handler);
 	}
-	this->listener = updown_listener_create(this->handler);
+	threads = lib->settings->get_int(lib->settings,
+									 "charon.plugins.updown.threads", 0);
+	if (threads < 0 || threads > MAX_THREADS)
+	{
+		DBG1(DBG_CFG, "invalid number of updown threads %d, executing "
+			 "scripts synchronously", threads);
+		threads = 0;
+	}
+	batch = lib->settings->get_int(lib->settings,
+								   "charon.plugins.updown.batch", 0);
+	if (batch < 0 || batch > MAX_BATCH)
+	{
+		DBG1(DBG_CFG, "invalid updown batch size %d, not batching events",
+			 batch);
+		batch = 0;
+	}
+	this->listener = updown_listener_create(this->handler,
+				updown_executor_create(threads, batch,
+					lib->settings->get_str(lib->settings,
+								"charon.plugins.updown.batch_scripts", NULL)));
 	charon->bus->add_listener(charon->bus, &this->listener->listener);
 
 	return &this->public.plugin;
@@ -15,8 +15,34 @@
 
 #include "eap_method.h"
 
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
 #include <daemon.h>
 
+/**
+ * Default value of charon.max_packet, as used by the socket plugins
+ */
+#define MAX_PACKET 10000
+
+/**
+ * Maximum length of an EAP message, as limited by its length field
+ */
+#define MAX_EAP_LEN 65535
+
+/**
+ * IKE overhead of an EAP message without encryption: UDP header, non-ESP
+ * marker, IKE header, encrypted payload header and EAP payload header
+ */
+#define IKE_EAP_OVERHEAD (8 + 4 + 28 + 4 + 4)
+
+/**
+ * Encryption overhead if the IKE_SA has no AEAD transform (yet): a 16 byte
+ * IV, up to 16 bytes padding and a 32 byte ICV
+ */
+#define IKE_CRYPTO_OVERHEAD 64
+
 ENUM(eap_role_names, EAP_SERVER, EAP_PEER,
 	"EAP_SERVER",
 	"EAP_PEER",
@@ -40,3 +66,89 @@ bool eap_method_register(plugin_t *plugin, plugin_feature_t *feature,
 	}
 	return TRUE;
 }
+
+/**
+ * Get the path MTU towards the peer, as currently known to the kernel,
+ * 0 if unknown
+ */
+static int get_path_mtu(host_t *other)
+{
+	int skt, mtu = 0;
+	socklen_t len = sizeof(mtu);
+
+	skt = socket(other->get_family(other), SOCK_DGRAM, 0);
+	if (skt < 0)
+	{
+		return 0;
+	}
+	/* the kernel reports the path MTU of the route of a connected socket */
+	if (connect(skt, other->get_sockaddr(other),
+				*other->get_sockaddr_len(other)) == 0)
+	{
+		switch (other->get_family(other))
+		{
+#ifdef IP_MTU
+			case AF_INET:
+				if (getsockopt(skt, IPPROTO_IP, IP_MTU, &mtu, &len) != 0)
+				{
+					mtu = 0;
+				}
+				break;
+#endif
+#ifdef IPV6_MTU
+			case AF_INET6:
+				if (getsockopt(skt, IPPROTO_IPV6, IPV6_MTU, &mtu, &len) != 0)
+				{
+					mtu = 0;
+				}
+				break;
+#endif
+			default:
+				break;
+		}
+	}
+	close(skt);
+	return mtu;
+}
+
+/**
+ * See header
+ */
+size_t eap_method_get_max_size()
+{
+	ike_sa_t *ike_sa;
+	keymat_t *keymat;
+	aead_t *aead;
+	host_t *other;
+	int mtu, overhead;
+
+	ike_sa = charon->bus->get_sa(charon->bus);
+	if (!ike_sa)
+	{
+		return 0;
+	}
+	other = ike_sa->get_other_host(ike_sa);
+	mtu = get_path_mtu(other);
+
+	overhead = IKE_EAP_OVERHEAD;
+	overhead += other->get_family(other) == AF_INET6 ? 40 : 20;
+	keymat = ike_sa->get_keymat(ike_sa);
+	aead = keymat->get_aead(keymat, FALSE);
+	if (aead)
+	{
+		overhead += aead->get_iv_size(aead) + aead->get_block_size(aead) +
+					aead->get_icv_size(aead);
+	}
+	else
+	{
+		overhead += IKE_CRYPTO_OVERHEAD;
+	}
+	/* larger IKE messages than the receiving socket accepts get truncated */
+	mtu = min(mtu, lib->settings->get_int(lib->settings, "%s.max_packet",
+										  MAX_PACKET, charon->name));
+	if (mtu <= overhead)
+	{
+		return 0;
+	}
+	return min(mtu - overhead, MAX_EAP_LEN);
+}
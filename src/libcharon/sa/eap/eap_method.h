@@ -67,6 +67,10 @@ struct eap_method_t {
 	 * initiate() is only useable for server implementations, as clients only
 	 * reply to server requests.
 	 * A eap_payload is created in "out" if result is NEED_MORE.
+	 * A server method waiting for a backend may instead defer the IKE
+	 * response with ike_sa_t.defer_response() and return NEED_MORE without
+	 * setting "out". It gets initiated again once it called
+	 * ike_sa_t.resume_response() and must then return its result.
 	 *
 	 * @param out		eap_payload to send to the client
 	 * @return
@@ -79,6 +83,9 @@ struct eap_method_t {
 	 * Process a received EAP message.
 	 *
 	 * A eap_payload is created in "out" if result is NEED_MORE.
+	 * As with initiate(), a server method may defer the IKE response and
+	 * return NEED_MORE without setting "out", it gets invoked again with the
+	 * same response after ike_sa_t.resume_response().
 	 *
 	 * @param in		eap_payload response received
 	 * @param out		created eap_payload to send
@@ -174,4 +181,17 @@ typedef eap_method_t *(*eap_constructor_t)(identification_t *server,
 bool eap_method_register(plugin_t *plugin, plugin_feature_t *feature,
 						 bool reg, void *data);
 
+/**
+ * Get the maximum size of an EAP message the IKE_SA currently checked out
+ * by this thread can carry without IP fragmentation.
+ *
+ * The size is derived from the path MTU towards the peer as known to the
+ * kernel, minus the IP, UDP and IKE overhead, and is limited by
+ * charon.max_packet. EAP methods that fragment their messages may use it to
+ * minimize the number of round trips.
+ *
+ * @return				maximum EAP message size, 0 if unknown
+ */
+size_t eap_method_get_max_size();
+
 #endif /** EAP_METHOD_H_ @}*/
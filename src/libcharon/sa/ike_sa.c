@@ -1958,6 +1958,27 @@ METHOD(ike_sa_t, queue_task, void,
 	this->task_manager->queue_task(this->task_manager, task);
 }
 
+METHOD(ike_sa_t, defer_response, bool,
+	private_ike_sa_t *this)
+{
+	return this->task_manager->defer_response(this->task_manager);
+}
+
+METHOD(ike_sa_t, resume_response, status_t,
+	private_ike_sa_t *this)
+{
+	status_t status;
+
+	status = this->task_manager->resume_response(this->task_manager);
+	if (this->flush_auth_cfg && this->state == IKE_ESTABLISHED)
+	{
+		/* authentication completed */
+		this->flush_auth_cfg = FALSE;
+		flush_auth_cfgs(this);
+	}
+	return status;
+}
+
 METHOD(ike_sa_t, inherit, void,
 	private_ike_sa_t *this, ike_sa_t *other_public)
 {
@@ -2235,6 +2256,8 @@ ike_sa_t * ike_sa_create(ike_sa_id_t *ike_sa_id, bool initiator,
 			.create_task_enumerator = _create_task_enumerator,
 			.flush_queue = _flush_queue,
 			.queue_task = _queue_task,
+			.defer_response = _defer_response,
+			.resume_response = _resume_response,
 #ifdef ME
 			.act_as_mediation_server = _act_as_mediation_server,
 			.get_server_reflexive_host = _get_server_reflexive_host,
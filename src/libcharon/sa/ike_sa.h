@@ -1009,6 +1009,20 @@ struct ike_sa_t {
 	 */
 	void (*queue_task)(ike_sa_t *this, task_t *task);
 
+	/**
+	 * Defer the response to the request currently being processed.
+	 *
+	 * @return				TRUE if response deferred, FALSE if not supported
+	 */
+	bool (*defer_response)(ike_sa_t *this);
+
+	/**
+	 * Build and send a response deferred with defer_response().
+	 *
+	 * @return				DESTROY_ME if the IKE_SA must be destroyed
+	 */
+	status_t (*resume_response)(ike_sa_t *this);
+
 	/**
 	 * Inherit all attributes of other to this after rekeying.
 	 *
@@ -1046,6 +1046,10 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 	status_t status;
 
 	status = msg->parse_body(msg, this->ike_sa->get_keymat(this->ike_sa));
+	if (status == SUCCESS)
+	{	/* retransmits are detected before parsing, verify all payloads */
+		status = msg->parse_remaining(msg);
+	}
 
 	if (status != SUCCESS)
 	{
@@ -1574,6 +1578,18 @@ METHOD(task_manager_t, incr_mid, void,
 {
 }
 
+METHOD(task_manager_t, defer_response, bool,
+	private_task_manager_t *this)
+{
+	return FALSE;
+}
+
+METHOD(task_manager_t, resume_response, status_t,
+	private_task_manager_t *this)
+{
+	return SUCCESS;
+}
+
 METHOD(task_manager_t, reset, void,
 	private_task_manager_t *this, u_int32_t initiate, u_int32_t respond)
 {
@@ -1673,6 +1689,8 @@ task_manager_v1_t *task_manager_v1_create(ike_sa_t *ike_sa)
 				.initiate = _initiate,
 				.retransmit = _retransmit,
 				.incr_mid = _incr_mid,
+				.defer_response = _defer_response,
+				.resume_response = _resume_response,
 				.reset = _reset,
 				.adopt_tasks = _adopt_tasks,
 				.busy = _busy,
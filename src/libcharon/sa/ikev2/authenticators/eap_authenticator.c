@@ -98,6 +98,16 @@ struct private_eap_authenticator_t {
 	 * EAP identity of peer
 	 */
 	identification_t *eap_identity;
+
+	/**
+	 * Copy of the EAP response the method deferred its result for
+	 */
+	eap_payload_t *deferred;
+
+	/**
+	 * Method deferred the result of initiate()
+	 */
+	bool initiate_deferred;
 };
 
 /**
@@ -134,6 +144,49 @@ static eap_method_t *load_method(private_eap_authenticator_t *this,
 										role, server, peer);
 }
 
+/**
+ * Initiate the loaded EAP method as server, NULL if it deferred the result
+ */
+static eap_payload_t* server_initiate_method(private_eap_authenticator_t *this)
+{
+	eap_payload_t *out = NULL;
+	eap_type_t type;
+	u_int32_t vendor;
+
+	if (this->method->initiate(this->method, &out) == NEED_MORE)
+	{
+		if (!out)
+		{	/* method deferred the IKE response, gets initiated again */
+			this->initiate_deferred = TRUE;
+			return NULL;
+		}
+		type = this->method->get_type(this->method, &vendor);
+		if (vendor)
+		{
+			DBG1(DBG_IKE, "initiating EAP vendor type %d-%d method (id 0x%02X)",
+				 type, vendor, out->get_identifier(out));
+		}
+		else
+		{
+			DBG1(DBG_IKE, "initiating %N method (id 0x%02X)", eap_type_names,
+				 type, out->get_identifier(out));
+		}
+		return out;
+	}
+	/* type might have changed for virtual methods */
+	type = this->method->get_type(this->method, &vendor);
+	if (vendor)
+	{
+		DBG1(DBG_IKE, "initiating EAP vendor type %d-%d method failed",
+					  type,	vendor);
+	}
+	else
+	{
+		DBG1(DBG_IKE, "initiating %N method failed", eap_type_names, type);
+	}
+	return eap_payload_create_code(EAP_FAILURE, 0);
+}
+
 /**
  * Initiate EAP conversation as server
  */
@@ -145,7 +198,6 @@ static eap_payload_t* server_initiate_eap(private_eap_authenticator_t *this,
 	identification_t *id;
 	u_int32_t vendor;
 	eap_payload_t *out;
-	char *action;
 
 	auth = this->ike_sa->get_auth_cfg(this->ike_sa, FALSE);
 
@@ -182,37 +234,19 @@ static eap_payload_t* server_initiate_eap(private_eap_authenticator_t *this,
 	/* invoke real EAP method */
 	type = (uintptr_t)auth->get(auth, AUTH_RULE_EAP_TYPE);
 	vendor = (uintptr_t)auth->get(auth, AUTH_RULE_EAP_VENDOR);
-	action = "loading";
 	this->method = load_method(this, type, vendor, EAP_SERVER);
 	if (this->method)
 	{
-		action = "initiating";
-		if (this->method->initiate(this->method, &out) == NEED_MORE)
-		{
-			type = this->method->get_type(this->method, &vendor);
-			if (vendor)
-			{
-				DBG1(DBG_IKE, "initiating EAP vendor type %d-%d method (id 0x%02X)",
-					 type, vendor, out->get_identifier(out));
-			}
-			else
-			{
-				DBG1(DBG_IKE, "initiating %N method (id 0x%02X)", eap_type_names,
-					 type, out->get_identifier(out));
-			}
-			return out;
-		}
-		/* type might have changed for virtual methods */
-		type = this->method->get_type(this->method, &vendor);
+		return server_initiate_method(this);
 	}
 	if (vendor)
 	{
-		DBG1(DBG_IKE, "%s EAP vendor type %d-%d method failed",
-					  action, type,	vendor);
+		DBG1(DBG_IKE, "loading EAP vendor type %d-%d method failed",
+					  type,	vendor);
 	}
 	else
 	{
-		DBG1(DBG_IKE, "%s %N method failed", action, eap_type_names, type);
+		DBG1(DBG_IKE, "loading %N method failed", eap_type_names, type);
 	}
 	return eap_payload_create_code(EAP_FAILURE, 0);
 }
@@ -275,9 +309,14 @@ static eap_payload_t* server_process_eap(private_eap_authenticator_t *this,
 		}
 	}
 
+	out = NULL;
 	switch (this->method->process(this->method, in, &out))
 	{
 		case NEED_MORE:
+			if (!out)
+			{	/* method deferred the IKE response, gets invoked again */
+				this->deferred = eap_payload_create_data(in->get_data(in));
+			}
 			return out;
 		case SUCCESS:
 			if (!vendor && type == EAP_IDENTITY)
@@ -545,6 +584,20 @@ METHOD(authenticator_t, process_server, status_t,
 METHOD(authenticator_t, build_server, status_t,
 	private_eap_authenticator_t *this, message_t *message)
 {
+	eap_payload_t *deferred;
+
+	if (this->initiate_deferred)
+	{	/* collect the result of the deferred method */
+		this->initiate_deferred = FALSE;
+		this->eap_payload = server_initiate_method(this);
+	}
+	else if (this->deferred)
+	{
+		deferred = this->deferred;
+		this->deferred = NULL;
+		this->eap_payload = server_process_eap(this, deferred);
+		deferred->destroy(deferred);
+	}
 	if (this->eap_payload)
 	{
 		eap_code_t code;
@@ -678,6 +731,7 @@ METHOD(authenticator_t, destroy, void,
 	DESTROY_IF(this->method);
 	DESTROY_IF(this->eap_payload);
 	DESTROY_IF(this->eap_identity);
+	DESTROY_IF(this->deferred);
 	chunk_free(&this->msk);
 	free(this);
 }
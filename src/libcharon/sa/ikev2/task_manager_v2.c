@@ -93,6 +93,21 @@ struct private_task_manager_t {
 		 */
 		packet_t *packet;
 
+		/**
+		 * TRUE while the tasks process a request
+		 */
+		bool processing;
+
+		/**
+		 * Number of pending defer_response() calls
+		 */
+		u_int deferred;
+
+		/**
+		 * Stub of the request a deferred response gets built for
+		 */
+		message_t *request;
+
 	} responding;
 
 	/**
@@ -887,6 +902,7 @@ static status_t process_request(private_task_manager_t *this,
 	}
 
 	/* let the tasks process the message */
+	this->responding.processing = TRUE;
 	enumerator = this->passive_tasks->create_enumerator(this->passive_tasks);
 	while (enumerator->enumerate(enumerator, (void*)&task))
 	{
@@ -909,14 +925,76 @@ static status_t process_request(private_task_manager_t *this,
 				this->passive_tasks->remove_at(this->passive_tasks, enumerator);
 				enumerator->destroy(enumerator);
 				task->destroy(task);
+				this->responding.processing = FALSE;
+				this->responding.deferred = 0;
 				return DESTROY_ME;
 		}
 	}
 	enumerator->destroy(enumerator);
+	this->responding.processing = FALSE;
 
+	if (this->responding.deferred)
+	{
+		host_t *me, *other;
+
+		DBG2(DBG_IKE, "deferring response to request with ID %d",
+			 this->responding.mid);
+		/* keep what build_response() needs from the request */
+		me = message->get_destination(message);
+		other = message->get_source(message);
+		this->responding.request = message_create(IKEV2_MAJOR_VERSION,
+												  IKEV2_MINOR_VERSION);
+		this->responding.request->set_exchange_type(this->responding.request,
+										message->get_exchange_type(message));
+		this->responding.request->set_source(this->responding.request,
+											 other->clone(other));
+		this->responding.request->set_destination(this->responding.request,
+												  me->clone(me));
+		return SUCCESS;
+	}
 	return build_response(this, message);
 }
 
+METHOD(task_manager_t, defer_response, bool,
+	private_task_manager_t *this)
+{
+	if (!this->responding.processing)
+	{
+		return FALSE;
+	}
+	this->responding.deferred++;
+	return TRUE;
+}
+
+METHOD(task_manager_t, resume_response, status_t,
+	private_task_manager_t *this)
+{
+	message_t *request;
+	status_t status;
+
+	if (!this->responding.deferred || --this->responding.deferred)
+	{
+		return SUCCESS;
+	}
+	request = this->responding.request;
+	if (!request)
+	{	/* resumed while processing, response gets built as usual */
+		return SUCCESS;
+	}
+	this->responding.request = NULL;
+	DBG2(DBG_IKE, "resuming response to request with ID %d",
+		 this->responding.mid);
+	status = build_response(this, request);
+	request->destroy(request);
+	if (status != SUCCESS)
+	{
+		flush(this);
+		return DESTROY_ME;
+	}
+	this->responding.mid++;
+	return SUCCESS;
+}
+
 METHOD(task_manager_t, incr_mid, void,
 	private_task_manager_t *this, bool initiate)
 {
@@ -968,6 +1046,68 @@ static void send_notify_response(private_task_manager_t *this,
 	response->destroy(response);
 }
 
+/**
+ * Handle a message that failed to parse or verify, type is the unsupported
+ * critical payload type for NOT_SUPPORTED
+ */
+static status_t parse_failed(private_task_manager_t *this, message_t *msg,
+							 status_t status, u_int8_t type)
+{
+	bool is_request = msg->get_request(msg);
+
+	switch (status)
+	{
+		case NOT_SUPPORTED:
+			DBG1(DBG_IKE, "critical unknown payloads found");
+			if (is_request)
+			{
+				send_notify_response(this, msg,
+									 UNSUPPORTED_CRITICAL_PAYLOAD,
+									 chunk_from_thing(type));
+				incr_mid(this, FALSE);
+			}
+			break;
+		case PARSE_ERROR:
+			DBG1(DBG_IKE, "message parsing failed");
+			if (is_request)
+			{
+				send_notify_response(this, msg,
+									 INVALID_SYNTAX, chunk_empty);
+				incr_mid(this, FALSE);
+			}
+			break;
+		case VERIFY_ERROR:
+			DBG1(DBG_IKE, "message verification failed");
+			if (is_request)
+			{
+				send_notify_response(this, msg,
+									 INVALID_SYNTAX, chunk_empty);
+				incr_mid(this, FALSE);
+			}
+			break;
+		case FAILED:
+			DBG1(DBG_IKE, "integrity check failed");
+			/* ignored */
+			break;
+		case INVALID_STATE:
+			DBG1(DBG_IKE, "found encrypted message, but no keys available");
+		default:
+			break;
+	}
+	DBG1(DBG_IKE, "%N %s with message ID %d processing failed",
+		 exchange_type_names, msg->get_exchange_type(msg),
+		 is_request ? "request" : "response",
+		 msg->get_message_id(msg));
+
+	charon->bus->alert(charon->bus, ALERT_PARSE_ERROR_BODY, msg, status);
+
+	if (this->ike_sa->get_state(this->ike_sa) == IKE_CREATED)
+	{	/* invalid initiation attempt, close SA */
+		return DESTROY_ME;
+	}
+	return status;
+}
+
 /**
  * Parse the given message and verify that it is valid.
  */
@@ -984,13 +1124,12 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 		unknown_payload_t *unknown;
 		payload_t *payload;
 
-		enumerator = msg->create_payload_enumerator(msg);
+		enumerator = msg->create_unknown_payload_enumerator(msg);
 		while (enumerator->enumerate(enumerator, &payload))
 		{
 			unknown = (unknown_payload_t*)payload;
 			type = payload->get_type(payload);
-			if (!payload_is_known(type) &&
-				unknown->is_critical(unknown))
+			if (unknown->is_critical(unknown))
 			{
 				DBG1(DBG_ENC, "payload type %N is not supported, "
 					 "but its critical!", payload_type_names, type);
@@ -1003,60 +1142,9 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 
 	if (status != SUCCESS)
 	{
-		bool is_request = msg->get_request(msg);
-
-		switch (status)
-		{
-			case NOT_SUPPORTED:
-				DBG1(DBG_IKE, "critical unknown payloads found");
-				if (is_request)
-				{
-					send_notify_response(this, msg,
-										 UNSUPPORTED_CRITICAL_PAYLOAD,
-										 chunk_from_thing(type));
-					incr_mid(this, FALSE);
-				}
-				break;
-			case PARSE_ERROR:
-				DBG1(DBG_IKE, "message parsing failed");
-				if (is_request)
-				{
-					send_notify_response(this, msg,
-										 INVALID_SYNTAX, chunk_empty);
-					incr_mid(this, FALSE);
-				}
-				break;
-			case VERIFY_ERROR:
-				DBG1(DBG_IKE, "message verification failed");
-				if (is_request)
-				{
-					send_notify_response(this, msg,
-										 INVALID_SYNTAX, chunk_empty);
-					incr_mid(this, FALSE);
-				}
-				break;
-			case FAILED:
-				DBG1(DBG_IKE, "integrity check failed");
-				/* ignored */
-				break;
-			case INVALID_STATE:
-				DBG1(DBG_IKE, "found encrypted message, but no keys available");
-			default:
-				break;
-		}
-		DBG1(DBG_IKE, "%N %s with message ID %d processing failed",
-			 exchange_type_names, msg->get_exchange_type(msg),
-			 is_request ? "request" : "response",
-			 msg->get_message_id(msg));
-
-		charon->bus->alert(charon->bus, ALERT_PARSE_ERROR_BODY, msg, status);
-
-		if (this->ike_sa->get_state(this->ike_sa) == IKE_CREATED)
-		{	/* invalid initiation attempt, close SA */
-			return DESTROY_ME;
-		}
+		return parse_failed(this, msg, status, type);
 	}
-	return status;
+	return SUCCESS;
 }
 
 
@@ -1110,8 +1198,19 @@ METHOD(task_manager_t, process_message, status_t,
 	mid = msg->get_message_id(msg);
 	if (msg->get_request(msg))
 	{
+		if (mid == this->responding.mid && this->responding.request)
+		{
+			DBG1(DBG_IKE, "received retransmit of request with ID %d, "
+				 "response pending", mid);
+			return SUCCESS;
+		}
 		if (mid == this->responding.mid)
 		{
+			status = msg->parse_remaining(msg);
+			if (status != SUCCESS)
+			{	/* lazily parsed payloads are verified before processing */
+				return parse_failed(this, msg, status, 0);
+			}
 			if (this->ike_sa->get_state(this->ike_sa) == IKE_CREATED ||
 				this->ike_sa->get_state(this->ike_sa) == IKE_CONNECTING ||
 				msg->get_exchange_type(msg) != IKE_SA_INIT)
@@ -1131,7 +1230,10 @@ METHOD(task_manager_t, process_message, status_t,
 				flush(this);
 				return DESTROY_ME;
 			}
-			this->responding.mid++;
+			if (!this->responding.request)
+			{	/* increased once a deferred response has been sent */
+				this->responding.mid++;
+			}
 		}
 		else if ((mid == this->responding.mid - 1) && this->responding.packet)
 		{
@@ -1158,6 +1260,11 @@ METHOD(task_manager_t, process_message, status_t,
 	{
 		if (mid == this->initiating.mid)
 		{
+			status = msg->parse_remaining(msg);
+			if (status != SUCCESS)
+			{	/* lazily parsed payloads are verified before processing */
+				return parse_failed(this, msg, status, 0);
+			}
 			if (this->ike_sa->get_state(this->ike_sa) == IKE_CREATED ||
 				this->ike_sa->get_state(this->ike_sa) == IKE_CONNECTING ||
 				msg->get_exchange_type(msg) != IKE_SA_INIT)
@@ -1399,8 +1506,11 @@ METHOD(task_manager_t, reset, void,
 
 	/* reset message counters and retransmit packets */
 	DESTROY_IF(this->responding.packet);
+	DESTROY_IF(this->responding.request);
 	DESTROY_IF(this->initiating.packet);
 	this->responding.packet = NULL;
+	this->responding.request = NULL;
+	this->responding.deferred = 0;
 	this->initiating.packet = NULL;
 	if (initiate != UINT_MAX)
 	{
@@ -1457,6 +1567,7 @@ METHOD(task_manager_t, destroy, void,
 	this->passive_tasks->destroy(this->passive_tasks);
 
 	DESTROY_IF(this->responding.packet);
+	DESTROY_IF(this->responding.request);
 	DESTROY_IF(this->initiating.packet);
 	free(this);
 }
@@ -1485,6 +1596,8 @@ task_manager_v2_t *task_manager_v2_create(ike_sa_t *ike_sa)
 				.initiate = _initiate,
 				.retransmit = _retransmit,
 				.incr_mid = _incr_mid,
+				.defer_response = _defer_response,
+				.resume_response = _resume_response,
 				.reset = _reset,
 				.adopt_tasks = _adopt_tasks,
 				.busy = _busy,
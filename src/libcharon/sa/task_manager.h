@@ -221,6 +221,26 @@ struct task_manager_t {
 	 */
 	void (*incr_mid)(task_manager_t *this, bool initiate);
 
+	/**
+	 * Defer the response to the request currently being processed.
+	 *
+	 * May be called while the tasks process a request, e.g. from a listener
+	 * hook, if data required to build the response is not available yet.
+	 * The response gets built once resume_response() has been called for
+	 * each call to defer_response(). Retransmits of the request are ignored
+	 * in the meantime.
+	 *
+	 * @return				TRUE if response deferred, FALSE if not supported
+	 */
+	bool (*defer_response)(task_manager_t *this);
+
+	/**
+	 * Build and send a response deferred with defer_response().
+	 *
+	 * @return				DESTROY_ME if the IKE_SA must be destroyed
+	 */
+	status_t (*resume_response)(task_manager_t *this);
+
 	/**
 	 * Reset message ID counters of the task manager.
 	 *
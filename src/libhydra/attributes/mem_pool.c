@@ -18,12 +18,40 @@
 
 #include <utils/debug.h>
 #include <collections/hashtable.h>
-#include <collections/linked_list.h>
-#include <threading/mutex.h>
+#include <threading/rwlock.h>
 
 #define POOL_LIMIT (sizeof(uintptr_t)*8)
 
+/**
+ * Initial number of lease slots allocated, doubled if required
+ */
+#define LEASES_INITIAL 64
+
 typedef struct private_mem_pool_t private_mem_pool_t;
+typedef struct entry_t entry_t;
+
+/**
+ * Links of a lease in a circular, doubly linked queue, as offsets
+ */
+typedef struct {
+	/** previous lease in queue */
+	u_int prev;
+	/** next lease in queue */
+	u_int next;
+} lease_link_t;
+
+/**
+ * Lease slot, indexed by offset.
+ */
+typedef struct {
+	/** identity the address is leased to, NULL if not yet assigned */
+	entry_t *entry;
+	/** position in the queue of offline leases to reassign, least recently
+	 * released first */
+	lease_link_t lru;
+	/** position in the queue of offline leases of entry */
+	lease_link_t id;
+} lease_t;
 
 /**
  * private data of mem_pool_t
@@ -55,27 +83,57 @@ struct private_mem_pool_t {
 	u_int unused;
 
 	/**
-	 * lease hashtable [identity => entry]
+	 * identity hashtable [identity => entry]
+	 */
+	hashtable_t *ids;
+
+	/**
+	 * lease slots, indexed by offset
+	 */
+	lease_t *leases;
+
+	/**
+	 * bitmap of online leases, indexed by offset
+	 */
+	u_char *online;
+
+	/**
+	 * number of allocated lease slots
+	 */
+	u_int capacity;
+
+	/**
+	 * first offline lease to reassign, 0 if none
+	 */
+	u_int lru;
+
+	/**
+	 * number of online leases
 	 */
-	hashtable_t *leases;
+	u_int online_count;
+
+	/**
+	 * number of offline leases
+	 */
+	u_int offline_count;
 
 	/**
 	 * lock to safely access the pool
 	 */
-	mutex_t *mutex;
+	rwlock_t *lock;
 };
 
 /**
- * Lease entry.
+ * Per-identity lease record.
  */
-typedef struct {
+struct entry_t {
 	/* identitiy reference */
 	identification_t *id;
-	/* list of online leases, as offset */
-	linked_list_t *online;
-	/* list of offline leases, as offset */
-	linked_list_t *offline;
-} entry_t;
+	/* first offline lease of this identity, 0 if none */
+	u_int offline;
+	/* number of online and offline leases of this identity */
+	u_int leases;
+};
 
 /**
  * hashtable hash function for identities
@@ -93,6 +151,136 @@ static bool id_equals(identification_t *a, identification_t *b)
 	return a->equals(a, b);
 }
 
+/**
+ * Get the queue links of a lease
+ */
+static lease_link_t *get_link(private_mem_pool_t *this, u_int offset, bool lru)
+{
+	return lru ? &this->leases[offset].lru : &this->leases[offset].id;
+}
+
+/**
+ * Append a lease to the queue starting at head
+ */
+static void link_insert(private_mem_pool_t *this, u_int *head, u_int offset,
+						bool lru)
+{
+	lease_link_t *link, *first;
+
+	link = get_link(this, offset, lru);
+	if (!*head)
+	{
+		link->prev = link->next = *head = offset;
+		return;
+	}
+	first = get_link(this, *head, lru);
+	link->prev = first->prev;
+	link->next = *head;
+	get_link(this, first->prev, lru)->next = offset;
+	first->prev = offset;
+}
+
+/**
+ * Remove a lease from the queue starting at head
+ */
+static void link_remove(private_mem_pool_t *this, u_int *head, u_int offset,
+						bool lru)
+{
+	lease_link_t *link;
+
+	link = get_link(this, offset, lru);
+	if (link->next == offset)
+	{
+		*head = 0;
+	}
+	else
+	{
+		get_link(this, link->prev, lru)->next = link->next;
+		get_link(this, link->next, lru)->prev = link->prev;
+		if (*head == offset)
+		{
+			*head = link->next;
+		}
+	}
+	link->prev = link->next = 0;
+}
+
+/**
+ * Check if the lease at offset is online
+ */
+static bool is_online(private_mem_pool_t *this, u_int offset)
+{
+	return this->online[offset / 8] & (1 << (offset % 8));
+}
+
+/**
+ * Mark the lease at offset online or offline
+ */
+static void set_online(private_mem_pool_t *this, u_int offset, bool online)
+{
+	if (online)
+	{
+		this->online[offset / 8] |= (1 << (offset % 8));
+	}
+	else
+	{
+		this->online[offset / 8] &= ~(1 << (offset % 8));
+	}
+}
+
+/**
+ * Make sure a lease slot for offset is allocated
+ */
+static void grow_leases(private_mem_pool_t *this, u_int offset)
+{
+	u_int capacity;
+
+	if (offset < this->capacity)
+	{
+		return;
+	}
+	capacity = max(this->capacity, LEASES_INITIAL);
+	while (capacity <= offset)
+	{
+		capacity *= 2;
+	}
+	this->leases = realloc(this->leases, capacity * sizeof(lease_t));
+	memset(this->leases + this->capacity, 0,
+		   (capacity - this->capacity) * sizeof(lease_t));
+	this->online = realloc(this->online, capacity / 8);
+	memset(this->online + this->capacity / 8, 0,
+		   (capacity - this->capacity) / 8);
+	this->capacity = capacity;
+}
+
+/**
+ * Get the lease record of an identity, create one if requested
+ */
+static entry_t *get_entry(private_mem_pool_t *this, identification_t *id,
+						  bool create)
+{
+	entry_t *entry;
+
+	entry = this->ids->get(this->ids, id);
+	if (!entry && create)
+	{
+		INIT(entry,
+			.id = id->clone(id),
+		);
+		this->ids->put(this->ids, entry->id, entry);
+	}
+	return entry;
+}
+
+/**
+ * Destroy a lease record
+ */
+static void entry_destroy(entry_t *entry)
+{
+	entry->id->destroy(entry->id);
+	free(entry);
+}
+
 /**
  * convert a pool offset to an address
  */
@@ -177,18 +365,11 @@ METHOD(mem_pool_t, get_size, u_int,
 METHOD(mem_pool_t, get_online, u_int,
 	private_mem_pool_t *this)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
-	u_int count = 0;
+	u_int count;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
-	{
-		count += entry->online->get_count(entry->online);
-	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	this->lock->read_lock(this->lock);
+	count = this->online_count;
+	this->lock->unlock(this->lock);
 
 	return count;
 }
@@ -196,95 +377,113 @@ METHOD(mem_pool_t, get_online, u_int,
 METHOD(mem_pool_t, get_offline, u_int,
 	private_mem_pool_t *this)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
-	u_int count = 0;
+	u_int count;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
+	this->lock->read_lock(this->lock);
+	count = this->offline_count;
+	this->lock->unlock(this->lock);
+
+	return count;
+}
+
+/**
+ * Convert a host to the offset of an assigned lease, 0 if not assigned
+ */
+static u_int get_lease_offset(private_mem_pool_t *this, host_t *addr)
+{
+	int offset;
+
+	offset = host2offset(this, addr);
+	if (offset <= 0 || offset > this->unused ||
+		!this->leases[offset].entry)
 	{
-		count += entry->offline->get_count(entry->offline);
+		return 0;
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	return offset;
+}
 
-	return count;
+/**
+ * Check for a requested online lease of id that can be reassigned without
+ * modifying the pool, requires a read lock
+ */
+static u_int get_existing_online(private_mem_pool_t *this,
+								 identification_t *id, host_t *requested)
+{
+	entry_t *entry;
+	u_int offset;
+
+	entry = get_entry(this, id, FALSE);
+	if (!entry || entry->offline)
+	{
+		return 0;
+	}
+	offset = get_lease_offset(this, requested);
+	if (offset && this->leases[offset].entry == entry &&
+		is_online(this, offset))
+	{
+		DBG1(DBG_CFG, "reassigning online lease to '%Y'", id);
+		return offset;
+	}
+	return 0;
 }
 
 /**
  * Get an existing lease for id
  */
-static int get_existing(private_mem_pool_t *this, identification_t *id,
-						host_t *requested)
+static u_int get_existing(private_mem_pool_t *this, identification_t *id,
+						  host_t *requested)
 {
-	enumerator_t *enumerator;
-	uintptr_t current;
 	entry_t *entry;
-	int offset = 0;
+	u_int offset;
 
-	entry = this->leases->get(this->leases, id);
+	entry = get_entry(this, id, FALSE);
 	if (!entry)
 	{
 		return 0;
 	}
 
 	/* check for a valid offline lease, refresh */
-	enumerator = entry->offline->create_enumerator(entry->offline);
-	if (enumerator->enumerate(enumerator, &current))
-	{
-		entry->offline->remove_at(entry->offline, enumerator);
-		entry->online->insert_last(entry->online, (void*)current);
-		offset = current;
-	}
-	enumerator->destroy(enumerator);
+	offset = entry->offline;
 	if (offset)
 	{
+		link_remove(this, &entry->offline, offset, FALSE);
+		link_remove(this, &this->lru, offset, TRUE);
+		set_online(this, offset, TRUE);
+		this->offline_count--;
+		this->online_count++;
 		DBG1(DBG_CFG, "reassigning offline lease to '%Y'", id);
 		return offset;
 	}
 
 	/* check for a valid online lease to reassign */
-	enumerator = entry->online->create_enumerator(entry->online);
-	while (enumerator->enumerate(enumerator, &current))
-	{
-		if (current == host2offset(this, requested))
-		{
-			offset = current;
-			break;
-		}
-	}
-	enumerator->destroy(enumerator);
-	if (offset)
+	offset = get_lease_offset(this, requested);
+	if (offset && this->leases[offset].entry == entry &&
+		is_online(this, offset))
 	{
 		DBG1(DBG_CFG, "reassigning online lease to '%Y'", id);
+		return offset;
 	}
-	return offset;
+	return 0;
 }
 
 /**
  * Get a new lease for id
  */
-static int get_new(private_mem_pool_t *this, identification_t *id)
+static u_int get_new(private_mem_pool_t *this, identification_t *id)
 {
 	entry_t *entry;
-	uintptr_t offset = 0;
+	u_int offset = 0;
 
 	if (this->unused < this->size)
 	{
-		entry = this->leases->get(this->leases, id);
-		if (!entry)
-		{
-			INIT(entry,
-				.id = id->clone(id),
-				.online = linked_list_create(),
-				.offline = linked_list_create(),
-			);
-			this->leases->put(this->leases, entry->id, entry);
-		}
+		entry = get_entry(this, id, TRUE);
 		/* assigning offset, starting by 1 */
 		offset = ++this->unused;
-		entry->online->insert_last(entry->online, (void*)offset);
+		grow_leases(this, offset);
+		this->leases[offset].entry = entry;
+		set_online(this, offset, TRUE);
+		entry->leases++;
+		this->online_count++;
 		DBG1(DBG_CFG, "assigning new lease to '%Y'", id);
 	}
 	return offset;
@@ -293,36 +492,33 @@ static int get_new(private_mem_pool_t *this, identification_t *id)
 /**
  * Get a reassigned lease for id in case the pool is full
  */
-static int get_reassigned(private_mem_pool_t *this, identification_t *id)
+static u_int get_reassigned(private_mem_pool_t *this, identification_t *id)
 {
-	enumerator_t *enumerator;
 	entry_t *entry;
-	uintptr_t current, offset = 0;
+	u_int offset;
 
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
+	offset = this->lru;
+	if (!offset)
 	{
-		if (entry->offline->remove_first(entry->offline,
-										 (void**)&current) == SUCCESS)
-		{
-			offset = current;
-			DBG1(DBG_CFG, "reassigning existing offline lease by '%Y'"
-				 " to '%Y'", entry->id, id);
-			break;
-		}
+		return 0;
 	}
-	enumerator->destroy(enumerator);
-
-	if (offset)
-	{
-		INIT(entry,
-			.id = id->clone(id),
-			.online = linked_list_create(),
-			.offline = linked_list_create(),
-		);
-		entry->online->insert_last(entry->online, (void*)offset);
-		this->leases->put(this->leases, entry->id, entry);
+	entry = this->leases[offset].entry;
+	link_remove(this, &this->lru, offset, TRUE);
+	link_remove(this, &entry->offline, offset, FALSE);
+	DBG1(DBG_CFG, "reassigning existing offline lease by '%Y' to '%Y'",
+		 entry->id, id);
+	if (--entry->leases == 0)
+	{	/* drop records of identities without any leases */
+		this->ids->remove(this->ids, entry->id);
+		entry_destroy(entry);
 	}
+
+	entry = get_entry(this, id, TRUE);
+	this->leases[offset].entry = entry;
+	set_online(this, offset, TRUE);
+	entry->leases++;
+	this->offline_count--;
+	this->online_count++;
 	return offset;
 }
 
@@ -330,7 +526,7 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 	private_mem_pool_t *this, identification_t *id, host_t *requested,
 	mem_pool_op_t operation)
 {
-	int offset = 0;
+	u_int offset = 0;
 
 	/* if the pool is empty (e.g. in the %config case) we simply return the
 	 * requested address */
@@ -345,7 +541,18 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 		return NULL;
 	}
 
-	this->mutex->lock(this->mutex);
+	if (operation == MEM_POOL_EXISTING)
+	{	/* online leases can be reassigned concurrently */
+		this->lock->read_lock(this->lock);
+		offset = get_existing_online(this, id, requested);
+		this->lock->unlock(this->lock);
+		if (offset)
+		{
+			return offset2host(this, offset);
+		}
+	}
+
+	this->lock->write_lock(this->lock);
 	switch (operation)
 	{
 		case MEM_POOL_EXISTING:
@@ -365,7 +572,7 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 		default:
 			break;
 	}
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 
 	if (offset)
 	{
@@ -379,23 +586,25 @@ METHOD(mem_pool_t, release_address, bool,
 {
 	bool found = FALSE;
 	entry_t *entry;
-	uintptr_t offset;
+	u_int offset;
 
 	if (this->size != 0)
 	{
-		this->mutex->lock(this->mutex);
-		entry = this->leases->get(this->leases, id);
-		if (entry)
+		this->lock->write_lock(this->lock);
+		entry = get_entry(this, id, FALSE);
+		offset = get_lease_offset(this, address);
+		if (entry && offset && this->leases[offset].entry == entry &&
+			is_online(this, offset))
 		{
-			offset = host2offset(this, address);
-			if (entry->online->remove(entry->online, (void*)offset, NULL) > 0)
-			{
-				DBG1(DBG_CFG, "lease %H by '%Y' went offline", address, id);
-				entry->offline->insert_last(entry->offline, (void*)offset);
-				found = TRUE;
-			}
+			DBG1(DBG_CFG, "lease %H by '%Y' went offline", address, id);
+			set_online(this, offset, FALSE);
+			link_insert(this, &entry->offline, offset, FALSE);
+			link_insert(this, &this->lru, offset, TRUE);
+			this->online_count--;
+			this->offline_count++;
+			found = TRUE;
 		}
-		this->mutex->unlock(this->mutex);
+		this->lock->unlock(this->lock);
 	}
 	return found;
 }
@@ -406,16 +615,10 @@ METHOD(mem_pool_t, release_address, bool,
 typedef struct {
 	/** implemented enumerator interface */
 	enumerator_t public;
-	/** hash-table enumerator */
-	enumerator_t *entries;
-	/** online enumerator */
-	enumerator_t *online;
-	/** offline enumerator */
-	enumerator_t *offline;
 	/** enumerated pool */
 	private_mem_pool_t *pool;
-	/** currently enumerated entry */
-	entry_t *entry;
+	/** offset of the currently enumerated lease */
+	u_int offset;
 	/** currently enumerated lease address */
 	host_t *addr;
 } lease_enumerator_t;
@@ -423,52 +626,30 @@ typedef struct {
 METHOD(enumerator_t, lease_enumerate, bool,
 	lease_enumerator_t *this, identification_t **id, host_t **addr, bool *online)
 {
-	uintptr_t offset;
+	private_mem_pool_t *pool = this->pool;
 
 	DESTROY_IF(this->addr);
 	this->addr = NULL;
 
-	while (TRUE)
+	while (this->offset < pool->unused)
 	{
-		if (this->entry)
-		{
-			if (this->online->enumerate(this->online, (void**)&offset))
-			{
-				*id = this->entry->id;
-				*addr = this->addr = offset2host(this->pool, offset);
-				*online = TRUE;
-				return TRUE;
-			}
-			if (this->offline->enumerate(this->offline, (void**)&offset))
-			{
-				*id = this->entry->id;
-				*addr = this->addr = offset2host(this->pool, offset);
-				*online = FALSE;
-				return TRUE;
-			}
-			this->online->destroy(this->online);
-			this->offline->destroy(this->offline);
-			this->online = this->offline = NULL;
-		}
-		if (!this->entries->enumerate(this->entries, NULL, &this->entry))
+		this->offset++;
+		if (pool->leases[this->offset].entry)
 		{
-			return FALSE;
+			*id = pool->leases[this->offset].entry->id;
+			*addr = this->addr = offset2host(pool, this->offset);
+			*online = is_online(pool, this->offset);
+			return TRUE;
 		}
-		this->online = this->entry->online->create_enumerator(
-														this->entry->online);
-		this->offline = this->entry->offline->create_enumerator(
-														this->entry->offline);
 	}
+	return FALSE;
 }
 
 METHOD(enumerator_t, lease_enumerator_destroy, void,
 	lease_enumerator_t *this)
 {
 	DESTROY_IF(this->addr);
-	DESTROY_IF(this->online);
-	DESTROY_IF(this->offline);
-	this->entries->destroy(this->entries);
-	this->pool->mutex->unlock(this->pool->mutex);
+	this->pool->lock->unlock(this->pool->lock);
 	free(this);
 }
 
@@ -477,14 +658,13 @@ METHOD(mem_pool_t, create_lease_enumerator, enumerator_t*,
 {
 	lease_enumerator_t *enumerator;
 
-	this->mutex->lock(this->mutex);
+	this->lock->read_lock(this->lock);
 	INIT(enumerator,
 		.public = {
 			.enumerate = (void*)_lease_enumerate,
 			.destroy = _lease_enumerator_destroy,
 		},
 		.pool = this,
-		.entries = this->leases->create_enumerator(this->leases),
 	);
 	return &enumerator->public;
 }
@@ -495,19 +675,18 @@ METHOD(mem_pool_t, destroy, void,
 	enumerator_t *enumerator;
 	entry_t *entry;
 
-	enumerator = this->leases->create_enumerator(this->leases);
+	enumerator = this->ids->create_enumerator(this->ids);
 	while (enumerator->enumerate(enumerator, NULL, &entry))
 	{
-		entry->id->destroy(entry->id);
-		entry->online->destroy(entry->online);
-		entry->offline->destroy(entry->offline);
-		free(entry);
+		entry_destroy(entry);
 	}
 	enumerator->destroy(enumerator);
 
-	this->leases->destroy(this->leases);
-	this->mutex->destroy(this->mutex);
+	this->ids->destroy(this->ids);
+	this->lock->destroy(this->lock);
 	DESTROY_IF(this->base);
+	free(this->leases);
+	free(this->online);
 	free(this->name);
 	free(this);
 }
@@ -533,9 +712,9 @@ mem_pool_t *mem_pool_create(char *name, host_t *base, int bits)
 			.destroy = _destroy,
 		},
 		.name = strdup(name),
-		.leases = hashtable_create((hashtable_hash_t)id_hash,
-								   (hashtable_equals_t)id_equals, 16),
-		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.ids = hashtable_create((hashtable_hash_t)id_hash,
+								(hashtable_equals_t)id_equals, 16),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
 	if (base)
@@ -558,6 +737,8 @@ mem_pool_t *mem_pool_create(char *name, host_t *base, int bits)
 			this->size -= 2;
 		}
 		this->base = base->clone(base);
+		/* lookups and enumerators access leases up to unused */
+		grow_leases(this, this->unused);
 	}
 
 	return &this->public;
@@ -144,6 +144,109 @@ static u_int get_pool_size(chunk_t start, chunk_t end)
 	return ntohl(*end_ptr) -  ntohl(*start_ptr) + 1;
 }
 
+/**
+ * number of addresses inserted with a single multi-row INSERT statement,
+ * kept below the compound limit of older SQLite releases
+ */
+#define ADDRESS_BATCH 256
+
+/**
+ * maximum length of a row in the INSERT statement: separator, two u_int and
+ * an IPv6 address in hex, "(%u, X'%s', %u, 0, 1)"
+ */
+#define ADDRESS_ROW_MAX (2 + 1 + 10 + 4 + 2 * 16 + 3 + 10 + 7)
+
+/**
+ * buffer for the multi-row INSERT statement
+ */
+static char address_sql[128 + ADDRESS_BATCH * ADDRESS_ROW_MAX];
+
+/**
+ * current length of the statement in address_sql
+ */
+static int address_sql_len = 0;
+
+/**
+ * number of rows in address_sql
+ */
+static u_int address_rows = 0;
+
+/**
+ * insert the buffered addresses into the database
+ */
+static void flush_addresses()
+{
+	if (!address_rows)
+	{
+		return;
+	}
+	if (db->execute(db, NULL, address_sql) != address_rows)
+	{
+		fprintf(stderr, "inserting addresses failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	address_sql_len = 0;
+	address_rows = 0;
+}
+
+/**
+ * queue an address for insertion, the values are written as literals as the
+ * number of rows per statement varies
+ */
+static void insert_address(u_int pool, chunk_t address, u_int identity)
+{
+	char hex[2 * 16 + 1];
+	int len;
+
+	if (address.len * 2 >= sizeof(hex))
+	{
+		fprintf(stderr, "invalid address length.\n");
+		exit(EXIT_FAILURE);
+	}
+	chunk_to_hex(address, hex, FALSE);
+	if (sizeof(address_sql) - address_sql_len < ADDRESS_ROW_MAX)
+	{
+		flush_addresses();
+	}
+	if (!address_rows)
+	{
+		address_sql_len = snprintf(address_sql, sizeof(address_sql),
+						"INSERT INTO addresses "
+						"(pool, address, identity, acquired, released) VALUES ");
+	}
+	len = snprintf(address_sql + address_sql_len,
+				   sizeof(address_sql) - address_sql_len,
+				   "%s(%u, X'%s', %u, 0, 1)", address_rows ? ", " : "",
+				   pool, hex, identity);
+	if (len < 0 || len >= sizeof(address_sql) - address_sql_len)
+	{
+		fprintf(stderr, "building address INSERT statement failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	address_sql_len += len;
+	if (++address_rows == ADDRESS_BATCH)
+	{
+		flush_addresses();
+	}
+}
+
+/**
+ * insert all addresses from cur to end, cur gets incremented
+ */
+static void insert_range(u_int pool, chunk_t cur, chunk_t end)
+{
+	while (TRUE)
+	{
+		insert_address(pool, cur, 0);
+		if (chunk_equals(cur, end))
+		{
+			break;
+		}
+		chunk_increment(cur);
+	}
+	flush_addresses();
+}
+
 /**
  * ipsec pool --status - show pool overview
  */
@@ -274,7 +377,7 @@ static void status(void)
 		{
 			if (!found)
 			{
-				printf("%8s %15s %15s %8s %6s %11s %11s\n", "name", "start",
+				printf("%8s %15s %15s %8s %8s %13s %13s\n", "name", "start",
 					   "end", "timeout", "size", "online", "usage");
 				found = TRUE;
 			}
@@ -297,43 +400,28 @@ static void status(void)
 			{
 				printf("%8s ", "static");
 			}
-			/* get total number of hosts in the pool */
-			lease = db->query(db, "SELECT COUNT(*) FROM addresses "
-							  "WHERE pool = ?", DB_UINT, id, DB_INT);
-			if (lease)
+			/* count hosts, online hosts and online or valid leases at once */
+			lease = db->query(db, "SELECT COUNT(*), "
+							  "COUNT(CASE WHEN released = 0 THEN 1 END), "
+							  "COUNT(CASE WHEN (? AND acquired != 0) "
+							  "      OR released = 0 OR released > ? "
+							  "      THEN 1 END) "
+							  "FROM addresses WHERE pool = ?",
+							  DB_UINT, !timeout, DB_UINT, time(NULL) - timeout,
+							  DB_UINT, id, DB_UINT, DB_UINT, DB_UINT);
+			if (!lease || !lease->enumerate(lease, &size, &online, &used))
 			{
-				lease->enumerate(lease, &size);
-				lease->destroy(lease);
+				size = 0;
 			}
+			DESTROY_IF(lease);
 			if (!size)
 			{	/* empty pool */
-				printf("%6d %11s %11s ", 0, "n/a", "n/a");
+				printf("%8d %13s %13s ", 0, "n/a", "n/a");
 				goto next_pool;
 			}
-			printf("%6d ", size);
-			/* get number of online hosts */
-			lease = db->query(db, "SELECT COUNT(*) FROM addresses "
-							  "WHERE pool = ? AND released = 0",
-							  DB_UINT, id, DB_INT);
-			if (lease)
-			{
-				lease->enumerate(lease, &online);
-				lease->destroy(lease);
-			}
-			printf("%5d (%2d%%) ", online, online*100/size);
-			/* get number of online or valid leases */
-			lease = db->query(db, "SELECT COUNT(*) FROM addresses "
-							  "WHERE addresses.pool = ? "
-							  "AND ((? AND acquired != 0) "
-							  "     OR released = 0 OR released > ?) ",
-							  DB_UINT, id, DB_UINT, !timeout,
-							  DB_UINT, time(NULL) - timeout, DB_UINT);
-			if (lease)
-			{
-				lease->enumerate(lease, &used);
-				lease->destroy(lease);
-			}
-			printf("%5d (%2d%%) ", used, used*100/size);
+			printf("%8u ", size);
+			printf("%7u (%2u%%) ", online, online*100/size);
+			printf("%7u (%2u%%) ", used, used*100/size);
 
 next_pool:
 			printf("\n");
@@ -372,18 +460,7 @@ static void add(char *name, host_t *start, host_t *end, int timeout)
 	fflush(stdout);
 	/* run population in a transaction for sqlite */
 	begin_transaction();
-	while (TRUE)
-	{
-		db->execute(db, NULL,
-			"INSERT INTO addresses (pool, address, identity, acquired, released) "
-			"VALUES (?, ?, ?, ?, ?)",
-			DB_UINT, id, DB_BLOB, cur_addr,	DB_UINT, 0, DB_UINT, 0, DB_UINT, 1);
-		if (chunk_equals(cur_addr, end_addr))
-		{
-			break;
-		}
-		chunk_increment(cur_addr);
-	}
+	insert_range(id, cur_addr, end_addr);
 	commit_transaction();
 	printf("done.\n");
 }
@@ -421,17 +498,7 @@ static bool add_address(u_int pool_id, char *address_str, int *family)
 		return FALSE;
 	}
 
-	if (db->execute(db, NULL,
-			"INSERT INTO addresses "
-			"(pool, address, identity, acquired, released) "
-			"VALUES (?, ?, ?, ?, ?)",
-			DB_UINT, pool_id, DB_BLOB, address->get_address(address),
-			DB_UINT, user_id, DB_UINT, 0, DB_UINT, 1) != 1)
-	{
-		fprintf(stderr, "inserting address '%s' failed.\n", address_str);
-		address->destroy(address);
-		return FALSE;
-	}
+	insert_address(pool_id, address->get_address(address), user_id);
 	if (family)
 	{
 		*family = address->get_family(address);
@@ -489,6 +556,7 @@ static void add_addresses(char *pool, char *path, int timeout)
 		}
 		++count;
 	}
+	flush_addresses();
 
 	if (file != stdin)
 	{
@@ -593,13 +661,10 @@ static void resize(char *name, host_t *end)
 	fflush(stdout);
 	/* run population in a transaction for sqlite */
 	begin_transaction();
-	while (count-- > 0)
+	if (count)
 	{
 		chunk_increment(cur_addr);
-		db->execute(db, NULL,
-			"INSERT INTO addresses (pool, address, identity, acquired, released) "
-			"VALUES (?, ?, ?, ?, ?)",
-			DB_UINT, id, DB_BLOB, cur_addr,	DB_UINT, 0, DB_UINT, 0, DB_UINT, 1);
+		insert_range(id, cur_addr, new_addr);
 	}
 	commit_transaction();
 	printf("done.\n");
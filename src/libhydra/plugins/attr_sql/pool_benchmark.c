@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <library.h>
+#include <utils/debug.h>
+
+#include "sql_attribute.h"
+
+/**
+ * database handle
+ */
+static database_t *db;
+
+/**
+ * Benchmark phases
+ */
+typedef enum {
+	PHASE_LOAD,
+	PHASE_ACQUIRE,
+	PHASE_RELEASE,
+	PHASE_REACQUIRE,
+	PHASE_RERELEASE,
+	PHASE_FLUSH,
+	PHASE_MAX,
+} phase_t;
+
+/**
+ * Get the time in microseconds since start, restart the measurement
+ */
+static u_int64_t lap(timeval_t *start)
+{
+	timeval_t now, diff;
+
+	time_monotonic(&now);
+	timersub(&now, start, &diff);
+	*start = now;
+	return (u_int64_t)diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+/**
+ * Print the results of a phase
+ */
+static void print_phase(char *name, u_int64_t usec, int count)
+{
+	if (count)
+	{
+		printf("  %-10s %8llums %10llu leases/s\n", name, usec / 1000,
+			   (u_int64_t)count * 1000000 / max(usec, 1));
+	}
+	else
+	{
+		printf("  %-10s %8llums\n", name, usec / 1000);
+	}
+}
+
+/**
+ * Acquire or release addresses for all identities
+ */
+static bool run_phase(sql_attribute_t *attribute, linked_list_t *pools,
+					  identification_t **ids, host_t **addrs, int count,
+					  bool acquire)
+{
+	attribute_provider_t *provider = &attribute->provider;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (acquire)
+		{
+			addrs[i] = provider->acquire_address(provider, pools, ids[i],
+												 NULL);
+			if (!addrs[i])
+			{
+				fprintf(stderr, "acquiring lease %d failed, pool too "
+						"small?\n", i + 1);
+				return FALSE;
+			}
+		}
+		else
+		{
+			provider->release_address(provider, pools, addrs[i], ids[i]);
+			addrs[i]->destroy(addrs[i]);
+			addrs[i] = NULL;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Run the benchmark with the database or the in-memory lease allocation
+ */
+static bool run(char *name, int count, bool in_memory)
+{
+	identification_t **ids;
+	host_t **addrs;
+	sql_attribute_t *attribute;
+	linked_list_t *pools;
+	timeval_t start;
+	u_int64_t usec[PHASE_MAX];
+	char buf[128];
+	bool ok;
+	int i;
+
+	ids = calloc(count, sizeof(identification_t*));
+	addrs = calloc(count, sizeof(host_t*));
+	for (i = 0; i < count; i++)
+	{
+		snprintf(buf, sizeof(buf), "%s-%d@benchmark.%s",
+				 in_memory ? "memory" : "database", i, name);
+		ids[i] = identification_create_from_string(buf);
+	}
+	pools = linked_list_create();
+	pools->insert_last(pools, name);
+
+	lib->settings->set_bool(lib->settings,
+							"libhydra.plugins.attr-sql.in_memory", in_memory);
+	time_monotonic(&start);
+	attribute = sql_attribute_create(db);
+	usec[PHASE_LOAD] = lap(&start);
+	ok = run_phase(attribute, pools, ids, addrs, count, TRUE);
+	usec[PHASE_ACQUIRE] = lap(&start);
+	ok = ok && run_phase(attribute, pools, ids, addrs, count, FALSE);
+	usec[PHASE_RELEASE] = lap(&start);
+	ok = ok && run_phase(attribute, pools, ids, addrs, count, TRUE);
+	usec[PHASE_REACQUIRE] = lap(&start);
+	ok = ok && run_phase(attribute, pools, ids, addrs, count, FALSE);
+	usec[PHASE_RERELEASE] = lap(&start);
+	attribute->destroy(attribute);
+	usec[PHASE_FLUSH] = lap(&start);
+
+	if (ok)
+	{
+		printf("%s lease allocation on %N, %d identities:\n",
+			   in_memory ? "in-memory" : "database", db_driver_names,
+			   db->get_driver(db), count);
+		print_phase("load", usec[PHASE_LOAD], 0);
+		print_phase("acquire", usec[PHASE_ACQUIRE], count);
+		print_phase("release", usec[PHASE_RELEASE], count);
+		print_phase("reacquire", usec[PHASE_REACQUIRE], count);
+		print_phase("release", usec[PHASE_RERELEASE], count);
+		print_phase("write", usec[PHASE_FLUSH], 0);
+	}
+	for (i = 0; i < count; i++)
+	{
+		DESTROY_IF(addrs[i]);
+		ids[i]->destroy(ids[i]);
+	}
+	free(ids);
+	free(addrs);
+	pools->destroy(pools);
+	return ok;
+}
+
+/**
+ * Close the database on exit
+ */
+static void cleanup()
+{
+	db->destroy(db);
+}
+
+/**
+ * Compare database and in-memory lease allocation. Leases are acquired,
+ * released, acquired again and released for generated identities, use a
+ * dedicated pool as leases of these identities remain in the database.
+ * The backend is selected by the attr-sql database URI, e.g. sqlite:// or
+ * mysql://, as with the plugin.
+ */
+int main(int argc, char *argv[])
+{
+	enumerator_t *e;
+	char *uri, *name;
+	int count = 1000;
+	u_int pool;
+
+	if (argc < 2 || argc > 3 || (argc == 3 && (count = atoi(argv[2])) <= 0))
+	{
+		fprintf(stderr, "usage: pool_benchmark <pool name> [identities]\n"
+				"  the pool needs twice as many addresses as identities, "
+				"default 1000\n");
+		exit(EXIT_FAILURE);
+	}
+	name = argv[1];
+
+	atexit(library_deinit);
+	if (!library_init(NULL))
+	{
+		exit(SS_RC_LIBSTRONGSWAN_INTEGRITY);
+	}
+	if (!lib->plugins->load(lib->plugins, NULL,
+			lib->settings->get_str(lib->settings, "pool.load", PLUGINS)))
+	{
+		exit(SS_RC_INITIALIZATION_FAILED);
+	}
+	uri = lib->settings->get_str(lib->settings,
+								 "libhydra.plugins.attr-sql.database", NULL);
+	if (!uri)
+	{
+		fprintf(stderr, "database URI libhydra.plugins.attr-sql.database "
+				"not set.\n");
+		exit(SS_RC_INITIALIZATION_FAILED);
+	}
+	db = lib->db->create(lib->db, uri);
+	if (!db)
+	{
+		fprintf(stderr, "opening database failed.\n");
+		exit(SS_RC_INITIALIZATION_FAILED);
+	}
+	atexit(cleanup);
+
+	e = db->query(db, "SELECT id FROM pools WHERE name = ?",
+				  DB_TEXT, name, DB_UINT);
+	if (!e || !e->enumerate(e, &pool))
+	{
+		DESTROY_IF(e);
+		fprintf(stderr, "pool '%s' not found.\n", name);
+		exit(EXIT_FAILURE);
+	}
+	e->destroy(e);
+
+	/* don't log each lease */
+	dbg_default_set_level(0);
+	if (!run(name, count, FALSE) || !run(name, count, TRUE))
+	{
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -19,6 +19,7 @@
 #include <library.h>
 
 #include "sql_attribute.h"
+#include "sql_leases.h"
 
 typedef struct private_sql_attribute_t private_sql_attribute_t;
 
@@ -41,6 +42,11 @@ struct private_sql_attribute_t {
 	 * whether to record lease history in lease table
 	 */
 	bool history;
+
+	/**
+	 * in-memory lease allocator, if enabled
+	 */
+	sql_leases_t *leases;
 };
 
 /**
@@ -241,6 +247,11 @@ METHOD(attribute_provider_t, acquire_address, host_t*,
 	u_int identity, pool, timeout;
 	char *name;
 
+	if (this->leases)
+	{
+		return this->leases->acquire(this->leases, pools, id);
+	}
+
 	identity = get_identity(this, id);
 	if (identity)
 	{
@@ -292,6 +303,11 @@ METHOD(attribute_provider_t, release_address, bool,
 	bool found = FALSE;
 	char *name;
 
+	if (this->leases)
+	{
+		return this->leases->release(this->leases, pools, address);
+	}
+
 	enumerator = pools->create_enumerator(pools);
 	while (enumerator->enumerate(enumerator, &name))
 	{
@@ -425,6 +441,7 @@ METHOD(attribute_provider_t, create_attribute_enumerator, enumerator_t*,
 METHOD(sql_attribute_t, destroy, void,
 	private_sql_attribute_t *this)
 {
+	DESTROY_IF(this->leases);
 	free(this);
 }
 
@@ -435,6 +452,7 @@ sql_attribute_t *sql_attribute_create(database_t *db)
 {
 	private_sql_attribute_t *this;
 	time_t now = time(NULL);
+	int batch;
 
 	INIT(this,
 		.public = {
@@ -461,6 +479,24 @@ sql_attribute_t *sql_attribute_create(database_t *db)
 	this->db->execute(this->db, NULL,
 					  "UPDATE addresses SET released = ? WHERE released = 0",
 					  DB_UINT, now);
+
+	if (lib->settings->get_bool(lib->settings,
+							"libhydra.plugins.attr-sql.in_memory", FALSE))
+	{
+		batch = lib->settings->get_int(lib->settings,
+							"libhydra.plugins.attr-sql.batch_size", 256);
+		if (batch < 1 || batch > SQL_LEASES_MAX_BATCH)
+		{
+			batch = max(min(batch, SQL_LEASES_MAX_BATCH), 1);
+			DBG1(DBG_CFG, "attr-sql batch_size out of range 1..%d, using %d",
+				 SQL_LEASES_MAX_BATCH, batch);
+		}
+		this->leases = sql_leases_create(db, this->history, batch);
+		if (!this->leases)
+		{
+			DBG1(DBG_CFG, "falling back to database based lease allocation");
+		}
+	}
 	return &this->public;
 }
 
@@ -0,0 +1,923 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <time.h>
+
+#include "sql_leases.h"
+
+#include <utils/debug.h>
+#include <collections/hashtable.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+
+/**
+ * Maximum number of identity rows cached by the writing thread
+ */
+#define IDENTITY_CACHE_SIZE 65536
+
+typedef struct private_sql_leases_t private_sql_leases_t;
+typedef struct lease_t lease_t;
+typedef struct owner_t owner_t;
+typedef struct pool_t pool_t;
+
+/**
+ * An address of a pool
+ */
+struct lease_t {
+	/** row in the addresses table */
+	u_int id;
+	/** the address */
+	chunk_t address;
+	/** identity the address is assigned to, NULL if unassigned */
+	owner_t *owner;
+	/** time the lease was acquired */
+	time_t acquired;
+	/** time the lease was released, 0 if online */
+	time_t released;
+	/** previous lease in the queue of assignable leases */
+	lease_t *prev;
+	/** next lease in the queue of assignable leases */
+	lease_t *next;
+	/** TRUE if the lease is in the queue of assignable leases */
+	bool queued;
+};
+
+/**
+ * An identity with leases in a pool
+ */
+struct owner_t {
+	/** the identity */
+	identification_t *id;
+	/** leases assigned to this identity, as lease_t */
+	linked_list_t *leases;
+};
+
+/**
+ * An address pool
+ */
+struct pool_t {
+	/** name of the pool */
+	char *name;
+	/** row in the pools table */
+	u_int id;
+	/** lease timeout in seconds, 0 for static leases */
+	u_int timeout;
+	/** leases by address, lease_t */
+	hashtable_t *leases;
+	/** identities with leases, owner_t */
+	hashtable_t *owners;
+	/** unassigned or released lease that gets assigned next */
+	lease_t *first;
+	/** lease last added to the queue of assignable leases */
+	lease_t *last;
+};
+
+/**
+ * A lease change to write to the database
+ */
+typedef struct {
+	/** row in the addresses table */
+	u_int address;
+	/** identity the lease is assigned to */
+	identification_t *id;
+	/** time the lease was acquired */
+	time_t acquired;
+	/** time the lease was released, 0 if it went online */
+	time_t released;
+} change_t;
+
+/**
+ * Private data of an sql_leases_t object.
+ */
+struct private_sql_leases_t {
+
+	/**
+	 * Public sql_leases_t interface.
+	 */
+	sql_leases_t public;
+
+	/**
+	 * Database to write changes to
+	 */
+	database_t *db;
+
+	/**
+	 * Whether to record lease history in lease table
+	 */
+	bool history;
+
+	/**
+	 * Maximum number of changes written in one transaction
+	 */
+	u_int batch;
+
+	/**
+	 * Pools by name, pool_t
+	 */
+	hashtable_t *pools;
+
+	/**
+	 * Lock for pools and their leases
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Changes to write, change_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * Number of changes currently being written
+	 */
+	u_int writing;
+
+	/**
+	 * Lock for the queue of changes
+	 */
+	mutex_t *queue_mutex;
+
+	/**
+	 * Signals queued changes to the writing thread
+	 */
+	condvar_t *queued;
+
+	/**
+	 * Signals written changes to flushing threads
+	 */
+	condvar_t *written;
+
+	/**
+	 * Thread writing changes, NULL to write them synchronously
+	 */
+	thread_t *thread;
+
+	/**
+	 * TRUE if the writing thread terminates once the queue is empty
+	 */
+	bool stopping;
+
+	/**
+	 * Cached rows of the identities table, identification_t => row
+	 */
+	hashtable_t *identities;
+};
+
+/**
+ * Hash function for leases
+ */
+static u_int lease_hash(lease_t *lease)
+{
+	return chunk_hash(lease->address);
+}
+
+/**
+ * Equals function for leases
+ */
+static bool lease_equals(lease_t *a, lease_t *b)
+{
+	return chunk_equals(a->address, b->address);
+}
+
+/**
+ * Hash function for identities
+ */
+static u_int id_hash(identification_t *id)
+{
+	return chunk_hash(id->get_encoding(id));
+}
+
+/**
+ * Equals function for identities
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Hash function for pool names
+ */
+static u_int name_hash(char *name)
+{
+	return chunk_hash(chunk_create(name, strlen(name)));
+}
+
+/**
+ * Equals function for pool names
+ */
+static bool name_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Append a lease to the queue of assignable leases
+ */
+static void lease_enqueue(pool_t *pool, lease_t *lease)
+{
+	lease->prev = pool->last;
+	lease->next = NULL;
+	if (pool->last)
+	{
+		pool->last->next = lease;
+	}
+	else
+	{
+		pool->first = lease;
+	}
+	pool->last = lease;
+	lease->queued = TRUE;
+}
+
+/**
+ * Remove a lease from the queue of assignable leases
+ */
+static void lease_dequeue(pool_t *pool, lease_t *lease)
+{
+	if (lease->prev)
+	{
+		lease->prev->next = lease->next;
+	}
+	else
+	{
+		pool->first = lease->next;
+	}
+	if (lease->next)
+	{
+		lease->next->prev = lease->prev;
+	}
+	else
+	{
+		pool->last = lease->prev;
+	}
+	lease->prev = lease->next = NULL;
+	lease->queued = FALSE;
+}
+
+/**
+ * Destroy an owner_t
+ */
+static void owner_destroy(owner_t *owner)
+{
+	owner->id->destroy(owner->id);
+	owner->leases->destroy(owner->leases);
+	free(owner);
+}
+
+/**
+ * Get the owner_t of an identity, create it if requested
+ */
+static owner_t *get_owner(pool_t *pool, identification_t *id, bool create)
+{
+	owner_t *owner;
+
+	owner = pool->owners->get(pool->owners, id);
+	if (!owner && create)
+	{
+		INIT(owner,
+			.id = id->clone(id),
+			.leases = linked_list_create(),
+		);
+		pool->owners->put(pool->owners, owner->id, owner);
+	}
+	return owner;
+}
+
+/**
+ * Destroy a pool_t
+ */
+static void pool_destroy(pool_t *pool)
+{
+	enumerator_t *enumerator;
+	owner_t *owner;
+	lease_t *lease;
+
+	enumerator = pool->owners->create_enumerator(pool->owners);
+	while (enumerator->enumerate(enumerator, NULL, &owner))
+	{
+		owner_destroy(owner);
+	}
+	enumerator->destroy(enumerator);
+	enumerator = pool->leases->create_enumerator(pool->leases);
+	while (enumerator->enumerate(enumerator, NULL, &lease))
+	{
+		free(lease->address.ptr);
+		free(lease);
+	}
+	enumerator->destroy(enumerator);
+	pool->owners->destroy(pool->owners);
+	pool->leases->destroy(pool->leases);
+	free(pool->name);
+	free(pool);
+}
+
+/**
+ * Destroy a change_t
+ */
+static void change_destroy(change_t *change)
+{
+	change->id->destroy(change->id);
+	free(change);
+}
+
+/**
+ * Lookup/insert an identity, uses and updates the cache
+ */
+static u_int get_identity(private_sql_leases_t *this, identification_t *id)
+{
+	enumerator_t *e;
+	uintptr_t cached;
+	u_int row = 0;
+	int rowid;
+
+	cached = (uintptr_t)this->identities->get(this->identities, id);
+	if (cached)
+	{
+		return cached;
+	}
+	e = this->db->query(this->db,
+						"SELECT id FROM identities WHERE type = ? AND data = ?",
+						DB_INT, id->get_type(id), DB_BLOB, id->get_encoding(id),
+						DB_UINT);
+	if (!e || !e->enumerate(e, &row))
+	{
+		row = 0;
+	}
+	DESTROY_IF(e);
+	if (!row && this->db->execute(this->db, &rowid,
+				"INSERT INTO identities (type, data) VALUES (?, ?)",
+				DB_INT, id->get_type(id), DB_BLOB, id->get_encoding(id)) == 1)
+	{
+		row = rowid;
+	}
+	if (row)
+	{
+		if (this->identities->get_count(this->identities) >=
+														IDENTITY_CACHE_SIZE)
+		{
+			enumerator_t *enumerator;
+			identification_t *current;
+
+			enumerator = this->identities->create_enumerator(this->identities);
+			while (enumerator->enumerate(enumerator, &current, NULL))
+			{
+				this->identities->remove_at(this->identities, enumerator);
+				current->destroy(current);
+			}
+			enumerator->destroy(enumerator);
+		}
+		id = id->clone(id);
+		this->identities->put(this->identities, id, (void*)(uintptr_t)row);
+	}
+	return row;
+}
+
+/**
+ * Write a batch of changes to the database
+ */
+static void write_changes(private_sql_leases_t *this, change_t **changes,
+						  int count)
+{
+	u_int identity;
+	int i;
+
+	if (this->db->get_driver(this->db) == DB_SQLITE)
+	{
+		this->db->execute(this->db, NULL, "BEGIN EXCLUSIVE TRANSACTION");
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (!changes[i]->released)
+		{
+			identity = get_identity(this, changes[i]->id);
+			if (this->db->execute(this->db, NULL,
+					"UPDATE addresses SET "
+					"acquired = ?, released = 0, identity = ? WHERE id = ?",
+					DB_UINT, changes[i]->acquired, DB_UINT, identity,
+					DB_UINT, changes[i]->address) < 0)
+			{
+				DBG1(DBG_CFG, "writing lease of '%Y' failed", changes[i]->id);
+			}
+			continue;
+		}
+		if (this->db->execute(this->db, NULL,
+					"UPDATE addresses SET released = ? WHERE id = ?",
+					DB_UINT, changes[i]->released,
+					DB_UINT, changes[i]->address) < 0)
+		{
+			DBG1(DBG_CFG, "writing released lease of '%Y' failed",
+				 changes[i]->id);
+			continue;
+		}
+		if (this->history)
+		{
+			identity = get_identity(this, changes[i]->id);
+			this->db->execute(this->db, NULL,
+					"INSERT INTO leases (address, identity, acquired, released)"
+					" VALUES (?, ?, ?, ?)",
+					DB_UINT, changes[i]->address, DB_UINT, identity,
+					DB_UINT, changes[i]->acquired,
+					DB_UINT, changes[i]->released);
+		}
+	}
+	if (this->db->get_driver(this->db) == DB_SQLITE)
+	{
+		this->db->execute(this->db, NULL, "END TRANSACTION");
+	}
+}
+
+/**
+ * Writing thread
+ */
+static void *write_queue(private_sql_leases_t *this)
+{
+	change_t **changes;
+	int count, i;
+
+	changes = malloc(sizeof(change_t*) * this->batch);
+	while (TRUE)
+	{
+		this->queue_mutex->lock(this->queue_mutex);
+		while (!this->queue->get_count(this->queue))
+		{
+			if (this->stopping)
+			{
+				this->queue_mutex->unlock(this->queue_mutex);
+				free(changes);
+				return NULL;
+			}
+			this->queued->wait(this->queued, this->queue_mutex);
+		}
+		for (count = 0; count < this->batch; count++)
+		{
+			if (this->queue->remove_first(this->queue,
+										  (void**)&changes[count]) != SUCCESS)
+			{
+				break;
+			}
+		}
+		this->writing = count;
+		this->queue_mutex->unlock(this->queue_mutex);
+
+		write_changes(this, changes, count);
+
+		this->queue_mutex->lock(this->queue_mutex);
+		this->writing = 0;
+		this->written->broadcast(this->written);
+		this->queue_mutex->unlock(this->queue_mutex);
+
+		for (i = 0; i < count; i++)
+		{
+			change_destroy(changes[i]);
+		}
+	}
+}
+
+/**
+ * Queue the current state of a lease to write it to the database
+ */
+static void queue_change(private_sql_leases_t *this, lease_t *lease)
+{
+	change_t *change;
+
+	INIT(change,
+		.address = lease->id,
+		.id = lease->owner->id->clone(lease->owner->id),
+		.acquired = lease->acquired,
+		.released = lease->released,
+	);
+	if (!this->thread)
+	{
+		write_changes(this, &change, 1);
+		change_destroy(change);
+		return;
+	}
+	this->queue_mutex->lock(this->queue_mutex);
+	this->queue->insert_last(this->queue, change);
+	this->queued->signal(this->queued);
+	this->queue_mutex->unlock(this->queue_mutex);
+}
+
+/**
+ * Assign a lease to an identity
+ */
+static host_t *assign(private_sql_leases_t *this, pool_t *pool,
+					  lease_t *lease, identification_t *id)
+{
+	owner_t *owner = lease->owner;
+
+	if (lease->queued)
+	{
+		lease_dequeue(pool, lease);
+	}
+	if (owner && !owner->id->equals(owner->id, id))
+	{	/* reassign an expired lease */
+		owner->leases->remove(owner->leases, lease, NULL);
+		if (!owner->leases->get_count(owner->leases))
+		{
+			pool->owners->remove(pool->owners, owner->id);
+			owner_destroy(owner);
+		}
+		owner = NULL;
+	}
+	if (!owner)
+	{
+		owner = get_owner(pool, id, TRUE);
+		owner->leases->insert_last(owner->leases, lease);
+		lease->owner = owner;
+	}
+	lease->acquired = time(NULL);
+	lease->released = 0;
+	queue_change(this, lease);
+	return host_create_from_chunk(AF_UNSPEC, lease->address, 0);
+}
+
+/**
+ * Look up an existing offline lease of an identity
+ */
+static host_t *check_lease(private_sql_leases_t *this, pool_t *pool,
+						   identification_t *id)
+{
+	enumerator_t *enumerator;
+	lease_t *lease, *found = NULL;
+	owner_t *owner;
+	host_t *host;
+
+	owner = get_owner(pool, id, FALSE);
+	if (!owner)
+	{
+		return NULL;
+	}
+	enumerator = owner->leases->create_enumerator(owner->leases);
+	while (enumerator->enumerate(enumerator, &lease))
+	{
+		if (lease->released)
+		{
+			found = lease;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (!found)
+	{
+		return NULL;
+	}
+	host = assign(this, pool, found, id);
+	if (host)
+	{
+		DBG1(DBG_CFG, "acquired existing lease for address %H in pool '%s'",
+			 host, pool->name);
+	}
+	return host;
+}
+
+/**
+ * Assign an unallocated address or an expired lease
+ */
+static host_t *get_lease(private_sql_leases_t *this, pool_t *pool,
+						 identification_t *id)
+{
+	lease_t *lease = pool->first;
+	host_t *host;
+
+	/* with static leases only unassigned addresses are queued, the first
+	 * lease is the one released the longest time ago */
+	if (!lease || (lease->owner &&
+				   lease->released >= time(NULL) - pool->timeout))
+	{
+		DBG1(DBG_CFG, "no available address found in pool '%s'", pool->name);
+		return NULL;
+	}
+	host = assign(this, pool, lease, id);
+	if (host)
+	{
+		DBG1(DBG_CFG, "acquired new lease for address %H in pool '%s'",
+			 host, pool->name);
+	}
+	return host;
+}
+
+METHOD(sql_leases_t, acquire, host_t*,
+	private_sql_leases_t *this, linked_list_t *pools, identification_t *id)
+{
+	enumerator_t *enumerator;
+	host_t *address = NULL;
+	pool_t *pool;
+	char *name;
+
+	this->mutex->lock(this->mutex);
+	/* check for an existing lease in all pools */
+	enumerator = pools->create_enumerator(pools);
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		pool = this->pools->get(this->pools, name);
+		if (pool)
+		{
+			address = check_lease(this, pool, id);
+			if (address)
+			{
+				break;
+			}
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	if (!address)
+	{
+		/* get an unallocated address or expired lease */
+		enumerator = pools->create_enumerator(pools);
+		while (enumerator->enumerate(enumerator, &name))
+		{
+			pool = this->pools->get(this->pools, name);
+			if (pool)
+			{
+				address = get_lease(this, pool, id);
+				if (address)
+				{
+					break;
+				}
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	this->mutex->unlock(this->mutex);
+	return address;
+}
+
+METHOD(sql_leases_t, release, bool,
+	private_sql_leases_t *this, linked_list_t *pools, host_t *address)
+{
+	enumerator_t *enumerator;
+	lease_t *lease = NULL, lookup = {
+		.address = address->get_address(address),
+	};
+	pool_t *pool = NULL;
+	char *name;
+
+	this->mutex->lock(this->mutex);
+	enumerator = pools->create_enumerator(pools);
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		pool = this->pools->get(this->pools, name);
+		if (pool)
+		{
+			lease = pool->leases->get(pool->leases, &lookup);
+			if (lease)
+			{
+				break;
+			}
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (lease && lease->owner && !lease->released)
+	{
+		lease->released = time(NULL);
+		if (pool->timeout)
+		{	/* expires after the timeout */
+			lease_enqueue(pool, lease);
+		}
+		queue_change(this, lease);
+	}
+	this->mutex->unlock(this->mutex);
+	return lease != NULL;
+}
+
+METHOD(sql_leases_t, flush, void,
+	private_sql_leases_t *this)
+{
+	this->queue_mutex->lock(this->queue_mutex);
+	while (this->queue->get_count(this->queue) || this->writing)
+	{
+		this->written->wait(this->written, this->queue_mutex);
+	}
+	this->queue_mutex->unlock(this->queue_mutex);
+}
+
+/**
+ * Load the pools from the database
+ */
+static bool load_pools(private_sql_leases_t *this)
+{
+	enumerator_t *e;
+	pool_t *pool;
+	u_int id, timeout;
+	char *name;
+
+	e = this->db->query(this->db, "SELECT id, name, timeout FROM pools",
+						DB_UINT, DB_TEXT, DB_UINT);
+	if (!e)
+	{
+		return FALSE;
+	}
+	while (e->enumerate(e, &id, &name, &timeout))
+	{
+		INIT(pool,
+			.name = strdup(name),
+			.id = id,
+			.timeout = timeout,
+			.leases = hashtable_create((hashtable_hash_t)lease_hash,
+									   (hashtable_equals_t)lease_equals, 1024),
+			.owners = hashtable_create((hashtable_hash_t)id_hash,
+									   (hashtable_equals_t)id_equals, 1024),
+		);
+		pool = this->pools->put(this->pools, pool->name, pool);
+		if (pool)
+		{	/* pool names are not unique in the schema, keep the last one */
+			pool_destroy(pool);
+		}
+	}
+	e->destroy(e);
+	return TRUE;
+}
+
+/**
+ * Load the addresses and leases of a pool from the database
+ */
+static bool load_leases(private_sql_leases_t *this, pool_t *pool)
+{
+	identification_t *identity;
+	enumerator_t *e;
+	owner_t *owner;
+	lease_t *lease;
+	chunk_t address, data;
+	u_int id, row, acquired, released;
+	int type;
+
+	/* unassigned addresses get assigned first */
+	e = this->db->query(this->db,
+				"SELECT id, address FROM addresses "
+				"WHERE pool = ? AND identity = 0 ORDER BY id",
+				DB_UINT, pool->id, DB_UINT, DB_BLOB);
+	if (!e)
+	{
+		return FALSE;
+	}
+	while (e->enumerate(e, &id, &address))
+	{
+		INIT(lease,
+			.id = id,
+			.address = chunk_clone(address),
+		);
+		pool->leases->put(pool->leases, lease, lease);
+		lease_enqueue(pool, lease);
+	}
+	e->destroy(e);
+
+	/* expired leases are reassigned in the order they have been released */
+	e = this->db->query(this->db,
+				"SELECT addresses.id, address, identity, acquired, released, "
+				"type, data FROM addresses JOIN identities "
+				"ON addresses.identity = identities.id "
+				"WHERE pool = ? ORDER BY released",
+				DB_UINT, pool->id, DB_UINT, DB_BLOB, DB_UINT, DB_UINT, DB_UINT,
+				DB_INT, DB_BLOB);
+	if (!e)
+	{
+		return FALSE;
+	}
+	while (e->enumerate(e, &id, &address, &row, &acquired, &released,
+						&type, &data))
+	{
+		identity = identification_create_from_encoding(type, data);
+		owner = get_owner(pool, identity, TRUE);
+		if (this->identities->get_count(this->identities) <
+														IDENTITY_CACHE_SIZE &&
+			!this->identities->get(this->identities, owner->id))
+		{
+			this->identities->put(this->identities, identity,
+								  (void*)(uintptr_t)row);
+		}
+		else
+		{
+			identity->destroy(identity);
+		}
+		INIT(lease,
+			.id = id,
+			.address = chunk_clone(address),
+			.owner = owner,
+			.acquired = acquired,
+			.released = released,
+		);
+		owner->leases->insert_last(owner->leases, lease);
+		pool->leases->put(pool->leases, lease, lease);
+		if (pool->timeout && released)
+		{
+			lease_enqueue(pool, lease);
+		}
+	}
+	e->destroy(e);
+	return TRUE;
+}
+
+METHOD(sql_leases_t, destroy, void,
+	private_sql_leases_t *this)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	pool_t *pool;
+
+	if (this->thread)
+	{
+		this->queue_mutex->lock(this->queue_mutex);
+		this->stopping = TRUE;
+		this->queued->broadcast(this->queued);
+		this->queue_mutex->unlock(this->queue_mutex);
+		this->thread->join(this->thread);
+	}
+	enumerator = this->pools->create_enumerator(this->pools);
+	while (enumerator->enumerate(enumerator, NULL, &pool))
+	{
+		pool_destroy(pool);
+	}
+	enumerator->destroy(enumerator);
+	enumerator = this->identities->create_enumerator(this->identities);
+	while (enumerator->enumerate(enumerator, &id, NULL))
+	{
+		id->destroy(id);
+	}
+	enumerator->destroy(enumerator);
+	this->identities->destroy(this->identities);
+	this->pools->destroy(this->pools);
+	this->queue->destroy(this->queue);
+	this->written->destroy(this->written);
+	this->queued->destroy(this->queued);
+	this->queue_mutex->destroy(this->queue_mutex);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * See header
+ */
+sql_leases_t *sql_leases_create(database_t *db, bool history, u_int batch)
+{
+	private_sql_leases_t *this;
+	enumerator_t *enumerator;
+	pool_t *pool;
+	u_int leases = 0;
+	bool ok = TRUE;
+
+	INIT(this,
+		.public = {
+			.acquire = _acquire,
+			.release = _release,
+			.flush = _flush,
+			.destroy = _destroy,
+		},
+		.db = db,
+		.history = history,
+		.batch = max(min(batch, SQL_LEASES_MAX_BATCH), 1),
+		.pools = hashtable_create((hashtable_hash_t)name_hash,
+								  (hashtable_equals_t)name_equals, 8),
+		.identities = hashtable_create((hashtable_hash_t)id_hash,
+									   (hashtable_equals_t)id_equals, 1024),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.queue = linked_list_create(),
+		.queue_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.queued = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.written = condvar_create(CONDVAR_TYPE_DEFAULT),
+	);
+
+	if (!load_pools(this))
+	{
+		DBG1(DBG_CFG, "loading attr-sql pools failed");
+		destroy(this);
+		return NULL;
+	}
+	enumerator = this->pools->create_enumerator(this->pools);
+	while (ok && enumerator->enumerate(enumerator, NULL, &pool))
+	{
+		ok = load_leases(this, pool);
+		leases += pool->leases->get_count(pool->leases);
+	}
+	enumerator->destroy(enumerator);
+	if (!ok)
+	{
+		DBG1(DBG_CFG, "loading attr-sql leases failed");
+		destroy(this);
+		return NULL;
+	}
+	DBG1(DBG_CFG, "loaded %u addresses of %u pools into memory", leases,
+		 this->pools->get_count(this->pools));
+
+	this->thread = thread_create((thread_main_t)write_queue, this);
+	if (!this->thread)
+	{
+		DBG1(DBG_CFG, "creating attr-sql writer thread failed, writing "
+			 "leases synchronously");
+	}
+	return &this->public;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup sql_leases sql_leases
+ * @{ @ingroup attr_sql
+ */
+
+#ifndef SQL_LEASES_H_
+#define SQL_LEASES_H_
+
+#include <database/database.h>
+#include <collections/linked_list.h>
+#include <networking/host.h>
+#include <utils/identification.h>
+
+typedef struct sql_leases_t sql_leases_t;
+
+/**
+ * Maximum number of changes written in a transaction
+ */
+#define SQL_LEASES_MAX_BATCH 4096
+
+/**
+ * In-memory lease allocator for SQL address pools.
+ *
+ * Pools and their leases are loaded from the database on creation, leases
+ * are then assigned and released in memory. Changes are written back to the
+ * database by a separate thread, as batches in a single transaction (SQLite
+ * only). As the database always reflects a prefix of the changes made in
+ * memory, it stays consistent if the daemon terminates unexpectedly. Leases
+ * left online are closed by sql_attribute on the next start.
+ *
+ * Pools added, removed or resized in the database are not visible before
+ * the leases get loaded again.
+ */
+struct sql_leases_t {
+
+	/**
+	 * Acquire an address from one of the given pools.
+	 *
+	 * Same semantics as the SQL based allocation: An existing offline lease
+	 * of id in any pool is preferred, otherwise a new lease is assigned
+	 * from the first pool having an unassigned address or an expired lease.
+	 *
+	 * @param pools		list of pool names (char*)
+	 * @param id		identity to acquire an address for
+	 * @return			acquired address, NULL if none available
+	 */
+	host_t* (*acquire)(sql_leases_t *this, linked_list_t *pools,
+					   identification_t *id);
+
+	/**
+	 * Release an address leased from one of the given pools.
+	 *
+	 * @param pools		list of pool names (char*)
+	 * @param address	address to release
+	 * @return			TRUE if the address was found in one of the pools
+	 */
+	bool (*release)(sql_leases_t *this, linked_list_t *pools,
+					host_t *address);
+
+	/**
+	 * Wait until all changes have been written to the database.
+	 */
+	void (*flush)(sql_leases_t *this);
+
+	/**
+	 * Destroy a sql_leases_t, writes all pending changes.
+	 */
+	void (*destroy)(sql_leases_t *this);
+};
+
+/**
+ * Create a sql_leases instance, load the leases from the database.
+ *
+ * @param db			database to load pools from and write changes to
+ * @param history		TRUE to record released leases in the leases table
+ * @param batch			maximum number of changes written in a transaction,
+ *						capped to 1..SQL_LEASES_MAX_BATCH
+ * @return				sql_leases_t instance, NULL if loading failed
+ */
+sql_leases_t *sql_leases_create(database_t *db, bool history, u_int batch);
+
+#endif /** SQL_LEASES_H_ @}*/
@@ -331,6 +331,69 @@ static bool net_change_equals(net_change_t *a, net_change_t *b)
 	return streq(a->if_name, b->if_name);
 }
 
+typedef struct route_cache_entry_t route_cache_entry_t;
+
+/**
+ * Cached result of a route lookup
+ */
+struct route_cache_entry_t {
+	/** Destination of the lookup */
+	host_t *dest;
+
+	/** Preferred source address, if any */
+	host_t *src;
+
+	/** TRUE for nexthop lookups, FALSE for source address lookups */
+	bool nexthop;
+
+	/** Looked up address, NULL if none was found */
+	host_t *addr;
+};
+
+/**
+ * Destroy a route_cache_entry_t object
+ */
+static void route_cache_entry_destroy(route_cache_entry_t *this)
+{
+	this->dest->destroy(this->dest);
+	DESTROY_IF(this->src);
+	DESTROY_IF(this->addr);
+	free(this);
+}
+
+/**
+ * Hash a route_cache_entry_t object
+ */
+static u_int route_cache_entry_hash(route_cache_entry_t *this)
+{
+	u_int hash;
+
+	hash = chunk_hash_inc(this->dest->get_address(this->dest),
+						  chunk_hash(chunk_from_thing(this->nexthop)));
+	if (this->src)
+	{
+		hash = chunk_hash_inc(this->src->get_address(this->src), hash);
+	}
+	return hash;
+}
+
+/**
+ * Compare two route_cache_entry_t objects
+ */
+static bool route_cache_entry_equals(route_cache_entry_t *a,
+									 route_cache_entry_t *b)
+{
+	if (a->nexthop != b->nexthop || !a->dest->ip_equals(a->dest, b->dest))
+	{
+		return FALSE;
+	}
+	if (a->src && b->src)
+	{
+		return a->src->ip_equals(a->src, b->src);
+	}
+	return !a->src && !b->src;
+}
+
 typedef struct private_kernel_netlink_net_t private_kernel_netlink_net_t;
 
 /**
@@ -446,6 +509,36 @@ struct private_kernel_netlink_net_t {
 	 * list with routing tables to be excluded from route lookup
 	 */
 	linked_list_t *rt_exclude;
+
+	/**
+	 * cached route lookups (route_cache_entry_t)
+	 */
+	hashtable_t *route_cache;
+
+	/**
+	 * mutex for cached route lookups
+	 */
+	mutex_t *route_cache_lock;
+
+	/**
+	 * maximum number of cached route lookups, 0 to disable the cache
+	 */
+	u_int route_cache_size;
+
+	/**
+	 * incremented whenever the route cache gets flushed
+	 */
+	u_int route_cache_generation;
+
+	/**
+	 * number of route lookups served from the cache
+	 */
+	u_int route_cache_hits;
+
+	/**
+	 * number of route lookups that required a netlink request
+	 */
+	u_int route_cache_misses;
 };
 
 /**
@@ -747,6 +840,37 @@ static void addr_entry_unregister(addr_entry_t *addr, iface_entry_t *iface,
 	addr_map_entry_remove(this->addrs, addr, iface);
 }
 
+/**
+ * Flush all cached route lookups, route_cache_lock has to be held
+ */
+static void route_cache_flush_locked(private_kernel_netlink_net_t *this)
+{
+	enumerator_t *enumerator;
+	route_cache_entry_t *entry;
+
+	enumerator = this->route_cache->create_enumerator(this->route_cache);
+	while (enumerator->enumerate(enumerator, NULL, (void**)&entry))
+	{
+		this->route_cache->remove_at(this->route_cache, enumerator);
+		route_cache_entry_destroy(entry);
+	}
+	enumerator->destroy(enumerator);
+	this->route_cache_generation++;
+}
+
+/**
+ * Flush all cached route lookups, called for events that may change them
+ */
+static void route_cache_flush(private_kernel_netlink_net_t *this)
+{
+	if (this->route_cache_size)
+	{
+		this->route_cache_lock->lock(this->route_cache_lock);
+		route_cache_flush_locked(this);
+		this->route_cache_lock->unlock(this->route_cache_lock);
+	}
+}
+
 /**
  * process RTM_NEWLINK/RTM_DELLINK from kernel
  */
@@ -759,7 +883,7 @@ static void process_link(private_kernel_netlink_net_t *this,
 	enumerator_t *enumerator;
 	iface_entry_t *current, *entry = NULL;
 	char *name = NULL;
-	bool update = FALSE, update_routes = FALSE;
+	bool update = FALSE, update_routes = FALSE, flush = FALSE;
 
 	while (RTA_OK(rta, rtasize))
 	{
@@ -793,6 +917,10 @@ static void process_link(private_kernel_netlink_net_t *this,
 				);
 				this->ifaces->insert_last(this->ifaces, entry);
 			}
+			else if ((entry->flags ^ msg->ifi_flags) & IFF_UP)
+			{	/* routes via this interface are now (un)usable */
+				flush = TRUE;
+			}
 			strncpy(entry->ifname, name, IFNAMSIZ);
 			entry->ifname[IFNAMSIZ-1] = '\0';
 			if (event && entry->usable)
@@ -829,6 +957,7 @@ static void process_link(private_kernel_netlink_net_t *this,
 					current->addrs->invoke_function(current->addrs,
 								(void*)addr_entry_unregister, current, this);
 					iface_entry_destroy(current);
+					flush = TRUE;
 					break;
 				}
 			}
@@ -838,6 +967,11 @@ static void process_link(private_kernel_netlink_net_t *this,
 	}
 	this->lock->unlock(this->lock);
 
+	if (flush)
+	{
+		route_cache_flush(this);
+	}
+
 	if (update_routes && event)
 	{
 		queue_route_reinstall(this, strdup(name));
@@ -924,6 +1058,8 @@ static void process_addr(private_kernel_netlink_net_t *this,
 			/* no roam events etc. for virtual IPs */
 			this->condvar->broadcast(this->condvar);
 			this->lock->unlock(this->lock);
+			/* routes via virtual IPs are ignored in route lookups */
+			route_cache_flush(this);
 			host->destroy(host);
 			return;
 		}
@@ -975,6 +1111,11 @@ static void process_addr(private_kernel_netlink_net_t *this,
 	}
 	this->lock->unlock(this->lock);
 
+	if (found)
+	{
+		route_cache_flush(this);
+	}
+
 	if (update && event && route_ifname)
 	{
 		queue_route_reinstall(this, route_ifname);
@@ -1014,6 +1155,12 @@ static void process_route(private_kernel_netlink_net_t *this, struct nlmsghdr *h
 		return;
 	}
 
+	route_cache_flush(this);
+	if (!this->process_route)
+	{	/* no roam events for route changes */
+		return;
+	}
+
 	while (RTA_OK(rta, rtasize))
 	{
 		switch (rta->rta_type)
@@ -1108,10 +1255,7 @@ static job_requeue_t receive_events(private_kernel_netlink_net_t *this)
 				break;
 			case RTM_NEWROUTE:
 			case RTM_DELROUTE:
-				if (this->process_route)
-				{
-					process_route(this, hdr);
-				}
+				process_route(this, hdr);
 				break;
 			default:
 				break;
@@ -1617,16 +1761,86 @@ static host_t *get_route(private_kernel_netlink_net_t *this, host_t *dest,
 	return addr;
 }
 
+/**
+ * Get a route like get_route(), but serve it from the cache if possible
+ */
+static host_t *get_cached_route(private_kernel_netlink_net_t *this,
+								host_t *dest, bool nexthop, host_t *candidate)
+{
+	route_cache_entry_t *entry, *old, lookup = {
+		.dest = dest,
+		.src = candidate,
+		.nexthop = nexthop,
+	};
+	host_t *addr;
+	u_int generation;
+
+	if (!this->route_cache_size)
+	{
+		return get_route(this, dest, nexthop, candidate, 0);
+	}
+
+	this->route_cache_lock->lock(this->route_cache_lock);
+	entry = this->route_cache->get(this->route_cache, &lookup);
+	if (entry)
+	{
+		this->route_cache_hits++;
+		if (entry->addr->ip_equals(entry->addr, entry->dest))
+		{	/* directly reachable nexthop, keep the port of dest */
+			addr = dest->clone(dest);
+		}
+		else
+		{
+			addr = entry->addr->clone(entry->addr);
+		}
+		this->route_cache_lock->unlock(this->route_cache_lock);
+		return addr;
+	}
+	this->route_cache_misses++;
+	generation = this->route_cache_generation;
+	this->route_cache_lock->unlock(this->route_cache_lock);
+
+	addr = get_route(this, dest, nexthop, candidate, 0);
+	if (!addr)
+	{	/* failed lookups are not cached, as we can't distinguish missing
+		 * routes from failed netlink requests */
+		return NULL;
+	}
+
+	this->route_cache_lock->lock(this->route_cache_lock);
+	if (generation == this->route_cache_generation)
+	{	/* only cache the result if no event flushed the cache meanwhile */
+		if (this->route_cache->get_count(this->route_cache) >=
+														this->route_cache_size)
+		{
+			route_cache_flush_locked(this);
+		}
+		INIT(entry,
+			.dest = dest->clone(dest),
+			.src = candidate ? candidate->clone(candidate) : NULL,
+			.nexthop = nexthop,
+			.addr = addr->clone(addr),
+		);
+		old = this->route_cache->put(this->route_cache, entry, entry);
+		if (old)
+		{
+			route_cache_entry_destroy(old);
+		}
+	}
+	this->route_cache_lock->unlock(this->route_cache_lock);
+	return addr;
+}
+
 METHOD(kernel_net_t, get_source_addr, host_t*,
 	private_kernel_netlink_net_t *this, host_t *dest, host_t *src)
 {
-	return get_route(this, dest, FALSE, src, 0);
+	return get_cached_route(this, dest, FALSE, src);
 }
 
 METHOD(kernel_net_t, get_nexthop, host_t*,
 	private_kernel_netlink_net_t *this, host_t *dest, host_t *src)
 {
-	return get_route(this, dest, TRUE, src, 0);
+	return get_cached_route(this, dest, TRUE, src);
 }
 
 /**
@@ -2143,6 +2357,15 @@ METHOD(kernel_net_t, destroy, void,
 	this->routes_lock->destroy(this->routes_lock);
 	DESTROY_IF(this->socket);
 
+	if (this->route_cache_size)
+	{
+		DBG2(DBG_KNL, "route cache: %u hits, %u misses",
+			 this->route_cache_hits, this->route_cache_misses);
+	}
+	route_cache_flush_locked(this);
+	this->route_cache->destroy(this->route_cache);
+	this->route_cache_lock->destroy(this->route_cache_lock);
+
 	net_changes_clear(this);
 	this->net_changes->destroy(this->net_changes);
 	this->net_changes_lock->destroy(this->net_changes_lock);
@@ -2194,6 +2417,10 @@ kernel_netlink_net_t *kernel_netlink_net_create()
 								(hashtable_equals_t)addr_map_entry_equals, 16),
 		.vips = hashtable_create((hashtable_hash_t)addr_map_entry_hash,
 								 (hashtable_equals_t)addr_map_entry_equals, 16),
+		.route_cache = hashtable_create(
+								(hashtable_hash_t)route_cache_entry_hash,
+								(hashtable_equals_t)route_cache_entry_equals, 16),
+		.route_cache_lock = mutex_create(MUTEX_TYPE_DEFAULT),
 		.routes_lock = mutex_create(MUTEX_TYPE_DEFAULT),
 		.net_changes_lock = mutex_create(MUTEX_TYPE_DEFAULT),
 		.ifaces = linked_list_create(),
@@ -2210,6 +2437,8 @@ kernel_netlink_net_t *kernel_netlink_net_create()
 				"%s.install_virtual_ip", TRUE, hydra->daemon),
 		.install_virtual_ip_on = lib->settings->get_str(lib->settings,
 				"%s.install_virtual_ip_on", NULL, hydra->daemon),
+		.route_cache_size = lib->settings->get_int(lib->settings,
+				"%s.route_cache", 1024, hydra->daemon),
 	);
 	timerclear(&this->last_route_reinstall);
 	timerclear(&this->next_roam);
@@ -2219,6 +2448,8 @@ kernel_netlink_net_t *kernel_netlink_net_create()
 	if (streq(hydra->daemon, "starter"))
 	{	/* starter has no threads, so we do not register for kernel events */
 		register_for_events = FALSE;
+		/* without events we can't invalidate cached routes */
+		this->route_cache_size = 0;
 	}
 
 	exclude = lib->settings->get_str(lib->settings,
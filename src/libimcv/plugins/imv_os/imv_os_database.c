@@ -16,6 +16,9 @@
 #include "imv_os_database.h"
 
 #include <utils/debug.h>
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+#include <threading/rwlock.h>
 
 #include <string.h>
 
@@ -37,23 +40,290 @@ struct private_imv_os_database_t {
 	 */
 	database_t *db;
 
+	/**
+	 * Package indices of products, product_index_t
+	 */
+	linked_list_t *indices;
+
+	/**
+	 * Lock for package indices
+	 */
+	rwlock_t *lock;
+
+};
+
+typedef struct fingerprint_t fingerprint_t;
+
+/**
+ * Checksum over the versions of a product, changes with any version added,
+ * modified or removed in the database
+ */
+struct fingerprint_t {
+	int count;
+	u_int checksum;
+};
+
+typedef struct version_t version_t;
+
+/**
+ * Acceptable version of a package
+ */
+struct version_t {
+	char *release;
+	os_package_state_t state;
+};
+
+typedef struct package_t package_t;
+
+/**
+ * Acceptable versions of a package, in database order
+ */
+struct package_t {
+	char *name;
+	int count;
+	version_t *versions;
+};
+
+typedef struct product_index_t product_index_t;
+
+/**
+ * In-memory index of the packages of a product
+ */
+struct product_index_t {
+
+	/**
+	 * Primary key of product
+	 */
+	int pid;
+
+	/**
+	 * Versions summary when the index was loaded
+	 */
+	fingerprint_t fingerprint;
+
+	/**
+	 * Packages with versions for this product, name => package_t
+	 */
+	hashtable_t *packages;
 };
 
+/**
+ * Hashtable hash function for package names
+ */
+static u_int package_hash(char *name)
+{
+	return chunk_hash(chunk_create(name, strlen(name)));
+}
+
+/**
+ * Hashtable equals function for package names
+ */
+static bool package_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Destroy a product package index
+ */
+static void product_index_destroy(product_index_t *index)
+{
+	enumerator_t *enumerator;
+	package_t *package;
+	char *name;
+	int i;
+
+	enumerator = index->packages->create_enumerator(index->packages);
+	while (enumerator->enumerate(enumerator, &name, &package))
+	{
+		for (i = 0; i < package->count; i++)
+		{
+			free(package->versions[i].release);
+		}
+		free(package->versions);
+		free(package->name);
+		free(package);
+	}
+	enumerator->destroy(enumerator);
+	index->packages->destroy(index->packages);
+	free(index);
+}
+
+/**
+ * Get the versions checksum of a product.
+ *
+ * Covers all columns of the versions table the index is built from, without
+ * joining the package names, which never change once inserted.
+ */
+static bool get_fingerprint(private_imv_os_database_t *this, int pid,
+							fingerprint_t *fingerprint)
+{
+	enumerator_t *e;
+	int row[3];
+	char *release;
+
+	e = this->db->query(this->db,
+				"SELECT id, package, security, release FROM versions "
+				"WHERE product = ? ORDER BY id",
+				DB_INT, pid, DB_INT, DB_INT, DB_INT, DB_TEXT);
+	if (!e)
+	{
+		return FALSE;
+	}
+	*fingerprint = (fingerprint_t){};
+	while (e->enumerate(e, &row[0], &row[1], &row[2], &release))
+	{
+		fingerprint->checksum = chunk_hash_inc(chunk_from_thing(row),
+											   fingerprint->checksum);
+		fingerprint->checksum = chunk_hash_inc(
+								chunk_create(release, strlen(release)),
+								fingerprint->checksum);
+		fingerprint->count++;
+	}
+	e->destroy(e);
+	return TRUE;
+}
+
+/**
+ * Load all package versions of a product with a single query
+ */
+static product_index_t *product_index_load(private_imv_os_database_t *this,
+										   int pid, fingerprint_t *fingerprint)
+{
+	product_index_t *index;
+	package_t *package;
+	os_package_state_t state;
+	enumerator_t *e;
+	char *name, *release;
+
+	e = this->db->query(this->db,
+				"SELECT p.name, v.release, v.security FROM versions AS v "
+				"JOIN packages AS p ON p.id = v.package "
+				"WHERE v.product = ? ORDER BY v.id",
+				DB_INT, pid, DB_TEXT, DB_TEXT, DB_INT);
+	if (!e)
+	{
+		return NULL;
+	}
+	INIT(index,
+		.pid = pid,
+		.fingerprint = *fingerprint,
+		.packages = hashtable_create((hashtable_hash_t)package_hash,
+									 (hashtable_equals_t)package_equals, 1024),
+	);
+	while (e->enumerate(e, &name, &release, &state))
+	{
+		package = index->packages->get(index->packages, name);
+		if (!package)
+		{
+			INIT(package,
+				.name = strdup(name),
+			);
+			index->packages->put(index->packages, package->name, package);
+		}
+		package->versions = realloc(package->versions,
+								sizeof(version_t) * (package->count + 1));
+		package->versions[package->count++] = (version_t){
+			.release = strdup(release),
+			.state = state,
+		};
+	}
+	e->destroy(e);
+
+	DBG2(DBG_IMV, "loaded %d versions of %d packages", fingerprint->count,
+		 index->packages->get_count(index->packages));
+	return index;
+}
+
+/**
+ * Find the package index of a product, if still up to date
+ */
+static product_index_t *product_index_find(private_imv_os_database_t *this,
+										int pid, fingerprint_t *fingerprint)
+{
+	enumerator_t *enumerator;
+	product_index_t *index, *found = NULL;
+
+	enumerator = this->indices->create_enumerator(this->indices);
+	while (enumerator->enumerate(enumerator, &index))
+	{
+		if (index->pid == pid &&
+			memeq(&index->fingerprint, fingerprint, sizeof(fingerprint_t)))
+		{
+			found = index;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Get an up to date package index of a product, returns with lock held
+ */
+static product_index_t *get_index(private_imv_os_database_t *this, int pid)
+{
+	enumerator_t *enumerator;
+	product_index_t *index;
+	fingerprint_t fingerprint = {};
+
+	if (!get_fingerprint(this, pid, &fingerprint))
+	{
+		return NULL;
+	}
+
+	this->lock->read_lock(this->lock);
+	index = product_index_find(this, pid, &fingerprint);
+	if (index)
+	{
+		return index;
+	}
+	this->lock->unlock(this->lock);
+
+	this->lock->write_lock(this->lock);
+	index = product_index_find(this, pid, &fingerprint);
+	if (index)
+	{
+		return index;
+	}
+	enumerator = this->indices->create_enumerator(this->indices);
+	while (enumerator->enumerate(enumerator, &index))
+	{
+		if (index->pid == pid)
+		{
+			this->indices->remove_at(this->indices, enumerator);
+			product_index_destroy(index);
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	index = product_index_load(this, pid, &fingerprint);
+	if (!index)
+	{
+		this->lock->unlock(this->lock);
+		return NULL;
+	}
+	this->indices->insert_last(this->indices, index);
+	return index;
+}
+
 METHOD(imv_os_database_t, check_packages, status_t,
 	private_imv_os_database_t *this, imv_os_state_t *state,
 	enumerator_t *package_enumerator)
 {
-	char *product, *package, *release, *cur_release;
+	char *product, *package, *release;
 	u_char *pos;
 	chunk_t os_name, os_version, name, version;
 	os_type_t os_type;
 	size_t os_version_len;
-	os_package_state_t package_state;
-	int pid, gid;
+	os_package_state_t package_state = OS_PACKAGE_STATE_UPDATE;
+	product_index_t *index;
+	package_t *entry;
+	int pid, i;
 	int count = 0, count_ok = 0, count_no_match = 0, count_blacklist = 0;
 	enumerator_t *e;
 	status_t status = SUCCESS;
-	bool found, match;
+	bool match;
 
 	state->get_info(state, &os_type, &os_name, &os_version);
 
@@ -89,6 +359,14 @@ METHOD(imv_os_database_t, check_packages, status_t,
 		return NOT_FOUND;
 	}
 	e->destroy(e);
+	free(product);
+
+	/* Get the package index of the product, reloaded if the versions change */
+	index = get_index(this, pid);
+	if (!index)
+	{
+		return FAILED;
+	}
 
 	while (package_enumerator->enumerate(package_enumerator, &name, &version))
 	{
@@ -96,92 +374,61 @@ METHOD(imv_os_database_t, check_packages, status_t,
 		package = strndup(name.ptr, name.len);
 		count++;
 
-		/* Get primary key of package */
-		e = this->db->query(this->db,
-					"SELECT id FROM packages WHERE name = ?",
-					DB_TEXT, package, DB_INT);
-		if (!e)
-		{
-			free(product);
-			free(package);
-			return FAILED;
-		}
-		if (!e->enumerate(e, &gid))
+		entry = index->packages->get(index->packages, package);
+		if (!entry)
 		{
-			/* package not present in database for any product - skip */
+			/* package not present in database for this product - skip */
 			if (os_type == OS_TYPE_ANDROID)
 			{
 				DBG2(DBG_IMV, "package '%s' (%.*s) not found",
 					 package, version.len, version.ptr);
 			}
 			free(package);
-			e->destroy(e);
 			continue;
 		}
-		e->destroy(e);
 
 		/* Convert package version chunk to a string */
 		release = strndup(version.ptr, version.len);
 
-		/* Enumerate over all acceptable versions */
-		e = this->db->query(this->db,
-				"SELECT release, security FROM versions "
-				"WHERE product = ? AND package = ?",
-				DB_INT, pid, DB_INT, gid, DB_TEXT, DB_INT);
-		if (!e)
-		{
-			free(product);
-			free(package);
-			free(release);
-			return FAILED;
-		}
-		found = FALSE;
+		/* Check all acceptable versions */
 		match = FALSE;
-
-		while (e->enumerate(e, &cur_release, &package_state))
+		for (i = 0; i < entry->count; i++)
 		{
-			found = TRUE;
-			if (streq(release, cur_release) || streq("*", cur_release))
+			package_state = entry->versions[i].state;
+			if (streq(release, entry->versions[i].release) ||
+				streq("*", entry->versions[i].release))
 			{
 				match = TRUE;
 				break;
 			}
 		}
-		e->destroy(e);
-		
-		if (found)
+
+		if (match)
 		{
-			if (match)
+			if (package_state == OS_PACKAGE_STATE_BLACKLIST)
 			{
-				if (package_state == OS_PACKAGE_STATE_BLACKLIST)
-				{
-					DBG2(DBG_IMV, "package '%s' (%s) is blacklisted",
-								   package, release);
-					count_blacklist++;
-					state->add_bad_package(state, package, package_state);
-				}
-				else
-				{
-					DBG2(DBG_IMV, "package '%s' (%s)%N is ok", package, release,
-								   os_package_state_names, package_state);
-					count_ok++;
-				}
+				DBG2(DBG_IMV, "package '%s' (%s) is blacklisted",
+							   package, release);
+				count_blacklist++;
+				state->add_bad_package(state, package, package_state);
 			}
 			else
 			{
-				DBG1(DBG_IMV, "package '%s' (%s) no match", package, release);
-				count_no_match++;
-				state->add_bad_package(state, package, package_state);
+				DBG2(DBG_IMV, "package '%s' (%s)%N is ok", package, release,
+							   os_package_state_names, package_state);
+				count_ok++;
 			}
 		}
 		else
 		{
-			/* package not present in database for this product - skip */
+			DBG1(DBG_IMV, "package '%s' (%s) no match", package, release);
+			count_no_match++;
+			state->add_bad_package(state, package, package_state);
 		}
 		free(package);
 		free(release);
 	}
-	free(product);
+	this->lock->unlock(this->lock);
 	state->set_count(state, count, count_no_match, count_blacklist, count_ok);
 
 	return status;
@@ -277,6 +524,9 @@ METHOD(imv_os_database_t, set_device_info, void,
 METHOD(imv_os_database_t, destroy, void,
 	private_imv_os_database_t *this)
 {
+	this->indices->destroy_function(this->indices,
+									(void*)product_index_destroy);
+	this->lock->destroy(this->lock);
 	this->db->destroy(this->db);
 	free(this);
 }
@@ -296,12 +546,16 @@ imv_os_database_t *imv_os_database_create(char *uri)
 			.destroy = _destroy,
 		},
 		.db = lib->db->create(lib->db, uri),
+		.indices = linked_list_create(),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
 	if (!this->db)
 	{
 		DBG1(DBG_IMV,
 			 "failed to connect to OS database '%s'", uri);
+		this->indices->destroy(this->indices);
+		this->lock->destroy(this->lock);
 		free(this);
 		return NULL;
 	}
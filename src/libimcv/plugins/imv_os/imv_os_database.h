@@ -36,6 +36,9 @@ struct imv_os_database_t {
 	/**
 	 * Check Installed Packages for a given OS
 	 *
+	 * The package versions of a product are kept in memory and reloaded
+	 * if they change in the database.
+	 *
 	 * @param state					OS IMV state
 	 * @param package_enumerator	enumerates over installed packages
 	 */
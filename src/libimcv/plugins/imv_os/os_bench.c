@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2013 Andreas Steffen
+ * HSR Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "imv_os_state.h"
+#include "imv_os_database.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <library.h>
+#include <utils/debug.h>
+#include <collections/linked_list.h>
+
+/**
+ * Product the packages are registered for
+ */
+#define OS_NAME		"Ubuntu"
+#define OS_VERSION	"12.04 i686"
+#define PRODUCT		"Ubuntu 12.04"
+
+/**
+ * Number of packages installed if no package list is given
+ */
+#define PACKAGE_COUNT	2500
+
+typedef struct package_t package_t;
+
+/**
+ * Installed package
+ */
+struct package_t {
+	chunk_t name;
+	chunk_t version;
+};
+
+/**
+ * Destroy a package_t
+ */
+static void package_destroy(package_t *package)
+{
+	free(package->name.ptr);
+	free(package->version.ptr);
+	free(package);
+}
+
+/**
+ * Add an installed package to the list
+ */
+static void add_package(linked_list_t *list, char *name, char *version)
+{
+	package_t *package;
+
+	INIT(package,
+		.name = chunk_clone(chunk_create(name, strlen(name))),
+		.version = chunk_clone(chunk_create(version, strlen(version))),
+	);
+	list->insert_last(list, package);
+}
+
+/**
+ * Read the output of "dpkg-query -W", or generate a package list
+ */
+static linked_list_t *load_packages(char *path)
+{
+	linked_list_t *list;
+	char line[512], *pos;
+	FILE *file;
+	int i;
+
+	list = linked_list_create();
+	if (!path)
+	{
+		for (i = 0; i < PACKAGE_COUNT; i++)
+		{
+			snprintf(line, sizeof(line), "lib%s%d", i % 3 ? "" : "x", i);
+			snprintf(line + 256, 256, "%d.%d.%d-%dubuntu%d", i % 5,
+					 i % 13, i % 7, i % 4 + 1, i % 3);
+			add_package(list, line, line + 256);
+		}
+		return list;
+	}
+	file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "opening '%s' failed: %s\n", path, strerror(errno));
+		list->destroy(list);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		pos = strpbrk(line, " \t");
+		if (!pos)
+		{
+			continue;
+		}
+		*pos++ = '\0';
+		pos += strspn(pos, " \t");
+		add_package(list, line, pos);
+	}
+	fclose(file);
+	return list;
+}
+
+/**
+ * Register the packages in a new database
+ *
+ * Most installed versions are registered, next to an older security update.
+ * Some packages are unknown, run outdated versions or are blacklisted.
+ */
+static bool fill_database(database_t *db, linked_list_t *packages)
+{
+	static char *tables[] = {
+		"CREATE TABLE products (id INTEGER NOT NULL PRIMARY KEY "
+			"AUTOINCREMENT, name TEXT NOT NULL)",
+		"CREATE TABLE packages (id INTEGER NOT NULL PRIMARY KEY "
+			"AUTOINCREMENT, name TEXT NOT NULL)",
+		"CREATE INDEX packages_name ON packages (name)",
+		"CREATE TABLE versions (id INTEGER NOT NULL PRIMARY KEY "
+			"AUTOINCREMENT, package INTEGER NOT NULL, product INTEGER NOT NULL, "
+			"release TEXT NOT NULL, security INTEGER DEFAULT 0, "
+			"time INTEGER DEFAULT 0)",
+		"CREATE INDEX versions_release ON versions (release)",
+		"CREATE INDEX versions_package_product ON versions (package, product)",
+	};
+	enumerator_t *enumerator;
+	package_t *package;
+	char name[256], version[256];
+	int i, pid, gid;
+
+	for (i = 0; i < countof(tables); i++)
+	{
+		if (db->execute(db, NULL, tables[i]) < 0)
+		{
+			return FALSE;
+		}
+	}
+	if (db->execute(db, &pid, "INSERT INTO products (name) VALUES (?)",
+					DB_TEXT, PRODUCT) != 1)
+	{
+		return FALSE;
+	}
+	db->execute(db, NULL, "BEGIN TRANSACTION");
+	enumerator = packages->create_enumerator(packages);
+	for (i = 0; enumerator->enumerate(enumerator, &package); i++)
+	{
+		if (i % 8 == 7)
+		{	/* locally installed package */
+			continue;
+		}
+		snprintf(name, sizeof(name), "%.*s", (int)package->name.len,
+				 package->name.ptr);
+		db->execute(db, &gid, "INSERT INTO packages (name) VALUES (?)",
+					DB_TEXT, name);
+		db->execute(db, NULL, "INSERT INTO versions "
+					"(package, product, release, security, time) "
+					"VALUES (?, ?, ?, ?, ?)", DB_INT, gid, DB_INT, pid,
+					DB_TEXT, "0.9-1", DB_INT, OS_PACKAGE_STATE_SECURITY,
+					DB_INT, 1);
+		if (i % 20 == 3)
+		{	/* outdated version installed */
+			continue;
+		}
+		snprintf(version, sizeof(version), "%.*s", (int)package->version.len,
+				 package->version.ptr);
+		db->execute(db, NULL, "INSERT INTO versions "
+					"(package, product, release, security, time) "
+					"VALUES (?, ?, ?, ?, ?)", DB_INT, gid, DB_INT, pid,
+					DB_TEXT, version, DB_INT, i % 50 == 11 ?
+					OS_PACKAGE_STATE_BLACKLIST : OS_PACKAGE_STATE_UPDATE,
+					DB_INT, 2);
+	}
+	enumerator->destroy(enumerator);
+	db->execute(db, NULL, "COMMIT TRANSACTION");
+	return TRUE;
+}
+
+/**
+ * Enumerate name and version of installed packages
+ */
+static bool package_filter(void *null, package_t **package, chunk_t *name,
+						   void *i2, chunk_t *version)
+{
+	*name = (*package)->name;
+	*version = (*package)->version;
+	return TRUE;
+}
+
+/**
+ * Run an assessment of the installed packages, returns the duration
+ */
+static double assess(imv_os_database_t *os_db, linked_list_t *packages,
+					 int *count, int *update, int *blacklist, int *ok)
+{
+	imv_state_t *state;
+	imv_os_state_t *os_state;
+	enumerator_t *enumerator;
+	struct timespec start, end;
+
+	state = imv_os_state_create(1);
+	os_state = (imv_os_state_t*)state;
+	os_state->set_info(os_state, OS_TYPE_UBUNTU,
+					   chunk_create(OS_NAME, strlen(OS_NAME)),
+					   chunk_create(OS_VERSION, strlen(OS_VERSION)));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	enumerator = enumerator_create_filter(
+						packages->create_enumerator(packages),
+						(void*)package_filter, NULL, NULL);
+	if (os_db->check_packages(os_db, os_state, enumerator) != SUCCESS)
+	{
+		fprintf(stderr, "checking packages failed\n");
+		exit(EXIT_FAILURE);
+	}
+	enumerator->destroy(enumerator);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	os_state->get_count(os_state, count, update, blacklist, ok);
+	state->destroy(state);
+
+	return (end.tv_sec - start.tv_sec) * 1000.0 +
+		   (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	imv_os_database_t *os_db;
+	database_t *db;
+	linked_list_t *packages;
+	char uri[512];
+	int rounds, i, count, update, blacklist, ok;
+	double first, total = 0;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: os_bench <new sqlite file> [rounds] "
+						"[dpkg-query -W output]\n");
+		return EXIT_FAILURE;
+	}
+	if (access(argv[1], F_OK) == 0)
+	{
+		fprintf(stderr, "database '%s' already exists\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+	library_init(NULL);
+	atexit(library_deinit);
+	dbg_default_set_level(0);
+	if (!lib->plugins->load(lib->plugins, NULL,
+			lib->settings->get_str(lib->settings, "os_bench.load", "sqlite")))
+	{
+		return EXIT_FAILURE;
+	}
+	packages = load_packages(argc > 3 ? argv[3] : NULL);
+	if (!packages)
+	{
+		return EXIT_FAILURE;
+	}
+
+	snprintf(uri, sizeof(uri), "sqlite://%s", argv[1]);
+	db = lib->db->create(lib->db, uri);
+	if (!db || !fill_database(db, packages))
+	{
+		fprintf(stderr, "creating database '%s' failed\n", argv[1]);
+		DESTROY_IF(db);
+		packages->destroy_function(packages, (void*)package_destroy);
+		return EXIT_FAILURE;
+	}
+	db->destroy(db);
+
+	os_db = imv_os_database_create(uri);
+	if (!os_db)
+	{
+		packages->destroy_function(packages, (void*)package_destroy);
+		return EXIT_FAILURE;
+	}
+	first = assess(os_db, packages, &count, &update, &blacklist, &ok);
+	for (i = 0; i < rounds; i++)
+	{
+		total += assess(os_db, packages, &count, &update, &blacklist, &ok);
+	}
+	printf("%d packages: %d ok, %d no match, %d blacklisted\n",
+		   count, ok, update, blacklist);
+	printf("first assessment: %.2f ms, next %d: %.2f ms average\n",
+		   first, rounds, rounds ? total / rounds : 0.0);
+
+	os_db->destroy(os_db);
+	packages->destroy_function(packages, (void*)package_destroy);
+	unlink(argv[1]);
+	return EXIT_SUCCESS;
+}
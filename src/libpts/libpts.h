@@ -26,6 +26,7 @@
 #define LIBPTS_H_
 
 #include "pts/components/pts_component_manager.h"
+#include "pts/pts_file_hasher.h"
 
 #include <library.h>
 
@@ -46,4 +47,9 @@ void libpts_deinit(void);
  */
 extern pts_component_manager_t* pts_components;
 
+/**
+ * File hasher caching measurements between attestations
+ */
+extern pts_file_hasher_t* pts_file_hasher;
+
 #endif /** LIBPTS_H_ @}*/
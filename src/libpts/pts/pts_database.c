@@ -17,7 +17,17 @@
 
 #include <utils/debug.h>
 #include <crypto/hashers/hasher.h>
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+#include <threading/rwlock.h>
 
+#include <limits.h>
+#include <sys/stat.h>
+
+/**
+ * Default lifetime of cached reference hashes, in seconds
+ */
+#define HASH_CACHE_LIFETIME 600
 
 typedef struct private_pts_database_t private_pts_database_t;
 
@@ -37,8 +47,307 @@ struct private_pts_database_t {
 	 */
 	database_t *db;
 
+	/**
+	 * Cached reference file hashes, ref_set_t
+	 */
+	linked_list_t *sets;
+
+	/**
+	 * Lock for cached reference file hashes
+	 */
+	rwlock_t *lock;
+
+	/**
+	 * Lifetime of cached reference hashes, 0 to disable caching
+	 */
+	u_int lifetime;
+
+	/**
+	 * Path of an SQLite database file, to detect changes
+	 */
+	char *file;
+
+};
+
+typedef struct db_stamp_t db_stamp_t;
+
+/**
+ * Modification stamp of an SQLite database file and its write-ahead log
+ */
+struct db_stamp_t {
+
+	/**
+	 * Modification time and size of the database file
+	 */
+	struct timespec mtime;
+	off_t size;
+
+	/**
+	 * Modification time and size of the write-ahead log, if any
+	 */
+	struct timespec wal_mtime;
+	off_t wal_size;
+};
+
+typedef struct ref_set_t ref_set_t;
+
+/**
+ * Reference file hashes of a product for a given algorithm
+ */
+struct ref_set_t {
+
+	/**
+	 * Software product
+	 */
+	char *product;
+
+	/**
+	 * Measurement algorithm
+	 */
+	pts_meas_algorithms_t algo;
+
+	/**
+	 * Reference hashes, file path => ref_hash_t
+	 */
+	hashtable_t *hashes;
+
+	/**
+	 * Time the set was loaded (monotonic)
+	 */
+	time_t loaded;
+
+	/**
+	 * Modification stamp of the database when loaded
+	 */
+	db_stamp_t stamp;
+};
+
+typedef struct ref_hash_t ref_hash_t;
+
+/**
+ * Reference hashes of a file, relative filenames might have several
+ */
+struct ref_hash_t {
+
+	/**
+	 * File path
+	 */
+	char *path;
+
+	/**
+	 * Number of hashes
+	 */
+	int count;
+
+	/**
+	 * Array of hashes
+	 */
+	chunk_t *hashes;
 };
 
+/**
+ * Hashtable hash function for file paths
+ */
+static u_int path_hash(char *path)
+{
+	return chunk_hash(chunk_create(path, strlen(path)));
+}
+
+/**
+ * Hashtable equals function for file paths
+ */
+static bool path_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Destroy a set of reference hashes
+ */
+static void ref_set_destroy(ref_set_t *set)
+{
+	enumerator_t *enumerator;
+	ref_hash_t *ref;
+	char *path;
+	int i;
+
+	enumerator = set->hashes->create_enumerator(set->hashes);
+	while (enumerator->enumerate(enumerator, &path, &ref))
+	{
+		for (i = 0; i < ref->count; i++)
+		{
+			free(ref->hashes[i].ptr);
+		}
+		free(ref->hashes);
+		free(ref->path);
+		free(ref);
+	}
+	enumerator->destroy(enumerator);
+	set->hashes->destroy(set->hashes);
+	free(set->product);
+	free(set);
+}
+
+/**
+ * Get modification time, with nanoseconds if available, and size of a file
+ */
+static void stat_file(char *path, struct timespec *mtime, off_t *size)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+	{
+		return;
+	}
+#if defined(__APPLE__)
+	*mtime = st.st_mtimespec;
+#elif defined(st_mtime)
+	/* st_mtime is defined as st_mtim.tv_sec if struct timespec is used */
+	*mtime = st.st_mtim;
+#else
+	mtime->tv_sec = st.st_mtime;
+#endif
+	*size = st.st_size;
+}
+
+/**
+ * Get the modification stamp of the database file, if any.
+ *
+ * Transactions committed in WAL mode only modify the -wal file, the main
+ * file changes when the log gets checkpointed.
+ */
+static void get_db_stamp(private_pts_database_t *this, db_stamp_t *stamp)
+{
+	char wal[PATH_MAX];
+
+	*stamp = (db_stamp_t){};
+	if (this->file)
+	{
+		stat_file(this->file, &stamp->mtime, &stamp->size);
+		if (snprintf(wal, sizeof(wal), "%s-wal", this->file) < sizeof(wal))
+		{
+			stat_file(wal, &stamp->wal_mtime, &stamp->wal_size);
+		}
+	}
+}
+
+/**
+ * Compare two database modification stamps
+ */
+static bool db_stamp_equals(db_stamp_t *a, db_stamp_t *b)
+{
+	return a->mtime.tv_sec == b->mtime.tv_sec &&
+		   a->mtime.tv_nsec == b->mtime.tv_nsec && a->size == b->size &&
+		   a->wal_mtime.tv_sec == b->wal_mtime.tv_sec &&
+		   a->wal_mtime.tv_nsec == b->wal_mtime.tv_nsec &&
+		   a->wal_size == b->wal_size;
+}
+
+/**
+ * Load the reference hashes of a product with a single query
+ */
+static ref_set_t *ref_set_load(private_pts_database_t *this, char *product,
+							   pts_meas_algorithms_t algo, db_stamp_t *stamp)
+{
+	enumerator_t *e;
+	ref_set_t *set;
+	ref_hash_t *ref;
+	chunk_t hash;
+	char *path;
+	int count = 0;
+
+	INIT(set,
+		.product = strdup(product),
+		.algo = algo,
+		.hashes = hashtable_create((hashtable_hash_t)path_hash,
+								   (hashtable_equals_t)path_equals, 1024),
+		.loaded = time_monotonic(NULL),
+		.stamp = *stamp,
+	);
+
+	e = this->db->query(this->db,
+		"SELECT f.path, fh.hash FROM file_hashes AS fh "
+		"JOIN files AS f ON f.id = fh.file "
+		"JOIN products AS p ON p.id = fh.product "
+		"WHERE p.name = ? AND fh.algo = ?",
+		DB_TEXT, product, DB_INT, algo, DB_TEXT, DB_BLOB);
+	if (!e)
+	{
+		ref_set_destroy(set);
+		return NULL;
+	}
+	while (e->enumerate(e, &path, &hash))
+	{
+		ref = set->hashes->get(set->hashes, path);
+		if (!ref)
+		{
+			INIT(ref,
+				.path = strdup(path),
+			);
+			set->hashes->put(set->hashes, ref->path, ref);
+		}
+		ref->hashes = realloc(ref->hashes, sizeof(chunk_t) * (ref->count + 1));
+		ref->hashes[ref->count++] = chunk_clone(hash);
+		count++;
+	}
+	e->destroy(e);
+
+	DBG2(DBG_PTS, "loaded %d reference hashes for %d files of '%s'",
+		 count, set->hashes->get_count(set->hashes), product);
+	return set;
+}
+
+/**
+ * Find the cached reference hashes of a product, if still valid
+ */
+static ref_set_t *ref_set_find(private_pts_database_t *this, char *product,
+							   pts_meas_algorithms_t algo, time_t now,
+							   db_stamp_t *stamp)
+{
+	enumerator_t *enumerator;
+	ref_set_t *set, *found = NULL;
+
+	enumerator = this->sets->create_enumerator(this->sets);
+	while (enumerator->enumerate(enumerator, &set))
+	{
+		if (set->algo == algo && streq(set->product, product))
+		{
+			if (now - set->loaded < this->lifetime &&
+				db_stamp_equals(&set->stamp, stamp))
+			{
+				found = set;
+			}
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Flush cached reference hashes of a product, and all expired ones
+ */
+static void ref_set_flush(private_pts_database_t *this, char *product,
+						  pts_meas_algorithms_t algo, time_t now,
+						  db_stamp_t *stamp)
+{
+	enumerator_t *enumerator;
+	ref_set_t *set;
+
+	enumerator = this->sets->create_enumerator(this->sets);
+	while (enumerator->enumerate(enumerator, &set))
+	{
+		if ((set->algo == algo && streq(set->product, product)) ||
+			now - set->loaded >= this->lifetime ||
+			!db_stamp_equals(&set->stamp, stamp))
+		{
+			this->sets->remove_at(this->sets, enumerator);
+			ref_set_destroy(set);
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
 METHOD(pts_database_t, create_file_meas_enumerator, enumerator_t*,
 	private_pts_database_t *this, char *product)
 {
@@ -121,9 +430,13 @@ METHOD(pts_database_t, check_aik_keyid, status_t,
 	return SUCCESS;
 }
 
-METHOD(pts_database_t, check_file_measurement, status_t,
-	private_pts_database_t *this, char *product, pts_meas_algorithms_t algo,
-	chunk_t measurement, char *filename)
+/**
+ * Check a file measurement with a database query
+ */
+static status_t check_file_measurement_db(private_pts_database_t *this,
+										  char *product,
+										  pts_meas_algorithms_t algo,
+										  chunk_t measurement, char *filename)
 {
 	enumerator_t *e;
 	chunk_t hash;
@@ -157,6 +470,63 @@ METHOD(pts_database_t, check_file_measurement, status_t,
 	return status;
 }
 
+METHOD(pts_database_t, check_file_measurement, status_t,
+	private_pts_database_t *this, char *product, pts_meas_algorithms_t algo,
+	chunk_t measurement, char *filename)
+{
+	ref_set_t *set;
+	ref_hash_t *ref;
+	status_t status = NOT_FOUND;
+	db_stamp_t stamp;
+	time_t now;
+	int i;
+
+	if (!this->lifetime)
+	{
+		return check_file_measurement_db(this, product, algo, measurement,
+										 filename);
+	}
+	now = time_monotonic(NULL);
+	get_db_stamp(this, &stamp);
+
+	this->lock->read_lock(this->lock);
+	set = ref_set_find(this, product, algo, now, &stamp);
+	if (!set)
+	{
+		this->lock->unlock(this->lock);
+		this->lock->write_lock(this->lock);
+		set = ref_set_find(this, product, algo, now, &stamp);
+		if (!set)
+		{
+			ref_set_flush(this, product, algo, now, &stamp);
+			set = ref_set_load(this, product, algo, &stamp);
+			if (!set)
+			{
+				this->lock->unlock(this->lock);
+				return FAILED;
+			}
+			this->sets->insert_last(this->sets, set);
+		}
+	}
+	ref = set->hashes->get(set->hashes, filename);
+	if (ref)
+	{
+		/* with relative filenames there might be multiple entries */
+		status = VERIFY_ERROR;
+		for (i = 0; i < ref->count; i++)
+		{
+			if (chunk_equals(measurement, ref->hashes[i]))
+			{
+				status = SUCCESS;
+				break;
+			}
+		}
+	}
+	this->lock->unlock(this->lock);
+
+	return status;
+}
+
 METHOD(pts_database_t, create_comp_evid_enumerator, enumerator_t*,
 	private_pts_database_t *this, int kid)
 {
@@ -308,7 +678,10 @@ METHOD(pts_database_t, get_comp_measurement_count, status_t,
 METHOD(pts_database_t, destroy, void,
 	private_pts_database_t *this)
 {
+	this->sets->destroy_function(this->sets, (void*)ref_set_destroy);
+	this->lock->destroy(this->lock);
 	this->db->destroy(this->db);
+	free(this->file);
 	free(this);
 }
 
@@ -334,15 +707,27 @@ pts_database_t *pts_database_create(char *uri)
 			.destroy = _destroy,
 		},
 		.db = lib->db->create(lib->db, uri),
+		.sets = linked_list_create(),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.lifetime = lib->settings->get_time(lib->settings,
+							"libimcv.plugins.imv-attestation.hash_cache_lifetime",
+							HASH_CACHE_LIFETIME),
 	);
 
 	if (!this->db)
 	{
 		DBG1(DBG_PTS,
 			 "failed to connect to PTS file measurement database '%s'", uri);
+		this->sets->destroy(this->sets);
+		this->lock->destroy(this->lock);
 		free(this);
 		return NULL;
 	}
+	if (strncaseeq(uri, "sqlite://", strlen("sqlite://")))
+	{
+		/* reference hashes get reloaded if the database file changes */
+		this->file = strdup(uri + strlen("sqlite://"));
+	}
 
 	return &this->public;
 }
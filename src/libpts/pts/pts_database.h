@@ -84,6 +84,9 @@ struct pts_database_t {
 	/**
 	* Check PTS file measurement against reference stored in database
 	*
+	* The reference hashes of a product are loaded with a single query and
+	* cached until they expire or the database changes.
+	*
 	* @param product		Software product (os, vpn client, etc.)
 	* @param algo			File measurement hash algorithm used
 	* @param measurement	File measurement hash
@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2013 Andreas Steffen
+ * HSR Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "pts_file_hasher.h"
+
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <threading/thread.h>
+#include <processing/jobs/callback_job.h>
+#include <utils/debug.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Size of the blocks read from files
+ */
+#define READ_BLOCK_SIZE		65536
+
+typedef struct private_pts_file_hasher_t private_pts_file_hasher_t;
+
+/**
+ * Private data of a pts_file_hasher_t object.
+ */
+struct private_pts_file_hasher_t {
+
+	/**
+	 * Public pts_file_hasher_t interface.
+	 */
+	pts_file_hasher_t public;
+
+	/**
+	 * Cached measurements, entry_t => entry_t
+	 */
+	hashtable_t *cache;
+
+	/**
+	 * Cached measurements in the order they were added, for eviction
+	 */
+	linked_list_t *order;
+
+	/**
+	 * Maximum number of cached measurements
+	 */
+	u_int cache_size;
+
+	/**
+	 * Mutex to lock cache
+	 */
+	mutex_t *mutex;
+};
+
+typedef struct entry_t entry_t;
+
+/**
+ * Cached file measurement
+ */
+struct entry_t {
+	char *path;
+	hash_algorithm_t alg;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	struct timespec ctime;
+	off_t size;
+	chunk_t hash;
+};
+
+/**
+ * Get modification and status change time of a file, with nanoseconds if
+ * struct stat provides them
+ */
+static void get_times(struct stat *st, struct timespec *mtime,
+					  struct timespec *ctime)
+{
+#if defined(__APPLE__)
+	*mtime = st->st_mtimespec;
+	*ctime = st->st_ctimespec;
+#elif defined(st_mtime)
+	/* st_mtime is defined as st_mtim.tv_sec if struct timespec is used */
+	*mtime = st->st_mtim;
+	*ctime = st->st_ctim;
+#else
+	*mtime = (struct timespec){ .tv_sec = st->st_mtime };
+	*ctime = (struct timespec){ .tv_sec = st->st_ctime };
+#endif
+}
+
+/**
+ * Compare two struct timespec
+ */
+static bool times_equal(struct timespec *a, struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/**
+ * Hashtable hash function for cache entries
+ */
+static u_int entry_hash(entry_t *key)
+{
+	return chunk_hash_inc(chunk_create(key->path, strlen(key->path)), key->alg);
+}
+
+/**
+ * Hashtable equals function for cache entries
+ */
+static bool entry_equals(entry_t *a, entry_t *b)
+{
+	return a->alg == b->alg && streq(a->path, b->path);
+}
+
+/**
+ * Destroy a cache entry
+ */
+static void entry_destroy(entry_t *entry)
+{
+	free(entry->path);
+	free(entry->hash.ptr);
+	free(entry);
+}
+
+/**
+ * Look up a cached measurement still valid for the given file status
+ */
+static bool cache_lookup(private_pts_file_hasher_t *this, char *path,
+						 hash_algorithm_t alg, struct stat *st, chunk_t *hash)
+{
+	entry_t *entry, key = {
+		.path = path,
+		.alg = alg,
+	};
+	struct timespec mtime, ctime;
+	bool found = FALSE;
+
+	get_times(st, &mtime, &ctime);
+	this->mutex->lock(this->mutex);
+	entry = this->cache->get(this->cache, &key);
+	if (entry && entry->dev == st->st_dev && entry->ino == st->st_ino &&
+		entry->size == st->st_size && times_equal(&entry->mtime, &mtime) &&
+		times_equal(&entry->ctime, &ctime))
+	{
+		*hash = chunk_clone(entry->hash);
+		found = TRUE;
+	}
+	this->mutex->unlock(this->mutex);
+	return found;
+}
+
+/**
+ * Add or update a cached measurement, evicting the oldest one if full
+ */
+static void cache_add(private_pts_file_hasher_t *this, char *path,
+					  hash_algorithm_t alg, struct stat *st, chunk_t hash)
+{
+	entry_t *entry, key = {
+		.path = path,
+		.alg = alg,
+	};
+
+	this->mutex->lock(this->mutex);
+	entry = this->cache->get(this->cache, &key);
+	if (entry)
+	{
+		free(entry->hash.ptr);
+	}
+	else
+	{
+		if (this->cache->get_count(this->cache) >= this->cache_size &&
+			this->order->remove_first(this->order, (void**)&entry) == SUCCESS)
+		{
+			this->cache->remove(this->cache, entry);
+			entry_destroy(entry);
+		}
+		INIT(entry,
+			.path = strdup(path),
+			.alg = alg,
+		);
+		this->cache->put(this->cache, entry, entry);
+		this->order->insert_last(this->order, entry);
+	}
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	get_times(st, &entry->mtime, &entry->ctime);
+	entry->size = st->st_size;
+	entry->hash = chunk_clone(hash);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Feed an open file to the hasher in large blocks
+ */
+static bool hash_fd(hasher_t *hasher, int fd, chunk_t *hash)
+{
+	chunk_t block;
+	ssize_t len;
+	bool success;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	block = chunk_alloc(READ_BLOCK_SIZE);
+	while (TRUE)
+	{
+		len = read(fd, block.ptr, block.len);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			success = FALSE;
+			break;
+		}
+		if (len == 0)
+		{
+			success = hasher->allocate_hash(hasher, chunk_empty, hash);
+			break;
+		}
+		if (!hasher->get_hash(hasher, chunk_create(block.ptr, len), NULL))
+		{
+			success = FALSE;
+			break;
+		}
+	}
+	chunk_free(&block);
+	return success;
+}
+
+/**
+ * Measure a single file and cache the result
+ */
+static bool hash_file(private_pts_file_hasher_t *this, hasher_t *hasher,
+					  hash_algorithm_t alg, char *path, time_t started,
+					  chunk_t *hash)
+{
+	struct stat st;
+	bool success;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		DBG1(DBG_PTS, "  file '%s' can not be opened, %s", path,
+			 strerror(errno));
+		return FALSE;
+	}
+	if (fstat(fd, &st) == -1)
+	{
+		DBG1(DBG_PTS, "  file '%s' can not be accessed, %s", path,
+			 strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+	success = hash_fd(hasher, fd, hash);
+	close(fd);
+
+	if (!success)
+	{
+		DBG1(DBG_PTS, "  hashing file '%s' failed", path);
+		return FALSE;
+	}
+	/* files modified during the current second might get modified again
+	 * without changing their time stamps, don't cache these */
+	if (this->cache_size && S_ISREG(st.st_mode) && st.st_mtime < started &&
+		st.st_ctime < started)
+	{
+		cache_add(this, path, alg, &st, *hash);
+	}
+	return TRUE;
+}
+
+typedef struct batch_t batch_t;
+
+/**
+ * Files to be hashed by a number of threads
+ */
+struct batch_t {
+
+	/**
+	 * Hasher the batch belongs to
+	 */
+	private_pts_file_hasher_t *this;
+
+	/**
+	 * Hash algorithm
+	 */
+	hash_algorithm_t alg;
+
+	/**
+	 * Time the batch was started
+	 */
+	time_t started;
+
+	/**
+	 * Pathnames of the files to hash
+	 */
+	char **paths;
+
+	/**
+	 * Resulting hashes
+	 */
+	chunk_t **hashes;
+
+	/**
+	 * Number of files
+	 */
+	int count;
+
+	/**
+	 * Index of the next file to hash
+	 */
+	int next;
+
+	/**
+	 * Number of files hashed (or failed)
+	 */
+	int done;
+
+	/**
+	 * TRUE if a file could not be hashed
+	 */
+	bool failed;
+
+	/**
+	 * Mutex to lock the fields above
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Signaled when a file has been hashed
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Reference count, one for the caller and one per queued job
+	 */
+	refcount_t refs;
+};
+
+/**
+ * Release a reference to a batch
+ */
+static void batch_destroy(batch_t *batch)
+{
+	if (ref_put(&batch->refs))
+	{
+		batch->condvar->destroy(batch->condvar);
+		batch->mutex->destroy(batch->mutex);
+		free(batch);
+	}
+}
+
+/**
+ * Hash files of a batch until none are left
+ */
+static job_requeue_t process_batch(batch_t *batch)
+{
+	hasher_t *hasher = NULL;
+	bool success, old;
+	int i;
+
+	batch->mutex->lock(batch->mutex);
+	while (!batch->failed && batch->next < batch->count)
+	{
+		i = batch->next++;
+		batch->mutex->unlock(batch->mutex);
+
+		/* other threads wait for the file to complete */
+		old = thread_cancelability(FALSE);
+		if (!hasher)
+		{
+			hasher = lib->crypto->create_hasher(lib->crypto, batch->alg);
+		}
+		success = hasher && hash_file(batch->this, hasher, batch->alg,
+						batch->paths[i], batch->started, batch->hashes[i]);
+		thread_cancelability(old);
+
+		batch->mutex->lock(batch->mutex);
+		batch->done++;
+		if (!success)
+		{
+			batch->failed = TRUE;
+		}
+		batch->condvar->broadcast(batch->condvar);
+	}
+	batch->mutex->unlock(batch->mutex);
+	DESTROY_IF(hasher);
+	return JOB_REQUEUE_NONE;
+}
+
+METHOD(pts_file_hasher_t, hash_files, bool,
+	private_pts_file_hasher_t *this, hash_algorithm_t alg, int count,
+	char *paths[], chunk_t hashes[])
+{
+	batch_t *batch;
+	struct stat st;
+	u_int workers = 0;
+	bool success, old;
+	int i;
+
+	INIT(batch,
+		.this = this,
+		.alg = alg,
+		.started = time(NULL),
+		.paths = malloc(sizeof(char*) * count),
+		.hashes = malloc(sizeof(chunk_t*) * count),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.refs = 1,
+	);
+
+	/* only files that changed since they were measured get hashed again */
+	for (i = 0; i < count; i++)
+	{
+		hashes[i] = chunk_empty;
+		if (this->cache_size && stat(paths[i], &st) == 0 &&
+			cache_lookup(this, paths[i], alg, &st, &hashes[i]))
+		{
+			continue;
+		}
+		batch->paths[batch->count] = paths[i];
+		batch->hashes[batch->count] = &hashes[i];
+		batch->count++;
+	}
+
+	if (batch->count > 1)
+	{
+		workers = min(batch->count - 1,
+					  lib->processor->get_idle_threads(lib->processor));
+	}
+	DBG2(DBG_PTS, "hashing %d of %d files using %u additional threads",
+		 batch->count, count, workers);
+	for (i = 0; i < workers; i++)
+	{
+		ref_get(&batch->refs);
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)process_batch,
+					batch, (callback_job_cleanup_t)batch_destroy, NULL));
+	}
+	process_batch(batch);
+
+	old = thread_cancelability(FALSE);
+	batch->mutex->lock(batch->mutex);
+	while (batch->done < batch->next)
+	{
+		batch->condvar->wait(batch->condvar, batch->mutex);
+	}
+	success = !batch->failed;
+	batch->mutex->unlock(batch->mutex);
+	thread_cancelability(old);
+
+	/* jobs not yet started find nothing left to hash, but still reference
+	 * the batch until they are destroyed */
+	free(batch->paths);
+	free(batch->hashes);
+	batch_destroy(batch);
+
+	if (!success)
+	{
+		for (i = 0; i < count; i++)
+		{
+			chunk_free(&hashes[i]);
+		}
+	}
+	return success;
+}
+
+METHOD(pts_file_hasher_t, destroy, void,
+	private_pts_file_hasher_t *this)
+{
+	this->order->destroy_function(this->order, (void*)entry_destroy);
+	this->cache->destroy(this->cache);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * See header
+ */
+pts_file_hasher_t *pts_file_hasher_create(u_int cache_size)
+{
+	private_pts_file_hasher_t *this;
+
+	INIT(this,
+		.public = {
+			.hash_files = _hash_files,
+			.destroy = _destroy,
+		},
+		.cache = hashtable_create((hashtable_hash_t)entry_hash,
+								  (hashtable_equals_t)entry_equals, 128),
+		.order = linked_list_create(),
+		.cache_size = cache_size,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2013 Andreas Steffen
+ * HSR Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup pts_file_hasher pts_file_hasher
+ * @{ @ingroup pts
+ */
+
+#ifndef PTS_FILE_HASHER_H_
+#define PTS_FILE_HASHER_H_
+
+#include <library.h>
+#include <crypto/hashers/hasher.h>
+
+typedef struct pts_file_hasher_t pts_file_hasher_t;
+
+/**
+ * Measures files, in parallel and with a cache of previous measurements.
+ *
+ * Files are read in large blocks and distributed to idle threads of the job
+ * processor, the calling thread takes part in hashing. Measurements are
+ * cached by pathname and hash algorithm and reused as long as device, inode,
+ * size, modification and status change time of the file remain unchanged.
+ * The times are compared with nanosecond resolution where available.
+ */
+struct pts_file_hasher_t {
+
+	/**
+	 * Hash a set of files.
+	 *
+	 * @param alg			hash algorithm to use
+	 * @param count			number of files
+	 * @param paths			absolute pathnames of the files to hash
+	 * @param hashes		allocated hashes, in the order of paths
+	 * @return				TRUE if all files have been hashed
+	 */
+	bool (*hash_files)(pts_file_hasher_t *this, hash_algorithm_t alg,
+					   int count, char *paths[], chunk_t hashes[]);
+
+	/**
+	 * Destroy a pts_file_hasher_t object.
+	 */
+	void (*destroy)(pts_file_hasher_t *this);
+};
+
+/**
+ * Create a pts_file_hasher_t object.
+ *
+ * @param cache_size		maximum number of cached measurements, 0 to disable
+ */
+pts_file_hasher_t* pts_file_hasher_create(u_int cache_size);
+
+#endif /** PTS_FILE_HASHER_H_ @}*/
@@ -15,6 +15,8 @@
 
 #include "pts_file_meas.h"
 
+#include "libpts.h"
+
 #include <collections/linked_list.h>
 #include <utils/debug.h>
 
@@ -234,50 +236,6 @@ pts_file_meas_t *pts_file_meas_create(u_int16_t request_id)
 	return &this->public;
 }
 
-/**
- * Hash a file with a given absolute pathname
- */
-static bool hash_file(hasher_t *hasher, char *pathname, u_char *hash)
-{
-	u_char buffer[4096];
-	size_t bytes_read;
-	bool success = TRUE;
-	FILE *file;
-
-	file = fopen(pathname, "rb");
-	if (!file)
-	{
-		DBG1(DBG_PTS,"  file '%s' can not be opened, %s", pathname,
-			 strerror(errno));
-		return FALSE;
-	}
-	while (TRUE)
-	{
-		bytes_read = fread(buffer, 1, sizeof(buffer), file);
-		if (bytes_read > 0)
-		{
-			if (!hasher->get_hash(hasher, chunk_create(buffer, bytes_read), NULL))
-			{
-				DBG1(DBG_PTS, "  hasher increment error");
-				success = FALSE;
-				break;
-			}
-		}
-		else
-		{
-			if (!hasher->get_hash(hasher, chunk_empty, hash))
-			{
-				DBG1(DBG_PTS, "  hasher finalize error");
-				success = FALSE;
-			}
-			break;
-		}
-	}
-	fclose(file);
-
-	return success;
-}
-
 /**
  * See header
  */
@@ -288,12 +246,13 @@ pts_file_meas_t *pts_file_meas_create_from_path(u_int16_t request_id,
 	private_pts_file_meas_t *this;
 	hash_algorithm_t hash_alg;
 	hasher_t *hasher;
-	u_char hash[HASH_SIZE_SHA384];
-	chunk_t measurement;
-	char* filename;
+	linked_list_t *files;
+	enumerator_t *enumerator;
+	chunk_t *hashes;
+	char **paths, *filename;
 	bool success = TRUE;
+	int count, i;
 
-	/* Create a hasher and a hash measurement buffer */
 	hash_alg = pts_meas_algo_to_hash(alg);
 	hasher = lib->crypto->create_hasher(lib->crypto, hash_alg);
 	if (!hasher)
@@ -301,25 +260,11 @@ pts_file_meas_t *pts_file_meas_create_from_path(u_int16_t request_id,
 		DBG1(DBG_PTS, "hasher %N not available", hash_algorithm_names, hash_alg);
 		return NULL;
 	}
-	measurement = chunk_create(hash, hasher->get_hash_size(hasher));
-
-	INIT(this,
-		.public = {
-			.get_request_id = _get_request_id,
-			.get_file_count = _get_file_count,
-			.add = _add,
-			.create_enumerator = _create_enumerator,
-			.check = _check,
-			.verify = _verify,
-			.destroy = _destroy,
-		},
-		.request_id = request_id,
-		.list = linked_list_create(),
-	);
+	hasher->destroy(hasher);
+	files = linked_list_create();
 
 	if (is_dir)
 	{
-		enumerator_t *enumerator;
 		char *rel_name, *abs_name;
 		struct stat st;
 
@@ -328,40 +273,70 @@ pts_file_meas_t *pts_file_meas_create_from_path(u_int16_t request_id,
 		{
 			DBG1(DBG_PTS, "  directory '%s' can not be opened, %s", pathname,
 				 strerror(errno));
-			success = FALSE;
-			goto end;
+			files->destroy(files);
+			return NULL;
 		}
 		while (enumerator->enumerate(enumerator, &rel_name, &abs_name, &st))
 		{
 			/* measure regular files only */
 			if (S_ISREG(st.st_mode) && *rel_name != '.')
 			{
-				if (!hash_file(hasher, abs_name, hash))
-				{
-					success = FALSE;
-					break;
-				}
-				filename = use_rel_name ? rel_name : abs_name;
-				DBG2(DBG_PTS, "  %#B for '%s'", &measurement, filename);
-				add(this, filename, measurement);
+				files->insert_last(files, strdup(abs_name));
 			}
 		}
 		enumerator->destroy(enumerator);
 	}
 	else
 	{
-		if (!hash_file(hasher, pathname, hash))
+		files->insert_last(files, strdup(pathname));
+	}
+
+	INIT(this,
+		.public = {
+			.get_request_id = _get_request_id,
+			.get_file_count = _get_file_count,
+			.add = _add,
+			.create_enumerator = _create_enumerator,
+			.check = _check,
+			.verify = _verify,
+			.destroy = _destroy,
+		},
+		.request_id = request_id,
+		.list = linked_list_create(),
+	);
+
+	/* hash all files at once, in parallel if possible */
+	count = files->get_count(files);
+	paths = malloc(sizeof(char*) * count);
+	hashes = malloc(sizeof(chunk_t) * count);
+	enumerator = files->create_enumerator(files);
+	for (i = 0; enumerator->enumerate(enumerator, &paths[i]); i++);
+	enumerator->destroy(enumerator);
+
+	if (pts_file_hasher->hash_files(pts_file_hasher, hash_alg, count,
+									paths, hashes))
+	{
+		for (i = 0; i < count; i++)
 		{
-			success = FALSE;
-			goto end;
+			filename = paths[i];
+			if (use_rel_name)
+			{
+				filename = is_dir ? strrchr(filename, '/') + 1
+								  : basename(filename);
+			}
+			DBG2(DBG_PTS, "  %#B for '%s'", &hashes[i], filename);
+			add(this, filename, hashes[i]);
+			free(hashes[i].ptr);
 		}
-		filename = use_rel_name ? basename(pathname) : pathname;
-		DBG2(DBG_PTS, "  %#B for '%s'", &measurement, filename);
-		add(this, filename, measurement);
 	}
+	else
+	{
+		success = FALSE;
+	}
+	free(hashes);
+	free(paths);
+	files->destroy_function(files, free);
 
-end:
-	hasher->destroy(hasher);
 	if (success)
 	{
 		return &this->public;
@@ -51,6 +51,21 @@ struct private_radius_client_t {
 	 * EAP MSK, from MPPE keys
 	 */
 	chunk_t msk;
+
+	/**
+	 * Key to select the socket by, if pinned
+	 */
+	u_int pin;
+
+	/**
+	 * Send requests over the socket selected by pin?
+	 */
+	bool pinned;
+
+	/**
+	 * Reference count, asynchronous requests hold one
+	 */
+	refcount_t ref;
 };
 
 /**
@@ -78,13 +93,13 @@ static void save_state(private_radius_client_t *this, radius_message_t *msg)
 	chunk_free(&this->state);
 }
 
-METHOD(radius_client_t, request, radius_message_t*,
-	private_radius_client_t *this, radius_message_t *req)
+/**
+ * Add NAS attributes and state to a request, get a socket to send it
+ */
+static radius_socket_t *prepare(private_radius_client_t *this,
+								radius_message_t *req)
 {
 	char virtual[] = {0x00,0x00,0x00,0x05};
-	radius_socket_t *socket;
-	radius_message_t *res;
-	chunk_t data;
 
 	/* we add the "Virtual" NAS-Port-Type, as we SHOULD include one */
 	req->add(req, RAT_NAS_PORT_TYPE, chunk_create(virtual, sizeof(virtual)));
@@ -96,25 +111,49 @@ METHOD(radius_client_t, request, radius_message_t*,
 	{
 		req->add(req, RAT_STATE, this->state);
 	}
-	socket = this->config->get_socket(this->config);
 	DBG1(DBG_CFG, "sending RADIUS %N to server '%s'", radius_message_code_names,
 		 req->get_code(req), this->config->get_name(this->config));
+	if (this->pinned)
+	{
+		return this->config->get_pinned_socket(this->config, this->pin);
+	}
+	return this->config->get_socket(this->config);
+}
+
+/**
+ * Log a response, update State and MSK from it
+ */
+static void process_response(private_radius_client_t *this,
+							 radius_socket_t *socket, radius_message_t *req,
+							 radius_message_t *res)
+{
+	chunk_t data;
+
+	DBG1(DBG_CFG, "received RADIUS %N from server '%s'",
+		 radius_message_code_names, res->get_code(res),
+		 this->config->get_name(this->config));
+	data = res->get_encoding(res);
+	DBG3(DBG_CFG, "%B", &data);
+
+	save_state(this, res);
+	if (res->get_code(res) == RMC_ACCESS_ACCEPT)
+	{
+		chunk_clear(&this->msk);
+		this->msk = socket->decrypt_msk(socket, req, res);
+	}
+}
+
+METHOD(radius_client_t, request, radius_message_t*,
+	private_radius_client_t *this, radius_message_t *req)
+{
+	radius_socket_t *socket;
+	radius_message_t *res;
 
+	socket = prepare(this, req);
 	res = socket->request(socket, req);
 	if (res)
 	{
-		DBG1(DBG_CFG, "received RADIUS %N from server '%s'",
-			 radius_message_code_names, res->get_code(res),
-			 this->config->get_name(this->config));
-		data = res->get_encoding(res);
-		DBG3(DBG_CFG, "%B", &data);
-
-		save_state(this, res);
-		if (res->get_code(res) == RMC_ACCESS_ACCEPT)
-		{
-			chunk_clear(&this->msk);
-			this->msk = socket->decrypt_msk(socket, req, res);
-		}
+		process_response(this, socket, req, res);
 		this->config->put_socket(this->config, socket, TRUE);
 		return res;
 	}
@@ -122,6 +161,72 @@ METHOD(radius_client_t, request, radius_message_t*,
 	return NULL;
 }
 
+/**
+ * Context for an asynchronous request
+ */
+typedef struct {
+	/** client the request has been sent by, holds a reference */
+	private_radius_client_t *client;
+	/** socket the request has been sent over */
+	radius_socket_t *socket;
+	/** user callback */
+	radius_callback_t cb;
+	/** user data */
+	void *data;
+} async_t;
+
+/**
+ * Callback for asynchronous requests
+ */
+static void async_cb(async_t *async, radius_message_t *req,
+					 radius_message_t *res)
+{
+	private_radius_client_t *this = async->client;
+
+	if (res)
+	{
+		process_response(this, async->socket, req, res);
+	}
+	this->config->put_socket(this->config, async->socket, res != NULL);
+	if (async->cb)
+	{
+		async->cb(async->data, req, res);
+	}
+	this->public.destroy(&this->public);
+	free(async);
+}
+
+METHOD(radius_client_t, request_async, bool,
+	private_radius_client_t *this, radius_message_t *req,
+	radius_callback_t cb, void *data)
+{
+	async_t *async;
+
+	ref_get(&this->ref);
+	INIT(async,
+		.client = this,
+		.socket = prepare(this, req),
+		.cb = cb,
+		.data = data,
+	);
+	if (!async->socket->request_async(async->socket, req,
+									  (radius_callback_t)async_cb, async))
+	{
+		this->config->put_socket(this->config, async->socket, FALSE);
+		this->public.destroy(&this->public);
+		free(async);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+METHOD(radius_client_t, pin_socket, void,
+	private_radius_client_t *this, u_int key)
+{
+	this->pin = key;
+	this->pinned = TRUE;
+}
+
 METHOD(radius_client_t, get_msk, chunk_t,
 	private_radius_client_t *this)
 {
@@ -131,10 +236,13 @@ METHOD(radius_client_t, get_msk, chunk_t,
 METHOD(radius_client_t, destroy, void,
 	private_radius_client_t *this)
 {
-	this->config->destroy(this->config);
-	chunk_clear(&this->msk);
-	free(this->state.ptr);
-	free(this);
+	if (ref_put(&this->ref))
+	{
+		this->config->destroy(this->config);
+		chunk_clear(&this->msk);
+		free(this->state.ptr);
+		free(this);
+	}
 }
 
 /**
@@ -147,10 +255,13 @@ radius_client_t *radius_client_create(radius_config_t *config)
 	INIT(this,
 		.public = {
 			.request = _request,
+			.request_async = _request_async,
+			.pin_socket = _pin_socket,
 			.get_msk = _get_msk,
 			.destroy = _destroy,
 		},
 		.config = config,
+		.ref = 1,
 	);
 
 	return &this->public;
@@ -44,6 +44,33 @@ struct radius_client_t {
 	 */
 	radius_message_t* (*request)(radius_client_t *this, radius_message_t *msg);
 
+	/**
+	 * Send a RADIUS request, invoke a callback for the response.
+	 *
+	 * As with request(), the State attribute and the MSK of the client get
+	 * updated from the response, before the callback is invoked. The client
+	 * may be destroyed before that, but should not be used concurrently
+	 * while the request is outstanding.
+	 *
+	 * @param msg			RADIUS request message to send, gets owned
+	 * @param cb			callback to invoke with the response, or NULL
+	 * @param data			data to pass to callback
+	 * @return				TRUE if request sent or queued
+	 */
+	bool (*request_async)(radius_client_t *this, radius_message_t *msg,
+						  radius_callback_t cb, void *data);
+
+	/**
+	 * Send further requests over the socket selected by a key.
+	 *
+	 * By default, each request is sent over the least loaded socket of the
+	 * server, and requests might overtake each other. Requests sent over
+	 * the same socket keep their order.
+	 *
+	 * @param key			key selecting the socket, e.g. a session identifier
+	 */
+	void (*pin_socket)(radius_client_t *this, u_int key);
+
 	/**
 	 * Get the EAP MSK after successful RADIUS authentication.
 	 *
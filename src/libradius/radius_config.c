@@ -15,8 +15,6 @@
 
 #include "radius_config.h"
 
-#include <threading/mutex.h>
-#include <threading/condvar.h>
 #include <collections/linked_list.h>
 
 typedef struct private_radius_config_t private_radius_config_t;
@@ -32,25 +30,15 @@ struct private_radius_config_t {
 	radius_config_t public;
 
 	/**
-	 * list of radius sockets, as radius_socket_t
+	 * list of radius sockets, as radius_socket_t, never modified after create
 	 */
 	linked_list_t *sockets;
 
 	/**
-	 * Total number of sockets, in list + currently in use
+	 * Total number of sockets
 	 */
 	int socket_count;
 
-	/**
-	 * mutex to lock sockets list
-	 */
-	mutex_t *mutex;
-
-	/**
-	 * condvar to wait for sockets
-	 */
-	condvar_t *condvar;
-
 	/**
 	 * Server name
 	 */
@@ -82,27 +70,72 @@ struct private_radius_config_t {
 	refcount_t ref;
 };
 
+/**
+ * Get the total number of outstanding requests on all sockets
+ */
+static u_int get_load(private_radius_config_t *this)
+{
+	enumerator_t *enumerator;
+	radius_socket_t *skt;
+	u_int load = 0;
+
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &skt))
+	{
+		load += skt->get_load(skt);
+	}
+	enumerator->destroy(enumerator);
+	return load;
+}
+
 METHOD(radius_config_t, get_socket, radius_socket_t*,
 	private_radius_config_t *this)
 {
-	radius_socket_t *skt;
+	enumerator_t *enumerator;
+	radius_socket_t *current, *skt = NULL;
+	u_int load, best = 0;
+
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		load = current->get_load(current);
+		if (!skt || load < best)
+		{
+			skt = current;
+			best = load;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return skt;
+}
+
+METHOD(radius_config_t, get_pinned_socket, radius_socket_t*,
+	private_radius_config_t *this, u_int key)
+{
+	enumerator_t *enumerator;
+	radius_socket_t *current, *skt = NULL;
+	u_int i = 0;
 
-	this->mutex->lock(this->mutex);
-	while (this->sockets->remove_first(this->sockets, (void**)&skt) != SUCCESS)
+	if (this->socket_count)
 	{
-		this->condvar->wait(this->condvar, this->mutex);
+		key %= this->socket_count;
+	}
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (i++ == key)
+		{
+			skt = current;
+			break;
+		}
 	}
-	this->mutex->unlock(this->mutex);
+	enumerator->destroy(enumerator);
 	return skt;
 }
 
 METHOD(radius_config_t, put_socket, void,
 	private_radius_config_t *this, radius_socket_t *skt, bool result)
 {
-	this->mutex->lock(this->mutex);
-	this->sockets->insert_last(this->sockets, skt);
-	this->mutex->unlock(this->mutex);
-	this->condvar->signal(this->condvar);
 	this->reachable = result;
 }
 
@@ -115,6 +148,7 @@ METHOD(radius_config_t, get_nas_identifier, chunk_t,
 METHOD(radius_config_t, get_preference, int,
 	private_radius_config_t *this)
 {
+	u_int capacity, load;
 	int pref;
 
 	if (this->socket_count == 0)
@@ -122,8 +156,10 @@ METHOD(radius_config_t, get_preference, int,
 		return -1;
 	}
 	/* calculate preference between 0-100 + boost */
+	capacity = this->socket_count * RADIUS_MAX_OUTSTANDING;
+	load = min(get_load(this), capacity);
 	pref = this->preference;
-	pref += this->sockets->get_count(this->sockets) * 100 / this->socket_count;
+	pref += (capacity - load) * 100 / capacity;
 	if (this->reachable)
 	{	/* reachable server get a boost: pref = 110-210 + boost */
 		return pref + 110;
@@ -166,8 +202,6 @@ METHOD(radius_config_t, destroy, void,
 {
 	if (ref_put(&this->ref))
 	{
-		this->mutex->destroy(this->mutex);
-		this->condvar->destroy(this->condvar);
 		this->sockets->destroy_offset(this->sockets,
 									  offsetof(radius_socket_t, destroy));
 		free(this);
@@ -188,6 +222,7 @@ radius_config_t *radius_config_create(char *name, char *address,
 	INIT(this,
 		.public = {
 			.get_socket = _get_socket,
+			.get_pinned_socket = _get_pinned_socket,
 			.put_socket = _put_socket,
 			.get_nas_identifier = _get_nas_identifier,
 			.get_preference = _get_preference,
@@ -199,8 +234,6 @@ radius_config_t *radius_config_create(char *name, char *address,
 		.nas_identifier = chunk_create(nas_identifier, strlen(nas_identifier)),
 		.socket_count = sockets,
 		.sockets = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
-		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.name = name,
 		.preference = preference,
 		.ref = 1,
@@ -31,14 +31,28 @@ typedef struct radius_config_t radius_config_t;
 struct radius_config_t {
 
 	/**
-	 * Get a RADIUS socket from the pool to communicate with this config.
+	 * Get the least loaded RADIUS socket to communicate with this config.
+	 *
+	 * Sockets multiplex requests, so this call does not block and the socket
+	 * may be used by other threads concurrently.
 	 *
 	 * @return			RADIUS socket
 	 */
 	radius_socket_t* (*get_socket)(radius_config_t *this);
 
 	/**
-	 * Release a socket to the pool after use.
+	 * Get the RADIUS socket selected by a key, regardless of its load.
+	 *
+	 * Requests sent over the same socket keep their order, this allows to
+	 * send related requests, e.g. accounting messages of a session, in order.
+	 *
+	 * @param key		key selecting the socket, e.g. a session identifier
+	 * @return			RADIUS socket
+	 */
+	radius_socket_t* (*get_pinned_socket)(radius_config_t *this, u_int key);
+
+	/**
+	 * Release a socket after use, updating the server reachability.
 	 *
 	 * @param skt		RADIUS socket to release
 	 * @param result	result of the socket use, TRUE for success
@@ -55,7 +69,7 @@ struct radius_config_t {
 	/**
 	 * Get the preference of this server.
 	 *
-	 * Based on the available sockets and the server reachability a preference
+	 * Based on the outstanding requests and the server reachability a preference
 	 * value is calculated: better servers return a higher value.
 	 */
 	int (*get_preference)(radius_config_t *this);
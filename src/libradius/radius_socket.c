@@ -18,51 +18,129 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <pen/pen.h>
 #include <utils/debug.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <threading/thread.h>
+#include <collections/linked_list.h>
+#include <processing/jobs/callback_job.h>
+
+/**
+ * Number of times a request is sent, with timeouts of 2, 3, 4 and 5 seconds
+ */
+#define RADIUS_TRIES 4
 
 typedef struct private_radius_socket_t private_radius_socket_t;
+typedef struct channel_t channel_t;
+typedef struct request_t request_t;
+typedef struct receiver_t receiver_t;
 
 /**
- * Private data of an radius_socket_t object.
+ * A connected UDP socket to a port of the server
  */
-struct private_radius_socket_t {
+struct channel_t {
 
 	/**
-	 * Public radius_socket_t interface.
+	 * Server port
 	 */
-	radius_socket_t public;
+	u_int16_t port;
 
 	/**
-	 * Server port for authentication
+	 * socket file descriptor
 	 */
-	u_int16_t auth_port;
+	int fd;
 
 	/**
-	 * socket file descriptor for authentication
+	 * next RADIUS identifier to try
 	 */
-	int auth_fd;
+	u_int8_t identifier;
 
 	/**
-	 * Server port for accounting
+	 * outstanding requests, indexed by identifier
 	 */
-	u_int16_t acct_port;
+	request_t *pending[RADIUS_MAX_OUTSTANDING];
 
 	/**
-	 * socket file descriptor for accounting
+	 * number of outstanding requests
 	 */
-	int acct_fd;
+	u_int count;
 
 	/**
-	 * Server address
+	 * requests waiting for a free identifier, as request_t
 	 */
-	char *address;
+	linked_list_t *queue;
+};
+
+/**
+ * A request in progress
+ */
+struct request_t {
 
 	/**
-	 * current RADIUS identifier
+	 * request message
 	 */
-	u_int8_t identifier;
+	radius_message_t *message;
+
+	/**
+	 * received response, if any
+	 */
+	radius_message_t *response;
+
+	/**
+	 * callback for asynchronous requests, NULL for synchronous requests
+	 */
+	radius_callback_t cb;
+
+	/**
+	 * user data to pass to callback
+	 */
+	void *data;
+
+	/**
+	 * number of times the request has been sent
+	 */
+	int tries;
+
+	/**
+	 * time to retransmit or give up
+	 */
+	timeval_t timeout;
+
+	/**
+	 * synchronous request completed
+	 */
+	bool done;
+};
+
+/**
+ * Private data of an radius_socket_t object.
+ */
+struct private_radius_socket_t {
+
+	/**
+	 * Public radius_socket_t interface.
+	 */
+	radius_socket_t public;
+
+	/**
+	 * Channel for authentication
+	 */
+	channel_t auth;
+
+	/**
+	 * Channel for accounting
+	 */
+	channel_t acct;
+
+	/**
+	 * Server address
+	 */
+	char *address;
 
 	/**
 	 * hasher to use for response verification
@@ -83,148 +161,795 @@ struct private_radius_socket_t {
 	 * RADIUS secret
 	 */
 	chunk_t secret;
+
+	/**
+	 * earliest timeout of all outstanding requests
+	 */
+	timeval_t next_timeout;
+
+	/**
+	 * receiver the socket is registered with
+	 */
+	receiver_t *receiver;
+
+	/**
+	 * no more requests accepted, socket gets destroyed or receiver stopped
+	 */
+	bool stopping;
+
+	/**
+	 * number of threads waiting for synchronous requests
+	 */
+	u_int waiters;
+
+	/**
+	 * mutex to lock channels, requests and crypto primitives
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * condvar to signal completed synchronous requests
+	 */
+	condvar_t *condvar;
 };
 
 /**
- * Check or establish RADIUS connection
+ * Job receiving responses and handling timeouts for all sockets
  */
-static bool check_connection(private_radius_socket_t *this,
-							 int *fd, u_int16_t port)
+struct receiver_t {
+
+	/**
+	 * registered sockets, as private_radius_socket_t
+	 */
+	linked_list_t *sockets;
+
+	/**
+	 * incremented whenever a socket gets unregistered
+	 */
+	u_int generation;
+
+	/**
+	 * pipe to wake up the receiving job
+	 */
+	int notify[2];
+
+	/**
+	 * is the receiving job queued or running?
+	 */
+	bool running;
+
+	/**
+	 * stop the receiving job
+	 */
+	bool stopping;
+
+	/**
+	 * last socket got unregistered by a callback, the job frees the receiver
+	 */
+	bool detached;
+
+	/**
+	 * thread executing the receiving job
+	 */
+	thread_t *thread;
+
+	/**
+	 * mutex to lock the fields above, acquired before socket mutexes
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * condvar to signal the stopped job
+	 */
+	condvar_t *condvar;
+};
+
+/**
+ * Receiver shared by all sockets, NULL if no socket exists
+ */
+static receiver_t *receiver = NULL;
+
+/**
+ * Lock to create and release the shared receiver
+ */
+static pthread_mutex_t receiver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Wake up the receiving job
+ */
+static void notify(receiver_t *this)
+{
+	char c = 0;
+
+	ignore_result(write(this->notify[1], &c, 1));
+}
+
+/**
+ * Check or establish RADIUS connection, requires the lock
+ */
+static bool check_connection(private_radius_socket_t *this, channel_t *channel)
 {
-	if (*fd == -1)
+	if (channel->fd == -1)
 	{
+		int size = RADIUS_MAX_OUTSTANDING * 1024;
 		host_t *server;
 
-		server = host_create_from_dns(this->address, AF_UNSPEC, port);
+		server = host_create_from_dns(this->address, AF_UNSPEC, channel->port);
 		if (!server)
 		{
 			DBG1(DBG_CFG, "resolving RADIUS server address '%s' failed",
 				 this->address);
 			return FALSE;
 		}
-		*fd = socket(server->get_family(server), SOCK_DGRAM, IPPROTO_UDP);
-		if (*fd == -1)
+		channel->fd = socket(server->get_family(server), SOCK_DGRAM,
+							 IPPROTO_UDP);
+		if (channel->fd == -1)
 		{
 			DBG1(DBG_CFG, "opening RADIUS socket for %#H failed: %s",
 				 server, strerror(errno));
 			server->destroy(server);
 			return FALSE;
 		}
-		if (connect(*fd, server->get_sockaddr(server),
+		if (connect(channel->fd, server->get_sockaddr(server),
 					*server->get_sockaddr_len(server)) < 0)
 		{
 			DBG1(DBG_CFG, "connecting RADIUS socket to %#H failed: %s",
 				 server, strerror(errno));
 			server->destroy(server);
-			close(*fd);
-			*fd = -1;
+			close(channel->fd);
+			channel->fd = -1;
 			return FALSE;
 		}
 		server->destroy(server);
+		/* responses to all outstanding requests may arrive in a burst */
+		setsockopt(channel->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		/* let the receiving job poll the new socket */
+		notify(this->receiver);
 	}
 	return TRUE;
 }
 
-METHOD(radius_socket_t, request, radius_message_t*,
-	private_radius_socket_t *this, radius_message_t *request)
+/**
+ * Destroy a request and the messages it owns
+ */
+static void request_destroy(request_t *request)
 {
-	chunk_t data;
-	int i, *fd;
-	u_int16_t port;
-	rng_t *rng = NULL;
+	request->message->destroy(request->message);
+	DESTROY_IF(request->response);
+	free(request);
+}
 
-	if (request->get_code(request) == RMC_ACCOUNTING_REQUEST)
+/**
+ * Complete a request with a response, or NULL on failure, requires the lock.
+ * Asynchronous requests get added to a list to invoke the callback later,
+ * without holding the lock.
+ */
+static void complete(private_radius_socket_t *this, request_t *request,
+					 radius_message_t *response, linked_list_t *completed)
+{
+	request->response = response;
+	if (request->cb)
 	{
-		fd = &this->acct_fd;
-		port = this->acct_port;
+		completed->insert_last(completed, request);
 	}
 	else
 	{
-		fd = &this->auth_fd;
-		port = this->auth_port;
-		rng = this->rng;
+		request->done = TRUE;
+		this->condvar->broadcast(this->condvar);
 	}
+}
 
+/**
+ * Invoke the callbacks of completed asynchronous requests, destroy them
+ */
+static void invoke_completed(linked_list_t *completed)
+{
+	request_t *request;
+
+	while (completed->remove_first(completed, (void**)&request) == SUCCESS)
+	{
+		request->cb(request->data, request->message, request->response);
+		request_destroy(request);
+	}
+	completed->destroy(completed);
+}
+
+/**
+ * Allocate an identifier, sign and send a request, requires the lock.
+ * Returns OUT_OF_RES if no identifier is available.
+ */
+static status_t send_request(private_radius_socket_t *this, channel_t *channel,
+							 request_t *request)
+{
+	radius_message_t *message = request->message;
+	rng_t *rng = NULL;
+	chunk_t data;
+	int i;
+
+	if (channel->count >= RADIUS_MAX_OUTSTANDING)
+	{
+		return OUT_OF_RES;
+	}
+	for (i = 0; i < RADIUS_MAX_OUTSTANDING; i++)
+	{
+		if (!channel->pending[channel->identifier])
+		{
+			break;
+		}
+		channel->identifier++;
+	}
+	if (!check_connection(this, channel))
+	{
+		return FAILED;
+	}
+	if (message->get_code(message) != RMC_ACCOUNTING_REQUEST)
+	{
+		rng = this->rng;
+	}
 	/* set Message Identifier */
-	request->set_identifier(request, this->identifier++);
+	message->set_identifier(message, channel->identifier++);
 	/* sign the request */
-	if (!request->sign(request, NULL, this->secret, this->hasher, this->signer,
+	if (!message->sign(message, NULL, this->secret, this->hasher, this->signer,
 					   rng, rng != NULL))
 	{
-		return NULL;
+		return FAILED;
+	}
+	data = message->get_encoding(message);
+	DBG3(DBG_CFG, "%B", &data);
+	if (send(channel->fd, data.ptr, data.len, 0) != data.len)
+	{
+		DBG1(DBG_CFG, "sending RADIUS message failed: %s", strerror(errno));
+		return FAILED;
 	}
+	channel->pending[message->get_identifier(message)] = request;
+	channel->count++;
 
-	if (!check_connection(this, fd, port))
+	request->tries = 1;
+	time_monotonic(&request->timeout);
+	request->timeout.tv_sec += request->tries + 1;
+	if (!timerisset(&this->next_timeout) ||
+		timercmp(&request->timeout, &this->next_timeout, <))
 	{
-		return NULL;
+		this->next_timeout = request->timeout;
+		notify(this->receiver);
 	}
+	return SUCCESS;
+}
 
-	data = request->get_encoding(request);
-	DBG3(DBG_CFG, "%B", &data);
+/**
+ * Send queued requests while identifiers are available, requires the lock
+ */
+static void send_queued(private_radius_socket_t *this, channel_t *channel,
+						linked_list_t *completed)
+{
+	request_t *request;
 
-	/* timeout after 2, 3, 4, 5 seconds */
-	for (i = 2; i <= 5; i++)
+	while (channel->queue->get_first(channel->queue,
+									 (void**)&request) == SUCCESS)
 	{
-		radius_message_t *response;
-		bool retransmit = FALSE;
-		struct timeval tv;
-		char buf[4096];
-		fd_set fds;
-		int res;
+		switch (send_request(this, channel, request))
+		{
+			case OUT_OF_RES:
+				return;
+			case SUCCESS:
+				break;
+			default:
+				complete(this, request, NULL, completed);
+				break;
+		}
+		channel->queue->remove_first(channel->queue, (void**)&request);
+	}
+}
+
+/**
+ * Send a new request or queue it, requires the lock
+ */
+static bool submit(private_radius_socket_t *this, request_t *request)
+{
+	channel_t *channel = &this->auth;
 
-		if (send(*fd, data.ptr, data.len, 0) != data.len)
+	if (this->stopping)
+	{
+		return FALSE;
+	}
+	if (request->message->get_code(request->message) == RMC_ACCOUNTING_REQUEST)
+	{
+		channel = &this->acct;
+	}
+	if (channel->queue->get_count(channel->queue))
+	{	/* keep the order of queued requests */
+		channel->queue->insert_last(channel->queue, request);
+		return TRUE;
+	}
+	switch (send_request(this, channel, request))
+	{
+		case SUCCESS:
+			return TRUE;
+		case OUT_OF_RES:
+			channel->queue->insert_last(channel->queue, request);
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Receive and dispatch a response on a channel
+ */
+static void receive_response(private_radius_socket_t *this, channel_t *channel,
+							 linked_list_t *completed)
+{
+	radius_message_t *response;
+	request_t *request;
+	char buf[4096];
+	int len;
+
+	len = recv(channel->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (len <= 0)
+	{
+		if (errno != EAGAIN && errno != EINTR)
 		{
-			DBG1(DBG_CFG, "sending RADIUS message failed: %s", strerror(errno));
-			return NULL;
+			DBG1(DBG_CFG, "receiving RADIUS message failed: %s",
+				 strerror(errno));
+		}
+		return;
+	}
+	response = radius_message_parse(chunk_create(buf, len));
+	if (response)
+	{
+		request = channel->pending[response->get_identifier(response)];
+		if (request && response->verify(response,
+							request->message->get_authenticator(request->message),
+							this->secret, this->hasher, this->signer))
+		{
+			channel->pending[response->get_identifier(response)] = NULL;
+			channel->count--;
+			complete(this, request, response, completed);
+			send_queued(this, channel, completed);
+			return;
 		}
-		tv.tv_sec = i;
-		tv.tv_usec = 0;
+		response->destroy(response);
+	}
+	DBG1(DBG_CFG, "received invalid RADIUS message, ignored");
+}
+
+/**
+ * Retransmit or fail timed out requests of a channel, requires the lock
+ */
+static void check_timeouts(private_radius_socket_t *this, channel_t *channel,
+						   timeval_t *now, linked_list_t *completed)
+{
+	request_t *request;
+	chunk_t data;
+	int i;
 
-		while (TRUE)
+	for (i = 0; i < RADIUS_MAX_OUTSTANDING && channel->count; i++)
+	{
+		request = channel->pending[i];
+		if (!request)
 		{
-			FD_ZERO(&fds);
-			FD_SET(*fd, &fds);
-			res = select((*fd) + 1, &fds, NULL, NULL, &tv);
-			/* TODO: updated tv to time not waited. Linux does this for us. */
-			if (res < 0)
-			{	/* failed */
-				DBG1(DBG_CFG, "waiting for RADIUS message failed: %s",
-					 strerror(errno));
-				break;
-			}
-			if (res == 0)
-			{	/* timeout */
+			continue;
+		}
+		if (timercmp(&request->timeout, now, <=))
+		{
+			if (request->tries < RADIUS_TRIES)
+			{
 				DBG1(DBG_CFG, "retransmitting RADIUS message");
-				retransmit = TRUE;
-				break;
+				data = request->message->get_encoding(request->message);
+				if (send(channel->fd, data.ptr, data.len, 0) == data.len)
+				{
+					request->tries++;
+					request->timeout = *now;
+					request->timeout.tv_sec += request->tries + 1;
+				}
+				else
+				{
+					DBG1(DBG_CFG, "sending RADIUS message failed: %s",
+						 strerror(errno));
+					request->tries = RADIUS_TRIES;
+				}
 			}
-			res = recv(*fd, buf, sizeof(buf), MSG_DONTWAIT);
-			if (res <= 0)
+			else
 			{
-				DBG1(DBG_CFG, "receiving RADIUS message failed: %s",
-					 strerror(errno));
-				break;
+				DBG1(DBG_CFG, "RADIUS server is not responding");
+				channel->pending[i] = NULL;
+				channel->count--;
+				complete(this, request, NULL, completed);
+				continue;
 			}
-			response = radius_message_parse(chunk_create(buf, res));
-			if (response)
+		}
+		if (!timerisset(&this->next_timeout) ||
+			timercmp(&request->timeout, &this->next_timeout, <))
+		{
+			this->next_timeout = request->timeout;
+		}
+	}
+	send_queued(this, channel, completed);
+}
+
+/**
+ * Fail all outstanding requests of a channel, requires the lock
+ */
+static void fail_requests(private_radius_socket_t *this, channel_t *channel,
+						  linked_list_t *completed)
+{
+	request_t *request;
+	int i;
+
+	while (channel->queue->remove_first(channel->queue,
+										(void**)&request) == SUCCESS)
+	{
+		complete(this, request, NULL, completed);
+	}
+	for (i = 0; i < RADIUS_MAX_OUTSTANDING; i++)
+	{
+		request = channel->pending[i];
+		if (request)
+		{
+			channel->pending[i] = NULL;
+			complete(this, request, NULL, completed);
+		}
+	}
+	channel->count = 0;
+}
+
+/**
+ * Receive responses and handle timeouts for the requests of all sockets
+ */
+static job_requeue_t receive_responses(receiver_t *this)
+{
+	private_radius_socket_t *socket;
+	enumerator_t *enumerator;
+	linked_list_t *completed;
+	struct pollfd *pfd;
+	timeval_t now, next;
+	u_int generation;
+	int count = 1, timeout = -1, i;
+	char buf[64];
+
+	this->mutex->lock(this->mutex);
+	this->thread = thread_current();
+	if (this->stopping)
+	{
+		this->mutex->unlock(this->mutex);
+		return JOB_REQUEUE_NONE;
+	}
+	generation = this->generation;
+	pfd = calloc(1 + 2 * this->sockets->get_count(this->sockets),
+				 sizeof(struct pollfd));
+	pfd[0].fd = this->notify[0];
+	pfd[0].events = POLLIN;
+	timerclear(&next);
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &socket))
+	{
+		socket->mutex->lock(socket->mutex);
+		pfd[count].fd = socket->auth.fd;
+		pfd[count++].events = POLLIN;
+		pfd[count].fd = socket->acct.fd;
+		pfd[count++].events = POLLIN;
+		if (timerisset(&socket->next_timeout) && (!timerisset(&next) ||
+			timercmp(&socket->next_timeout, &next, <)))
+		{
+			next = socket->next_timeout;
+		}
+		socket->mutex->unlock(socket->mutex);
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+
+	if (timerisset(&next))
+	{
+		time_monotonic(&now);
+		if (timercmp(&next, &now, >))
+		{
+			timersub(&next, &now, &now);
+			timeout = now.tv_sec * 1000 + now.tv_usec / 1000 + 1;
+		}
+		else
+		{
+			timeout = 0;
+		}
+	}
+	if (poll(pfd, count, timeout) < 0)
+	{
+		free(pfd);
+		if (errno != EINTR)
+		{
+			DBG1(DBG_CFG, "waiting for RADIUS messages failed: %s",
+				 strerror(errno));
+			sleep(1);
+		}
+		return JOB_REQUEUE_DIRECT;
+	}
+	if (pfd[0].revents & POLLIN)
+	{
+		while (read(this->notify[0], buf, sizeof(buf)) == sizeof(buf))
+		{
+			/* drain the pipe */
+		}
+	}
+
+	completed = linked_list_create();
+	time_monotonic(&now);
+	this->mutex->lock(this->mutex);
+	i = 1;
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &socket))
+	{
+		socket->mutex->lock(socket->mutex);
+		/* new sockets get appended, the polled ones are at the same position
+		 * unless a socket got unregistered since polling */
+		if (generation == this->generation && i < count)
+		{
+			if (pfd[i].revents & POLLIN)
 			{
-				if (response->verify(response,
-							request->get_authenticator(request), this->secret,
-							this->hasher, this->signer))
-				{
-					return response;
-				}
-				response->destroy(response);
+				receive_response(socket, &socket->auth, completed);
+			}
+			if (pfd[i + 1].revents & POLLIN)
+			{
+				receive_response(socket, &socket->acct, completed);
 			}
-			DBG1(DBG_CFG, "received invalid RADIUS message, ignored");
+			i += 2;
 		}
-		if (!retransmit)
+		if (timerisset(&socket->next_timeout) &&
+			timercmp(&socket->next_timeout, &now, <=))
 		{
-			break;
+			timerclear(&socket->next_timeout);
+			check_timeouts(socket, &socket->auth, &now, completed);
+			check_timeouts(socket, &socket->acct, &now, completed);
+		}
+		socket->mutex->unlock(socket->mutex);
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+	free(pfd);
+
+	/* callbacks might destroy sockets, or the last one, which lets this job
+	 * terminate and free the receiver */
+	invoke_completed(completed);
+	return JOB_REQUEUE_DIRECT;
+}
+
+/**
+ * Stop the receiving job
+ */
+static bool cancel_receiving(receiver_t *this)
+{
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	notify(this);
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
+/**
+ * Release all resources of the receiver
+ */
+static void receiver_destroy(receiver_t *this)
+{
+	if (this->notify[0] != -1)
+	{
+		close(this->notify[0]);
+		close(this->notify[1]);
+	}
+	this->sockets->destroy(this->sockets);
+	this->mutex->destroy(this->mutex);
+	this->condvar->destroy(this->condvar);
+	free(this);
+}
+
+/**
+ * Receiving job terminated or got destroyed without being executed, fails
+ * the requests of all registered sockets
+ */
+static void receiving_stopped(receiver_t *this)
+{
+	private_radius_socket_t *socket;
+	enumerator_t *enumerator;
+	linked_list_t *completed;
+	bool detached;
+
+	completed = linked_list_create();
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &socket))
+	{
+		socket->mutex->lock(socket->mutex);
+		socket->stopping = TRUE;
+		fail_requests(socket, &socket->auth, completed);
+		fail_requests(socket, &socket->acct, completed);
+		socket->mutex->unlock(socket->mutex);
+	}
+	enumerator->destroy(enumerator);
+	detached = this->detached;
+	this->running = FALSE;
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+
+	/* the receiver might get freed once running is reset, don't touch it */
+	invoke_completed(completed);
+	if (detached)
+	{
+		receiver_destroy(this);
+	}
+}
+
+/**
+ * Register a socket with the shared receiver, created if necessary
+ */
+static receiver_t *receiver_register(private_radius_socket_t *socket)
+{
+	receiver_t *this;
+
+	pthread_mutex_lock(&receiver_lock);
+	this = receiver;
+	if (!this)
+	{
+		INIT(this,
+			.sockets = linked_list_create(),
+			.notify = { -1, -1 },
+			.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+			.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		);
+		if (pipe(this->notify) != 0)
+		{
+			DBG1(DBG_CFG, "creating RADIUS notification pipe failed: %s",
+				 strerror(errno));
+			this->notify[0] = this->notify[1] = -1;
+			receiver_destroy(this);
+			pthread_mutex_unlock(&receiver_lock);
+			return NULL;
 		}
+		fcntl(this->notify[0], F_SETFL, O_NONBLOCK);
+		fcntl(this->notify[1], F_SETFL, O_NONBLOCK);
+		this->running = TRUE;
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+					(callback_job_cb_t)receive_responses, this,
+					(callback_job_cleanup_t)receiving_stopped,
+					(callback_job_cancel_t)cancel_receiving, JOB_PRIO_CRITICAL));
+		receiver = this;
 	}
-	DBG1(DBG_CFG, "RADIUS server is not responding");
-	return NULL;
+	this->mutex->lock(this->mutex);
+	this->sockets->insert_last(this->sockets, socket);
+	if (this->stopping)
+	{	/* the processor got canceled, we won't receive anything */
+		socket->stopping = TRUE;
+	}
+	this->mutex->unlock(this->mutex);
+	pthread_mutex_unlock(&receiver_lock);
+	return this;
+}
+
+/**
+ * Unregister a socket from the receiver, stop and free it if it was the last
+ */
+static void receiver_unregister(private_radius_socket_t *socket)
+{
+	receiver_t *this = socket->receiver;
+	bool last;
+
+	pthread_mutex_lock(&receiver_lock);
+	this->mutex->lock(this->mutex);
+	this->sockets->remove(this->sockets, socket, NULL);
+	this->generation++;
+	last = this->sockets->get_count(this->sockets) == 0;
+	if (last)
+	{
+		receiver = NULL;
+	}
+	pthread_mutex_unlock(&receiver_lock);
+	if (!last)
+	{
+		this->mutex->unlock(this->mutex);
+		return;
+	}
+	if (this->running)
+	{
+		this->stopping = TRUE;
+		notify(this);
+		if (this->thread == thread_current())
+		{	/* called from a callback, the job frees us when terminating */
+			this->detached = TRUE;
+			this->mutex->unlock(this->mutex);
+			return;
+		}
+		while (this->running)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+	receiver_destroy(this);
+}
+
+/**
+ * Close a channel
+ */
+static void channel_destroy(channel_t *channel)
+{
+	channel->queue->destroy(channel->queue);
+	if (channel->fd != -1)
+	{
+		close(channel->fd);
+	}
+}
+
+/**
+ * Release all resources of the socket
+ */
+static void destroy_socket(private_radius_socket_t *this)
+{
+	channel_destroy(&this->auth);
+	channel_destroy(&this->acct);
+	DESTROY_IF(this->hasher);
+	DESTROY_IF(this->signer);
+	DESTROY_IF(this->rng);
+	this->mutex->destroy(this->mutex);
+	this->condvar->destroy(this->condvar);
+	free(this);
+}
+
+METHOD(radius_socket_t, request, radius_message_t*,
+	private_radius_socket_t *this, radius_message_t *message)
+{
+	radius_message_t *response = NULL;
+	request_t *request;
+
+	INIT(request,
+		.message = message,
+	);
+	this->mutex->lock(this->mutex);
+	if (submit(this, request))
+	{
+		this->waiters++;
+		while (!request->done)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+		this->waiters--;
+		this->condvar->broadcast(this->condvar);
+		response = request->response;
+	}
+	this->mutex->unlock(this->mutex);
+	free(request);
+	return response;
+}
+
+METHOD(radius_socket_t, request_async, bool,
+	private_radius_socket_t *this, radius_message_t *message,
+	radius_callback_t cb, void *data)
+{
+	request_t *request;
+	bool success;
+
+	INIT(request,
+		.message = message,
+		.cb = cb,
+		.data = data,
+	);
+	this->mutex->lock(this->mutex);
+	success = submit(this, request);
+	this->mutex->unlock(this->mutex);
+	if (!success)
+	{
+		request_destroy(request);
+	}
+	return success;
+}
+
+METHOD(radius_socket_t, get_load, u_int,
+	private_radius_socket_t *this)
+{
+	u_int load;
+
+	this->mutex->lock(this->mutex);
+	load = this->auth.count + this->auth.queue->get_count(this->auth.queue) +
+		   this->acct.count + this->acct.queue->get_count(this->acct.queue);
+	this->mutex->unlock(this->mutex);
+	return load;
 }
 
 /**
@@ -292,6 +1017,7 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 	chunk_t data, send = chunk_empty, recv = chunk_empty;
 	int type;
 
+	this->mutex->lock(this->mutex);
 	enumerator = response->create_enumerator(response);
 	while (enumerator->enumerate(enumerator, &type, &data))
 	{
@@ -314,6 +1040,7 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 		}
 	}
 	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
 	if (send.ptr && recv.ptr)
 	{
 		return chunk_cat("mm", recv, send);
@@ -326,18 +1053,23 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 METHOD(radius_socket_t, destroy, void,
 	private_radius_socket_t *this)
 {
-	DESTROY_IF(this->hasher);
-	DESTROY_IF(this->signer);
-	DESTROY_IF(this->rng);
-	if (this->auth_fd != -1)
-	{
-		close(this->auth_fd);
-	};
-	if (this->acct_fd != -1)
+	linked_list_t *completed;
+
+	/* once unregistered, the receiving job does not touch the socket */
+	receiver_unregister(this);
+
+	completed = linked_list_create();
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	fail_requests(this, &this->auth, completed);
+	fail_requests(this, &this->acct, completed);
+	while (this->waiters)
 	{
-		close(this->acct_fd);
+		this->condvar->wait(this->condvar, this->mutex);
 	}
-	free(this);
+	this->mutex->unlock(this->mutex);
+	invoke_completed(completed);
+	destroy_socket(this);
 }
 
 /**
@@ -351,29 +1083,46 @@ radius_socket_t *radius_socket_create(char *address, u_int16_t auth_port,
 	INIT(this,
 		.public = {
 			.request = _request,
+			.request_async = _request_async,
+			.get_load = _get_load,
 			.decrypt_msk = _decrypt_msk,
 			.destroy = _destroy,
 		},
 		.address = address,
-		.auth_port = auth_port,
-		.auth_fd = -1,
-		.acct_port = acct_port,
-		.acct_fd = -1,
+		.auth = {
+			.port = auth_port,
+			.fd = -1,
+			.queue = linked_list_create(),
+		},
+		.acct = {
+			.port = acct_port,
+			.fd = -1,
+			.queue = linked_list_create(),
+		},
 		.hasher = lib->crypto->create_hasher(lib->crypto, HASH_MD5),
 		.signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_MD5_128),
 		.rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	if (!this->hasher || !this->signer || !this->rng ||
 		!this->signer->set_key(this->signer, secret))
 	{
 		DBG1(DBG_CFG, "RADIUS initialization failed, HMAC/MD5/RNG required");
-		destroy(this);
+		destroy_socket(this);
 		return NULL;
 	}
 	this->secret = secret;
 	/* we use a random identifier, helps if we restart often */
-	this->identifier = random();
+	this->auth.identifier = random();
+	this->acct.identifier = random();
 
+	this->receiver = receiver_register(this);
+	if (!this->receiver)
+	{
+		destroy_socket(this);
+		return NULL;
+	}
 	return &this->public;
 }
@@ -27,8 +27,28 @@ typedef struct radius_socket_t radius_socket_t;
 
 #include <networking/host.h>
 
+/**
+ * Maximum number of outstanding requests per socket and port.
+ */
+#define RADIUS_MAX_OUTSTANDING 256
+
+/**
+ * Callback function invoked for a response to an asynchronous request.
+ *
+ * @param data			user data passed to radius_socket_t.request_async()
+ * @param request		request message sent
+ * @param response		verified response, NULL if server did not respond
+ */
+typedef void (*radius_callback_t)(void *data, radius_message_t *request,
+								  radius_message_t *response);
+
 /**
  * RADIUS socket to a server.
+ *
+ * Requests from any number of threads are multiplexed over the socket, up to
+ * RADIUS_MAX_OUTSTANDING requests are outstanding per port, further requests
+ * get queued until an identifier gets available. Responses are received and
+ * dispatched by identifier in a single job shared by all sockets.
  */
 struct radius_socket_t {
 
@@ -47,6 +67,29 @@ struct radius_socket_t {
 	radius_message_t* (*request)(radius_socket_t *this,
 								 radius_message_t *request);
 
+	/**
+	 * Send a RADIUS request, invoke a callback for the response.
+	 *
+	 * Like request(), but does not block the calling thread. The callback
+	 * is invoked from a job once the response has been received, or the
+	 * server did not respond to any retransmit. As the job serves all
+	 * sockets, callbacks should not block.
+	 *
+	 * @param request		request message, gets owned and destroyed
+	 * @param cb			callback function to invoke for the response
+	 * @param data			data to pass to callback
+	 * @return				TRUE if request sent or queued
+	 */
+	bool (*request_async)(radius_socket_t *this, radius_message_t *request,
+						  radius_callback_t cb, void *data);
+
+	/**
+	 * Get the number of outstanding and queued requests.
+	 *
+	 * @return				number of requests not completed yet
+	 */
+	u_int (*get_load)(radius_socket_t *this);
+
 	/**
 	 * Decrypt the MSK encoded in a messages MS-MPPE-Send/Recv-Key.
 	 *
@@ -88,6 +88,21 @@ struct private_linked_list_t {
 	 * NULL if no elements in list.
 	 */
 	element_t *last;
+
+	/**
+	 * Arena to allocate from, if any
+	 */
+	arena_t *arena;
+
+	/**
+	 * Removed elements for reuse, if allocated from an arena
+	 */
+	element_t *unused;
+
+	/**
+	 * Destroyed enumerators for reuse, if allocated from an arena
+	 */
+	void *enumerators;
 };
 
 typedef struct private_enumerator_t private_enumerator_t;
@@ -116,8 +131,56 @@ struct private_enumerator_t {
 	 * enumerator has enumerated all items
 	 */
 	bool finished;
+
+	/**
+	 * next destroyed enumerator, if allocated from an arena
+	 */
+	private_enumerator_t *next;
 };
 
+/**
+ * Create a list element, from the arena if the list has one
+ */
+static element_t *new_element(private_linked_list_t *this, void *value)
+{
+	element_t *element;
+
+	if (!this->arena)
+	{
+		return element_create(value);
+	}
+	element = this->unused;
+	if (element)
+	{
+		this->unused = element->next;
+		*element = (element_t){
+			.value = value,
+		};
+	}
+	else
+	{
+		element = this->arena->alloc(this->arena, sizeof(*element));
+		element->value = value;
+	}
+	return element;
+}
+
+/**
+ * Free a list element, recycle it if allocated from an arena
+ */
+static void free_element(private_linked_list_t *this, element_t *element)
+{
+	if (this->arena)
+	{
+		element->next = this->unused;
+		this->unused = element;
+	}
+	else
+	{
+		free(element);
+	}
+}
+
 METHOD(enumerator_t, enumerate, bool,
 	private_enumerator_t *this, void **item)
 {
@@ -142,11 +205,39 @@ METHOD(enumerator_t, enumerate, bool,
 	return TRUE;
 }
 
+METHOD(enumerator_t, enumerator_recycle, void,
+	private_enumerator_t *this)
+{
+	this->next = this->list->enumerators;
+	this->list->enumerators = this;
+}
+
 METHOD(linked_list_t, create_enumerator, enumerator_t*,
 	private_linked_list_t *this)
 {
 	private_enumerator_t *enumerator;
 
+	if (this->arena)
+	{
+		enumerator = this->enumerators;
+		if (enumerator)
+		{
+			this->enumerators = enumerator->next;
+		}
+		else
+		{
+			enumerator = this->arena->alloc(this->arena, sizeof(*enumerator));
+		}
+		*enumerator = (private_enumerator_t){
+			.enumerator = {
+				.enumerate = (void*)_enumerate,
+				.destroy = (void*)_enumerator_recycle,
+			},
+			.list = this,
+		};
+		return &enumerator->enumerator;
+	}
+
 	INIT(enumerator,
 		.enumerator = {
 			.enumerate = (void*)_enumerate,
@@ -186,7 +277,7 @@ METHOD(linked_list_t, insert_first, void,
 {
 	element_t *element;
 
-	element = element_create(item);
+	element = new_element(this, item);
 	if (this->count == 0)
 	{
 		/* first entry in list */
@@ -212,7 +303,7 @@ static element_t* remove_element(private_linked_list_t *this,
 
 	next = element->next;
 	previous = element->previous;
-	free(element);
+	free_element(this, element);
 	if (next)
 	{
 		next->previous = previous;
@@ -264,7 +355,7 @@ METHOD(linked_list_t, insert_last, void,
 {
 	element_t *element;
 
-	element = element_create(item);
+	element = new_element(this, item);
 	if (this->count == 0)
 	{
 		/* first entry in list */
@@ -299,7 +390,7 @@ METHOD(linked_list_t, insert_before, void,
 		}
 		return;
 	}
-	element = element_create(item);
+	element = new_element(this, item);
 	if (current->previous)
 	{
 		current->previous->next = element;
@@ -502,7 +593,10 @@ METHOD(linked_list_t, destroy, void,
 		/* values are not destroyed so memory leaks are possible
 		 * if list is not empty when deleting */
 	}
-	free(this);
+	if (!this->arena)
+	{
+		free(this);
+	}
 }
 
 METHOD(linked_list_t, destroy_offset, void,
@@ -515,10 +609,16 @@ METHOD(linked_list_t, destroy_offset, void,
 		void (**method)(void*) = current->value + offset;
 		(*method)(current->value);
 		next = current->next;
-		free(current);
+		if (!this->arena)
+		{
+			free(current);
+		}
 		current = next;
 	}
-	free(this);
+	if (!this->arena)
+	{
+		free(this);
+	}
 }
 
 METHOD(linked_list_t, destroy_function, void,
@@ -530,20 +630,34 @@ METHOD(linked_list_t, destroy_function, void,
 	{
 		fn(current->value);
 		next = current->next;
-		free(current);
+		if (!this->arena)
+		{
+			free(current);
+		}
 		current = next;
 	}
-	free(this);
+	if (!this->arena)
+	{
+		free(this);
+	}
 }
 
-/*
- * Described in header.
+/**
+ * Create a linked list, allocated from an arena if given
  */
-linked_list_t *linked_list_create()
+static linked_list_t *create_list(arena_t *arena)
 {
 	private_linked_list_t *this;
 
-	INIT(this,
+	if (arena)
+	{
+		this = arena->alloc(arena, sizeof(*this));
+	}
+	else
+	{
+		this = malloc(sizeof(*this));
+	}
+	*this = (private_linked_list_t){
 		.public = {
 			.get_count = _get_count,
 			.create_enumerator = _create_enumerator,
@@ -569,11 +683,28 @@ linked_list_t *linked_list_create()
 			.destroy_offset = _destroy_offset,
 			.destroy_function = _destroy_function,
 		},
-	);
+		.arena = arena,
+	};
 
 	return &this->public;
 }
 
+/*
+ * Described in header.
+ */
+linked_list_t *linked_list_create()
+{
+	return create_list(NULL);
+}
+
+/*
+ * Described in header.
+ */
+linked_list_t *linked_list_create_arena(arena_t *arena)
+{
+	return create_list(arena);
+}
+
 /*
  * See header.
  */
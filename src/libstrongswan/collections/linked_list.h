@@ -26,6 +26,7 @@
 typedef struct linked_list_t linked_list_t;
 
 #include <collections/enumerator.h>
+#include <utils/arena.h>
 
 /**
  * Method to match elements in a linked list (used in find_* functions)
@@ -299,6 +300,18 @@ struct linked_list_t {
  */
 linked_list_t *linked_list_create(void);
 
+/**
+ * Creates an empty linked list object allocating from an arena.
+ *
+ * The list, its elements and enumerators are allocated from the arena.
+ * Removed elements and destroyed enumerators are recycled by the list,
+ * destroying the list releases no memory, the arena does.
+ *
+ * @param arena			arena to allocate from, must outlive the list
+ * @return				linked_list_t object.
+ */
+linked_list_t *linked_list_create_arena(arena_t *arena);
+
 /**
  * Creates a linked list from an enumerator.
  *
@@ -20,6 +20,7 @@
 
 #include <utils/debug.h>
 #include <threading/thread.h>
+#include <threading/lock_stats.h>
 #include <utils/identification.h>
 #include <networking/host.h>
 #include <collections/hashtable.h>
@@ -106,6 +107,7 @@ void library_deinit()
 	}
 
 	threads_deinit();
+	lock_stats_deinit();
 	backtrace_deinit();
 
 	free(this);
@@ -219,6 +221,12 @@ bool library_init(char *settings)
 	this->public.scheduler = scheduler_create();
 	this->public.plugins = plugin_loader_create();
 
+	if (lib->settings->get_bool(lib->settings,
+								"libstrongswan.lock_stats", FALSE))
+	{
+		lock_stats_set_state(TRUE);
+	}
+
 	if (lib->settings->get_bool(lib->settings,
 								"libstrongswan.integrity_test", FALSE))
 	{
@@ -20,8 +20,18 @@
 #include <library.h>
 #include <utils/debug.h>
 #include <threading/mutex.h>
+#include <threading/thread_value.h>
+#include <collections/linked_list.h>
+#include <collections/hashtable.h>
+
+/**
+ * Default number of prepared statements cached per connection
+ */
+#define DEFAULT_STATEMENT_CACHE 32
 
 typedef struct private_sqlite_database_t private_sqlite_database_t;
+typedef struct conn_t conn_t;
+typedef struct cached_stmt_t cached_stmt_t;
 
 /**
  * private data of sqlite_database
@@ -33,31 +43,359 @@ struct private_sqlite_database_t {
 	 */
 	sqlite_database_t public;
 
+	/**
+	 * database file
+	 */
+	char *file;
+
+	/**
+	 * connection pool, contains conn_t
+	 */
+	linked_list_t *pool;
+
+	/**
+	 * TRUE if the database uses WAL mode, connections are not shared then
+	 */
+	bool wal;
+
+	/**
+	 * connection with an open transaction used by a thread, as conn_t
+	 */
+	thread_value_t *transaction;
+
+	/**
+	 * maximum number of prepared statements cached per connection
+	 */
+	u_int cache_size;
+
+	/**
+	 * mutex used to lock execute(), the pool and the statement caches
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * connection pool entry
+ */
+struct conn_t {
+
 	/**
 	 * sqlite database connection
 	 */
 	sqlite3 *db;
 
 	/**
-	 * mutex used to lock execute()
+	 * number of users of this connection
 	 */
-	mutex_t *mutex;
+	u_int in_use;
+
+	/**
+	 * prepared statements, cached_stmt_t by SQL string
+	 */
+	hashtable_t *stmts;
+
+	/**
+	 * cached statements as cached_stmt_t, most recently used first
+	 */
+	linked_list_t *lru;
 };
 
 /**
- * Create and run a sqlite stmt using a sql string and args
+ * prepared statement cache entry
+ */
+struct cached_stmt_t {
+
+	/**
+	 * SQL string the statement was prepared from
+	 */
+	char *sql;
+
+	/**
+	 * prepared statement
+	 */
+	sqlite3_stmt *stmt;
+
+	/**
+	 * statement currently in use?
+	 */
+	bool in_use;
+};
+
+/**
+ * Hash function for SQL strings
+ */
+static u_int sql_hash(char *sql)
+{
+	return chunk_hash(chunk_create(sql, strlen(sql)));
+}
+
+/**
+ * Comparison function for SQL strings
+ */
+static bool sql_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Busy handler implementation
+ */
+static int busy_handler(private_sqlite_database_t *this, int count)
+{
+	/* add a backoff time, quadratically increasing with every try */
+	usleep(count * count * 1000);
+	/* always retry */
+	return 1;
+}
+
+/**
+ * Destroy a connection and its cached statements
+ */
+static void conn_destroy(conn_t *this)
+{
+	enumerator_t *enumerator;
+	cached_stmt_t *cached;
+
+	enumerator = this->stmts->create_enumerator(this->stmts);
+	while (enumerator->enumerate(enumerator, NULL, &cached))
+	{
+		sqlite3_finalize(cached->stmt);
+		free(cached->sql);
+		free(cached);
+	}
+	enumerator->destroy(enumerator);
+	this->stmts->destroy(this->stmts);
+	this->lru->destroy(this->lru);
+	if (sqlite3_close(this->db) == SQLITE_BUSY)
+	{
+		DBG1(DBG_LIB, "sqlite close failed because database is busy");
+	}
+	free(this);
+}
+
+/**
+ * Open a new connection to the database
+ */
+static conn_t *conn_create(private_sqlite_database_t *this)
+{
+	conn_t *conn;
+
+	INIT(conn,
+		.stmts = hashtable_create((hashtable_hash_t)sql_hash,
+								  (hashtable_equals_t)sql_equals, 8),
+		.lru = linked_list_create(),
+	);
+	if (sqlite3_open(this->file, &conn->db) != SQLITE_OK)
+	{
+		DBG1(DBG_LIB, "opening SQLite database '%s' failed: %s",
+			 this->file, sqlite3_errmsg(conn->db));
+		conn_destroy(conn);
+		return NULL;
+	}
+	sqlite3_busy_handler(conn->db, (void*)busy_handler, this);
+	return conn;
+}
+
+/**
+ * Acquire a connection, opens a new one if all connections are in use
+ */
+static conn_t *conn_get(private_sqlite_database_t *this)
+{
+	conn_t *current, *found = NULL;
+	enumerator_t *enumerator;
+
+	if (!this->wal)
+	{	/* a single connection shared by all threads */
+		this->pool->get_first(this->pool, (void**)&found);
+		return found;
+	}
+
+	this->mutex->lock(this->mutex);
+	found = this->transaction->get(this->transaction);
+	if (found)
+	{	/* stick to the connection this thread has a transaction open on */
+		found->in_use++;
+	}
+	else
+	{
+		enumerator = this->pool->create_enumerator(this->pool);
+		while (enumerator->enumerate(enumerator, &current))
+		{
+			if (!current->in_use)
+			{
+				found = current;
+				found->in_use++;
+				break;
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!found)
+	{
+		found = conn_create(this);
+		if (found)
+		{
+			found->in_use++;
+			this->mutex->lock(this->mutex);
+			this->pool->insert_last(this->pool, found);
+			DBG2(DBG_LIB, "increased SQLite connection pool size to %d",
+				 this->pool->get_count(this->pool));
+			this->mutex->unlock(this->mutex);
+		}
+	}
+	return found;
+}
+
+/**
+ * Release a connection acquired with conn_get()
+ */
+static void conn_release(private_sqlite_database_t *this, conn_t *conn)
+{
+	if (!this->wal)
+	{
+		return;
+	}
+	this->mutex->lock(this->mutex);
+	if (!sqlite3_get_autocommit(conn->db))
+	{	/* keep the connection for this thread until the transaction ends */
+		if (this->transaction->get(this->transaction) != conn)
+		{
+			this->transaction->set(this->transaction, conn);
+			conn->in_use++;
+		}
+	}
+	else if (this->transaction->get(this->transaction) == conn)
+	{
+		this->transaction->set(this->transaction, NULL);
+		conn->in_use--;
+	}
+	conn->in_use--;
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Evict the least recently used statement not in use from the cache of a
+ * connection, mutex must be held
+ */
+static void stmt_evict(conn_t *conn)
+{
+	enumerator_t *enumerator;
+	cached_stmt_t *current, *found = NULL;
+
+	enumerator = conn->lru->create_enumerator(conn->lru);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (!current->in_use)
+		{
+			found = current;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (found)
+	{
+		conn->lru->remove(conn->lru, found, NULL);
+		conn->stmts->remove(conn->stmts, found->sql);
+		sqlite3_finalize(found->stmt);
+		free(found->sql);
+		free(found);
+	}
+}
+
+/**
+ * Get a prepared statement for an SQL string, from the cache if possible
  */
-static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
-						 va_list *args)
+static sqlite3_stmt* stmt_get(private_sqlite_database_t *this, conn_t *conn,
+							  char *sql, cached_stmt_t **cached)
 {
+	cached_stmt_t *entry;
 	sqlite3_stmt *stmt = NULL;
-	int params, i, res = SQLITE_OK;
+
+	*cached = NULL;
+	this->mutex->lock(this->mutex);
+	entry = conn->stmts->get(conn->stmts, sql);
+	if (entry && !entry->in_use)
+	{
+		entry->in_use = TRUE;
+		*cached = entry;
+		stmt = entry->stmt;
+		conn->lru->remove(conn->lru, entry, NULL);
+		conn->lru->insert_first(conn->lru, entry);
+	}
+	this->mutex->unlock(this->mutex);
+	if (stmt)
+	{
+		return stmt;
+	}
 
 #ifdef HAVE_SQLITE3_PREPARE_V2
-	if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
+	if (sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL) != SQLITE_OK)
 #else
-	if (sqlite3_prepare(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
+	if (sqlite3_prepare(conn->db, sql, -1, &stmt, NULL) != SQLITE_OK)
 #endif
+	{
+		DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
+			 sqlite3_errmsg(conn->db));
+		return NULL;
+	}
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	/* statements prepared with sqlite3_prepare() can't be cached, as they
+	 * don't get recompiled automatically after schema changes */
+	this->mutex->lock(this->mutex);
+	if (this->cache_size && !conn->stmts->get(conn->stmts, sql))
+	{
+		if (conn->stmts->get_count(conn->stmts) >= this->cache_size)
+		{
+			stmt_evict(conn);
+		}
+		if (conn->stmts->get_count(conn->stmts) < this->cache_size)
+		{
+			INIT(entry,
+				.sql = strdup(sql),
+				.stmt = stmt,
+				.in_use = TRUE,
+			);
+			conn->stmts->put(conn->stmts, entry->sql, entry);
+			conn->lru->insert_first(conn->lru, entry);
+			*cached = entry;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+#endif /* HAVE_SQLITE3_PREPARE_V2 */
+	return stmt;
+}
+
+/**
+ * Release a statement acquired with stmt_get()
+ */
+static void stmt_release(private_sqlite_database_t *this, sqlite3_stmt *stmt,
+						 cached_stmt_t *cached)
+{
+	if (cached)
+	{
+		sqlite3_reset(stmt);
+		this->mutex->lock(this->mutex);
+		cached->in_use = FALSE;
+		this->mutex->unlock(this->mutex);
+	}
+	else
+	{
+		sqlite3_finalize(stmt);
+	}
+}
+
+/**
+ * Create and run a sqlite stmt using a sql string and args
+ */
+static sqlite3_stmt* run(private_sqlite_database_t *this, conn_t *conn,
+						 char *sql, va_list *args, cached_stmt_t **cached)
+{
+	sqlite3_stmt *stmt;
+	int params, i, res = SQLITE_OK;
+
+	stmt = stmt_get(this, conn, sql, cached);
+	if (stmt)
 	{
 		params = sqlite3_bind_parameter_count(stmt);
 		for (i = 1; i <= params; i++)
@@ -108,16 +446,11 @@ static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
 			}
 		}
 	}
-	else
-	{
-		DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
-			 sqlite3_errmsg(this->db));
-	}
 	if (res != SQLITE_OK)
 	{
 		DBG1(DBG_LIB, "binding sqlite statement failed: %s",
-			 sqlite3_errmsg(this->db));
-		sqlite3_finalize(stmt);
+			 sqlite3_errmsg(conn->db));
+		stmt_release(this, stmt, *cached);
 		return NULL;
 	}
 	return stmt;
@@ -128,6 +461,10 @@ typedef struct {
 	enumerator_t public;
 	/** associated sqlite statement */
 	sqlite3_stmt *stmt;
+	/** cache entry of the statement, if any */
+	cached_stmt_t *cached;
+	/** connection the statement runs on */
+	conn_t *conn;
 	/** number of result columns */
 	int count;
 	/** column types */
@@ -141,7 +478,8 @@ typedef struct {
  */
 static void sqlite_enumerator_destroy(sqlite_enumerator_t *this)
 {
-	sqlite3_finalize(this->stmt);
+	stmt_release(this->database, this->stmt, this->cached);
+	conn_release(this->database, this->conn);
 #if SQLITE_VERSION_NUMBER < 3005000
 	this->database->mutex->unlock(this->database->mutex);
 #endif
@@ -163,7 +501,7 @@ static bool sqlite_enumerator_enumerate(sqlite_enumerator_t *this, ...)
 			break;
 		default:
 			DBG1(DBG_LIB, "stepping sqlite statement failed: %s",
-				 sqlite3_errmsg(this->database->db));
+				 sqlite3_errmsg(this->conn->db));
 			/* fall */
 		case SQLITE_DONE:
 			return FALSE;
@@ -220,6 +558,8 @@ METHOD(database_t, query, enumerator_t*,
 	sqlite3_stmt *stmt;
 	va_list args;
 	sqlite_enumerator_t *enumerator = NULL;
+	cached_stmt_t *cached;
+	conn_t *conn;
 	int i;
 
 #if SQLITE_VERSION_NUMBER < 3005000
@@ -227,14 +567,24 @@ METHOD(database_t, query, enumerator_t*,
 	this->mutex->lock(this->mutex);
 #endif
 
+	conn = conn_get(this);
+	if (!conn)
+	{
+#if SQLITE_VERSION_NUMBER < 3005000
+		this->mutex->unlock(this->mutex);
+#endif
+		return NULL;
+	}
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, conn, sql, &args, &cached);
 	if (stmt)
 	{
 		enumerator = malloc_thing(sqlite_enumerator_t);
 		enumerator->public.enumerate = (void*)sqlite_enumerator_enumerate;
 		enumerator->public.destroy = (void*)sqlite_enumerator_destroy;
 		enumerator->stmt = stmt;
+		enumerator->cached = cached;
+		enumerator->conn = conn;
 		enumerator->count = sqlite3_column_count(stmt);
 		enumerator->columns = malloc(sizeof(db_type_t) * enumerator->count);
 		enumerator->database = this;
@@ -243,6 +593,13 @@ METHOD(database_t, query, enumerator_t*,
 			enumerator->columns[i] = va_arg(args, db_type_t);
 		}
 	}
+	else
+	{
+		conn_release(this, conn);
+#if SQLITE_VERSION_NUMBER < 3005000
+		this->mutex->unlock(this->mutex);
+#endif
+	}
 	va_end(args);
 	return (enumerator_t*)enumerator;
 }
@@ -251,13 +608,22 @@ METHOD(database_t, execute, int,
 	private_sqlite_database_t *this, int *rowid, char *sql, ...)
 {
 	sqlite3_stmt *stmt;
+	cached_stmt_t *cached;
+	conn_t *conn;
 	int affected = -1;
 	va_list args;
 
-	/* we need a lock to get our rowid/changes correctly */
-	this->mutex->lock(this->mutex);
+	conn = conn_get(this);
+	if (!conn)
+	{
+		return -1;
+	}
+	if (!this->wal)
+	{	/* we need a lock to get our rowid/changes correctly */
+		this->mutex->lock(this->mutex);
+	}
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, conn, sql, &args, &cached);
 	va_end(args);
 	if (stmt)
 	{
@@ -265,18 +631,22 @@ METHOD(database_t, execute, int,
 		{
 			if (rowid)
 			{
-				*rowid = sqlite3_last_insert_rowid(this->db);
+				*rowid = sqlite3_last_insert_rowid(conn->db);
 			}
-			affected = sqlite3_changes(this->db);
+			affected = sqlite3_changes(conn->db);
 		}
 		else
 		{
 			DBG1(DBG_LIB, "sqlite execute failed: %s",
-				 sqlite3_errmsg(this->db));
+				 sqlite3_errmsg(conn->db));
 		}
-		sqlite3_finalize(stmt);
+		stmt_release(this, stmt, cached);
 	}
-	this->mutex->unlock(this->mutex);
+	if (!this->wal)
+	{
+		this->mutex->unlock(this->mutex);
+	}
+	conn_release(this, conn);
 	return affected;
 }
 
@@ -287,24 +657,39 @@ METHOD(database_t, get_driver, db_driver_t,
 }
 
 /**
- * Busy handler implementation
+ * Switch the database to WAL journal mode
  */
-static int busy_handler(private_sqlite_database_t *this, int count)
+static bool enable_wal(conn_t *conn)
 {
-	/* add a backoff time, quadratically increasing with every try */
-	usleep(count * count * 1000);
-	/* always retry */
-	return 1;
+	sqlite3_stmt *stmt;
+	bool success = FALSE;
+	char *mode;
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	if (sqlite3_prepare_v2(conn->db, "PRAGMA journal_mode=WAL", -1, &stmt,
+						   NULL) == SQLITE_OK)
+#else
+	if (sqlite3_prepare(conn->db, "PRAGMA journal_mode=WAL", -1, &stmt,
+						NULL) == SQLITE_OK)
+#endif
+	{
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+		{	/* returns the resulting journal mode, if supported at all */
+			mode = (char*)sqlite3_column_text(stmt, 0);
+			success = mode && strcaseeq(mode, "wal");
+		}
+		sqlite3_finalize(stmt);
+	}
+	return success;
 }
 
 METHOD(database_t, destroy, void,
 	private_sqlite_database_t *this)
 {
-	if (sqlite3_close(this->db) == SQLITE_BUSY)
-	{
-		DBG1(DBG_LIB, "sqlite close failed because database is busy");
-	}
+	this->pool->destroy_function(this->pool, (void*)conn_destroy);
+	DESTROY_IF(this->transaction);
 	this->mutex->destroy(this->mutex);
+	free(this->file);
 	free(this);
 }
 
@@ -313,8 +698,8 @@ METHOD(database_t, destroy, void,
  */
 sqlite_database_t *sqlite_database_create(char *uri)
 {
-	char *file;
 	private_sqlite_database_t *this;
+	conn_t *conn;
 
 	/**
 	 * parse sqlite:///path/to/file.db uri
@@ -323,7 +708,6 @@ sqlite_database_t *sqlite_database_create(char *uri)
 	{
 		return NULL;
 	}
-	file = uri + 9;
 
 	INIT(this,
 		.public = {
@@ -334,19 +718,36 @@ sqlite_database_t *sqlite_database_create(char *uri)
 				.destroy = _destroy,
 			},
 		},
+		.file = strdup(uri + 9),
+		.pool = linked_list_create(),
+		.cache_size = lib->settings->get_int(lib->settings,
+								"libstrongswan.plugins.sqlite.statement_cache",
+								DEFAULT_STATEMENT_CACHE),
 		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
 	);
 
-	if (sqlite3_open(file, &this->db) != SQLITE_OK)
+	conn = conn_create(this);
+	if (!conn)
 	{
-		DBG1(DBG_LIB, "opening SQLite database '%s' failed: %s",
-			 file, sqlite3_errmsg(this->db));
 		_destroy(this);
 		return NULL;
 	}
+	this->pool->insert_last(this->pool, conn);
 
-	sqlite3_busy_handler(this->db, (void*)busy_handler, this);
-
+	if (lib->settings->get_bool(lib->settings,
+								"libstrongswan.plugins.sqlite.wal", FALSE))
+	{
+		if (enable_wal(conn))
+		{
+			this->wal = TRUE;
+			this->transaction = thread_value_create(NULL);
+		}
+		else
+		{
+			DBG1(DBG_LIB, "enabling WAL mode for SQLite database '%s' failed, "
+				 "using a single connection", this->file);
+		}
+	}
 	return &this->public;
 }
 
@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <string.h>
+
+#ifdef HAVE_DLADDR
+# include <dlfcn.h>
+#endif /* HAVE_DLADDR */
+
+#ifdef HAVE_BACKTRACE
+# include <execinfo.h>
+#endif /* HAVE_BACKTRACE */
+
+#include "lock_stats.h"
+
+#include <collections/hashtable.h>
+
+ENUM(lock_stats_type_names, LOCK_STATS_MUTEX, LOCK_STATS_CONDVAR,
+	"mutex",
+	"rwlock",
+	"condvar",
+);
+
+/**
+ * Number of histogram buckets, bucket i counts durations < 2^i us
+ */
+#define BUCKETS 24
+
+typedef struct site_t site_t;
+
+/**
+ * Statistics of a lock creation site
+ */
+struct site_t {
+
+	/**
+	 * Type of the locks
+	 */
+	lock_stats_type_t type;
+
+	/**
+	 * Return address of the function creating the locks
+	 */
+	void *creator;
+
+	/**
+	 * Number of acquisitions, or waits on a condvar
+	 */
+	u_int64_t locked;
+
+	/**
+	 * Number of contended acquisitions, or timed out waits on a condvar
+	 */
+	u_int64_t contended;
+
+	/**
+	 * Overall time waited, in us
+	 */
+	u_int64_t waited;
+
+	/**
+	 * Longest time waited, in us
+	 */
+	u_int64_t waited_max;
+
+	/**
+	 * Overall time held, in us
+	 */
+	u_int64_t held;
+
+	/**
+	 * Longest time held, in us
+	 */
+	u_int64_t held_max;
+
+	/**
+	 * Histogram of waiting times
+	 */
+	u_int64_t wait_hist[BUCKETS];
+
+	/**
+	 * Histogram of holding times
+	 */
+	u_int64_t hold_hist[BUCKETS];
+};
+
+/**
+ * See header.
+ */
+bool lock_stats_enabled = FALSE;
+
+/**
+ * Creation sites, site_t => site_t, raw pthread mutex as we are used by
+ * mutex_t ourselves
+ */
+static hashtable_t *sites = NULL;
+static pthread_mutex_t sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HAVE_GCC_ATOMIC_OPERATIONS
+
+/**
+ * Atomically add a value to a counter
+ */
+static inline void add(u_int64_t *counter, u_int64_t value)
+{
+	__sync_fetch_and_add(counter, value);
+}
+
+/**
+ * Atomically raise a maximum
+ */
+static inline void raise_max(u_int64_t *max, u_int64_t value)
+{
+	u_int64_t current;
+
+	current = *max;
+	while (current < value)
+	{
+		if (__sync_bool_compare_and_swap(max, current, value))
+		{
+			break;
+		}
+		current = *max;
+	}
+}
+
+#else /* !HAVE_GCC_ATOMIC_OPERATIONS */
+
+/**
+ * Mutex to update counters without atomic operations
+ */
+static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Add a value to a counter
+ */
+static inline void add(u_int64_t *counter, u_int64_t value)
+{
+	pthread_mutex_lock(&counter_mutex);
+	*counter += value;
+	pthread_mutex_unlock(&counter_mutex);
+}
+
+/**
+ * Raise a maximum
+ */
+static inline void raise_max(u_int64_t *max, u_int64_t value)
+{
+	pthread_mutex_lock(&counter_mutex);
+	*max = max(*max, value);
+	pthread_mutex_unlock(&counter_mutex);
+}
+
+#endif /* HAVE_GCC_ATOMIC_OPERATIONS */
+
+/**
+ * Hashtable hash function
+ */
+static u_int site_hash(site_t *site)
+{
+	return chunk_hash_inc(chunk_from_thing(site->creator),
+						  chunk_hash(chunk_from_thing(site->type)));
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool site_equals(site_t *a, site_t *b)
+{
+	return a->creator == b->creator && a->type == b->type;
+}
+
+/**
+ * Get the statistics of the creation site of a lock
+ */
+static site_t *get_site(lock_stats_t *stats)
+{
+	site_t *site, lookup = {
+		.type = stats->type,
+		.creator = stats->creator,
+	};
+
+	if (stats->site)
+	{
+		return stats->site;
+	}
+	pthread_mutex_lock(&sites_mutex);
+	if (!sites)
+	{
+		sites = hashtable_create((hashtable_hash_t)site_hash,
+								 (hashtable_equals_t)site_equals, 64);
+	}
+	site = sites->get(sites, &lookup);
+	if (!site)
+	{
+		INIT(site,
+			.type = stats->type,
+			.creator = stats->creator,
+		);
+		sites->put(sites, site, site);
+	}
+	pthread_mutex_unlock(&sites_mutex);
+	stats->site = site;
+	return site;
+}
+
+/**
+ * Get the time since start in us
+ */
+static u_int64_t elapsed(timeval_t *start, timeval_t *now)
+{
+	timeval_t diff;
+
+	timersub(now, start, &diff);
+	return (u_int64_t)diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+/**
+ * Get the histogram bucket of a duration
+ */
+static inline int bucket(u_int64_t us)
+{
+	int i;
+
+	for (i = 0; i < BUCKETS - 1 && us >= (1ULL << i); i++)
+	{
+		/* find first bucket the duration is smaller than */
+	}
+	return i;
+}
+
+/**
+ * See header.
+ */
+void lock_stats_acquired(lock_stats_t *stats, timeval_t *start,
+						 bool exclusive)
+{
+	site_t *site;
+	timeval_t now;
+	u_int64_t us;
+
+	site = get_site(stats);
+	add(&site->locked, 1);
+	if (start || exclusive)
+	{
+		time_monotonic(&now);
+	}
+	if (start)
+	{
+		us = elapsed(start, &now);
+		add(&site->contended, 1);
+		add(&site->waited, us);
+		add(&site->wait_hist[bucket(us)], 1);
+		raise_max(&site->waited_max, us);
+	}
+	if (exclusive)
+	{
+		stats->acquired = now;
+	}
+}
+
+/**
+ * See header.
+ */
+void lock_stats_held(lock_stats_t *stats)
+{
+	site_t *site;
+	timeval_t now;
+	u_int64_t us;
+
+	site = get_site(stats);
+	time_monotonic(&now);
+	us = elapsed(&stats->acquired, &now);
+	timerclear(&stats->acquired);
+	add(&site->held, us);
+	add(&site->hold_hist[bucket(us)], 1);
+	raise_max(&site->held_max, us);
+}
+
+/**
+ * See header.
+ */
+void lock_stats_waited(lock_stats_t *stats, timeval_t *start, bool timed_out)
+{
+	site_t *site;
+	timeval_t now;
+	u_int64_t us;
+
+	site = get_site(stats);
+	time_monotonic(&now);
+	us = elapsed(start, &now);
+	add(&site->locked, 1);
+	if (timed_out)
+	{
+		add(&site->contended, 1);
+	}
+	add(&site->waited, us);
+	add(&site->wait_hist[bucket(us)], 1);
+	raise_max(&site->waited_max, us);
+}
+
+/**
+ * See header.
+ */
+bool lock_stats_set_state(bool enable)
+{
+	bool old = lock_stats_enabled;
+
+	lock_stats_enabled = enable;
+	return old;
+}
+
+/**
+ * See header.
+ */
+void lock_stats_reset()
+{
+	enumerator_t *enumerator;
+	site_t *site;
+
+	pthread_mutex_lock(&sites_mutex);
+	if (sites)
+	{
+		enumerator = sites->create_enumerator(sites);
+		while (enumerator->enumerate(enumerator, NULL, &site))
+		{
+			*site = (site_t){
+				.type = site->type,
+				.creator = site->creator,
+			};
+		}
+		enumerator->destroy(enumerator);
+	}
+	pthread_mutex_unlock(&sites_mutex);
+}
+
+/**
+ * Get a printable name of a creation site
+ */
+static void get_site_name(site_t *site, char *buf, size_t len)
+{
+#ifdef HAVE_DLADDR
+	Dl_info info;
+
+	if (dladdr(site->creator, &info) && info.dli_sname)
+	{
+		snprintf(buf, len, "%s+0x%tx", info.dli_sname,
+				 site->creator - info.dli_saddr);
+		return;
+	}
+#endif /* HAVE_DLADDR */
+#ifdef HAVE_BACKTRACE
+	char **strings;
+
+	strings = backtrace_symbols(&site->creator, 1);
+	if (strings)
+	{
+		snprintf(buf, len, "%s", strings[0]);
+		free(strings);
+		return;
+	}
+#endif /* HAVE_BACKTRACE */
+	snprintf(buf, len, "%p", site->creator);
+}
+
+/**
+ * Sort sites by waiting time, descending, condvars last
+ */
+static int site_cmp(const void *a, const void *b)
+{
+	const site_t *sa = a, *sb = b;
+
+	if ((sa->type == LOCK_STATS_CONDVAR) != (sb->type == LOCK_STATS_CONDVAR))
+	{
+		return sa->type == LOCK_STATS_CONDVAR ? 1 : -1;
+	}
+	if (sa->waited == sb->waited)
+	{
+		return sa->locked == sb->locked ? 0 : sa->locked > sb->locked ? -1 : 1;
+	}
+	return sa->waited > sb->waited ? -1 : 1;
+}
+
+/**
+ * Print a histogram as CSV column
+ */
+static void print_hist_csv(FILE *out, u_int64_t *hist)
+{
+	int i;
+
+	for (i = 0; i < BUCKETS; i++)
+	{
+		fprintf(out, "%s%llu", i ? " " : "", hist[i]);
+	}
+}
+
+/**
+ * Print the non-empty buckets of a histogram
+ */
+static void print_hist(FILE *out, char *label, u_int64_t *hist)
+{
+	int i;
+
+	fprintf(out, "  %s:", label);
+	for (i = 0; i < BUCKETS; i++)
+	{
+		if (hist[i])
+		{
+			if (i == BUCKETS - 1)
+			{
+				fprintf(out, " >=%lluus: %llu", 1ULL << (i - 1), hist[i]);
+			}
+			else
+			{
+				fprintf(out, " <%lluus: %llu", 1ULL << i, hist[i]);
+			}
+		}
+	}
+	fprintf(out, "\n");
+}
+
+/**
+ * See header.
+ */
+void lock_stats_print(FILE *out, bool csv)
+{
+	enumerator_t *enumerator;
+	site_t *copy, *site;
+	char name[128];
+	int i, count = 0;
+
+	pthread_mutex_lock(&sites_mutex);
+	copy = malloc(sizeof(site_t) * max(sites ? sites->get_count(sites) : 0, 1));
+	if (sites)
+	{
+		enumerator = sites->create_enumerator(sites);
+		while (enumerator->enumerate(enumerator, NULL, &site))
+		{
+			copy[count++] = *site;
+		}
+		enumerator->destroy(enumerator);
+	}
+	pthread_mutex_unlock(&sites_mutex);
+
+	qsort(copy, count, sizeof(site_t), site_cmp);
+
+	if (csv)
+	{
+		fprintf(out, "type,site,locked,contended,waited_us,waited_max_us,"
+				"held_us,held_max_us,wait_histogram,hold_histogram\n");
+	}
+	else
+	{
+		fprintf(out, "lock statistics %s, %d creation sites:\n",
+				lock_stats_enabled ? "enabled" : "disabled", count);
+	}
+	for (i = 0; i < count; i++)
+	{
+		site = &copy[i];
+		if (!site->locked)
+		{
+			continue;
+		}
+		get_site_name(site, name, sizeof(name));
+		if (csv)
+		{
+			fprintf(out, "%N,%s,%llu,%llu,%llu,%llu,%llu,%llu,",
+					lock_stats_type_names, site->type, name, site->locked,
+					site->contended, site->waited, site->waited_max,
+					site->held, site->held_max);
+			print_hist_csv(out, site->wait_hist);
+			fprintf(out, ",");
+			print_hist_csv(out, site->hold_hist);
+			fprintf(out, "\n");
+			continue;
+		}
+		if (site->type == LOCK_STATS_CONDVAR)
+		{
+			fprintf(out, "%N created at %s: %llu waits, %llu timed out, "
+					"waited %llums (max %lluus)\n", lock_stats_type_names,
+					site->type, name, site->locked, site->contended,
+					site->waited / 1000, site->waited_max);
+		}
+		else
+		{
+			fprintf(out, "%N created at %s: %llu locked, %llu contended "
+					"(%llu%%), waited %llums (max %lluus), held %llums "
+					"(max %lluus)\n", lock_stats_type_names, site->type, name,
+					site->locked, site->contended,
+					site->contended * 100 / site->locked, site->waited / 1000,
+					site->waited_max, site->held / 1000, site->held_max);
+		}
+		if (site->waited)
+		{
+			print_hist(out, "wait", site->wait_hist);
+		}
+		if (site->held)
+		{
+			print_hist(out, "hold", site->hold_hist);
+		}
+	}
+	free(copy);
+}
+
+/**
+ * See header.
+ */
+void lock_stats_deinit()
+{
+	enumerator_t *enumerator;
+	site_t *site;
+
+	lock_stats_enabled = FALSE;
+	pthread_mutex_lock(&sites_mutex);
+	if (sites)
+	{
+		enumerator = sites->create_enumerator(sites);
+		while (enumerator->enumerate(enumerator, NULL, &site))
+		{
+			free(site);
+		}
+		enumerator->destroy(enumerator);
+		sites->destroy(sites);
+		sites = NULL;
+	}
+	pthread_mutex_unlock(&sites_mutex);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup lock_stats lock_stats
+ * @{ @ingroup threading
+ */
+
+#ifndef THREADING_LOCK_STATS_H_
+#define THREADING_LOCK_STATS_H_
+
+typedef struct lock_stats_t lock_stats_t;
+typedef enum lock_stats_type_t lock_stats_type_t;
+
+#include <stdio.h>
+
+#include <library.h>
+
+/**
+ * Type of a profiled lock.
+ */
+enum lock_stats_type_t {
+	/** mutex_t */
+	LOCK_STATS_MUTEX,
+	/** rwlock_t */
+	LOCK_STATS_RWLOCK,
+	/** condvar_t */
+	LOCK_STATS_CONDVAR,
+};
+
+/**
+ * enum names for lock_stats_type_t.
+ */
+extern enum_name_t *lock_stats_type_names;
+
+/**
+ * TRUE if lock statistics get collected, change with lock_stats_set_state().
+ */
+extern bool lock_stats_enabled;
+
+/**
+ * Profiling state embedded into each lock.
+ *
+ * Statistics are collected per creation site of a lock, i.e. all locks
+ * created by the same caller of mutex_create() share statistics.
+ */
+struct lock_stats_t {
+
+	/**
+	 * Type of the lock
+	 */
+	lock_stats_type_t type;
+
+	/**
+	 * Return address of the function creating the lock
+	 */
+	void *creator;
+
+	/**
+	 * Statistics of the creation site, looked up when first profiled
+	 */
+	void *site;
+
+	/**
+	 * Time the lock has been acquired exclusively, if profiled
+	 */
+	timeval_t acquired;
+};
+
+/**
+ * Initialize lock_stats_t of a lock, to use in the create function only.
+ *
+ * @param t				type of the lock, lock_stats_type_t
+ */
+#define lock_stats_create(t) \
+	(lock_stats_t){ .type = t, .creator = __builtin_return_address(0), }
+
+/**
+ * Record an acquisition of a lock, called by the thread acquiring it.
+ *
+ * @param stats			profiling state of the lock
+ * @param start			time waiting started if contended, NULL if not
+ * @param exclusive		TRUE to measure the time the lock is held
+ */
+void lock_stats_acquired(lock_stats_t *stats, timeval_t *start,
+						 bool exclusive);
+
+/**
+ * Record the time an exclusively acquired lock has been held.
+ *
+ * @param stats			profiling state of the lock
+ */
+void lock_stats_held(lock_stats_t *stats);
+
+/**
+ * Record a wait on a condvar.
+ *
+ * @param stats			profiling state of the condvar
+ * @param start			time waiting started
+ * @param timed_out		TRUE if the wait timed out
+ */
+void lock_stats_waited(lock_stats_t *stats, timeval_t *start, bool timed_out);
+
+/**
+ * Record the release of a lock, to call before actually releasing it.
+ *
+ * @param stats			profiling state of the lock
+ */
+static inline void lock_stats_released(lock_stats_t *stats)
+{
+	if (timerisset(&stats->acquired))
+	{
+		lock_stats_held(stats);
+	}
+}
+
+/**
+ * Record the reacquisition of a lock after waiting on a condvar.
+ *
+ * @param stats			profiling state of the lock
+ */
+static inline void lock_stats_reacquired(lock_stats_t *stats)
+{
+	if (lock_stats_enabled)
+	{
+		time_monotonic(&stats->acquired);
+	}
+}
+
+/**
+ * Enable or disable collecting lock statistics at runtime.
+ *
+ * @param enable		TRUE to enable, FALSE to disable
+ * @return				previous state
+ */
+bool lock_stats_set_state(bool enable);
+
+/**
+ * Reset all collected lock statistics.
+ */
+void lock_stats_reset();
+
+/**
+ * Print collected lock statistics, sorted by overall waiting time, condvars
+ * last.
+ *
+ * The CSV output contains a header line and a line for each creation site,
+ * the histogram columns list the number of waits/holds shorter than
+ * 1us, 2us, 4us, ... separated by spaces.
+ *
+ * @param out			stream to print to
+ * @param csv			TRUE to print machine-readable CSV
+ */
+void lock_stats_print(FILE *out, bool csv);
+
+/**
+ * Release all collected lock statistics.
+ */
+void lock_stats_deinit();
+
+#endif /** THREADING_LOCK_STATS_H_ @}*/
@@ -26,6 +26,7 @@
 #include "condvar.h"
 #include "mutex.h"
 #include "lock_profiler.h"
+#include "lock_stats.h"
 
 typedef struct private_mutex_t private_mutex_t;
 typedef struct private_r_mutex_t private_r_mutex_t;
@@ -55,6 +56,11 @@ struct private_mutex_t {
 	 * profiling info, if enabled
 	 */
 	lock_profile_t profile;
+
+	/**
+	 * runtime lock statistics
+	 */
+	lock_stats_t stats;
 };
 
 /**
@@ -93,8 +99,37 @@ struct private_condvar_t {
 	 */
 	pthread_cond_t condvar;
 
+	/**
+	 * runtime condvar statistics
+	 */
+	lock_stats_t stats;
 };
 
+/**
+ * Lock a pthread mutex, collecting statistics
+ */
+static int lock_profiled(private_mutex_t *this)
+{
+	timeval_t start;
+	int err;
+
+	err = pthread_mutex_trylock(&this->mutex);
+	if (err == EBUSY)
+	{
+		time_monotonic(&start);
+		err = pthread_mutex_lock(&this->mutex);
+		if (!err)
+		{
+			lock_stats_acquired(&this->stats, &start, TRUE);
+		}
+	}
+	else if (!err)
+	{
+		lock_stats_acquired(&this->stats, NULL, TRUE);
+	}
+	return err;
+}
+
 
 METHOD(mutex_t, lock, void,
 	private_mutex_t *this)
@@ -102,7 +137,14 @@ METHOD(mutex_t, lock, void,
 	int err;
 
 	profiler_start(&this->profile);
-	err = pthread_mutex_lock(&this->mutex);
+	if (lock_stats_enabled)
+	{
+		err = lock_profiled(this);
+	}
+	else
+	{
+		err = pthread_mutex_lock(&this->mutex);
+	}
 	if (err)
 	{
 		DBG1(DBG_LIB, "!!! MUTEX LOCK ERROR: %s !!!", strerror(err));
@@ -115,6 +157,7 @@ METHOD(mutex_t, unlock, void,
 {
 	int err;
 
+	lock_stats_released(&this->stats);
 	err = pthread_mutex_unlock(&this->mutex);
 	if (err)
 	{
@@ -184,6 +227,7 @@ mutex_t *mutex_create(mutex_type_t type)
 						.destroy = _mutex_destroy_r,
 					},
 					.recursive = TRUE,
+					.stats = lock_stats_create(LOCK_STATS_MUTEX),
 				},
 			);
 
@@ -203,6 +247,7 @@ mutex_t *mutex_create(mutex_type_t type)
 					.unlock = _unlock,
 					.destroy = _mutex_destroy,
 				},
+				.stats = lock_stats_create(LOCK_STATS_MUTEX),
 			);
 
 			pthread_mutex_init(&this->mutex, NULL);
@@ -217,6 +262,14 @@ mutex_t *mutex_create(mutex_type_t type)
 METHOD(condvar_t, wait_, void,
 	private_condvar_t *this, private_mutex_t *mutex)
 {
+	timeval_t start;
+	bool profiled = lock_stats_enabled;
+
+	lock_stats_released(&mutex->stats);
+	if (profiled)
+	{
+		time_monotonic(&start);
+	}
 	if (mutex->recursive)
 	{
 		private_r_mutex_t* recursive = (private_r_mutex_t*)mutex;
@@ -234,6 +287,11 @@ METHOD(condvar_t, wait_, void,
 	{
 		pthread_cond_wait(&this->condvar, &mutex->mutex);
 	}
+	lock_stats_reacquired(&mutex->stats);
+	if (profiled)
+	{
+		lock_stats_waited(&this->stats, &start, FALSE);
+	}
 }
 
 /* use the monotonic clock based version of this function if available */
@@ -245,11 +303,17 @@ METHOD(condvar_t, timed_wait_abs, bool,
 	private_condvar_t *this, private_mutex_t *mutex, timeval_t time)
 {
 	struct timespec ts;
-	bool timed_out;
+	timeval_t start;
+	bool timed_out, profiled = lock_stats_enabled;
 
 	ts.tv_sec = time.tv_sec;
 	ts.tv_nsec = time.tv_usec * 1000;
 
+	lock_stats_released(&mutex->stats);
+	if (profiled)
+	{
+		time_monotonic(&start);
+	}
 	if (mutex->recursive)
 	{
 		private_r_mutex_t* recursive = (private_r_mutex_t*)mutex;
@@ -267,6 +331,11 @@ METHOD(condvar_t, timed_wait_abs, bool,
 		timed_out = pthread_cond_timedwait(&this->condvar, &mutex->mutex,
 										   &ts) == ETIMEDOUT;
 	}
+	lock_stats_reacquired(&mutex->stats);
+	if (profiled)
+	{
+		lock_stats_waited(&this->stats, &start, timed_out);
+	}
 	return timed_out;
 }
 
@@ -325,7 +394,8 @@ condvar_t *condvar_create(condvar_type_t type)
 					.signal = _signal_,
 					.broadcast = _broadcast,
 					.destroy = _condvar_destroy,
-				}
+				},
+				.stats = lock_stats_create(LOCK_STATS_CONDVAR),
 			);
 
 #ifdef HAVE_PTHREAD_CONDATTR_INIT
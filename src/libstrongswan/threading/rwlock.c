@@ -16,6 +16,7 @@
 
 #define _GNU_SOURCE
 #include <pthread.h>
+#include <errno.h>
 
 #include <library.h>
 #include <utils/debug.h>
@@ -26,6 +27,7 @@
 #include "condvar.h"
 #include "mutex.h"
 #include "lock_profiler.h"
+#include "lock_stats.h"
 
 typedef struct private_rwlock_t private_rwlock_t;
 typedef struct private_rwlock_condvar_t private_rwlock_condvar_t;
@@ -85,6 +87,15 @@ struct private_rwlock_t {
 	 * profiling info, if enabled
 	 */
 	lock_profile_t profile;
+
+#ifdef HAVE_PTHREAD_RWLOCK_INIT
+
+	/**
+	 * runtime lock statistics
+	 */
+	lock_stats_t stats;
+
+#endif /* HAVE_PTHREAD_RWLOCK_INIT */
 };
 
 /**
@@ -111,13 +122,59 @@ struct private_rwlock_condvar_t {
 
 #ifdef HAVE_PTHREAD_RWLOCK_INIT
 
+/**
+ * Lock a pthread rwlock, collecting statistics
+ */
+static int lock_profiled(private_rwlock_t *this, bool write)
+{
+	timeval_t start;
+	int err;
+
+	if (write)
+	{
+		err = pthread_rwlock_trywrlock(&this->rwlock);
+	}
+	else
+	{
+		err = pthread_rwlock_tryrdlock(&this->rwlock);
+	}
+	if (err == EBUSY)
+	{
+		time_monotonic(&start);
+		if (write)
+		{
+			err = pthread_rwlock_wrlock(&this->rwlock);
+		}
+		else
+		{
+			err = pthread_rwlock_rdlock(&this->rwlock);
+		}
+		if (err == 0)
+		{	/* the holding time of readers is not measured */
+			lock_stats_acquired(&this->stats, &start, write);
+		}
+	}
+	else if (err == 0)
+	{
+		lock_stats_acquired(&this->stats, NULL, write);
+	}
+	return err;
+}
+
 METHOD(rwlock_t, read_lock, void,
 	private_rwlock_t *this)
 {
 	int err;
 
 	profiler_start(&this->profile);
-	err = pthread_rwlock_rdlock(&this->rwlock);
+	if (lock_stats_enabled)
+	{
+		err = lock_profiled(this, FALSE);
+	}
+	else
+	{
+		err = pthread_rwlock_rdlock(&this->rwlock);
+	}
 	if (err != 0)
 	{
 		DBG1(DBG_LIB, "!!! RWLOCK READ LOCK ERROR: %s !!!", strerror(err));
@@ -131,7 +188,14 @@ METHOD(rwlock_t, write_lock, void,
 	int err;
 
 	profiler_start(&this->profile);
-	err = pthread_rwlock_wrlock(&this->rwlock);
+	if (lock_stats_enabled)
+	{
+		err = lock_profiled(this, TRUE);
+	}
+	else
+	{
+		err = pthread_rwlock_wrlock(&this->rwlock);
+	}
 	if (err != 0)
 	{
 		DBG1(DBG_LIB, "!!! RWLOCK WRITE LOCK ERROR: %s !!!", strerror(err));
@@ -142,7 +206,15 @@ METHOD(rwlock_t, write_lock, void,
 METHOD(rwlock_t, try_write_lock, bool,
 	private_rwlock_t *this)
 {
-	return pthread_rwlock_trywrlock(&this->rwlock) == 0;
+	if (pthread_rwlock_trywrlock(&this->rwlock) == 0)
+	{
+		if (lock_stats_enabled)
+		{
+			lock_stats_acquired(&this->stats, NULL, TRUE);
+		}
+		return TRUE;
+	}
+	return FALSE;
 }
 
 METHOD(rwlock_t, unlock, void,
@@ -150,6 +222,8 @@ METHOD(rwlock_t, unlock, void,
 {
 	int err;
 
+	/* readers never set the acquisition time, so this is a writer */
+	lock_stats_released(&this->stats);
 	err = pthread_rwlock_unlock(&this->rwlock);
 	if (err != 0)
 	{
@@ -184,7 +258,8 @@ rwlock_t *rwlock_create(rwlock_type_t type)
 					.try_write_lock = _try_write_lock,
 					.unlock = _unlock,
 					.destroy = _destroy,
-				}
+				},
+				.stats = lock_stats_create(LOCK_STATS_RWLOCK),
 			);
 
 			pthread_rwlock_init(&this->rwlock, NULL);
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "arena.h"
+
+#include <string.h>
+
+/**
+ * Alignment of allocations, suitable for any pointer or 64-bit integer
+ */
+#define ALIGNMENT (sizeof(void*) > 8 ? sizeof(void*) : 8)
+
+/**
+ * Round up a size to the alignment
+ */
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+typedef struct private_arena_t private_arena_t;
+typedef struct block_t block_t;
+
+/**
+ * A block of memory to allocate from, data follows the aligned header
+ */
+struct block_t {
+
+	/**
+	 * Next, older block
+	 */
+	block_t *next;
+
+	/**
+	 * Usable size of the block
+	 */
+	size_t size;
+
+	/**
+	 * Bytes allocated from this block
+	 */
+	size_t used;
+};
+
+/**
+ * Size of the aligned block header
+ */
+#define BLOCK_HEADER ALIGN(sizeof(block_t))
+
+/**
+ * Private data of an arena_t object.
+ */
+struct private_arena_t {
+
+	/**
+	 * Public arena_t interface.
+	 */
+	arena_t public;
+
+	/**
+	 * Block we currently allocate from, links to older blocks
+	 */
+	block_t *current;
+
+	/**
+	 * First block, allocated along with the arena
+	 */
+	block_t *first;
+
+	/**
+	 * Size of new blocks
+	 */
+	size_t block;
+
+	/**
+	 * Bytes currently allocated
+	 */
+	size_t allocated;
+};
+
+/**
+ * Allocate a new block to satisfy an allocation of size bytes
+ */
+static block_t *new_block(private_arena_t *this, size_t size)
+{
+	block_t *block;
+
+	if (size > this->block)
+	{	/* dedicated block, insert behind current to keep using it */
+		block = malloc(BLOCK_HEADER + size);
+		block->size = size;
+		block->next = this->current->next;
+		this->current->next = block;
+	}
+	else
+	{
+		block = malloc(BLOCK_HEADER + this->block);
+		block->size = this->block;
+		block->next = this->current;
+		this->current = block;
+	}
+	block->used = 0;
+	return block;
+}
+
+METHOD(arena_t, alloc, void*,
+	private_arena_t *this, size_t size)
+{
+	block_t *block = this->current;
+	void *ptr;
+
+	size = ALIGN(size);
+	if (block->size - block->used < size)
+	{
+		block = new_block(this, size);
+	}
+	ptr = (char*)block + BLOCK_HEADER + block->used;
+	block->used += size;
+	this->allocated += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+METHOD(arena_t, clone_, chunk_t,
+	private_arena_t *this, chunk_t chunk)
+{
+	chunk_t clone = chunk_empty;
+
+	if (chunk.len)
+	{
+		clone = chunk_create(alloc(this, chunk.len), chunk.len);
+		memcpy(clone.ptr, chunk.ptr, chunk.len);
+	}
+	return clone;
+}
+
+METHOD(arena_t, get_size, size_t,
+	private_arena_t *this)
+{
+	return this->allocated;
+}
+
+METHOD(arena_t, reset, void,
+	private_arena_t *this)
+{
+	block_t *block;
+
+	while (this->current != this->first)
+	{
+		block = this->current;
+		this->current = block->next;
+		free(block);
+	}
+	while (this->first->next)
+	{	/* dedicated blocks inserted behind the first */
+		block = this->first->next;
+		this->first->next = block->next;
+		free(block);
+	}
+	this->first->used = 0;
+	this->allocated = 0;
+}
+
+METHOD(arena_t, destroy, void,
+	private_arena_t *this)
+{
+	reset(this);
+	free(this);
+}
+
+/**
+ * See header
+ */
+arena_t *arena_create(size_t block)
+{
+	private_arena_t *this;
+
+	block = ALIGN(max(block, ALIGNMENT));
+	this = malloc(ALIGN(sizeof(*this)) + BLOCK_HEADER + block);
+	*this = (private_arena_t){
+		.public = {
+			.alloc = _alloc,
+			.clone = _clone_,
+			.get_size = _get_size,
+			.reset = _reset,
+			.destroy = _destroy,
+		},
+		.first = (block_t*)((char*)this + ALIGN(sizeof(*this))),
+		.block = block,
+	};
+	*this->first = (block_t){
+		.size = block,
+	};
+	this->current = this->first;
+
+	return &this->public;
+}
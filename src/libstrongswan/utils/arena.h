@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013 Martin Willi
+ * Copyright (C) 2013 revosec AG
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup arena arena
+ * @{ @ingroup utils
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+typedef struct arena_t arena_t;
+
+#include <utils/chunk.h>
+
+/**
+ * Region based allocator, releasing all allocated memory at once.
+ *
+ * Memory is taken from blocks allocated on demand, allocations never get
+ * freed individually. This makes the arena suitable for many small,
+ * short-lived objects that share a common lifetime, e.g. the transient
+ * objects used while parsing or generating a message.
+ *
+ * The arena is not thread safe.
+ */
+struct arena_t {
+
+	/**
+	 * Allocate zero-initialized memory from the arena.
+	 *
+	 * @param size			number of bytes to allocate
+	 * @return				allocated memory, valid until reset()/destroy()
+	 */
+	void* (*alloc)(arena_t *this, size_t size);
+
+	/**
+	 * Clone a chunk to memory allocated from the arena.
+	 *
+	 * @param chunk			chunk to clone
+	 * @return				cloned chunk, valid until reset()/destroy()
+	 */
+	chunk_t (*clone)(arena_t *this, chunk_t chunk);
+
+	/**
+	 * Get the number of bytes currently allocated from the arena.
+	 *
+	 * @return				allocated bytes, including alignment
+	 */
+	size_t (*get_size)(arena_t *this);
+
+	/**
+	 * Release all allocations, but keep the first block for reuse.
+	 */
+	void (*reset)(arena_t *this);
+
+	/**
+	 * Destroy an arena_t, releasing all allocated memory.
+	 */
+	void (*destroy)(arena_t *this);
+};
+
+/**
+ * Create an arena_t.
+ *
+ * The first block gets allocated along with the arena, further blocks are
+ * allocated with the same size if required. Allocations larger than the
+ * block size get a block of their own.
+ *
+ * @param block			size of the blocks to allocate, in bytes
+ * @return				arena
+ */
+arena_t *arena_create(size_t block);
+
+#endif /** ARENA_H_ @}*/
@@ -226,6 +226,17 @@ struct identification_t {
 	 */
 	bool (*equals) (identification_t *this, identification_t *other);
 
+	/**
+	 * Hash an identification_t, consistent with equals().
+	 *
+	 * IDs considered equal by equals() return the same hash value, allowing
+	 * the use of identities as hashtable keys.
+	 *
+	 * @param inc		value to include in hash
+	 * @return			hash value
+	 */
+	u_int32_t (*hash) (identification_t *this, u_int32_t inc);
+
 	/**
 	 * Check if an ID matches a wildcard ID.
 	 *
@@ -28,6 +28,9 @@
 #include <pthread.h>
 #include <netdb.h>
 #include <locale.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "leak_detective.h"
 
@@ -370,10 +373,567 @@ static int print_traces(private_leak_detective_t *this,
 	return leaks;
 }
 
+/**
+ * Number of hash buckets for sampled allocations, a power of two
+ */
+#define SAMPLE_BUCKETS 65536
+
+/**
+ * Number of locks protecting sample buckets, a power of two
+ */
+#define SAMPLE_LOCKS 64
+
+/**
+ * Number of entries in top lists of the per-context summary
+ */
+#define SAMPLE_TOP 10
+
+/**
+ * Real allocator functions of the C library
+ */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+typedef struct sample_t sample_t;
+
+/**
+ * A sampled allocation
+ */
+struct sample_t {
+
+	/**
+	 * Next sample in the same bucket
+	 */
+	sample_t *next;
+
+	/**
+	 * Sampled memory
+	 */
+	void *ptr;
+
+	/**
+	 * Estimated number of bytes this sample represents
+	 */
+	size_t bytes;
+
+	/**
+	 * Backtrace of the allocation, shared by all samples of a callsite
+	 */
+	backtrace_t *backtrace;
+
+	/**
+	 * Context of the allocation, 0 for none
+	 */
+	u_int context;
+};
+
+/**
+ * Sample on average every sample_interval bytes allocated, 0 if not in
+ * sampling mode
+ */
+static size_t sample_interval = 0;
+
+/**
+ * Sampling temporarily enabled/disabled with set_state()
+ */
+static bool sampling = FALSE;
+
+/**
+ * Sampled allocations, hashed by address
+ */
+static sample_t *samples[SAMPLE_BUCKETS];
+
+/**
+ * Locks for sample buckets, raw pthread mutexes as mutex_t allocates memory
+ */
+static pthread_mutex_t sample_locks[SAMPLE_LOCKS];
+
+/**
+ * Backtraces of allocation callsites, backtrace_t => backtrace_t
+ */
+static hashtable_t *sample_sites;
+
+/**
+ * Lock for sample_sites
+ */
+static pthread_mutex_t sample_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Name of registered contexts
+ */
+static char *context_name;
+
+/**
+ * Callback returning the context of the calling thread
+ */
+static leak_detective_context_t context_cb;
+
+/**
+ * Callback returning the number of contexts
+ */
+static leak_detective_count_t count_cb;
+
+/**
+ * Bytes the calling thread allocates until it gets sampled next
+ */
+static __thread size_t sample_next;
+
+/**
+ * State of the pseudo random generator of the calling thread, 0 if unseeded
+ */
+static __thread u_int64_t sample_seed;
+
+/**
+ * Set while the calling thread samples or reports, suppresses sampling
+ */
+static __thread bool sample_busy;
+
+/**
+ * Get the bucket of an address
+ */
+static inline u_int sample_bucket(void *ptr)
+{
+	return ((uintptr_t)ptr >> 4) & (SAMPLE_BUCKETS - 1);
+}
+
+/**
+ * Natural logarithm of x in (0, 1], we don't link against libm
+ */
+static double sample_log(double x)
+{
+	double y, y2, sum = 0;
+	int i, n = 0;
+
+	while (x < 0.5)
+	{
+		x *= 2;
+		n++;
+	}
+	/* ln(x) = 2 * atanh((x - 1) / (x + 1)), converging fast for x >= 0.5 */
+	y = (x - 1) / (x + 1);
+	y2 = y * y;
+	for (i = 1; i < 20; i += 2)
+	{
+		sum += y / i;
+		y *= y2;
+	}
+	return 2 * sum - n * 0.69314718055994531;
+}
+
+/**
+ * Draw the number of bytes until the next sample from an exponential
+ * distribution, so that sampling doesn't align with allocation patterns
+ */
+static size_t sample_draw()
+{
+	u_int64_t x = sample_seed;
+	double u;
+
+	if (!x)
+	{	/* a thread-local address and the time are good enough as seed */
+		x = ((uintptr_t)&sample_seed ^ time(NULL)) | 1;
+	}
+	/* xorshift64*, uses no locks or memory as rand() might do */
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sample_seed = x;
+	u = (((x * 2685821657736338717ULL) >> 11) + 1) / 9007199254740992.0;
+	return min(-sample_log(u) * sample_interval, SIZE_MAX / 2);
+}
+
+/**
+ * Estimate the number of bytes a sampled allocation represents
+ */
+static size_t sample_weight(size_t bytes)
+{
+	double x, e;
+	int i, n = 0;
+
+	x = (double)bytes / sample_interval;
+	if (x > 32)
+	{
+		return bytes;
+	}
+	while (x > 0.125)
+	{
+		x /= 2;
+		n++;
+	}
+	/* exp(-x) with a short series, squared back n times */
+	e = 1 - x * (1 - x / 2 * (1 - x / 3 * (1 - x / 4)));
+	for (i = 0; i < n; i++)
+	{
+		e *= e;
+	}
+	/* an allocation gets sampled with a probability of 1 - exp(-x) */
+	if (e >= 1)
+	{
+		return max(bytes, sample_interval);
+	}
+	return max(bytes / (1 - e), bytes);
+}
+
+/**
+ * Check if an allocation gets sampled, marks the thread busy if so
+ */
+static inline bool sample_check(void *ptr, size_t bytes)
+{
+	if (!ptr || !sampling || sample_busy)
+	{
+		return FALSE;
+	}
+	if (!sample_seed)
+	{
+		sample_next = sample_draw();
+	}
+	if (bytes < sample_next)
+	{
+		sample_next -= bytes;
+		return FALSE;
+	}
+	sample_next = sample_draw();
+	sample_busy = TRUE;
+	return TRUE;
+}
+
+/**
+ * Record a sampled allocation, clears the busy flag of the thread
+ */
+static void sample_add(void *ptr, size_t bytes, backtrace_t *backtrace)
+{
+	backtrace_t *site;
+	leak_detective_context_t context = context_cb;
+	sample_t *sample;
+	u_int bucket;
+
+	pthread_mutex_lock(&sample_sites_lock);
+	site = sample_sites->get(sample_sites, backtrace);
+	if (site)
+	{
+		backtrace->destroy(backtrace);
+	}
+	else
+	{
+		site = backtrace;
+		sample_sites->put(sample_sites, site, site);
+	}
+	pthread_mutex_unlock(&sample_sites_lock);
+
+	sample = __libc_malloc(sizeof(sample_t));
+	if (sample)
+	{
+		*sample = (sample_t){
+			.ptr = ptr,
+			.bytes = sample_weight(bytes),
+			.backtrace = site,
+			.context = context ? context() : 0,
+		};
+		bucket = sample_bucket(ptr);
+		pthread_mutex_lock(&sample_locks[bucket & (SAMPLE_LOCKS - 1)]);
+		sample->next = samples[bucket];
+		samples[bucket] = sample;
+		pthread_mutex_unlock(&sample_locks[bucket & (SAMPLE_LOCKS - 1)]);
+	}
+	sample_busy = FALSE;
+}
+
+/**
+ * Remove the sample of an allocation getting freed, if any
+ */
+static void sample_remove(void *ptr)
+{
+	sample_t *sample = NULL, **prev;
+	u_int bucket;
+
+	bucket = sample_bucket(ptr);
+	if (!samples[bucket])
+	{	/* the common case, checked without locking. The allocation itself
+		 * can't get added concurrently, as it is just getting freed */
+		return;
+	}
+	pthread_mutex_lock(&sample_locks[bucket & (SAMPLE_LOCKS - 1)]);
+	for (prev = &samples[bucket]; *prev; prev = &(*prev)->next)
+	{
+		if ((*prev)->ptr == ptr)
+		{
+			sample = *prev;
+			*prev = sample->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sample_locks[bucket & (SAMPLE_LOCKS - 1)]);
+	__libc_free(sample);
+}
+
+/**
+ * Memory usage of a callsite or context, summarized from samples
+ */
+typedef struct {
+	/** backtrace of the callsite, NULL for contexts */
+	backtrace_t *backtrace;
+	/** context identifier, 0 for callsites */
+	u_int context;
+	/** estimated number of bytes in use */
+	size_t bytes;
+	/** estimated number of bytes in use, allocated within a context */
+	size_t context_bytes;
+	/** number of samples */
+	u_int count;
+} sample_usage_t;
+
+/**
+ * Hashtable hash function for pointers and context identifiers
+ */
+static u_int ptr_hash(void *key)
+{
+	return chunk_hash(chunk_from_thing(key));
+}
+
+/**
+ * Hashtable equals function for pointers and context identifiers
+ */
+static bool ptr_equals(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Sort usage by bytes, descending
+ */
+static int usage_cmp(const void *a, const void *b)
+{
+	const sample_usage_t *ua = *(sample_usage_t**)a, *ub = *(sample_usage_t**)b;
+
+	if (ua->bytes == ub->bytes)
+	{
+		return 0;
+	}
+	return ua->bytes > ub->bytes ? -1 : 1;
+}
+
+/**
+ * Sort usage by bytes allocated within contexts, descending
+ */
+static int context_usage_cmp(const void *a, const void *b)
+{
+	const sample_usage_t *ua = *(sample_usage_t**)a, *ub = *(sample_usage_t**)b;
+
+	if (ua->context_bytes == ub->context_bytes)
+	{
+		return 0;
+	}
+	return ua->context_bytes > ub->context_bytes ? -1 : 1;
+}
+
+/**
+ * Get the usage entries of a hashtable as sorted array
+ */
+static sample_usage_t **sort_usage(hashtable_t *table,
+								   int (*cmp)(const void*, const void*))
+{
+	enumerator_t *enumerator;
+	sample_usage_t **sorted, *usage;
+	int i = 0;
+
+	sorted = malloc(sizeof(sample_usage_t*) * max(table->get_count(table), 1));
+	enumerator = table->create_enumerator(table);
+	while (enumerator->enumerate(enumerator, NULL, &usage))
+	{
+		sorted[i++] = usage;
+	}
+	enumerator->destroy(enumerator);
+	qsort(sorted, i, sizeof(sample_usage_t*), cmp);
+	return sorted;
+}
+
+/**
+ * Destroy a hashtable and the usage entries it contains
+ */
+static void destroy_usage(hashtable_t *table)
+{
+	enumerator_t *enumerator;
+	sample_usage_t *usage;
+
+	enumerator = table->create_enumerator(table);
+	while (enumerator->enumerate(enumerator, NULL, &usage))
+	{
+		free(usage);
+	}
+	enumerator->destroy(enumerator);
+	table->destroy(table);
+}
+
+/**
+ * Copy all samples, returns the number of samples copied
+ */
+static u_int copy_samples(sample_t **copy)
+{
+	sample_t *sample;
+	u_int i, count = 0;
+
+	/* we hold all locks while allocating, which does not lock any of them */
+	for (i = 0; i < SAMPLE_LOCKS; i++)
+	{
+		pthread_mutex_lock(&sample_locks[i]);
+	}
+	for (i = 0; i < SAMPLE_BUCKETS; i++)
+	{
+		for (sample = samples[i]; sample; sample = sample->next)
+		{
+			count++;
+		}
+	}
+	*copy = malloc(sizeof(sample_t) * max(count, 1));
+	count = 0;
+	for (i = 0; i < SAMPLE_BUCKETS; i++)
+	{
+		for (sample = samples[i]; sample; sample = sample->next)
+		{
+			(*copy)[count++] = *sample;
+		}
+	}
+	for (i = 0; i < SAMPLE_LOCKS; i++)
+	{
+		pthread_mutex_unlock(&sample_locks[i]);
+	}
+	return count;
+}
+
+/**
+ * Print the per-context summary of sampled allocations
+ */
+static void print_contexts(FILE *out, char *name, hashtable_t *sites,
+						   hashtable_t *contexts, bool detailed)
+{
+	leak_detective_count_t count = count_cb;
+	sample_usage_t **sorted;
+	size_t total = 0;
+	u_int i, n;
+
+	sorted = sort_usage(contexts, usage_cmp);
+	n = contexts->get_count(contexts);
+	for (i = 0; i < n; i++)
+	{
+		total += sorted[i]->bytes;
+	}
+	/* most contexts probably have no sampled allocations */
+	if (count)
+	{
+		n = max(n, count());
+	}
+	fprintf(out, "%zu bytes in use by %u %ss, %zu bytes per %s\n",
+			total, n, name, total / n, name);
+	fprintf(out, "largest %ss:\n", name);
+	for (i = 0; i < contexts->get_count(contexts) && i < SAMPLE_TOP; i++)
+	{
+		fprintf(out, "  %s #%u: %zu bytes, %u samples\n", name,
+				sorted[i]->context, sorted[i]->bytes, sorted[i]->count);
+	}
+	free(sorted);
+
+	fprintf(out, "top allocators per %s:\n", name);
+	sorted = sort_usage(sites, context_usage_cmp);
+	for (i = 0; i < sites->get_count(sites) && i < SAMPLE_TOP &&
+				sorted[i]->context_bytes; i++)
+	{
+		fprintf(out, "%zu bytes per %s, %zu bytes total:\n",
+				sorted[i]->context_bytes / n, name,
+				sorted[i]->context_bytes);
+		sorted[i]->backtrace->log(sorted[i]->backtrace, out, detailed);
+	}
+	free(sorted);
+}
+
+/**
+ * Summarize and print sampled allocations
+ */
+static void print_samples(FILE *out, int thresh, bool detailed)
+{
+	hashtable_t *sites, *contexts;
+	sample_usage_t *usage, **sorted;
+	sample_t *copy;
+	char *name = context_name;
+	size_t total = 0;
+	u_int i, count;
+	bool busy;
+
+	busy = sample_busy;
+	sample_busy = TRUE;
+
+	sites = hashtable_create((hashtable_hash_t)ptr_hash,
+							 (hashtable_equals_t)ptr_equals, 1024);
+	contexts = hashtable_create((hashtable_hash_t)ptr_hash,
+								(hashtable_equals_t)ptr_equals, 1024);
+	count = copy_samples(&copy);
+	for (i = 0; i < count; i++)
+	{
+		usage = sites->get(sites, copy[i].backtrace);
+		if (!usage)
+		{
+			INIT(usage,
+				.backtrace = copy[i].backtrace,
+			);
+			sites->put(sites, usage->backtrace, usage);
+		}
+		usage->bytes += copy[i].bytes;
+		usage->count++;
+		total += copy[i].bytes;
+		if (copy[i].context)
+		{
+			usage->context_bytes += copy[i].bytes;
+			usage = contexts->get(contexts,
+								  (void*)(uintptr_t)copy[i].context);
+			if (!usage)
+			{
+				INIT(usage,
+					.context = copy[i].context,
+				);
+				contexts->put(contexts, (void*)(uintptr_t)usage->context,
+							  usage);
+			}
+			usage->bytes += copy[i].bytes;
+			usage->count++;
+		}
+	}
+	free(copy);
+
+	fprintf(out, "sampling every %zu bytes, %u samples, %zu bytes in use "
+			"(estimated)\n", sample_interval, count, total);
+	sorted = sort_usage(sites, usage_cmp);
+	for (i = 0; i < sites->get_count(sites); i++)
+	{
+		if (thresh && sorted[i]->bytes < thresh)
+		{
+			break;
+		}
+		fprintf(out, "%zu bytes total, %u samples:\n",
+				sorted[i]->bytes, sorted[i]->count);
+		sorted[i]->backtrace->log(sorted[i]->backtrace, out, detailed);
+	}
+	free(sorted);
+
+	if (name && contexts->get_count(contexts))
+	{
+		print_contexts(out, name, sites, contexts, detailed);
+	}
+	destroy_usage(contexts);
+	destroy_usage(sites);
+
+	sample_busy = busy;
+}
+
 METHOD(leak_detective_t, report, void,
 	private_leak_detective_t *this, bool detailed)
 {
-	if (lib->leak_detective)
+	if (sample_interval)
+	{
+		fprintf(stderr, "Leak detective in sampling mode, leaks not "
+				"reported\n");
+	}
+	else if (lib->leak_detective)
 	{
 		int leaks = 0, whitelisted = 0;
 
@@ -406,6 +966,13 @@ METHOD(leak_detective_t, set_state, bool,
 	struct sched_param params;
 	pthread_t thread_id;
 
+	if (sample_interval)
+	{
+		bool old = sampling;
+
+		sampling = enable;
+		return old;
+	}
 	if (enable == installed)
 	{
 		return installed;
@@ -440,6 +1007,12 @@ METHOD(leak_detective_t, usage, void,
 	detailed = lib->settings->get_bool(lib->settings,
 					"libstrongswan.leak_detective.detailed", TRUE);
 
+	if (sample_interval)
+	{
+		print_samples(out, thresh, detailed);
+		return;
+	}
+
 	pthread_getschedparam(thread_id, &oldpolicy, &oldparams);
 	params.__sched_priority = sched_get_priority_max(SCHED_FIFO);
 	pthread_setschedparam(thread_id, SCHED_FIFO, &params);
@@ -449,6 +1022,16 @@ METHOD(leak_detective_t, usage, void,
 	pthread_setschedparam(thread_id, oldpolicy, &oldparams);
 }
 
+METHOD(leak_detective_t, set_context, void,
+	private_leak_detective_t *this, char *name,
+	leak_detective_context_t context, leak_detective_count_t count)
+{
+	context_cb = NULL;
+	count_cb = count;
+	context_name = context ? name : NULL;
+	context_cb = context;
+}
+
 /**
  * Hook function for malloc()
  */
@@ -631,13 +1214,105 @@ void *realloc_hook(void *old, size_t bytes, const void *caller)
 	return hdr + 1;
 }
 
+/**
+ * Hook function for malloc(), replacing the C library version
+ */
+void *malloc(size_t bytes)
+{
+	void *ptr;
+
+	ptr = __libc_malloc(bytes);
+	if (sample_interval && sample_check(ptr, bytes))
+	{
+		sample_add(ptr, bytes, backtrace_create(2));
+	}
+	return ptr;
+}
+
+/**
+ * Hook function for calloc(), replacing the C library version
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	ptr = __libc_calloc(nmemb, size);
+	if (sample_interval && sample_check(ptr, nmemb * size))
+	{
+		sample_add(ptr, nmemb * size, backtrace_create(2));
+	}
+	return ptr;
+}
+
+/**
+ * Hook function for realloc(), replacing the C library version
+ */
+void *realloc(void *old, size_t bytes)
+{
+	void *ptr;
+
+	ptr = __libc_realloc(old, bytes);
+	/* a failing realloc() keeps the old allocation, and its sample */
+	if (sample_interval && old && (ptr || !bytes))
+	{
+		sample_remove(old);
+	}
+	if (sample_interval && sample_check(ptr, bytes))
+	{
+		sample_add(ptr, bytes, backtrace_create(2));
+	}
+	return ptr;
+}
+
+/**
+ * Hook function for free(), replacing the C library version
+ */
+void free(void *ptr)
+{
+	if (sample_interval && ptr)
+	{
+		sample_remove(ptr);
+	}
+	__libc_free(ptr);
+}
+
 METHOD(leak_detective_t, destroy, void,
 	private_leak_detective_t *this)
 {
+	enumerator_t *enumerator;
+	backtrace_t *backtrace;
+	sample_t *sample;
+	int i;
+
 	if (installed)
 	{
 		uninstall_hooks();
 	}
+	if (sample_interval)
+	{
+		sampling = FALSE;
+		sample_interval = 0;
+		for (i = 0; i < SAMPLE_BUCKETS; i++)
+		{
+			while (samples[i])
+			{
+				sample = samples[i];
+				samples[i] = sample->next;
+				__libc_free(sample);
+			}
+		}
+		enumerator = sample_sites->create_enumerator(sample_sites);
+		while (enumerator->enumerate(enumerator, NULL, &backtrace))
+		{
+			backtrace->destroy(backtrace);
+		}
+		enumerator->destroy(enumerator);
+		sample_sites->destroy(sample_sites);
+		for (i = 0; i < SAMPLE_LOCKS; i++)
+		{
+			pthread_mutex_destroy(&sample_locks[i]);
+		}
+	}
 	free(this);
 }
 
@@ -647,17 +1322,46 @@ METHOD(leak_detective_t, destroy, void,
 leak_detective_t *leak_detective_create()
 {
 	private_leak_detective_t *this;
+	char *sample, *end;
+	size_t interval = 0;
 
 	INIT(this,
 		.public = {
 			.report = _report,
 			.usage = _usage,
 			.set_state = _set_state,
+			.set_context = _set_context,
 			.destroy = _destroy,
 		},
 	);
 
-	if (getenv("LEAK_DETECTIVE_DISABLE") == NULL)
+	sample = getenv("LEAK_DETECTIVE_SAMPLE");
+	if (sample && getenv("LEAK_DETECTIVE_DISABLE") == NULL)
+	{
+		errno = 0;
+		interval = strtoul(sample, &end, 10);
+		if (!isdigit(*sample) || *end || errno || !interval)
+		{
+			fprintf(stderr, "invalid LEAK_DETECTIVE_SAMPLE interval '%s', "
+					"detecting leaks instead\n", sample);
+			interval = 0;
+		}
+	}
+	if (interval)
+	{
+		int i;
+
+		for (i = 0; i < SAMPLE_LOCKS; i++)
+		{
+			pthread_mutex_init(&sample_locks[i], NULL);
+		}
+		sample_sites = hashtable_create((hashtable_hash_t)hash,
+										(hashtable_equals_t)equals, 1024);
+		sampling = TRUE;
+		/* enables sampling, allocations until here are not tracked */
+		sample_interval = interval;
+	}
+	else if (getenv("LEAK_DETECTIVE_DISABLE") == NULL)
 	{
 		cpu_set_t mask;
 
@@ -25,11 +25,32 @@ typedef struct leak_detective_t leak_detective_t;
 
 #include <library.h>
 
+/**
+ * Callback function returning the context the calling thread works on.
+ *
+ * @return				unique context identifier, 0 for none
+ */
+typedef u_int (*leak_detective_context_t)(void);
+
+/**
+ * Callback function returning the number of existing contexts.
+ *
+ * @return				number of contexts
+ */
+typedef u_int (*leak_detective_count_t)(void);
+
 /**
  * Leak detective finds leaks and bad frees using malloc hooks.
  *
  * Currently leaks are reported to stderr on destruction.
  *
+ * If the LEAK_DETECTIVE_SAMPLE environment variable is set to a number of
+ * bytes N, leak detective runs as sampling heap profiler instead. It then
+ * records a backtrace for an allocation about every N bytes allocated only,
+ * at randomized intervals, and reports the estimated memory in use per
+ * allocation callsite. An invalid N falls back to leak detection. The overhead is low
+ * enough to use it in production, but leaks and bad frees are not reported.
+ *
  * @todo Build an API for leak detective, allowing leak enumeration, statistics
  * and dynamic whitelisting.
  */
@@ -57,6 +78,21 @@ struct leak_detective_t {
 	 */
 	bool (*set_state)(leak_detective_t *this, bool enabled);
 
+	/**
+	 * Register callbacks to attribute sampled allocations to contexts.
+	 *
+	 * The usage report summarizes the allocations per context, and lists
+	 * the allocation callsites using most memory per context.
+	 *
+	 * @param name			name of a context, e.g. "IKE_SA"
+	 * @param context		callback returning context of the calling thread,
+	 *						NULL to unregister
+	 * @param count			callback returning number of contexts, or NULL
+	 */
+	void (*set_context)(leak_detective_t *this, char *name,
+						leak_detective_context_t context,
+						leak_detective_count_t count);
+
 	/**
 	 * Destroy a leak_detective instance.
 	 */
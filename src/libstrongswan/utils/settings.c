@@ -32,7 +32,10 @@
 #include "settings.h"
 
 #include "collections/linked_list.h"
+#include "collections/hashtable.h"
 #include "threading/rwlock.h"
+#include "threading/mutex.h"
+#include "utils/chunk.h"
 #include "utils/debug.h"
 
 #define MAX_INCLUSION_LEVEL		10
@@ -65,6 +68,21 @@ struct private_settings_t {
 	 * lock to safely access the settings
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * generation of the settings tree, incremented on each modification
+	 */
+	volatile u_int generation;
+
+	/**
+	 * handles returned by get_handle(), settings_handle_t by key
+	 */
+	hashtable_t *handles;
+
+	/**
+	 * mutex to create and refresh handles
+	 */
+	mutex_t *handle_mutex;
 };
 
 /**
@@ -78,14 +96,50 @@ struct section_t {
 	char *name;
 
 	/**
-	 * subsections, as section_t
+	 * subsections, as section_t, in the order they were added
 	 */
 	linked_list_t *sections;
 
 	/**
-	 * key value pairs, as kv_t
+	 * subsections hashed by name, section_t
+	 */
+	hashtable_t *sections_by_name;
+
+	/**
+	 * key value pairs, as kv_t, in the order they were added
 	 */
 	linked_list_t *kv;
+
+	/**
+	 * key value pairs hashed by key, kv_t
+	 */
+	hashtable_t *kv_by_key;
+};
+
+/**
+ * Handle to a key, caching its value for a generation of the settings tree
+ */
+struct settings_handle_t {
+
+	/**
+	 * settings the handle belongs to
+	 */
+	private_settings_t *settings;
+
+	/**
+	 * formatted sections and key, each terminated by '\0'
+	 */
+	chunk_t components;
+
+	/**
+	 * cached value, valid if generation matches the settings generation
+	 */
+	char * volatile value;
+
+	/**
+	 * generation of the settings the value has been resolved for
+	 */
+	volatile u_int generation;
 };
 
 /**
@@ -126,6 +180,22 @@ static void kv_destroy(kv_t *this)
 	free(this);
 }
 
+/**
+ * Hash function for section names and keys
+ */
+static u_int hash_name(char *name)
+{
+	return chunk_hash(chunk_create(name, strlen(name)));
+}
+
+/**
+ * Comparison function for section names and keys
+ */
+static bool equals_name(char *a, char *b)
+{
+	return streq(a, b);
+}
+
 /**
  * create a section with the given name
  */
@@ -135,7 +205,11 @@ static section_t *section_create(char *name)
 	INIT(this,
 		.name = strdupnull(name),
 		.sections = linked_list_create(),
+		.sections_by_name = hashtable_create((hashtable_hash_t)hash_name,
+									(hashtable_equals_t)equals_name, 4),
 		.kv = linked_list_create(),
+		.kv_by_key = hashtable_create((hashtable_hash_t)hash_name,
+									(hashtable_equals_t)equals_name, 4),
 	);
 	return this;
 }
@@ -146,7 +220,9 @@ static section_t *section_create(char *name)
 static void section_destroy(section_t *this)
 {
 	this->kv->destroy_function(this->kv, (void*)kv_destroy);
+	this->kv_by_key->destroy(this->kv_by_key);
 	this->sections->destroy_function(this->sections, (void*)section_destroy);
+	this->sections_by_name->destroy(this->sections_by_name);
 	free(this->name);
 	free(this);
 }
@@ -158,24 +234,48 @@ static void section_purge(section_t *this)
 {
 	this->kv->destroy_function(this->kv, (void*)kv_destroy);
 	this->kv = linked_list_create();
+	this->kv_by_key->destroy(this->kv_by_key);
+	this->kv_by_key = hashtable_create((hashtable_hash_t)hash_name,
+									(hashtable_equals_t)equals_name, 4);
 	this->sections->destroy_function(this->sections, (void*)section_destroy);
 	this->sections = linked_list_create();
+	this->sections_by_name->destroy(this->sections_by_name);
+	this->sections_by_name = hashtable_create((hashtable_hash_t)hash_name,
+									(hashtable_equals_t)equals_name, 4);
+}
+
+/**
+ * Find a subsection by name
+ */
+static inline section_t *section_get_section(section_t *this, char *name)
+{
+	return this->sections_by_name->get(this->sections_by_name, name);
+}
+
+/**
+ * Add a subsection, which must not exist yet
+ */
+static void section_add_section(section_t *this, section_t *sub)
+{
+	this->sections->insert_last(this->sections, sub);
+	this->sections_by_name->put(this->sections_by_name, sub->name, sub);
 }
 
 /**
- * callback to find a section by name
+ * Find a key/value pair by key
  */
-static bool section_find(section_t *this, char *name)
+static inline kv_t *section_get_kv(section_t *this, char *key)
 {
-	return streq(this->name, name);
+	return this->kv_by_key->get(this->kv_by_key, key);
 }
 
 /**
- * callback to find a kv pair by key
+ * Add a key/value pair, which must not exist yet
  */
-static bool kv_find(kv_t *this, char *key)
+static void section_add_kv(section_t *this, kv_t *kv)
 {
-	return streq(this->key, key);
+	this->kv->insert_last(this->kv, kv);
+	this->kv_by_key->put(this->kv_by_key, kv->key, kv);
 }
 
 /**
@@ -251,15 +351,11 @@ static section_t *find_section_buffered(section_t *section,
 	{
 		return NULL;
 	}
-	if (section->sections->find_first(section->sections,
-									  (linked_list_match_t)section_find,
-									  (void**)&found, buf) != SUCCESS)
+	found = section_get_section(section, buf);
+	if (!found && ensure)
 	{
-		if (ensure)
-		{
-			found = section_create(buf);
-			section->sections->insert_last(section->sections, found);
-		}
+		found = section_create(buf);
+		section_add_section(section, found);
 	}
 	if (found && pos)
 	{
@@ -336,16 +432,15 @@ static kv_t *find_value_buffered(section_t *section, char *start, char *key,
 		{
 			return NULL;
 		}
-		if (section->sections->find_first(section->sections,
-										  (linked_list_match_t)section_find,
-										  (void**)&found, buf) != SUCCESS)
+		found = section_get_section(section, buf);
+		if (!found)
 		{
 			if (!ensure)
 			{
 				return NULL;
 			}
 			found = section_create(buf);
-			section->sections->insert_last(section->sections, found);
+			section_add_section(section, found);
 		}
 		return find_value_buffered(found, start, pos, args, buf, len,
 								   ensure);
@@ -356,14 +451,11 @@ static kv_t *find_value_buffered(section_t *section, char *start, char *key,
 		{
 			return NULL;
 		}
-		if (section->kv->find_first(section->kv, (linked_list_match_t)kv_find,
-									(void**)&kv, buf) != SUCCESS)
+		kv = section_get_kv(section, buf);
+		if (!kv && ensure)
 		{
-			if (ensure)
-			{
-				kv = kv_create(buf, NULL);
-				section->kv->insert_last(section->kv, kv);
-			}
+			kv = kv_create(buf, NULL);
+			section_add_kv(section, kv);
 		}
 	}
 	return kv;
@@ -425,6 +517,7 @@ static void set_value(private_settings_t *this, section_t *section,
 			this->contents->insert_last(this->contents, kv->value);
 		}
 	}
+	this->generation++;
 	this->lock->unlock(this->lock);
 }
 
@@ -644,6 +737,174 @@ METHOD(settings_t, set_time, void,
 	va_end(args);
 }
 
+/**
+ * Format the sections and the key of a handle, consuming all arguments
+ */
+static bool print_components(char *key, va_list args, chunk_t *components)
+{
+	char buf[512], keybuf[512], *start, *pos;
+	int len = 0;
+
+	if (snprintf(keybuf, sizeof(keybuf), "%s", key) >= sizeof(keybuf))
+	{
+		return FALSE;
+	}
+	start = key = keybuf;
+	while (key)
+	{
+		pos = strchr(key, '.');
+		if (pos)
+		{
+			*pos = '\0';
+			pos++;
+		}
+		if (!print_key(buf + len, sizeof(buf) - len, start, key, args))
+		{
+			return FALSE;
+		}
+		len += strlen(buf + len) + 1;
+		key = pos;
+	}
+	*components = chunk_clone(chunk_create(buf, len));
+	return TRUE;
+}
+
+/**
+ * Hash function for handles
+ */
+static u_int handle_hash(chunk_t *components)
+{
+	return chunk_hash(*components);
+}
+
+/**
+ * Comparison function for handles
+ */
+static bool handle_equals(chunk_t *a, chunk_t *b)
+{
+	return chunk_equals(*a, *b);
+}
+
+METHOD(settings_t, get_handle, settings_handle_t*,
+	   private_settings_t *this, char *key, ...)
+{
+	settings_handle_t *handle;
+	chunk_t components;
+	va_list args;
+	bool ok;
+
+	va_start(args, key);
+	ok = print_components(key, args, &components);
+	va_end(args);
+	if (!ok)
+	{
+		return NULL;
+	}
+	this->handle_mutex->lock(this->handle_mutex);
+	handle = this->handles->get(this->handles, &components);
+	if (handle)
+	{
+		free(components.ptr);
+	}
+	else
+	{
+		INIT(handle,
+			.settings = this,
+			.components = components,
+		);
+		this->handles->put(this->handles, &handle->components, handle);
+	}
+	this->handle_mutex->unlock(this->handle_mutex);
+	return handle;
+}
+
+/**
+ * Look up the value of a handle in the tree, requires the read lock
+ */
+static char *resolve_handle(settings_handle_t *handle)
+{
+	section_t *section = handle->settings->top;
+	char *pos, *next, *end;
+	kv_t *kv;
+
+	pos = handle->components.ptr;
+	end = pos + handle->components.len;
+	while (section)
+	{
+		next = pos + strlen(pos) + 1;
+		if (next >= end)
+		{
+			kv = section_get_kv(section, pos);
+			return kv ? kv->value : NULL;
+		}
+		section = section_get_section(section, pos);
+		pos = next;
+	}
+	return NULL;
+}
+
+/**
+ * Described in header
+ */
+char *settings_handle_get_str(settings_handle_t *handle, char *def)
+{
+	private_settings_t *this;
+	char *value;
+
+	if (!handle)
+	{
+		return def;
+	}
+	this = handle->settings;
+	if (handle->generation != this->generation)
+	{	/* the tree changed since we cached the value, look it up again */
+		this->handle_mutex->lock(this->handle_mutex);
+		this->lock->read_lock(this->lock);
+		if (handle->generation != this->generation)
+		{
+			handle->value = resolve_handle(handle);
+			handle->generation = this->generation;
+		}
+		this->lock->unlock(this->lock);
+		this->handle_mutex->unlock(this->handle_mutex);
+	}
+	value = handle->value;
+	return value ?: def;
+}
+
+/**
+ * Described in header
+ */
+bool settings_handle_get_bool(settings_handle_t *handle, bool def)
+{
+	return settings_value_as_bool(settings_handle_get_str(handle, NULL), def);
+}
+
+/**
+ * Described in header
+ */
+int settings_handle_get_int(settings_handle_t *handle, int def)
+{
+	return settings_value_as_int(settings_handle_get_str(handle, NULL), def);
+}
+
+/**
+ * Described in header
+ */
+double settings_handle_get_double(settings_handle_t *handle, double def)
+{
+	return settings_value_as_double(settings_handle_get_str(handle, NULL),
+									def);
+}
+
+/**
+ * Described in header
+ */
+u_int32_t settings_handle_get_time(settings_handle_t *handle, u_int32_t def)
+{
+	return settings_value_as_time(settings_handle_get_str(handle, NULL), def);
+}
+
 /**
  * Enumerate section names, not sections
  */
@@ -861,15 +1122,13 @@ static bool parse_section(linked_list_t *contents, char *file, int level,
 							 section->name);
 						continue;
 					}
-					if (section->sections->find_first(section->sections,
-											(linked_list_match_t)section_find,
-											(void**)&sub, key) != SUCCESS)
+					sub = section_get_section(section, key);
+					if (!sub)
 					{
 						sub = section_create(key);
 						if (parse_section(contents, file, level, &inner, sub))
 						{
-							section->sections->insert_last(section->sections,
-														   sub);
+							section_add_section(section, sub);
 							continue;
 						}
 						section_destroy(sub);
@@ -896,12 +1155,11 @@ static bool parse_section(linked_list_t *contents, char *file, int level,
 							 section->name);
 						continue;
 					}
-					if (section->kv->find_first(section->kv,
-								(linked_list_match_t)kv_find,
-								(void**)&kv, key) != SUCCESS)
+					kv = section_get_kv(section, key);
+					if (!kv)
 					{
 						kv = kv_create(key, value);
-						section->kv->insert_last(section->kv, kv);
+						section_add_kv(section, kv);
 					}
 					else
 					{	/* replace with the most recently read value */
@@ -1076,16 +1334,18 @@ static void section_extend(section_t *base, section_t *extension)
 	while (enumerator->enumerate(enumerator, (void**)&sec))
 	{
 		section_t *found;
-		if (base->sections->find_first(base->sections,
-					(linked_list_match_t)section_find, (void**)&found,
-					sec->name) == SUCCESS)
+
+		found = section_get_section(base, sec->name);
+		if (found)
 		{
 			section_extend(found, sec);
 		}
 		else
 		{
 			extension->sections->remove_at(extension->sections, enumerator);
-			base->sections->insert_last(base->sections, sec);
+			extension->sections_by_name->remove(extension->sections_by_name,
+												sec->name);
+			section_add_section(base, sec);
 		}
 	}
 	enumerator->destroy(enumerator);
@@ -1094,15 +1354,17 @@ static void section_extend(section_t *base, section_t *extension)
 	while (enumerator->enumerate(enumerator, (void**)&kv))
 	{
 		kv_t *found;
-		if (base->kv->find_first(base->kv, (linked_list_match_t)kv_find,
-					(void**)&found, kv->key) == SUCCESS)
+
+		found = section_get_kv(base, kv->key);
+		if (found)
 		{
 			found->value = kv->value;
 		}
 		else
 		{
 			extension->kv->remove_at(extension->kv, enumerator);
-			base->kv->insert_last(base->kv, kv);
+			extension->kv_by_key->remove(extension->kv_by_key, kv->key);
+			section_add_kv(base, kv);
 		}
 	}
 	enumerator->destroy(enumerator);
@@ -1151,6 +1413,8 @@ static bool load_files_internal(private_settings_t *this, section_t *parent,
 	{
 		this->contents->insert_last(this->contents, text);
 	}
+	/* invalidate the values cached in handles */
+	this->generation++;
 	this->lock->unlock(this->lock);
 
 	section_destroy(section);
@@ -1184,6 +1448,18 @@ METHOD(settings_t, load_files_section, bool,
 METHOD(settings_t, destroy, void,
 	   private_settings_t *this)
 {
+	enumerator_t *enumerator;
+	settings_handle_t *handle;
+
+	enumerator = this->handles->create_enumerator(this->handles);
+	while (enumerator->enumerate(enumerator, NULL, &handle))
+	{
+		free(handle->components.ptr);
+		free(handle);
+	}
+	enumerator->destroy(enumerator);
+	this->handles->destroy(this->handles);
+	this->handle_mutex->destroy(this->handle_mutex);
 	section_destroy(this->top);
 	this->contents->destroy_function(this->contents, (void*)free);
 	this->lock->destroy(this->lock);
@@ -1204,6 +1480,7 @@ settings_t *settings_create(char *file)
 			.get_double = _get_double,
 			.get_time = _get_time,
 			.get_bool = _get_bool,
+			.get_handle = _get_handle,
 			.set_str = _set_str,
 			.set_int = _set_int,
 			.set_double = _set_double,
@@ -1218,6 +1495,10 @@ settings_t *settings_create(char *file)
 		.top = section_create(NULL),
 		.contents = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.generation = 1,
+		.handles = hashtable_create((hashtable_hash_t)handle_hash,
+									(hashtable_equals_t)handle_equals, 8),
+		.handle_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	load_files(this, file, FALSE);
@@ -23,6 +23,7 @@
 #define SETTINGS_H_
 
 typedef struct settings_t settings_t;
+typedef struct settings_handle_t settings_handle_t;
 
 #include "utils.h"
 #include "collections/enumerator.h"
@@ -67,6 +68,60 @@ double settings_value_as_double(char *value, double def);
  */
 u_int32_t settings_value_as_time(char *value, u_int32_t def);
 
+/**
+ * Get the value of a key resolved with settings_t.get_handle() as a string.
+ *
+ * The value is looked up once after the settings have been modified or
+ * reloaded, subsequent calls return the cached value without formatting the
+ * key or locking the settings.
+ *
+ * @see settings_t.get_str()
+ * @param handle		handle to the key, NULL to return def
+ * @param def			value returned if key not found
+ * @return				value pointing to internal string
+ */
+char *settings_handle_get_str(settings_handle_t *handle, char *def);
+
+/**
+ * Get the value of a key resolved with settings_t.get_handle() as boolean.
+ *
+ * @see settings_t.get_bool()
+ * @param handle		handle to the key, NULL to return def
+ * @param def			value returned if key not found
+ * @return				value of the key
+ */
+bool settings_handle_get_bool(settings_handle_t *handle, bool def);
+
+/**
+ * Get the value of a key resolved with settings_t.get_handle() as integer.
+ *
+ * @see settings_t.get_int()
+ * @param handle		handle to the key, NULL to return def
+ * @param def			value returned if key not found
+ * @return				value of the key
+ */
+int settings_handle_get_int(settings_handle_t *handle, int def);
+
+/**
+ * Get the value of a key resolved with settings_t.get_handle() as double.
+ *
+ * @see settings_t.get_double()
+ * @param handle		handle to the key, NULL to return def
+ * @param def			value returned if key not found
+ * @return				value of the key
+ */
+double settings_handle_get_double(settings_handle_t *handle, double def);
+
+/**
+ * Get the value of a key resolved with settings_t.get_handle() as time value.
+ *
+ * @see settings_t.get_time()
+ * @param handle		handle to the key, NULL to return def
+ * @param def			value returned if key not found
+ * @return				value of the key
+ */
+u_int32_t settings_handle_get_time(settings_handle_t *handle, u_int32_t def);
+
 /**
  * Generic configuration options read from a config file.
  *
@@ -193,6 +248,21 @@ struct settings_t {
 	 */
 	u_int32_t (*get_time)(settings_t *this, char *key, u_int32_t def, ...);
 
+	/**
+	 * Get a handle to a key, to read its value repeatedly.
+	 *
+	 * The key is formatted once, the handle may be used with the
+	 * settings_handle_get_*() functions to read the current value of the key,
+	 * even if it does not exist yet or the settings get reloaded.
+	 * Handles for the same key are shared, they are owned by the settings and
+	 * stay valid until the settings get destroyed.
+	 *
+	 * @param key		key including sections, printf style format
+	 * @param ...		argument list for key
+	 * @return			handle to the key, NULL if key is too long
+	 */
+	settings_handle_t* (*get_handle)(settings_t *this, char *key, ...);
+
 	/**
 	 * Set a string value.
 	 *
@@ -45,7 +45,10 @@ ENUM_BEGIN(tls_handshake_type_names, TLS_HELLO_REQUEST, TLS_SERVER_HELLO,
 	"ClientHello",
 	"ServerHello");
 ENUM_NEXT(tls_handshake_type_names,
-		TLS_CERTIFICATE, TLS_CLIENT_KEY_EXCHANGE, TLS_SERVER_HELLO,
+		TLS_NEW_SESSION_TICKET, TLS_NEW_SESSION_TICKET, TLS_SERVER_HELLO,
+	"NewSessionTicket");
+ENUM_NEXT(tls_handshake_type_names,
+		TLS_CERTIFICATE, TLS_CLIENT_KEY_EXCHANGE, TLS_NEW_SESSION_TICKET,
 	"Certificate",
 	"ServerKeyExchange",
 	"CertificateRequest",
@@ -74,8 +77,12 @@ ENUM_NEXT(tls_extension_names,
 		TLS_EXT_EC_POINT_FORMATS,
 	"signature algorithms");
 ENUM_NEXT(tls_extension_names,
-		TLS_EXT_RENEGOTIATION_INFO, TLS_EXT_RENEGOTIATION_INFO,
+		TLS_EXT_SESSION_TICKET, TLS_EXT_SESSION_TICKET,
 		TLS_EXT_SIGNATURE_ALGORITHMS,
+	"session ticket");
+ENUM_NEXT(tls_extension_names,
+		TLS_EXT_RENEGOTIATION_INFO, TLS_EXT_RENEGOTIATION_INFO,
+		TLS_EXT_SESSION_TICKET,
 	"renegotiation info");
 ENUM_END(tls_extension_names, TLS_EXT_RENEGOTIATION_INFO);
 
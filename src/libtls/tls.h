@@ -81,6 +81,7 @@ enum tls_handshake_type_t {
 	TLS_HELLO_REQUEST = 0,
 	TLS_CLIENT_HELLO = 1,
 	TLS_SERVER_HELLO = 2,
+	TLS_NEW_SESSION_TICKET = 4,
 	TLS_CERTIFICATE = 11,
 	TLS_SERVER_KEY_EXCHANGE = 12,
 	TLS_CERTIFICATE_REQUEST = 13,
@@ -133,6 +134,8 @@ enum tls_extension_t {
 	TLS_EXT_EC_POINT_FORMATS = 11,
 	/** list supported signature algorithms */
 	TLS_EXT_SIGNATURE_ALGORITHMS = 13,
+	/** RFC 5077 stateless session resumption ticket */
+	TLS_EXT_SESSION_TICKET = 35,
 	/** cryptographic binding for RFC 5746 renegotiation indication */
 	TLS_EXT_RENEGOTIATION_INFO = 65281,
 };
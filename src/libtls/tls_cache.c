@@ -16,12 +16,43 @@
 #include "tls_cache.h"
 
 #include <utils/debug.h>
+#include <bio/bio_reader.h>
+#include <bio/bio_writer.h>
 #include <collections/linked_list.h>
 #include <collections/hashtable.h>
 #include <threading/rwlock.h>
 
+/**
+ * Size of a ticket key name
+ */
+#define TICKET_NAME_SIZE 16
+
+/**
+ * Size of the AES-128-CBC ticket encryption key
+ */
+#define TICKET_ENCR_KEY_SIZE 16
+
+/**
+ * Size of the HMAC-SHA-256 ticket authentication key
+ */
+#define TICKET_MAC_KEY_SIZE 32
+
 typedef struct private_tls_cache_t private_tls_cache_t;
 
+/**
+ * Key protecting session tickets
+ */
+typedef struct {
+	/** key name, prefixed to tickets to select the key */
+	char name[TICKET_NAME_SIZE];
+	/** encryption key */
+	char encr[TICKET_ENCR_KEY_SIZE];
+	/** authentication key */
+	char mac[TICKET_MAC_KEY_SIZE];
+	/** time of key creation */
+	time_t created;
+} ticket_key_t;
+
 /**
  * Private data of an tls_cache_t object.
  */
@@ -37,13 +68,18 @@ struct private_tls_cache_t {
 	 */
 	hashtable_t *table;
 
+	/**
+	 * Mapping identity => most recent entry_t, fast lookup by identity
+	 */
+	hashtable_t *ids;
+
 	/**
 	 * List containing all entries
 	 */
 	linked_list_t *list;
 
 	/**
-	 * Lock to list and table
+	 * Lock to list, tables and ticket keys
 	 */
 	rwlock_t *lock;
 
@@ -56,6 +92,16 @@ struct private_tls_cache_t {
 	 * maximum age of a session, in seconds
 	 */
 	u_int max_age;
+
+	/**
+	 * Current ticket key, NULL if none created yet
+	 */
+	ticket_key_t *current;
+
+	/**
+	 * Previous ticket key, still accepted for tickets, or NULL
+	 */
+	ticket_key_t *previous;
 };
 
 /**
@@ -70,6 +116,8 @@ typedef struct {
 	tls_cipher_suite_t suite;
 	/** optional identity this entry is bound to */
 	identification_t *id;
+	/** session ticket received for this session, if any */
+	chunk_t ticket;
 	/** time of add */
 	time_t t;
 } entry_t;
@@ -81,6 +129,7 @@ static void entry_destroy(entry_t *entry)
 {
 	chunk_clear(&entry->session);
 	chunk_clear(&entry->master);
+	chunk_free(&entry->ticket);
 	DESTROY_IF(entry->id);
 	free(entry);
 }
@@ -101,6 +150,37 @@ static bool equals(chunk_t *a, chunk_t *b)
 	return chunk_equals(*a, *b);
 }
 
+/**
+ * Identity hashtable hash function
+ */
+static u_int id_hash(identification_t *id)
+{
+	return chunk_hash(id->get_encoding(id));
+}
+
+/**
+ * Identity hashtable equals function
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Remove an entry from the tables, if it is the one they point to
+ */
+static void unindex_entry(private_tls_cache_t *this, entry_t *entry)
+{
+	if (this->table->get(this->table, &entry->session) == entry)
+	{
+		this->table->remove(this->table, &entry->session);
+	}
+	if (entry->id && this->ids->get(this->ids, entry->id) == entry)
+	{
+		this->ids->remove(this->ids, entry->id);
+	}
+}
+
 METHOD(tls_cache_t, create_, void,
 	private_tls_cache_t *this, chunk_t session, identification_t *id,
 	chunk_t master, tls_cipher_suite_t suite)
@@ -118,12 +198,16 @@ METHOD(tls_cache_t, create_, void,
 	this->lock->write_lock(this->lock);
 	this->list->insert_first(this->list, entry);
 	this->table->put(this->table, &entry->session, entry);
+	if (entry->id)
+	{
+		this->ids->put(this->ids, entry->id, entry);
+	}
 	if (this->list->get_count(this->list) > this->max_sessions &&
 		this->list->remove_last(this->list, (void**)&entry) == SUCCESS)
 	{
 		DBG2(DBG_TLS, "session limit of %u reached, deleting %#B",
 			 this->max_sessions, &entry->session);
-		this->table->remove(this->table, &entry->session);
+		unindex_entry(this, entry);
 		entry_destroy(entry);
 	}
 	this->lock->unlock(this->lock);
@@ -171,31 +255,302 @@ METHOD(tls_cache_t, lookup, tls_cipher_suite_t,
 }
 
 METHOD(tls_cache_t, check, chunk_t,
-	private_tls_cache_t *this, identification_t *id)
+	private_tls_cache_t *this, identification_t *id, chunk_t *ticket)
 {
 	chunk_t session = chunk_empty;
-	enumerator_t *enumerator;
 	entry_t *entry;
 	time_t now;
 
 	now = time_monotonic(NULL);
 	this->lock->read_lock(this->lock);
-	enumerator = this->list->create_enumerator(this->list);
-	while (enumerator->enumerate(enumerator, &entry))
+	entry = this->ids->get(this->ids, id);
+	if (entry && entry->t + this->max_age >= now)
 	{
-		if (entry->t + this->max_age >= now &&
-			entry->id && id->equals(id, entry->id))
+		session = chunk_clone(entry->session);
+		if (ticket)
 		{
-			session = chunk_clone(entry->session);
-			break;
+			*ticket = chunk_clone(entry->ticket);
 		}
 	}
-	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 
 	return session;
 }
 
+METHOD(tls_cache_t, set_ticket, void,
+	private_tls_cache_t *this, chunk_t session, chunk_t ticket)
+{
+	entry_t *entry;
+
+	this->lock->write_lock(this->lock);
+	entry = this->table->get(this->table, &session);
+	if (entry)
+	{
+		chunk_free(&entry->ticket);
+		entry->ticket = chunk_clone(ticket);
+	}
+	this->lock->unlock(this->lock);
+}
+
+/**
+ * Create crypter and signer for a ticket key
+ */
+static bool create_transforms(ticket_key_t *key, crypter_t **crypter,
+							  signer_t **signer)
+{
+	*crypter = lib->crypto->create_crypter(lib->crypto, ENCR_AES_CBC,
+										   TICKET_ENCR_KEY_SIZE);
+	*signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_SHA2_256_256);
+	if (!*crypter || !*signer)
+	{
+		DBG1(DBG_TLS, "AES-CBC/HMAC-SHA-256 not supported, session tickets "
+			 "disabled");
+	}
+	else if ((*crypter)->set_key(*crypter, chunk_from_thing(key->encr)) &&
+			 (*signer)->set_key(*signer, chunk_from_thing(key->mac)))
+	{
+		return TRUE;
+	}
+	DESTROY_IF(*crypter);
+	DESTROY_IF(*signer);
+	return FALSE;
+}
+
+/**
+ * Get a copy of the current ticket key, rotate keys if it is too old
+ */
+static bool get_current_key(private_tls_cache_t *this, ticket_key_t *key)
+{
+	ticket_key_t *new;
+	time_t now;
+	rng_t *rng;
+
+	now = time_monotonic(NULL);
+	this->lock->write_lock(this->lock);
+	if (!this->current || this->current->created + this->max_age < now)
+	{
+		INIT(new,
+			.created = now,
+		);
+		rng = lib->crypto->create_rng(lib->crypto, RNG_STRONG);
+		if (!rng ||
+			!rng->get_bytes(rng, sizeof(new->name), new->name) ||
+			!rng->get_bytes(rng, sizeof(new->encr), new->encr) ||
+			!rng->get_bytes(rng, sizeof(new->mac), new->mac))
+		{
+			DBG1(DBG_TLS, "generating TLS session ticket key failed");
+			DESTROY_IF(rng);
+			memwipe(new, sizeof(*new));
+			free(new);
+			this->lock->unlock(this->lock);
+			return FALSE;
+		}
+		rng->destroy(rng);
+		if (this->previous)
+		{
+			memwipe(this->previous, sizeof(ticket_key_t));
+			free(this->previous);
+		}
+		this->previous = this->current;
+		this->current = new;
+		DBG2(DBG_TLS, "rotated TLS session ticket key, new key %b",
+			 new->name, sizeof(new->name));
+	}
+	*key = *this->current;
+	this->lock->unlock(this->lock);
+	return TRUE;
+}
+
+/**
+ * Get a copy of the ticket key with the given name
+ */
+static bool get_named_key(private_tls_cache_t *this, chunk_t name,
+						  ticket_key_t *key)
+{
+	ticket_key_t *keys[] = { this->current, this->previous };
+	bool found = FALSE;
+	int i;
+
+	this->lock->read_lock(this->lock);
+	for (i = 0; i < countof(keys); i++)
+	{
+		if (keys[i] && memeq(keys[i]->name, name.ptr, sizeof(keys[i]->name)))
+		{
+			*key = *keys[i];
+			found = TRUE;
+			break;
+		}
+	}
+	this->lock->unlock(this->lock);
+	return found;
+}
+
+METHOD(tls_cache_t, seal_ticket, chunk_t,
+	private_tls_cache_t *this, identification_t *id, chunk_t master,
+	tls_cipher_suite_t suite)
+{
+	chunk_t ticket = chunk_empty, plain, encrypted, iv, mac;
+	bio_writer_t *writer;
+	ticket_key_t key;
+	crypter_t *crypter;
+	signer_t *signer;
+	size_t bs, padding, i;
+	rng_t *rng;
+
+	if (!get_current_key(this, &key))
+	{
+		return chunk_empty;
+	}
+	if (!create_transforms(&key, &crypter, &signer))
+	{
+		memwipe(&key, sizeof(key));
+		return chunk_empty;
+	}
+	memwipe(&key.encr, sizeof(key.encr));
+	memwipe(&key.mac, sizeof(key.mac));
+
+	/* suite, time of creation, master secret and bound identity */
+	writer = bio_writer_create(128);
+	writer->write_uint16(writer, suite);
+	writer->write_uint32(writer, time_monotonic(NULL));
+	writer->write_data8(writer, master);
+	writer->write_uint8(writer, id ? id->get_type(id) : ID_ANY);
+	writer->write_data16(writer, id ? id->get_encoding(id) : chunk_empty);
+	bs = crypter->get_block_size(crypter);
+	padding = bs - writer->get_buf(writer).len % bs;
+	for (i = 0; i < padding; i++)
+	{	/* PKCS#7 style padding, each byte denotes the padding length */
+		writer->write_uint8(writer, padding);
+	}
+	plain = writer->extract_buf(writer);
+	writer->destroy(writer);
+
+	iv = chunk_alloca(crypter->get_iv_size(crypter));
+	rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+	if (rng && rng->get_bytes(rng, iv.len, iv.ptr) &&
+		crypter->encrypt(crypter, plain, iv, &encrypted))
+	{
+		ticket = chunk_cat("ccm", chunk_from_thing(key.name), iv, encrypted);
+		if (signer->allocate_signature(signer, ticket, &mac))
+		{
+			ticket = chunk_cat("mm", ticket, mac);
+		}
+		else
+		{
+			chunk_free(&ticket);
+		}
+	}
+	if (!ticket.len)
+	{
+		DBG1(DBG_TLS, "creating TLS session ticket failed");
+	}
+	DESTROY_IF(rng);
+	chunk_clear(&plain);
+	crypter->destroy(crypter);
+	signer->destroy(signer);
+	return ticket;
+}
+
+METHOD(tls_cache_t, open_ticket, tls_cipher_suite_t,
+	private_tls_cache_t *this, chunk_t ticket, identification_t *id,
+	chunk_t *master)
+{
+	tls_cipher_suite_t suite = 0;
+	chunk_t name, iv, encrypted, mac, plain = chunk_empty, secret, encoding;
+	identification_t *bound = NULL;
+	bio_reader_t *reader;
+	ticket_key_t key;
+	crypter_t *crypter;
+	signer_t *signer;
+	u_int16_t suite16;
+	u_int32_t created;
+	u_int8_t type, padding;
+	size_t bs;
+	u_int age;
+
+	if (ticket.len <= TICKET_NAME_SIZE)
+	{
+		return 0;
+	}
+	name = chunk_create(ticket.ptr, TICKET_NAME_SIZE);
+	if (!get_named_key(this, name, &key))
+	{
+		DBG2(DBG_TLS, "TLS session ticket key %B unknown", &name);
+		return 0;
+	}
+	if (!create_transforms(&key, &crypter, &signer))
+	{
+		memwipe(&key, sizeof(key));
+		return 0;
+	}
+	memwipe(&key, sizeof(key));
+
+	bs = crypter->get_block_size(crypter);
+	iv.len = crypter->get_iv_size(crypter);
+	mac.len = signer->get_block_size(signer);
+	if (ticket.len < TICKET_NAME_SIZE + iv.len + bs + mac.len ||
+		(ticket.len - TICKET_NAME_SIZE - iv.len - mac.len) % bs)
+	{
+		DBG1(DBG_TLS, "received TLS session ticket has invalid length");
+		goto out;
+	}
+	iv.ptr = ticket.ptr + TICKET_NAME_SIZE;
+	mac.ptr = ticket.ptr + ticket.len - mac.len;
+	encrypted = chunk_create(iv.ptr + iv.len, mac.ptr - iv.ptr - iv.len);
+	if (!signer->verify_signature(signer,
+					chunk_create(ticket.ptr, ticket.len - mac.len), mac))
+	{
+		DBG1(DBG_TLS, "TLS session ticket integrity check failed");
+		goto out;
+	}
+	if (!crypter->decrypt(crypter, encrypted, iv, &plain))
+	{
+		goto out;
+	}
+	padding = plain.ptr[plain.len - 1];
+	if (padding == 0 || padding > plain.len)
+	{
+		DBG1(DBG_TLS, "TLS session ticket has invalid padding");
+		goto out;
+	}
+	reader = bio_reader_create(chunk_create(plain.ptr, plain.len - padding));
+	if (reader->read_uint16(reader, &suite16) &&
+		reader->read_uint32(reader, &created) &&
+		reader->read_data8(reader, &secret) &&
+		reader->read_uint8(reader, &type) &&
+		reader->read_data16(reader, &encoding))
+	{
+		age = (u_int32_t)time_monotonic(NULL) - created;
+		if (type != ID_ANY)
+		{
+			bound = identification_create_from_encoding(type, encoding);
+		}
+		if (age > this->max_age)
+		{
+			DBG2(DBG_TLS, "TLS session ticket expired: %u seconds", age);
+		}
+		else if (!id || !bound || id->equals(id, bound))
+		{
+			DBG2(DBG_TLS, "resuming TLS session from ticket, age %u seconds",
+				 age);
+			*master = chunk_clone(secret);
+			suite = suite16;
+		}
+		DESTROY_IF(bound);
+	}
+	else
+	{
+		DBG1(DBG_TLS, "TLS session ticket has invalid format");
+	}
+	reader->destroy(reader);
+
+out:
+	chunk_clear(&plain);
+	crypter->destroy(crypter);
+	signer->destroy(signer);
+	return suite;
+}
+
 METHOD(tls_cache_t, destroy, void,
 	private_tls_cache_t *this)
 {
@@ -205,8 +560,19 @@ METHOD(tls_cache_t, destroy, void,
 	{
 		entry_destroy(entry);
 	}
+	if (this->current)
+	{
+		memwipe(this->current, sizeof(ticket_key_t));
+		free(this->current);
+	}
+	if (this->previous)
+	{
+		memwipe(this->previous, sizeof(ticket_key_t));
+		free(this->previous);
+	}
 	this->list->destroy(this->list);
 	this->table->destroy(this->table);
+	this->ids->destroy(this->ids);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -223,10 +589,15 @@ tls_cache_t *tls_cache_create(u_int max_sessions, u_int max_age)
 			.create = _create_,
 			.lookup = _lookup,
 			.check = _check,
+			.set_ticket = _set_ticket,
+			.seal_ticket = _seal_ticket,
+			.open_ticket = _open_ticket,
 			.destroy = _destroy,
 		},
 		.table = hashtable_create((hashtable_hash_t)hash,
 								  (hashtable_equals_t)equals, 8),
+		.ids = hashtable_create((hashtable_hash_t)id_hash,
+								(hashtable_equals_t)id_equals, 8),
 		.list = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.max_sessions = max_sessions,
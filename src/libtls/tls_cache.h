@@ -27,6 +27,10 @@ typedef struct tls_cache_t tls_cache_t;
 
 /**
  * TLS session cache facility.
+ *
+ * Sessions are indexed by session ID and by the identity they are bound to.
+ * Servers may instead hand out stateless RFC 5077 session tickets, protected
+ * by a key shared by all connections using this cache.
  */
 struct tls_cache_t {
 
@@ -56,9 +60,43 @@ struct tls_cache_t {
 	 * Check if we have a session for a given identity.
 	 *
 	 * @param id			identity to check
+	 * @param ticket		gets allocated session ticket, if any, or NULL
 	 * @return				allocated session ID, or chunk_empty
 	 */
-	chunk_t (*check)(tls_cache_t *this, identification_t *id);
+	chunk_t (*check)(tls_cache_t *this, identification_t *id, chunk_t *ticket);
+
+	/**
+	 * Attach a session ticket received from a server to a session entry.
+	 *
+	 * @param session		session ID of the entry
+	 * @param ticket		opaque session ticket, gets cloned
+	 */
+	void (*set_ticket)(tls_cache_t *this, chunk_t session, chunk_t ticket);
+
+	/**
+	 * Create an RFC 5077 session ticket, protected with the current key.
+	 *
+	 * Ticket keys get rotated after the maximum session age, tickets
+	 * protected with the previous key are still accepted.
+	 *
+	 * @param id			identity the session is bound to, or NULL
+	 * @param master		TLS master secret
+	 * @param suite			TLS cipher suite of the session
+	 * @return				allocated ticket, chunk_empty on failure
+	 */
+	chunk_t (*seal_ticket)(tls_cache_t *this, identification_t *id,
+						   chunk_t master, tls_cipher_suite_t suite);
+
+	/**
+	 * Open a session ticket created with seal_ticket().
+	 *
+	 * @param ticket		ticket received from client
+	 * @param id			identity the session is bound to
+	 * @param master		gets allocated master secret, if ticket valid
+	 * @return				TLS suite of session, 0 if ticket invalid
+	 */
+	tls_cipher_suite_t (*open_ticket)(tls_cache_t *this, chunk_t ticket,
+									  identification_t *id, chunk_t *master);
 
 	/**
 	 * Destroy a tls_cache_t.
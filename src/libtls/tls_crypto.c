@@ -374,6 +374,11 @@ struct private_tls_crypto_t {
 	 */
 	tls_cache_t *cache;
 
+	/**
+	 * Master secret, kept to create a session ticket if we have a cache
+	 */
+	chunk_t master;
+
 	/**
 	 * All handshake data concatentated
 	 */
@@ -1493,10 +1498,15 @@ static bool derive_master(private_tls_crypto_t *this, chunk_t premaster,
 		return FALSE;
 	}
 
-	if (this->cache && session.len)
+	if (this->cache)
 	{
-		this->cache->create(this->cache, session, id, chunk_from_thing(master),
-							this->suite);
+		if (session.len)
+		{
+			this->cache->create(this->cache, session, id,
+								chunk_from_thing(master), this->suite);
+		}
+		chunk_clear(&this->master);
+		this->master = chunk_clone(chunk_from_thing(master));
 	}
 	memwipe(master, sizeof(master));
 	return TRUE;
@@ -1618,43 +1628,101 @@ METHOD(tls_crypto_t, derive_secrets, bool,
 		   expand_keys(this, client_random, server_random);
 }
 
+/**
+ * Resume a session with a cached master secret, derive key material
+ */
+static tls_cipher_suite_t resume(private_tls_crypto_t *this,
+								 tls_cipher_suite_t suite, chunk_t master,
+								 chunk_t client_random, chunk_t server_random)
+{
+	this->suite = select_cipher_suite(this, &suite, 1, KEY_ANY);
+	if (this->suite)
+	{
+		if (!this->prf->set_key(this->prf, master) ||
+			!expand_keys(this, client_random, server_random))
+		{
+			this->suite = 0;
+		}
+	}
+	return this->suite;
+}
+
 METHOD(tls_crypto_t, resume_session, tls_cipher_suite_t,
 	private_tls_crypto_t *this, chunk_t session, identification_t *id,
 	chunk_t client_random, chunk_t server_random)
 {
+	tls_cipher_suite_t suite;
 	chunk_t master;
 
 	if (this->cache && session.len)
 	{
-		this->suite = this->cache->lookup(this->cache, session, id, &master);
-		if (this->suite)
+		suite = this->cache->lookup(this->cache, session, id, &master);
+		if (suite)
 		{
-			this->suite = select_cipher_suite(this, &this->suite, 1, KEY_ANY);
-			if (this->suite)
-			{
-				if (!this->prf->set_key(this->prf, master) ||
-					!expand_keys(this, client_random, server_random))
-				{
-					this->suite = 0;
-				}
-			}
+			suite = resume(this, suite, master, client_random, server_random);
 			chunk_clear(&master);
 		}
-		return this->suite;
+		return suite;
+	}
+	return 0;
+}
+
+METHOD(tls_crypto_t, resume_ticket, tls_cipher_suite_t,
+	private_tls_crypto_t *this, chunk_t ticket, identification_t *id,
+	chunk_t client_random, chunk_t server_random)
+{
+	tls_cipher_suite_t suite;
+	chunk_t master;
+
+	if (this->cache && ticket.len)
+	{
+		suite = this->cache->open_ticket(this->cache, ticket, id, &master);
+		if (suite)
+		{
+			suite = resume(this, suite, master, client_random, server_random);
+			chunk_clear(&master);
+		}
+		return suite;
 	}
 	return 0;
 }
 
 METHOD(tls_crypto_t, get_session, chunk_t,
-	private_tls_crypto_t *this, identification_t *server)
+	private_tls_crypto_t *this, identification_t *server, chunk_t *ticket)
 {
 	if (this->cache)
 	{
-		return this->cache->check(this->cache, server);
+		return this->cache->check(this->cache, server, ticket);
 	}
 	return chunk_empty;
 }
 
+METHOD(tls_crypto_t, has_tickets, bool,
+	private_tls_crypto_t *this)
+{
+	return this->cache != NULL;
+}
+
+METHOD(tls_crypto_t, create_ticket, chunk_t,
+	private_tls_crypto_t *this, identification_t *id)
+{
+	if (this->cache && this->master.len)
+	{
+		return this->cache->seal_ticket(this->cache, id, this->master,
+										this->suite);
+	}
+	return chunk_empty;
+}
+
+METHOD(tls_crypto_t, save_ticket, void,
+	private_tls_crypto_t *this, chunk_t session, chunk_t ticket)
+{
+	if (this->cache && session.len)
+	{
+		this->cache->set_ticket(this->cache, session, ticket);
+	}
+}
+
 METHOD(tls_crypto_t, change_cipher, void,
 	private_tls_crypto_t *this, bool inbound)
 {
@@ -1690,6 +1758,7 @@ METHOD(tls_crypto_t, destroy, void,
 	free(this->iv_out.ptr);
 	free(this->handshake.ptr);
 	free(this->msk.ptr);
+	chunk_clear(&this->master);
 	DESTROY_IF(this->prf);
 	free(this->suites);
 	free(this);
@@ -1721,7 +1790,11 @@ tls_crypto_t *tls_crypto_create(tls_t *tls, tls_cache_t *cache)
 			.calculate_finished = _calculate_finished,
 			.derive_secrets = _derive_secrets,
 			.resume_session = _resume_session,
+			.resume_ticket = _resume_ticket,
 			.get_session = _get_session,
+			.has_tickets = _has_tickets,
+			.create_ticket = _create_ticket,
+			.save_ticket = _save_ticket,
 			.change_cipher = _change_cipher,
 			.get_eap_msk = _get_eap_msk,
 			.destroy = _destroy,
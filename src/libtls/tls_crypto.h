@@ -535,13 +535,52 @@ struct tls_crypto_t {
 										 chunk_t client_random,
 										 chunk_t server_random);
 
+	/**
+	 * Try to resume a TLS session from an RFC 5077 session ticket.
+	 *
+	 * @param ticket		session ticket received from client
+	 * @param id			identity the session is bound to
+	 * @param client_random	random data from client hello
+	 * @param server_random	random data from server hello
+	 * @return				selected suite
+	 */
+	tls_cipher_suite_t (*resume_ticket)(tls_crypto_t *this, chunk_t ticket,
+										identification_t *id,
+										chunk_t client_random,
+										chunk_t server_random);
+
 	/**
 	 * Check if we have a session to resume as a client.
 	 *
 	 * @param id			server identity to get a session for
+	 * @param ticket		gets allocated session ticket, if any
 	 * @return				allocated session identifier, or chunk_empty
 	 */
-	chunk_t (*get_session)(tls_crypto_t *this, identification_t *id);
+	chunk_t (*get_session)(tls_crypto_t *this, identification_t *id,
+						   chunk_t *ticket);
+
+	/**
+	 * Check if session tickets are supported, i.e. a session cache is used.
+	 *
+	 * @return				TRUE if session tickets supported
+	 */
+	bool (*has_tickets)(tls_crypto_t *this);
+
+	/**
+	 * Create a session ticket for the current session, as server.
+	 *
+	 * @param id			identity the session is bound to
+	 * @return				allocated session ticket, chunk_empty on failure
+	 */
+	chunk_t (*create_ticket)(tls_crypto_t *this, identification_t *id);
+
+	/**
+	 * Save a session ticket received from the server, as client.
+	 *
+	 * @param session		session identifier the ticket belongs to
+	 * @param ticket		received session ticket
+	 */
+	void (*save_ticket)(tls_crypto_t *this, chunk_t session, chunk_t ticket);
 
 	/**
 	 * Change the cipher used at protection layer.
@@ -27,6 +27,16 @@
  */
 #define TLS_MAX_MESSAGE_LEN		4 * (TLS_MAX_FRAGMENT_LEN + 2048)
 
+/**
+ * Default lifetime of cached sessions and session tickets, in seconds
+ */
+#define SESSION_LIFETIME		3600
+
+/**
+ * TLS session caches of EAP-TLS, EAP-TTLS and EAP-PEAP
+ */
+static tls_cache_t *caches[3];
+
 typedef struct private_tls_eap_t private_tls_eap_t;
 
 /**
@@ -85,6 +95,26 @@ struct private_tls_eap_t {
 	 * Maximum number of processed EAP messages/fragments
 	 */
 	int max_msg_count;
+
+	/**
+	 * Number of sent EAP packets carrying TLS data
+	 */
+	u_int frags_out;
+
+	/**
+	 * Total size of sent EAP packets carrying TLS data
+	 */
+	u_int bytes_out;
+
+	/**
+	 * Number of received EAP packets carrying TLS data
+	 */
+	u_int frags_in;
+
+	/**
+	 * Total size of received EAP packets carrying TLS data
+	 */
+	u_int bytes_in;
 };
 
 /**
@@ -281,6 +311,8 @@ static status_t build_pkt(private_tls_eap_t *this, chunk_t *out)
 	}
 	len += sizeof(eap_tls_packet_t);
 	htoun16(&pkt->length, len);
+	this->frags_out++;
+	this->bytes_out += len;
 	*out = chunk_clone(chunk_create(buf, len));
 	DBG2(DBG_TLS, "sending %N %s (%u bytes)",
 		 eap_type_names, this->type, kind, len);
@@ -324,13 +356,15 @@ static chunk_t create_ack(private_tls_eap_t *this)
 	return chunk_clone(chunk_from_thing(pkt));
 }
 
-METHOD(tls_eap_t, process, status_t,
-	private_tls_eap_t *this, chunk_t in, chunk_t *out)
+/**
+ * Process a received EAP message, build the next one
+ */
+static status_t process_msg(private_tls_eap_t *this, chunk_t in, chunk_t *out)
 {
 	eap_tls_packet_t *pkt;
 	status_t status;
 
-	if (this->max_msg_count && ++this->processed > this->max_msg_count)
+	if (++this->processed > this->max_msg_count && this->max_msg_count)
 	{
 		DBG1(DBG_TLS, "%N packet count exceeded (%d > %d)",
 			 eap_type_names, this->type,
@@ -374,6 +408,8 @@ METHOD(tls_eap_t, process, status_t,
 			}
 			return status;
 		}
+		this->frags_in++;
+		this->bytes_in += in.len;
 		status = process_pkt(this, pkt);
 		switch (status)
 		{
@@ -403,6 +439,23 @@ METHOD(tls_eap_t, process, status_t,
 	}
 }
 
+METHOD(tls_eap_t, process, status_t,
+	private_tls_eap_t *this, chunk_t in, chunk_t *out)
+{
+	status_t status;
+
+	status = process_msg(this, in, out);
+	if (status != NEED_MORE)
+	{
+		DBG1(DBG_TLS, "%N %s after %d round trips, sent %u fragments "
+			 "(%u bytes), received %u fragments (%u bytes)",
+			 eap_type_names, this->type,
+			 status == SUCCESS ? "completed" : "failed", this->processed,
+			 this->frags_out, this->bytes_out, this->frags_in, this->bytes_in);
+	}
+	return status;
+}
+
 METHOD(tls_eap_t, get_msk, chunk_t,
 	private_tls_eap_t *this)
 {
@@ -470,3 +523,74 @@ tls_eap_t *tls_eap_create(eap_type_t type, tls_t *tls, size_t frag_size,
 
 	return &this->public;
 }
+
+/**
+ * Get the session cache slot of an EAP type
+ */
+static tls_cache_t **get_cache_slot(eap_type_t type)
+{
+	switch (type)
+	{
+		case EAP_TLS:
+			return &caches[0];
+		case EAP_TTLS:
+			return &caches[1];
+		case EAP_PEAP:
+			return &caches[2];
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * See header
+ */
+void tls_eap_create_cache(eap_type_t type, char *section, ...)
+{
+	tls_cache_t **slot;
+	u_int max_sessions, lifetime;
+	char buf[128];
+	va_list args;
+
+	slot = get_cache_slot(type);
+	if (!slot)
+	{
+		return;
+	}
+	va_start(args, section);
+	vsnprintf(buf, sizeof(buf), section, args);
+	va_end(args);
+
+	max_sessions = lib->settings->get_int(lib->settings,
+								"%s.session_cache", 0, buf);
+	lifetime = lib->settings->get_time(lib->settings,
+								"%s.session_lifetime", SESSION_LIFETIME, buf);
+	DESTROY_IF(*slot);
+	*slot = max_sessions ? tls_cache_create(max_sessions, lifetime) : NULL;
+}
+
+/**
+ * See header
+ */
+tls_cache_t *tls_eap_get_cache(eap_type_t type)
+{
+	tls_cache_t **slot;
+
+	slot = get_cache_slot(type);
+	return slot ? *slot : NULL;
+}
+
+/**
+ * See header
+ */
+void tls_eap_destroy_cache(eap_type_t type)
+{
+	tls_cache_t **slot;
+
+	slot = get_cache_slot(type);
+	if (slot)
+	{
+		DESTROY_IF(*slot);
+		*slot = NULL;
+	}
+}
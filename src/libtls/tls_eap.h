@@ -94,4 +94,32 @@ struct tls_eap_t {
 tls_eap_t *tls_eap_create(eap_type_t type, tls_t *tls, size_t frag_size,
 						  int max_msg_count, bool include_length);
 
+/**
+ * Create the TLS session cache shared by all instances of an EAP method.
+ *
+ * The size and lifetime of the cache are read from the session_cache and
+ * session_lifetime options in the given settings section. No cache is
+ * created if session_cache is 0.
+ *
+ * @param type				EAP type, EAP-TLS, EAP-TTLS or EAP-PEAP
+ * @param section			settings section of the EAP method, printf style
+ * @param ...				arguments for section
+ */
+void tls_eap_create_cache(eap_type_t type, char *section, ...);
+
+/**
+ * Get the TLS session cache shared by all instances of an EAP method.
+ *
+ * @param type				EAP type, EAP-TLS, EAP-TTLS or EAP-PEAP
+ * @return					session cache, NULL if session resumption disabled
+ */
+tls_cache_t *tls_eap_get_cache(eap_type_t type);
+
+/**
+ * Destroy the TLS session cache of an EAP method, if any.
+ *
+ * @param type				EAP type, EAP-TLS, EAP-TTLS or EAP-PEAP
+ */
+void tls_eap_destroy_cache(eap_type_t type);
+
 #endif /** TLS_EAP_H_ @}*/
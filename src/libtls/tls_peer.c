@@ -22,6 +22,11 @@
 
 typedef struct private_tls_peer_t private_tls_peer_t;
 
+/**
+ * Size of the session ID we assign to sessions the server sends a ticket for
+ */
+#define SESSION_ID_SIZE 16
+
 typedef enum {
 	STATE_INIT,
 	STATE_HELLO_SENT,
@@ -119,6 +124,11 @@ struct private_tls_peer_t {
 	 */
 	chunk_t session;
 
+	/**
+	 * Did the server announce to send a session ticket?
+	 */
+	bool expect_ticket;
+
 	/**
 	 * List of server-supported hashsig algorithms
 	 */
@@ -137,9 +147,11 @@ static status_t process_server_hello(private_tls_peer_t *this,
 									 bio_reader_t *reader)
 {
 	u_int8_t compression;
-	u_int16_t version, cipher;
+	u_int16_t version, cipher, extension;
 	chunk_t random, session, ext = chunk_empty;
+	bio_reader_t *extensions;
 	tls_cipher_suite_t suite = 0;
+	rng_t *rng;
 
 	this->crypto->append_handshake(this->crypto,
 								   TLS_SERVER_HELLO, reader->peek(reader));
@@ -156,6 +168,29 @@ static status_t process_server_hello(private_tls_peer_t *this,
 		return NEED_MORE;
 	}
 
+	if (ext.len)
+	{
+		extensions = bio_reader_create(ext);
+		while (extensions->remaining(extensions))
+		{
+			if (!extensions->read_uint16(extensions, &extension) ||
+				!extensions->read_data16(extensions, &ext))
+			{
+				DBG1(DBG_TLS, "received invalid ServerHello Extensions");
+				this->alert->add(this->alert, TLS_FATAL, TLS_DECODE_ERROR);
+				extensions->destroy(extensions);
+				return NEED_MORE;
+			}
+			DBG2(DBG_TLS, "received TLS '%N' extension",
+				 tls_extension_names, extension);
+			if (extension == TLS_EXT_SESSION_TICKET)
+			{
+				this->expect_ticket = TRUE;
+			}
+		}
+		extensions->destroy(extensions);
+	}
+
 	memcpy(this->server_random, random.ptr, sizeof(this->server_random));
 
 	if (!this->tls->set_version(this->tls, version))
@@ -192,6 +227,17 @@ static status_t process_server_hello(private_tls_peer_t *this,
 			 tls_version_names, version, tls_cipher_suite_names, suite);
 		free(this->session.ptr);
 		this->session = chunk_clone(session);
+		if (!this->session.len && this->expect_ticket)
+		{	/* a ticket follows, assign our own ID to cache the session */
+			rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+			if (!rng ||
+				!rng->allocate_bytes(rng, SESSION_ID_SIZE, &this->session))
+			{
+				DBG1(DBG_TLS, "generating TLS session identifier failed, "
+					 "skipped");
+			}
+			DESTROY_IF(rng);
+		}
 	}
 	this->state = STATE_HELLO_RECEIVED;
 	return NEED_MORE;
@@ -633,11 +679,49 @@ static status_t process_finished(private_tls_peer_t *this, bio_reader_t *reader)
 	return NEED_MORE;
 }
 
+/**
+ * Process NewSessionTicket message
+ */
+static status_t process_new_session_ticket(private_tls_peer_t *this,
+										   bio_reader_t *reader)
+{
+	u_int32_t lifetime;
+	chunk_t ticket;
+
+	this->crypto->append_handshake(this->crypto,
+								   TLS_NEW_SESSION_TICKET, reader->peek(reader));
+
+	if (!reader->read_uint32(reader, &lifetime) ||
+		!reader->read_data16(reader, &ticket))
+	{
+		DBG1(DBG_TLS, "received invalid NewSessionTicket");
+		this->alert->add(this->alert, TLS_FATAL, TLS_DECODE_ERROR);
+		return NEED_MORE;
+	}
+	if (ticket.len)
+	{
+		DBG2(DBG_TLS, "received TLS session ticket (%u bytes)", ticket.len);
+		this->crypto->save_ticket(this->crypto, this->session, ticket);
+	}
+	this->expect_ticket = FALSE;
+	return NEED_MORE;
+}
+
 METHOD(tls_handshake_t, process, status_t,
 	private_tls_peer_t *this, tls_handshake_type_t type, bio_reader_t *reader)
 {
 	tls_handshake_type_t expected;
 
+	if (this->expect_ticket)
+	{	/* NewSessionTicket precedes ChangeCipherSpec of the server */
+		if (type == TLS_NEW_SESSION_TICKET &&
+			((this->resume && this->state == STATE_HELLO_RECEIVED) ||
+			 this->state == STATE_FINISHED_SENT))
+		{
+			return process_new_session_ticket(this, reader);
+		}
+	}
+
 	switch (this->state)
 	{
 		case STATE_HELLO_SENT:
@@ -704,6 +788,7 @@ static status_t send_client_hello(private_tls_peer_t *this,
 	tls_version_t version;
 	tls_named_curve_t curve;
 	enumerator_t *enumerator;
+	chunk_t ticket = chunk_empty;
 	int count, i;
 	rng_t *rng;
 
@@ -726,7 +811,8 @@ static status_t send_client_hello(private_tls_peer_t *this,
 	writer->write_data(writer, chunk_from_thing(this->client_random));
 
 	/* session identifier */
-	this->session = this->crypto->get_session(this->crypto, this->server);
+	this->session = this->crypto->get_session(this->crypto, this->server,
+											  &ticket);
 	writer->write_data8(writer, this->session);
 
 	/* add TLS cipher suites */
@@ -785,6 +871,14 @@ static status_t send_client_hello(private_tls_peer_t *this,
 		names->destroy(names);
 	}
 
+	if (this->crypto->has_tickets(this->crypto))
+	{	/* an empty extension requests a ticket */
+		DBG2(DBG_TLS, "sending TLS session ticket (%u bytes)", ticket.len);
+		extensions->write_uint16(extensions, TLS_EXT_SESSION_TICKET);
+		extensions->write_data16(extensions, ticket);
+	}
+	free(ticket.ptr);
+
 	writer->write_data16(writer, extensions->get_buf(extensions));
 	extensions->destroy(extensions);
 
@@ -1088,6 +1182,10 @@ METHOD(tls_handshake_t, cipherspec_changed, bool,
 {
 	if (inbound)
 	{
+		if (this->expect_ticket)
+		{
+			return FALSE;
+		}
 		if (this->resume)
 		{
 			return this->state == STATE_HELLO_RECEIVED;
@@ -40,6 +40,7 @@ typedef enum {
 	STATE_CERT_VERIFY_RECEIVED,
 	STATE_CIPHERSPEC_CHANGED_IN,
 	STATE_FINISHED_RECEIVED,
+	STATE_TICKET_SENT,
 	STATE_CIPHERSPEC_CHANGED_OUT,
 	STATE_FINISHED_SENT,
 } server_state_t;
@@ -134,6 +135,11 @@ struct private_tls_server_t {
 	 */
 	bool resume;
 
+	/**
+	 * Issue a session ticket instead of caching the session?
+	 */
+	bool send_ticket;
+
 	/**
 	 * Hash and signature algorithms supported by peer
 	 */
@@ -210,8 +216,10 @@ static status_t process_client_hello(private_tls_server_t *this,
 {
 	u_int16_t version, extension;
 	chunk_t random, session, ciphers, compression, ext = chunk_empty;
+	chunk_t ticket = chunk_empty;
 	bio_reader_t *extensions;
 	tls_cipher_suite_t *suites;
+	bool tickets = FALSE;
 	int count, i;
 	rng_t *rng;
 
@@ -255,6 +263,10 @@ static status_t process_client_hello(private_tls_server_t *this,
 					this->curves_received = TRUE;
 					this->curves = chunk_clone(ext);
 					break;
+				case TLS_EXT_SESSION_TICKET:
+					tickets = TRUE;
+					ticket = ext;
+					break;
 				default:
 					break;
 			}
@@ -286,9 +298,20 @@ static status_t process_client_hello(private_tls_server_t *this,
 	}
 
 	this->client_version = version;
-	this->suite = this->crypto->resume_session(this->crypto, session, this->peer,
+	if (ticket.len)
+	{
+		this->suite = this->crypto->resume_ticket(this->crypto, ticket,
+										this->peer,
+										chunk_from_thing(this->client_random),
+										chunk_from_thing(this->server_random));
+	}
+	if (!this->suite)
+	{
+		this->suite = this->crypto->resume_session(this->crypto, session,
+										this->peer,
 										chunk_from_thing(this->client_random),
 										chunk_from_thing(this->server_random));
+	}
 	if (this->suite)
 	{
 		this->session = chunk_clone(session);
@@ -312,12 +335,21 @@ static status_t process_client_hello(private_tls_server_t *this,
 			this->alert->add(this->alert, TLS_FATAL, TLS_HANDSHAKE_FAILURE);
 			return NEED_MORE;
 		}
-		rng = lib->crypto->create_rng(lib->crypto, RNG_STRONG);
-		if (!rng || !rng->allocate_bytes(rng, SESSION_ID_SIZE, &this->session))
+		if (tickets && this->crypto->has_tickets(this->crypto))
+		{	/* keep no state, the client gets a ticket instead of a session */
+			this->send_ticket = TRUE;
+		}
+		else
 		{
-			DBG1(DBG_TLS, "generating TLS session identifier failed, skipped");
+			rng = lib->crypto->create_rng(lib->crypto, RNG_STRONG);
+			if (!rng ||
+				!rng->allocate_bytes(rng, SESSION_ID_SIZE, &this->session))
+			{
+				DBG1(DBG_TLS, "generating TLS session identifier failed, "
+					 "skipped");
+			}
+			DESTROY_IF(rng);
 		}
-		DESTROY_IF(rng);
 		DBG1(DBG_TLS, "negotiated %N using suite %N",
 			 tls_version_names, this->tls->get_version(this->tls),
 			 tls_cipher_suite_names, this->suite);
@@ -661,6 +693,8 @@ METHOD(tls_handshake_t, process, status_t,
 static status_t send_server_hello(private_tls_server_t *this,
 							tls_handshake_type_t *type, bio_writer_t *writer)
 {
+	bio_writer_t *extensions;
+
 	/* TLS version */
 	writer->write_uint16(writer, this->tls->get_version(this->tls));
 	writer->write_data(writer, chunk_from_thing(this->server_random));
@@ -674,6 +708,15 @@ static status_t send_server_hello(private_tls_server_t *this,
 	/* NULL compression only */
 	writer->write_uint8(writer, 0);
 
+	if (this->send_ticket)
+	{	/* acknowledge session ticket support, the ticket follows later */
+		extensions = bio_writer_create(4);
+		extensions->write_uint16(extensions, TLS_EXT_SESSION_TICKET);
+		extensions->write_data16(extensions, chunk_empty);
+		writer->write_data16(writer, extensions->get_buf(extensions));
+		extensions->destroy(extensions);
+	}
+
 	*type = TLS_SERVER_HELLO;
 	this->state = STATE_HELLO_SENT;
 	this->crypto->append_handshake(this->crypto, *type, writer->get_buf(writer));
@@ -936,6 +979,29 @@ static status_t send_hello_done(private_tls_server_t *this,
 	return NEED_MORE;
 }
 
+/**
+ * Send NewSessionTicket
+ */
+static status_t send_new_session_ticket(private_tls_server_t *this,
+							tls_handshake_type_t *type, bio_writer_t *writer)
+{
+	chunk_t ticket;
+
+	/* an empty ticket is allowed if we fail to create one */
+	ticket = this->crypto->create_ticket(this->crypto, this->peer);
+	DBG2(DBG_TLS, "sending TLS session ticket (%u bytes)", ticket.len);
+
+	/* no lifetime hint */
+	writer->write_uint32(writer, 0);
+	writer->write_data16(writer, ticket);
+	free(ticket.ptr);
+
+	*type = TLS_NEW_SESSION_TICKET;
+	this->state = STATE_TICKET_SENT;
+	this->crypto->append_handshake(this->crypto, *type, writer->get_buf(writer));
+	return NEED_MORE;
+}
+
 /**
  * Send Finished
  */
@@ -986,6 +1052,12 @@ METHOD(tls_handshake_t, build, status_t,
 			/* otherwise fall through to next state */
 		case STATE_CERTREQ_SENT:
 			return send_hello_done(this, type, writer);
+		case STATE_FINISHED_RECEIVED:
+			if (this->send_ticket)
+			{
+				return send_new_session_ticket(this, type, writer);
+			}
+			return INVALID_STATE;
 		case STATE_CIPHERSPEC_CHANGED_OUT:
 			return send_finished(this, type, writer);
 		case STATE_FINISHED_SENT:
@@ -1016,6 +1088,10 @@ METHOD(tls_handshake_t, cipherspec_changed, bool,
 		{
 			return this->state == STATE_HELLO_SENT;
 		}
+		if (this->send_ticket)
+		{
+			return this->state == STATE_TICKET_SENT;
+		}
 		return this->state == STATE_FINISHED_RECEIVED;
 	}
 	return FALSE;
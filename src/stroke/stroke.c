@@ -352,6 +352,16 @@ static int memusage()
 	return send_stroke_msg(&msg);
 }
 
+static int lockstats(char *action)
+{
+	stroke_msg_t msg;
+
+	msg.type = STR_LOCKSTATS;
+	msg.length = offsetof(stroke_msg_t, buffer);
+	msg.lockstats.action = push_string(&msg, action);
+	return send_stroke_msg(&msg);
+}
+
 static int user_credentials(char *name, char *user, char *pass)
 {
 	stroke_msg_t msg;
@@ -364,6 +374,19 @@ static int user_credentials(char *name, char *user, char *pass)
 	return send_stroke_msg(&msg);
 }
 
+static int set_trace(char *selector, char *value, int level, char *type)
+{
+	stroke_msg_t msg;
+
+	msg.type = STR_TRACE;
+	msg.length = offsetof(stroke_msg_t, buffer);
+	msg.trace.selector = push_string(&msg, selector);
+	msg.trace.value = push_string(&msg, value);
+	msg.trace.type = push_string(&msg, type);
+	msg.trace.level = level;
+	return send_stroke_msg(&msg);
+}
+
 static int set_loglevel(char *type, u_int level)
 {
 	stroke_msg_t msg;
@@ -409,6 +432,13 @@ static void exit_usage(char *error)
 	printf("    stroke loglevel TYPE LEVEL\n");
 	printf("    where: TYPE is any|dmn|mgr|ike|chd|job|cfg|knl|net|asn|enc|tnc|imc|imv|pts|tls|esp|lib\n");
 	printf("           LEVEL is -1|0|1|2|3|4\n");
+	printf("  Set loglevel for specific IKE_SAs, or list them:\n");
+	printf("    stroke trace [SELECTOR VALUE LEVEL [TYPE]]\n");
+	printf("    where: SELECTOR is ike-sa|conn|id|addr\n");
+	printf("           VALUE is an IKE_SA unique id, connection name, remote identity\n");
+	printf("                 or remote address/subnet\n");
+	printf("           LEVEL is -1|0|1|2|3|4, -1 stops tracing\n");
+	printf("           TYPE is any (default) or a logging type as above\n");
 	printf("  Show connection status:\n");
 	printf("    stroke status\n");
 	printf("  Show extended status information:\n");
@@ -437,6 +467,8 @@ static void exit_usage(char *error)
 	printf("    stroke exportx509 DN\n");
 	printf("  Show current memory usage:\n");
 	printf("    stroke memusage\n");
+	printf("  Show or control lock contention statistics:\n");
+	printf("    stroke lockstats [on|off|reset|csv]\n");
 	printf("  Show leases of a pool:\n");
 	printf("    stroke leases [POOL [ADDRESS]]\n");
 	printf("  Set username and password for a connection:\n");
@@ -536,6 +568,16 @@ int main(int argc, char *argv[])
 			}
 			res = set_loglevel(argv[2], atoi(argv[3]));
 			break;
+		case STROKE_TRACE:
+			if (argc > 2 && argc < 5)
+			{
+				exit_usage("\"trace\" needs a selector, value and level");
+			}
+			res = set_trace(argc > 2 ? argv[2] : NULL,
+							argc > 3 ? argv[3] : NULL,
+							argc > 4 ? atoi(argv[4]) : 0,
+							argc > 5 ? argv[5] : NULL);
+			break;
 		case STROKE_STATUS:
 		case STROKE_STATUSALL:
 		case STROKE_STATUSALL_NOBLK:
@@ -585,6 +627,9 @@ int main(int argc, char *argv[])
 		case STROKE_MEMUSAGE:
 			res = memusage();
 			break;
+		case STROKE_LOCKSTATS:
+			res = lockstats(argc > 2 ? argv[2] : NULL);
+			break;
 		case STROKE_USER_CREDS:
 			if (argc < 4)
 			{
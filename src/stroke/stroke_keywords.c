@@ -54,12 +54,12 @@ struct stroke_token {
     stroke_keyword_t kw;
 };
 
-#define TOTAL_KEYWORDS 42
+#define TOTAL_KEYWORDS 44
 #define MIN_WORD_LENGTH 2
 #define MAX_WORD_LENGTH 15
 #define MIN_HASH_VALUE 4
-#define MAX_HASH_VALUE 49
-/* maximum key range = 46, duplicates = 0 */
+#define MAX_HASH_VALUE 65
+/* maximum key range = 62, duplicates = 0 */
 
 #ifdef __GNUC__
 __inline
@@ -75,32 +75,32 @@ hash (str, len)
 {
   static const unsigned char asso_values[] =
     {
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 19, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50,  1, 12,  2,
-       2, 16, 50, 14, 50, 11, 50, 16,  1,  8,
-      50, 18,  7, 50,  6, 12,  1, 11, 50, 50,
-       4,  3, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-      50, 50, 50, 50, 50, 50
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 19, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66,  1, 12,  2,
+       2, 16, 66, 14, 66, 11, 66, 16,  1,  8,
+      66, 18,  7, 66,  6, 33, 40, 11, 66, 66,
+       4,  3, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+      66, 66, 66, 66, 66, 66
     };
   register int hval = len;
 
@@ -128,7 +128,6 @@ static const struct stroke_token wordlist[] =
     {"add",             STROKE_ADD},
     {"del",             STROKE_DEL},
     {"down",            STROKE_DOWN},
-    {"delete",          STROKE_DELETE},
     {"listall",         STROKE_LIST_ALL},
     {"listcrls",        STROKE_LIST_CRLS},
     {"up",              STROKE_UP},
@@ -147,34 +146,38 @@ static const struct stroke_token wordlist[] =
     {"listcounters",    STROKE_LIST_COUNTERS},
     {"route",           STROKE_ROUTE},
     {"listacerts",      STROKE_LIST_ACERTS},
-    {"status",          STROKE_STATUS},
     {"listplugins",     STROKE_LIST_PLUGINS},
     {"listpubkeys",     STROKE_LIST_PUBKEYS},
-    {"rereadsecrets",   STROKE_REREAD_SECRETS},
-    {"statusall",       STROKE_STATUSALL},
     {"purgeocsp",       STROKE_PURGE_OCSP},
-    {"statusallnb",     STROKE_STATUSALL_NOBLK},
     {"exportx509",      STROKE_EXPORT_X509},
     {"down-srcip",      STROKE_DOWN_SRCIP},
     {"purgecrls",       STROKE_PURGE_CRLS},
-    {"listocsp",        STROKE_LIST_OCSP},
     {"rereadocspcerts", STROKE_REREAD_OCSPCERTS},
     {"loglevel",        STROKE_LOGLEVEL},
-    {"memusage",        STROKE_MEMUSAGE},
     {"listgroups",      STROKE_LIST_GROUPS},
-    {"listocspcerts",   STROKE_LIST_OCSPCERTS},
+    {"lockstats",       STROKE_LOCKSTATS},
     {"unroute",         STROKE_UNROUTE},
     {"user-creds",      STROKE_USER_CREDS},
     {"purgeike",        STROKE_PURGE_IKE},
-    {"purgecerts",      STROKE_PURGE_CERTS}
+    {"delete",          STROKE_DELETE},
+    {"purgecerts",      STROKE_PURGE_CERTS},
+    {"status",          STROKE_STATUS},
+    {"rereadsecrets",   STROKE_REREAD_SECRETS},
+    {"statusall",       STROKE_STATUSALL},
+    {"statusallnb",     STROKE_STATUSALL_NOBLK},
+    {"listocsp",        STROKE_LIST_OCSP},
+    {"trace",           STROKE_TRACE},
+    {"memusage",        STROKE_MEMUSAGE},
+    {"listocspcerts",   STROKE_LIST_OCSPCERTS}
   };
 
 static const short lookup[] =
   {
-    -1, -1, -1, -1,  0,  1,  2, -1, -1,  3,  4, -1,  5,  6,
-     7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
-    21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
-    35, 36, 37, 38, 39, 40, -1, 41
+    -1, -1, -1, -1,  0,  1,  2, -1, -1, -1,  3, -1,  4,  5,
+     6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+    20, -1, 21, 22, -1, -1, 23, -1, 24, 25, 26, -1, 27, 28,
+    -1, 29, 30, 31, 32, 33, 34, 35, 36, -1, -1, 37, 38, -1,
+    39, -1, -1, -1, 40, 41, -1, 42, -1, 43
   };
 
 #ifdef __GNUC__
@@ -225,6 +225,10 @@ struct stroke_msg_t {
 		STR_MEMUSAGE,
 		/* set username and password for a connection */
 		STR_USER_CREDS,
+		/* raise loglevel for specific IKE_SAs, or list traces */
+		STR_TRACE,
+		/* show or control lock statistics */
+		STR_LOCKSTATS,
 		/* more to come */
 	} type;
 
@@ -353,6 +357,19 @@ struct stroke_msg_t {
 			char *username;
 			char *password;
 		} user_creds;
+
+		/* data for STR_TRACE */
+		struct {
+			char *selector;
+			char *value;
+			char *type;
+			int level;
+		} trace;
+
+		/* data for STR_LOCKSTATS */
+		struct {
+			char *action;
+		} lockstats;
 	};
 	char buffer[STROKE_BUF_LEN];
 };